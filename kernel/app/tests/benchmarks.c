@@ -122,6 +122,55 @@ __NO_INLINE static void bench_memcpy(void)
     free(buf);
 }
 
+/* memcpy and memset across the sizes the kernel actually copies, from
+ * message headers up to large VMO reads. The cycle counter is 32 bits, or
+ * missing altogether on arm64, so these use the microsecond clock and
+ * repeat each size until about 64MB has been moved. */
+#define BENCH_SIZES_MAX (8*1024*1024)
+#define BENCH_SIZES_TOTAL (64*1024*1024)
+
+__NO_INLINE static void bench_string_sizes(void)
+{
+    uint8_t *src = malloc(BENCH_SIZES_MAX);
+    uint8_t *dst = malloc(BENCH_SIZES_MAX);
+    if (!src || !dst) {
+        printf("failed to allocate %u byte buffers\n", BENCH_SIZES_MAX);
+        goto out;
+    }
+    memset(src, 0x55, BENCH_SIZES_MAX);
+    memset(dst, 0, BENCH_SIZES_MAX);
+
+    printf("%10s %12s %12s\n", "size", "memcpy MB/s", "memset MB/s");
+    /* 16 * 4^n skips 8MB, so finish with it */
+    for (size_t size = 16; size <= BENCH_SIZES_MAX;
+         size = (size < BENCH_SIZES_MAX && size * 4 > BENCH_SIZES_MAX) ? BENCH_SIZES_MAX : size * 4) {
+        uint iter = BENCH_SIZES_TOTAL / size;
+
+        lk_bigtime_t t = current_time_hires();
+        for (uint i = 0; i < iter; i++) {
+            memcpy(dst, src, size);
+            __asm__ volatile("" ::: "memory");
+        }
+        lk_bigtime_t copy_us = current_time_hires() - t;
+
+        t = current_time_hires();
+        for (uint i = 0; i < iter; i++) {
+            memset(dst, (int)i, size);
+            __asm__ volatile("" ::: "memory");
+        }
+        lk_bigtime_t set_us = current_time_hires() - t;
+
+        /* bytes per microsecond is MB/s */
+        printf("%10zu %12llu %12llu\n", size,
+               copy_us ? (uint64_t)size * iter / copy_us : 0,
+               set_us ? (uint64_t)size * iter / set_us : 0);
+    }
+
+out:
+    free(src);
+    free(dst);
+}
+
 #if ARCH_ARM
 __NO_INLINE static void arm_bench_cset_stm(void)
 {
@@ -219,6 +268,7 @@ void benchmarks(void)
     bench_set_overhead();
     bench_memset();
     bench_memcpy();
+    bench_string_sizes();
 
     bench_cset_uint8_t();
     bench_cset_uint16_t();
@@ -0,0 +1,223 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <app/tests.h>
+#include <arch/ops.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/ticketlock.h>
+#include <platform.h>
+
+#define DEFAULT_DURATION 1000 /* msecs per lock type */
+#define CRITICAL_SECTION_SPINS 16
+
+/* lets the same contention loop drive both kinds of lock */
+struct lock_ops {
+    const char *name;
+    void (*init)(void *lock);
+    void (*lock)(void *lock);
+    void (*unlock)(void *lock);
+};
+
+static void spin_init_op(void *lock) { spin_lock_init(lock); }
+static void spin_lock_op(void *lock) { spin_lock(lock); }
+static void spin_unlock_op(void *lock) { spin_unlock(lock); }
+
+static void ticket_init_op(void *lock) { ticket_spin_lock_init(lock); }
+static void ticket_lock_op(void *lock) { ticket_spin_lock(lock); }
+static void ticket_unlock_op(void *lock) { ticket_spin_unlock(lock); }
+
+static const struct lock_ops lock_types[] = {
+    { "spin_lock_t", spin_init_op, spin_lock_op, spin_unlock_op },
+    { "ticket_spin_lock_t", ticket_init_op, ticket_lock_op, ticket_unlock_op },
+};
+
+struct contention_test {
+    const struct lock_ops *ops;
+    union {
+        spin_lock_t spin;
+        ticket_spin_lock_t ticket;
+    } lock;
+    event_t gate;
+    lk_time_t deadline;
+    volatile uint64_t shared_count; /* only touched with the lock held */
+    uint64_t acquires[SMP_MAX_CPUS];
+};
+
+static int contention_thread(void *arg)
+{
+    struct contention_test *test = arg;
+    uint cpu = thread_pinned_cpu(get_current_thread());
+    uint64_t acquires = 0;
+
+    event_wait(&test->gate);
+
+    while (current_time() < test->deadline) {
+        /* check in on the clock every so often, with interrupts enabled */
+        for (int i = 0; i < 256; i++) {
+            spin_lock_saved_state_t state;
+            arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+            test->ops->lock(&test->lock);
+
+            test->shared_count++;
+            for (int j = 0; j < CRITICAL_SECTION_SPINS; j++)
+                __asm__ volatile("" ::: "memory");
+
+            test->ops->unlock(&test->lock);
+            arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+            acquires++;
+        }
+    }
+
+    test->acquires[cpu] = acquires;
+    return 0;
+}
+
+static int contention_test(const struct lock_ops *ops, uint num_cpus, lk_time_t duration)
+{
+    static struct contention_test test;
+    thread_t *threads[SMP_MAX_CPUS] = { 0 };
+
+    memset(&test, 0, sizeof(test));
+    test.ops = ops;
+    ops->init(&test.lock);
+    event_init(&test.gate, false, 0);
+
+    for (uint i = 0; i < num_cpus; i++) {
+        threads[i] = thread_create("spinlock contention", contention_thread, &test,
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        if (!threads[i]) {
+            printf("failed to create thread\n");
+            break;
+        }
+        thread_set_pinned_cpu(threads[i], i);
+        thread_resume(threads[i]);
+    }
+
+    /* give everyone a moment to reach the gate */
+    thread_sleep(100);
+    test.deadline = current_time() + duration;
+    event_signal(&test.gate, true);
+
+    for (uint i = 0; i < num_cpus; i++) {
+        if (threads[i])
+            thread_join(threads[i], NULL, INFINITE_TIME);
+    }
+    event_destroy(&test.gate);
+
+    uint64_t total = 0, min = UINT64_MAX, max = 0;
+    for (uint i = 0; i < num_cpus; i++) {
+        total += test.acquires[i];
+        if (test.acquires[i] < min)
+            min = test.acquires[i];
+        if (test.acquires[i] > max)
+            max = test.acquires[i];
+    }
+
+    printf("%-20s %10llu acquires (%llu/msec), per cpu min %llu max %llu\n",
+           ops->name, total, total / duration, min, max);
+
+    if (test.shared_count != total) {
+        printf("FAIL: lost updates under %s: count %llu, expected %llu\n",
+               ops->name, test.shared_count, total);
+        return ERR_INTERNAL;
+    }
+    return NO_ERROR;
+}
+
+static void uncontended_test(const struct lock_ops *ops)
+{
+    union {
+        spin_lock_t spin;
+        ticket_spin_lock_t ticket;
+    } lock;
+
+    ops->init(&lock);
+
+#define COUNT (1024*1024)
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    uint32_t c = arch_cycle_count();
+    for (uint i = 0; i < COUNT; i++) {
+        ops->lock(&lock);
+        ops->unlock(&lock);
+    }
+    c = arch_cycle_count() - c;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    printf("%-20s %u cycles per uncontended acquire/release\n", ops->name, c / COUNT);
+#undef COUNT
+}
+
+static void ticket_spinlock_basic_test(void)
+{
+    spin_lock_saved_state_t state;
+    ticket_spin_lock_t lock = TICKET_SPIN_LOCK_INITIAL_VALUE;
+
+    printf("testing ticket spinlock:\n");
+    ASSERT(!ticket_spin_lock_held(&lock));
+    ASSERT(!arch_ints_disabled());
+    ticket_spin_lock_irqsave(&lock, state);
+    ASSERT(arch_ints_disabled());
+    ASSERT(ticket_spin_lock_held(&lock));
+    ASSERT(ticket_spin_trylock(&lock) != 0);
+    ticket_spin_unlock_irqrestore(&lock, state);
+    ASSERT(!ticket_spin_lock_held(&lock));
+    ASSERT(!arch_ints_disabled());
+
+    arch_disable_ints();
+    ASSERT(ticket_spin_trylock(&lock) == 0);
+    ASSERT(ticket_spin_lock_held(&lock));
+    ticket_spin_unlock(&lock);
+    ASSERT(!ticket_spin_lock_held(&lock));
+
+    /* make sure the ticket counters wrap cleanly */
+    lock.owner = lock.next = 0xffff;
+    ticket_spin_lock(&lock);
+    ASSERT(ticket_spin_lock_held(&lock));
+    ticket_spin_unlock(&lock);
+    ASSERT(!ticket_spin_lock_held(&lock));
+    ASSERT(lock.owner == 0 && lock.next == 0);
+    arch_enable_ints();
+    printf("seems to work\n");
+}
+
+int spinlock_tests(int argc, const cmd_args *argv)
+{
+    lk_time_t duration = DEFAULT_DURATION;
+    if (argc > 1)
+        duration = argv[1].u;
+    if (duration == 0)
+        return ERR_INVALID_ARGS;
+
+    ticket_spinlock_basic_test();
+
+    for (uint i = 0; i < countof(lock_types); i++)
+        uncontended_test(&lock_types[i]);
+
+    uint num_cpus = arch_max_num_cpus();
+    uint online = mp_get_online_mask();
+    if (online != (1U << num_cpus) - 1) {
+        printf("Can only run contention test with all CPUs online\n");
+        return ERR_NOT_SUPPORTED;
+    }
+
+    printf("contending on %u cpus for %u msecs per lock\n", num_cpus, duration);
+    status_t status = NO_ERROR;
+    for (uint i = 0; i < countof(lock_types); i++) {
+        status_t err = contention_test(&lock_types[i], num_cpus, duration);
+        if (err != NO_ERROR)
+            status = err;
+    }
+
+    return status;
+}
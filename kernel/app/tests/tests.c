@@ -28,6 +28,7 @@ STATIC_COMMAND("bench", "miscellaneous benchmarks", (console_cmd)&benchmarks)
 STATIC_COMMAND("fibo", "threaded fibonacci", (console_cmd)&fibo)
 STATIC_COMMAND("spinner", "create a spinning thread", (console_cmd)&spinner)
 STATIC_COMMAND("sync_ipi_tests", "test synchronous IPIs", (console_cmd)&sync_ipi_tests)
+STATIC_COMMAND("spinlock_tests", "spinlock fairness and contention benchmark", (console_cmd)&spinlock_tests)
 STATIC_COMMAND_END(tests);
 
 #endif
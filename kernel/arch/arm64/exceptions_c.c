@@ -12,6 +12,7 @@
 #include <arch/arch_ops.h>
 #include <arch/arm64.h>
 #include <kernel/thread.h>
+#include <lib/profile.h>
 
 #if WITH_LIB_MAGENTA
 #include <lib/user_copy.h>
@@ -225,6 +226,11 @@ void arm64_irq(struct arm64_iframe_long *iframe, uint exception_flags)
 {
     LTRACEF("iframe %p, flags 0x%x\n", iframe, exception_flags);
 
+    /* 32-bit user code keeps its frame pointer elsewhere; take just the pc */
+    bool from_user = exception_flags & ARM64_EXCEPTION_FLAG_LOWER_EL;
+    profile_irq(iframe->elr,
+                (exception_flags & ARM64_EXCEPTION_FLAG_ARM32) ? 0 : iframe->r[29], from_user);
+
     enum handler_return ret = platform_irq(iframe);
 
     /* if we came from user space, check to see if we have any signals to handle */
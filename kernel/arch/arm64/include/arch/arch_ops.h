@@ -71,7 +71,9 @@ static inline void arch_spinloop_pause(void)
 
 static inline void arch_spinloop_signal(void)
 {
-    __asm__ volatile("sev");
+    /* make sure the store being signalled is visible before waking up
+     * anyone sitting in wfe, or they may go straight back to sleep */
+    __asm__ volatile("dsb ishst; sev" ::: "memory");
 }
 
 #define mb()        __asm__ volatile("dsb sy" : : : "memory")
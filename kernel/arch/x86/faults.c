@@ -13,6 +13,8 @@
 #include <arch/x86/interrupts.h>
 #include <arch/x86/descriptor.h>
 #include <kernel/thread.h>
+#include <lib/ktrace.h>
+#include <lib/profile.h>
 
 #include <lib/user_copy.h>
 
@@ -268,6 +270,16 @@ void x86_exception_handler(x86_iframe_t *frame)
     // deliver the interrupt
     enum handler_return ret = INT_NO_RESCHEDULE;
 
+    bool is_irq = frame->vector > X86_INT_MAX_INTEL_DEFINED;
+    if (is_irq) {
+        ktrace(MX_KTRACE_IRQ_ENTER, (uint32_t)frame->vector, 0, 0, 0);
+#if ARCH_X86_64
+        profile_irq(frame->ip, frame->rbp, from_user);
+#else
+        profile_irq(frame->ip, frame->ebp, from_user);
+#endif
+    }
+
     switch (frame->vector) {
         case X86_INT_INVALID_OP:
             x86_invop_handler(frame);
@@ -333,6 +345,9 @@ void x86_exception_handler(x86_iframe_t *frame)
             x86_unhandled_exception(frame);
     }
 
+    if (is_irq)
+        ktrace(MX_KTRACE_IRQ_EXIT, (uint32_t)frame->vector, 0, 0, 0);
+
     /* if we came from user space, check to see if we have any signals to handle */
     if (unlikely(from_user)) {
         /* in the case of receiving a kill signal, this function may not return,
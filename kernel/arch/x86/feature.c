@@ -18,6 +18,7 @@ struct cpuid_leaf _cpuid[MAX_SUPPORTED_CPUID + 1];
 struct cpuid_leaf _cpuid_ext[MAX_SUPPORTED_CPUID_EXT - X86_CPUID_EXT_BASE + 1];
 uint32_t max_cpuid = 0;
 uint32_t max_ext_cpuid = 0;
+uint32_t x86_erms_enabled = 0;
 
 static int initialized = 0;
 
@@ -54,6 +55,8 @@ void x86_feature_init(void)
         cpuid_c(i, 0, &_cpuid_ext[index].a, &_cpuid_ext[index].b, &_cpuid_ext[index].c, &_cpuid_ext[index].d);
     }
 
+    x86_erms_enabled = x86_feature_test(X86_FEATURE_ERMS);
+
 #if LK_DEBUGLEVEL > 1
     x86_feature_debug();
 #endif
@@ -111,6 +114,7 @@ void x86_feature_debug(void)
         { X86_FEATURE_AESNI, "aesni" },
         { X86_FEATURE_TSC_ADJUST, "tsc_adj" },
         { X86_FEATURE_SMEP, "smep" },
+        { X86_FEATURE_ERMS, "erms" },
         { X86_FEATURE_SMAP, "smap" },
         { X86_FEATURE_RDRAND, "rdrand" },
         { X86_FEATURE_RDSEED, "rdseed" },
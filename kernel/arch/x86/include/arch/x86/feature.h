@@ -88,6 +88,12 @@ static inline bool x86_feature_test(struct x86_cpuid_bit bit)
 
 void x86_feature_debug(void);
 
+/* Set by x86_feature_init() when the cpu has enhanced rep movsb/stosb
+ * (ERMS), for the string and user copy routines, which test it directly
+ * rather than calling x86_feature_test(). Clear until then, so code that
+ * runs earlier takes the rep movsq/stosq path that every cpu handles. */
+extern uint32_t x86_erms_enabled;
+
 /* add feature bits to test here */
 #define X86_FEATURE_SSE3         X86_CPUID_BIT(0x1, 2, 0)
 #define X86_FEATURE_SSSE3        X86_CPUID_BIT(0x1, 2, 9)
@@ -106,6 +112,7 @@ void x86_feature_debug(void);
 #define X86_FEATURE_TSC_ADJUST   X86_CPUID_BIT(0x7, 1, 1)
 #define X86_FEATURE_AVX2         X86_CPUID_BIT(0x7, 1, 5)
 #define X86_FEATURE_SMEP         X86_CPUID_BIT(0x7, 1, 7)
+#define X86_FEATURE_ERMS         X86_CPUID_BIT(0x7, 1, 9)
 #define X86_FEATURE_RDSEED       X86_CPUID_BIT(0x7, 1, 18)
 #define X86_FEATURE_SMAP         X86_CPUID_BIT(0x7, 1, 20)
 #define X86_FEATURE_PKU          X86_CPUID_BIT(0x7, 2, 3)
@@ -0,0 +1,79 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS
+
+/* Lock contention statistics.
+ *
+ * Built with ENABLE_LOCK_STATS=true, every acquisition of a mutex_t,
+ * spin_lock_t or ticket_spin_lock_t is charged to the pc that took the
+ * lock: how often it was taken, how often it was found held (and, for
+ * mutexes, whether spinning on the holder got it or the caller blocked),
+ * how long the caller waited and how long it then held the lock. The
+ * "lockstat" console command prints the call sites sorted by total wait.
+ *
+ * Counters are updated with atomics rather than under a lock, since they
+ * are updated from inside the spinlocks themselves. Times are in
+ * microseconds, so short waits and holds only show up in the counts. */
+#ifndef LOCK_STATS
+#define LOCK_STATS 0
+#endif
+
+#if LOCK_STATS
+
+#define LOCKSTAT_MAX_SITES 512
+
+enum lockstat_type {
+    LOCKSTAT_MUTEX,
+    LOCKSTAT_SPIN,
+    LOCKSTAT_TICKET,
+};
+
+struct lockstat_site {
+    void *caller;
+    const void *lock;           /* the lock most recently taken here */
+    uint32_t type;              /* enum lockstat_type */
+    uint64_t acquired;
+    uint64_t contended;         /* acquisitions which found the lock held */
+    uint64_t spun;              /* mutexes: ... and got it spinning on the holder */
+    uint64_t blocked;           /* mutexes: ... and had to block */
+    uint64_t wait_total;
+    uint64_t wait_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+};
+
+/* An acquisition in progress, kept until the matching release. */
+struct lockstat_hold {
+    struct lockstat_site *site;
+    lk_bigtime_t start;
+};
+
+/* For the lock implementations. wait is the time the caller spent waiting
+ * for the lock, zero if it was free. */
+void lockstat_acquired(struct lockstat_hold *hold, const void *lock, void *caller,
+                       enum lockstat_type type, bool contended, lk_bigtime_t wait);
+void lockstat_released(struct lockstat_hold *hold);
+
+/* lockstat_acquired() for mutexes, which also count whether a contended
+ * acquisition was won by spinning on the holder or had to block. */
+void lockstat_mutex_acquired(struct lockstat_hold *hold, const void *lock, void *caller,
+                             bool contended, bool spun, lk_bigtime_t wait);
+
+/* Copy up to count sites with any acquisitions into sites. */
+size_t lockstat_read(struct lockstat_site *sites, size_t count);
+void lockstat_reset(void);
+
+#endif // LOCK_STATS
+
+__END_CDECLS
@@ -12,6 +12,7 @@
 #include <compiler.h>
 #include <debug.h>
 #include <stdint.h>
+#include <kernel/lockstat.h>
 #include <kernel/thread.h>
 
 __BEGIN_CDECLS;
@@ -23,6 +24,9 @@ typedef struct mutex {
     thread_t *holder;
     int count;
     wait_queue_t wait;
+#if LOCK_STATS
+    struct lockstat_hold lockstat;
+#endif
 } mutex_t;
 
 #define MUTEX_INITIAL_VALUE(m) \
@@ -36,6 +40,8 @@ typedef struct mutex {
 /* Rules for Mutexes:
  * - Mutexes are only safe to use from thread context.
  * - Mutexes are non-recursive.
+ * - A contended acquire spins briefly while the holder is running on
+ *   another cpu before blocking.
 */
 
 void mutex_init(mutex_t *);
@@ -9,25 +9,45 @@
 
 #include <compiler.h>
 #include <arch/spinlock.h>
+#include <kernel/lockstat.h>
 
 __BEGIN_CDECLS
 
+#if LOCK_STATS
+/* out of line, so that they can tell which call site took the lock */
+void lockstat_spin_lock(spin_lock_t *lock);
+int lockstat_spin_trylock(spin_lock_t *lock);
+void lockstat_spin_unlock(spin_lock_t *lock);
+#endif
+
 /* interrupts should already be disabled */
 static inline void spin_lock(spin_lock_t *lock)
 {
+#if LOCK_STATS
+    lockstat_spin_lock(lock);
+#else
     arch_spin_lock(lock);
+#endif
 }
 
 /* Returns 0 on success, non-0 on failure */
 static inline int spin_trylock(spin_lock_t *lock)
 {
+#if LOCK_STATS
+    return lockstat_spin_trylock(lock);
+#else
     return arch_spin_trylock(lock);
+#endif
 }
 
 /* interrupts should already be disabled */
 static inline void spin_unlock(spin_lock_t *lock)
 {
+#if LOCK_STATS
+    lockstat_spin_unlock(lock);
+#else
     arch_spin_unlock(lock);
+#endif
 }
 
 static inline void spin_lock_init(spin_lock_t *lock)
@@ -16,6 +16,7 @@
 #include <arch/thread.h>
 #include <kernel/wait.h>
 #include <kernel/spinlock.h>
+#include <kernel/ticketlock.h>
 #include <debug.h>
 
 #if WITH_KERNEL_VM
@@ -79,6 +80,10 @@ typedef struct thread {
     /* active bits */
     struct list_node queue_node;
     int priority;
+    /* priority as set by thread_create()/thread_set_priority(), before any
+     * priority inherited from threads blocked behind this one */
+    int base_priority;
+    int inherited_priority;
     enum thread_state state;
     int remaining_quantum;
     unsigned int flags;
@@ -181,6 +186,7 @@ void thread_construct_first(thread_t *t, const char *name);
 thread_t *thread_create_idle_thread(uint cpu_num);
 void thread_set_name(const char *name);
 void thread_set_priority(int priority);
+void thread_set_inherited_priority(thread_t *t, int priority);
 void thread_set_exit_callback(thread_t *t, thread_exit_callback_t cb, void *cb_arg);
 thread_t *thread_create(const char *name, thread_start_routine entry, void *arg, int priority, size_t stack_size);
 thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine entry, void *arg, int priority, void *stack, size_t stack_size, thread_trampoline_routine alt_trampoline);
@@ -193,6 +199,9 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout);
 status_t thread_detach_and_resume(thread_t *t);
 status_t thread_set_real_time(thread_t *t);
 
+/* total time spent running, in microseconds, including the current run */
+lk_bigtime_t thread_runtime(const thread_t *t);
+
 /* wait for at least delay amount of time. interruptable may return early with ERR_INTERRUPTED
  * if thread is signalled for kill.
  */
@@ -210,6 +219,7 @@ void thread_process_pending_signals(void);
 void dump_thread(thread_t *t);
 void arch_dump_thread(thread_t *t);
 void dump_all_threads(void);
+void thread_for_every(void (*func)(thread_t *t, void *arg), void *arg);
 
 /* scheduler routines */
 void thread_yield(void); /* give up the cpu voluntarily */
@@ -229,14 +239,14 @@ thread_t *get_current_thread(void);
 void set_current_thread(thread_t *);
 
 /* scheduler lock */
-extern spin_lock_t thread_lock;
+extern ticket_spin_lock_t thread_lock;
 
-#define THREAD_LOCK(state) spin_lock_saved_state_t state; spin_lock_irqsave(&thread_lock, state)
-#define THREAD_UNLOCK(state) spin_unlock_irqrestore(&thread_lock, state)
+#define THREAD_LOCK(state) spin_lock_saved_state_t state; ticket_spin_lock_irqsave(&thread_lock, state)
+#define THREAD_UNLOCK(state) ticket_spin_unlock_irqrestore(&thread_lock, state)
 
 static inline bool thread_lock_held(void)
 {
-    return spin_lock_held(&thread_lock);
+    return ticket_spin_lock_held(&thread_lock);
 }
 
 /* thread local storage */
@@ -0,0 +1,139 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <arch/ops.h>
+#include <kernel/spinlock.h>
+
+__BEGIN_CDECLS
+
+/* A fair spin lock.
+ *
+ * Each cpu that wants the lock takes the next ticket with a single atomic
+ * add and then waits for the owner field to reach its ticket, so the lock
+ * is granted in arrival order and waiters only read the lock word while
+ * spinning. Use it for hot global locks, such as thread_lock, where a
+ * test-and-set spin_lock_t lets some cpus starve under contention.
+ *
+ * The interface mirrors spin_lock_t, down to the irqsave helpers. */
+typedef union ticket_spin_lock {
+    uint32_t val;
+    struct {
+        uint16_t owner; /* ticket being served */
+        uint16_t next;  /* next ticket to hand out */
+    };
+} ticket_spin_lock_t;
+
+#define TICKET_SPIN_LOCK_INITIAL_VALUE { 0 }
+
+static inline void ticket_spin_lock_init(ticket_spin_lock_t *lock)
+{
+    __atomic_store_n(&lock->val, 0, __ATOMIC_RELAXED);
+}
+
+/* The lock operations themselves; use the wrappers below. */
+static inline void ticket_spin_lock_internal(ticket_spin_lock_t *lock)
+{
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+        arch_spinloop_pause();
+}
+
+static inline int ticket_spin_trylock_internal(ticket_spin_lock_t *lock)
+{
+    ticket_spin_lock_t old, taken;
+    old.val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+    if (old.owner != old.next)
+        return 1;
+
+    taken = old;
+    taken.next++;
+    return !__atomic_compare_exchange_n(&lock->val, &old.val, taken.val, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ticket_spin_unlock_internal(ticket_spin_lock_t *lock)
+{
+    /* only the holder writes owner, so a plain increment is safe */
+    uint16_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->owner, (uint16_t)(owner + 1), __ATOMIC_RELEASE);
+    arch_spinloop_signal();
+}
+
+#if LOCK_STATS
+void lockstat_ticket_spin_lock(ticket_spin_lock_t *lock);
+int lockstat_ticket_spin_trylock(ticket_spin_lock_t *lock);
+void lockstat_ticket_spin_unlock(ticket_spin_lock_t *lock);
+#endif
+
+/* interrupts should already be disabled */
+static inline void ticket_spin_lock(ticket_spin_lock_t *lock)
+{
+#if LOCK_STATS
+    lockstat_ticket_spin_lock(lock);
+#else
+    ticket_spin_lock_internal(lock);
+#endif
+}
+
+/* Returns 0 on success, non-0 on failure */
+static inline int ticket_spin_trylock(ticket_spin_lock_t *lock)
+{
+#if LOCK_STATS
+    return lockstat_ticket_spin_trylock(lock);
+#else
+    return ticket_spin_trylock_internal(lock);
+#endif
+}
+
+/* interrupts should already be disabled */
+static inline void ticket_spin_unlock(ticket_spin_lock_t *lock)
+{
+#if LOCK_STATS
+    lockstat_ticket_spin_unlock(lock);
+#else
+    ticket_spin_unlock_internal(lock);
+#endif
+}
+
+static inline bool ticket_spin_lock_held(ticket_spin_lock_t *lock)
+{
+    ticket_spin_lock_t cur;
+    cur.val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+    return cur.owner != cur.next;
+}
+
+/* same as ticket spin lock, but save disable and save interrupt state first */
+static inline void ticket_spin_lock_save(
+    ticket_spin_lock_t *lock,
+    spin_lock_saved_state_t *statep,
+    spin_lock_save_flags_t flags)
+{
+    arch_interrupt_save(statep, flags);
+    ticket_spin_lock(lock);
+}
+
+/* restore interrupt state before unlocking */
+static inline void ticket_spin_unlock_restore(
+    ticket_spin_lock_t *lock,
+    spin_lock_saved_state_t old_state,
+    spin_lock_save_flags_t flags)
+{
+    ticket_spin_unlock(lock);
+    arch_interrupt_restore(old_state, flags);
+}
+
+/* hand(ier) routines */
+#define ticket_spin_lock_irqsave(lock, statep) \
+    ticket_spin_lock_save(lock, &(statep), SPIN_LOCK_FLAG_INTERRUPTS)
+#define ticket_spin_unlock_irqrestore(lock, statep) \
+    ticket_spin_unlock_restore(lock, statep, SPIN_LOCK_FLAG_INTERRUPTS)
+
+__END_CDECLS
@@ -43,6 +43,10 @@ public:
     // fault in a page at a given offset with PF_FLAGS
     vm_page_t* FaultPage(uint64_t offset, uint pf_flags);
 
+    // commit the pages covering the range and return their physical addresses,
+    // one per page starting with the page containing offset
+    status_t Lookup(uint64_t offset, uint64_t len, paddr_t* pages, size_t page_count);
+
     // read/write operators against kernel pointers only
     status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read);
     status_t Write(const void* ptr, uint64_t offset, size_t len, size_t* bytes_written);
@@ -26,6 +26,9 @@ public:
     vaddr_t base() const { return base_; }
     size_t size() const { return size_; }
     uint arch_mmu_flags() const { return arch_mmu_flags_; }
+    // the flags the region was created with, which Protect() may drop
+    // permissions from but which user mode may not go beyond
+    uint initial_arch_mmu_flags() const { return initial_arch_mmu_flags_; }
 
     // set base address
     void set_base(vaddr_t vaddr) { base_ = vaddr; }
@@ -71,6 +74,7 @@ private:
 
     // cached mapping flags (read/write/user/etc)
     uint arch_mmu_flags_;
+    const uint initial_arch_mmu_flags_;
 
     // pointer back to our member address space
     utils::RefPtr<VmAspace> aspace_;
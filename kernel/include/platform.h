@@ -36,6 +36,11 @@ typedef enum {
 lk_time_t current_time(void);
 lk_bigtime_t current_time_hires(void);
 
+/* returns the fixed-point multiplier that converts the cycle counter user mode
+ * can read directly (e.g. the TSC) into nanoseconds on the current_time_hires()
+ * timeline, ns = (ticks * mult) >> 32, or 0 if user mode can't keep time that way. */
+uint64_t platform_user_ticks_to_ns_mult(void);
+
 /* super early platform initialization, before almost everything */
 void platform_early_init(void);
 
@@ -0,0 +1,333 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/**
+ * @file
+ * @brief  Lock contention statistics
+ *
+ * Call sites live in a fixed hash table keyed by pc. Entries are claimed
+ * with a compare and swap and never released, so that an acquisition in
+ * progress can hold on to its site without a reference; "lockstat reset"
+ * only clears the counters.
+ *
+ * Spinlocks have nowhere to keep the site and start time of the current
+ * acquisition, so each cpu keeps a short stack of the spinlocks it holds.
+ * Spinlocks are held with interrupts disabled and are released on the cpu
+ * that took them (thread_lock is carried across a context switch, but not
+ * to another cpu), so the stack is only touched by its own cpu.
+ */
+
+#include <kernel/lockstat.h>
+
+#include <arch/ops.h>
+#include <debug.h>
+#include <kernel/spinlock.h>
+#include <kernel/ticketlock.h>
+#include <lk/init.h>
+#include <platform.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+
+#define LOCKSTAT_HOLD_DEPTH 8
+
+struct lockstat_held {
+    const void *lock;
+    struct lockstat_hold hold;
+};
+
+struct lockstat_cpu {
+    uint depth;
+    struct lockstat_held held[LOCKSTAT_HOLD_DEPTH];
+};
+
+/* off until the cpu number and the clock can be read */
+static bool lockstat_enabled;
+static struct lockstat_site lockstat_sites[LOCKSTAT_MAX_SITES];
+static uint64_t lockstat_overflow;
+static struct lockstat_cpu lockstat_cpus[SMP_MAX_CPUS];
+
+static inline size_t lockstat_hash(const void *p)
+{
+    return (size_t)(((uintptr_t)p >> 2) * 2654435761u);
+}
+
+static struct lockstat_site *lockstat_site(void *caller)
+{
+    size_t h = lockstat_hash(caller);
+    for (size_t i = 0; i < LOCKSTAT_MAX_SITES; i++) {
+        struct lockstat_site *site = &lockstat_sites[(h + i) % LOCKSTAT_MAX_SITES];
+        void *cur = __atomic_load_n(&site->caller, __ATOMIC_RELAXED);
+        if (cur == NULL) {
+            /* another cpu may claim the slot first, maybe for this caller */
+            __atomic_compare_exchange_n(&site->caller, &cur, caller, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            if (cur == NULL)
+                return site;
+        }
+        if (cur == caller)
+            return site;
+    }
+
+    __atomic_fetch_add(&lockstat_overflow, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void lockstat_max(uint64_t *max, uint64_t val)
+{
+    uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (val > cur &&
+           !__atomic_compare_exchange_n(max, &cur, val, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void lockstat_acquired(struct lockstat_hold *hold, const void *lock, void *caller,
+                       enum lockstat_type type, bool contended, lk_bigtime_t wait)
+{
+    hold->site = NULL;
+    if (!lockstat_enabled)
+        return;
+
+    struct lockstat_site *site = lockstat_site(caller);
+    if (!site)
+        return;
+
+    __atomic_store_n(&site->lock, lock, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->type, type, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->acquired, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&site->wait_total, wait, __ATOMIC_RELAXED);
+        lockstat_max(&site->wait_max, wait);
+    }
+
+    hold->site = site;
+    hold->start = current_time_hires();
+}
+
+void lockstat_released(struct lockstat_hold *hold)
+{
+    struct lockstat_site *site = hold->site;
+    if (!site || !hold->start)
+        return;
+
+    uint64_t held = current_time_hires() - hold->start;
+    hold->start = 0;
+    __atomic_fetch_add(&site->hold_total, held, __ATOMIC_RELAXED);
+    lockstat_max(&site->hold_max, held);
+}
+
+void lockstat_mutex_acquired(struct lockstat_hold *hold, const void *lock, void *caller,
+                             bool contended, bool spun, lk_bigtime_t wait)
+{
+    lockstat_acquired(hold, lock, caller, LOCKSTAT_MUTEX, contended, wait);
+
+    struct lockstat_site *site = hold->site;
+    if (!site || !contended)
+        return;
+    __atomic_fetch_add(spun ? &site->spun : &site->blocked, 1, __ATOMIC_RELAXED);
+}
+
+static void lockstat_spin_acquired(const void *lock, void *caller, enum lockstat_type type,
+                                   bool contended, lk_bigtime_t wait)
+{
+    if (!lockstat_enabled || !arch_ints_disabled())
+        return;
+
+    struct lockstat_cpu *cpu = &lockstat_cpus[arch_curr_cpu_num()];
+    if (cpu->depth == LOCKSTAT_HOLD_DEPTH)
+        return;
+
+    struct lockstat_held *held = &cpu->held[cpu->depth];
+    lockstat_acquired(&held->hold, lock, caller, type, contended, wait);
+    if (held->hold.site) {
+        held->lock = lock;
+        cpu->depth++;
+    }
+}
+
+static void lockstat_spin_released(const void *lock)
+{
+    if (!lockstat_enabled || !arch_ints_disabled())
+        return;
+
+    /* usually the innermost, but locks aren't always dropped in order */
+    struct lockstat_cpu *cpu = &lockstat_cpus[arch_curr_cpu_num()];
+    for (uint i = cpu->depth; i-- > 0; ) {
+        if (cpu->held[i].lock != lock)
+            continue;
+        lockstat_released(&cpu->held[i].hold);
+        memmove(&cpu->held[i], &cpu->held[i + 1], (cpu->depth - i - 1) * sizeof(cpu->held[0]));
+        cpu->depth--;
+        return;
+    }
+}
+
+/* The spinlock wrappers call these instead of the lock operations. They
+ * are out of line, so __GET_CALLER() is the code taking the lock. Waits
+ * are only timed once a trylock has failed, to keep the clock out of the
+ * uncontended path. */
+
+void lockstat_spin_lock(spin_lock_t *lock)
+{
+    if (arch_spin_trylock(lock) == 0) {
+        lockstat_spin_acquired(lock, __GET_CALLER(), LOCKSTAT_SPIN, false, 0);
+        return;
+    }
+
+    lk_bigtime_t start = current_time_hires();
+    arch_spin_lock(lock);
+    lockstat_spin_acquired(lock, __GET_CALLER(), LOCKSTAT_SPIN, true,
+                           current_time_hires() - start);
+}
+
+int lockstat_spin_trylock(spin_lock_t *lock)
+{
+    int ret = arch_spin_trylock(lock);
+    if (ret == 0)
+        lockstat_spin_acquired(lock, __GET_CALLER(), LOCKSTAT_SPIN, false, 0);
+    return ret;
+}
+
+void lockstat_spin_unlock(spin_lock_t *lock)
+{
+    lockstat_spin_released(lock);
+    arch_spin_unlock(lock);
+}
+
+void lockstat_ticket_spin_lock(ticket_spin_lock_t *lock)
+{
+    if (ticket_spin_trylock_internal(lock) == 0) {
+        lockstat_spin_acquired(lock, __GET_CALLER(), LOCKSTAT_TICKET, false, 0);
+        return;
+    }
+
+    lk_bigtime_t start = current_time_hires();
+    ticket_spin_lock_internal(lock);
+    lockstat_spin_acquired(lock, __GET_CALLER(), LOCKSTAT_TICKET, true,
+                           current_time_hires() - start);
+}
+
+int lockstat_ticket_spin_trylock(ticket_spin_lock_t *lock)
+{
+    int ret = ticket_spin_trylock_internal(lock);
+    if (ret == 0)
+        lockstat_spin_acquired(lock, __GET_CALLER(), LOCKSTAT_TICKET, false, 0);
+    return ret;
+}
+
+void lockstat_ticket_spin_unlock(ticket_spin_lock_t *lock)
+{
+    lockstat_spin_released(lock);
+    ticket_spin_unlock_internal(lock);
+}
+
+size_t lockstat_read(struct lockstat_site *sites, size_t count)
+{
+    size_t n = 0;
+
+    /* unlocked, so a site may be caught halfway through an update */
+    for (size_t i = 0; i < LOCKSTAT_MAX_SITES && n < count; i++) {
+        const struct lockstat_site *site = &lockstat_sites[i];
+        if (__atomic_load_n(&site->acquired, __ATOMIC_RELAXED) == 0)
+            continue;
+        sites[n].caller = __atomic_load_n(&site->caller, __ATOMIC_RELAXED);
+        sites[n].lock = __atomic_load_n(&site->lock, __ATOMIC_RELAXED);
+        sites[n].type = __atomic_load_n(&site->type, __ATOMIC_RELAXED);
+        sites[n].acquired = __atomic_load_n(&site->acquired, __ATOMIC_RELAXED);
+        sites[n].contended = __atomic_load_n(&site->contended, __ATOMIC_RELAXED);
+        sites[n].spun = __atomic_load_n(&site->spun, __ATOMIC_RELAXED);
+        sites[n].blocked = __atomic_load_n(&site->blocked, __ATOMIC_RELAXED);
+        sites[n].wait_total = __atomic_load_n(&site->wait_total, __ATOMIC_RELAXED);
+        sites[n].wait_max = __atomic_load_n(&site->wait_max, __ATOMIC_RELAXED);
+        sites[n].hold_total = __atomic_load_n(&site->hold_total, __ATOMIC_RELAXED);
+        sites[n].hold_max = __atomic_load_n(&site->hold_max, __ATOMIC_RELAXED);
+        n++;
+    }
+
+    return n;
+}
+
+void lockstat_reset(void)
+{
+    for (size_t i = 0; i < LOCKSTAT_MAX_SITES; i++) {
+        struct lockstat_site *site = &lockstat_sites[i];
+        __atomic_store_n(&site->acquired, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->contended, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->spun, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->blocked, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->wait_total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->wait_max, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->hold_total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->hold_max, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&lockstat_overflow, 0, __ATOMIC_RELAXED);
+}
+
+static void lockstat_init(uint level)
+{
+    __atomic_store_n(&lockstat_enabled, true, __ATOMIC_RELEASE);
+}
+
+LK_INIT_HOOK(lockstat, lockstat_init, LK_INIT_LEVEL_THREADING);
+
+#if WITH_LIB_CONSOLE
+static int lockstat_cmp_wait(const void *a, const void *b)
+{
+    const struct lockstat_site *sa = a, *sb = b;
+    if (sa->wait_total != sb->wait_total)
+        return sa->wait_total > sb->wait_total ? -1 : 1;
+    if (sa->contended != sb->contended)
+        return sa->contended > sb->contended ? -1 : 1;
+    return 0;
+}
+
+static int cmd_lockstat(int argc, const cmd_args *argv)
+{
+    if (argc > 1 && !strcmp(argv[1].str, "reset")) {
+        lockstat_reset();
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1].str, "help")) {
+        printf("usage: %s [count]: call sites sorted by total wait, 20 by default\n", argv[0].str);
+        printf("       %s reset  : clear the counters\n", argv[0].str);
+        return 0;
+    }
+
+    size_t max = (argc > 1) ? argv[1].u : 20;
+
+    /* the table is too big for the stack */
+    static struct lockstat_site snapshot[LOCKSTAT_MAX_SITES];
+    size_t n = lockstat_read(snapshot, LOCKSTAT_MAX_SITES);
+    qsort(snapshot, n, sizeof(snapshot[0]), lockstat_cmp_wait);
+
+    static const char *const type_names[] = { "mutex", "spin", "ticket" };
+
+    printf("%-18s %-18s %-6s %10s %10s %10s %10s %12s %9s %12s %9s\n", "caller", "lock", "type",
+           "acquired", "contended", "spun", "blocked", "wait us", "max", "hold us", "max");
+    for (size_t i = 0; i < n && i < max; i++) {
+        const struct lockstat_site *site = &snapshot[i];
+        printf("%18p %18p %-6s %10llu %10llu %10llu %10llu %12llu %9llu %12llu %9llu\n",
+               site->caller, site->lock,
+               site->type < countof(type_names) ? type_names[site->type] : "?",
+               site->acquired, site->contended, site->spun, site->blocked,
+               site->wait_total, site->wait_max, site->hold_total, site->hold_max);
+    }
+
+    uint64_t overflow = __atomic_load_n(&lockstat_overflow, __ATOMIC_RELAXED);
+    if (overflow)
+        printf("%llu acquisitions from call sites that didn't fit in the table\n", overflow);
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("lockstat", "lock contention by call site [count|reset|help]", &cmd_lockstat)
+STATIC_COMMAND_END(lockstat);
+#endif
@@ -199,7 +199,7 @@ void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void *context)
 static void mp_unplug_trampoline(void) __NO_RETURN;
 static void mp_unplug_trampoline(void) {
     /* release the thread lock that was implicitly held across the reschedule */
-    spin_unlock(&thread_lock);
+    ticket_spin_unlock(&thread_lock);
 
     /* do *not* enable interrupts, we want this CPU to never receive another
      * interrupt */
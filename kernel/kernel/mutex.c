@@ -19,7 +19,13 @@
 #include <debug.h>
 #include <assert.h>
 #include <err.h>
+#include <arch/ops.h>
 #include <kernel/thread.h>
+#include <platform.h>
+
+/* How long to poll the holder of a contended mutex before giving up and
+ * blocking, even though the holder is still running, in microseconds. */
+#define MUTEX_SPIN_MAX_US 10
 
 /**
  * @brief  Initialize a mutex_t
@@ -74,10 +80,47 @@ status_t mutex_acquire_timeout_internal(mutex_t *m, lk_time_t timeout)
     }
 
     m->holder = get_current_thread();
+#if LOCK_STATS
+    /* cond_wait_timeout() comes back in here, so restart the hold time
+     * for the call site that first took the mutex */
+    m->lockstat.start = current_time_hires();
+#endif
 
     return NO_ERROR;
 }
 
+#if WITH_SMP
+/*
+ * Spin while the holder of a contended mutex is running on another cpu, on
+ * the theory that it will release the mutex sooner than it would take to
+ * block and be woken back up. Called without thread_lock held, so all of
+ * the state here is only a hint: the caller retakes the lock and decides.
+ *
+ * Nothing pins the holder: between our check of m->holder and the read of
+ * its state it may release the mutex, exit and be freed, and the memory
+ * may be reused, possibly for another running thread. The heap stays
+ * mapped, so the read itself is safe, and since a thread can't be freed
+ * while it still holds the mutex, the next check of m->holder ends the
+ * spin. A stale read costs at most one extra iteration.
+ */
+static void mutex_spin_on_holder(mutex_t *m, thread_t *holder)
+{
+    lk_bigtime_t start = current_time_hires();
+    while (current_time_hires() - start < MUTEX_SPIN_MAX_US) {
+        /* released, or handed to a blocked waiter */
+        if (*(thread_t * volatile *)&m->holder != holder)
+            return;
+        /* release will hand the mutex to a blocked waiter rather than to us */
+        if (*(volatile int *)&m->count > 1)
+            return;
+        /* the holder went to sleep or was preempted */
+        if (*(volatile enum thread_state *)&holder->state != THREAD_RUNNING)
+            return;
+        arch_spinloop_pause();
+    }
+}
+#endif
+
 /**
  * @brief  Mutex wait with timeout
  *
@@ -99,7 +142,32 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout)
 #endif
 
     THREAD_LOCK(state);
+
+#if LOCK_STATS
+    bool contended = m->count > 0;
+    lk_bigtime_t wait_start = contended ? current_time_hires() : 0;
+#endif
+
+    __UNUSED bool spun = false;
+#if WITH_SMP
+    if (unlikely(m->count > 0) && timeout != 0) {
+        thread_t *holder = m->holder;
+        if (holder && holder->state == THREAD_RUNNING) {
+            THREAD_UNLOCK(state);
+            mutex_spin_on_holder(m, holder);
+            ticket_spin_lock_irqsave(&thread_lock, state);
+            spun = (m->count == 0);
+        }
+    }
+#endif
+
     status_t ret = mutex_acquire_timeout_internal(m, timeout);
+#if LOCK_STATS
+    if (ret == NO_ERROR) {
+        lockstat_mutex_acquired(&m->lockstat, m, __GET_CALLER(), contended, spun,
+                                contended ? current_time_hires() - wait_start : 0);
+    }
+#endif
     THREAD_UNLOCK(state);
     return ret;
 }
@@ -107,6 +175,14 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout)
 void mutex_release_internal(mutex_t *m, bool reschedule)
 {
     m->holder = 0;
+#if LOCK_STATS
+    lockstat_released(&m->lockstat);
+#endif
+
+#if WITH_SMP
+    /* kick anyone waiting for us in mutex_spin_on_holder() */
+    arch_spinloop_signal();
+#endif
 
     if (unlikely(--m->count >= 1)) {
         /* release a thread */
@@ -29,6 +29,12 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/cmdline.c \
 
 
+# per call site lock contention statistics, see kernel/lockstat.h
+ifeq ($(call TOBOOL,$(ENABLE_LOCK_STATS)),true)
+KERNEL_DEFINES += LOCK_STATS=1
+MODULE_SRCS += $(LOCAL_DIR)/lockstat.c
+endif
+
 ifeq ($(WITH_KERNEL_VM),1)
 MODULE_DEPS += kernel/vm
 else
@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <list.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
 #include <printf.h>
 #include <err.h>
@@ -29,6 +30,7 @@
 #include <platform.h>
 #include <target.h>
 #include <lib/heap.h>
+#include <lib/ktrace.h>
 #if WITH_KERNEL_VM
 #include <kernel/vm.h>
 #endif
@@ -46,7 +48,7 @@ struct thread_stats thread_stats[SMP_MAX_CPUS];
 static struct list_node thread_list;
 
 /* master thread spinlock */
-spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
+ticket_spin_lock_t thread_lock = TICKET_SPIN_LOCK_INITIAL_VALUE;
 
 /* the run queue */
 static struct list_node run_queue[NUM_PRIORITIES];
@@ -81,7 +83,7 @@ static void insert_in_run_queue_head(thread_t *t)
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
 
     list_add_head(&run_queue[t->priority], &t->queue_node);
     run_queue_bitmap |= (1<<t->priority);
@@ -93,7 +95,7 @@ static void insert_in_run_queue_tail(thread_t *t)
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
 
     list_add_tail(&run_queue[t->priority], &t->queue_node);
     run_queue_bitmap |= (1<<t->priority);
@@ -114,7 +116,7 @@ static void initial_thread_func(void)
     int ret;
 
     /* release the thread lock that was implicitly held across the reschedule */
-    spin_unlock(&thread_lock);
+    ticket_spin_unlock(&thread_lock);
     arch_enable_ints();
 
     thread_t *ct = get_current_thread();
@@ -174,6 +176,7 @@ thread_t *thread_create_etc(
     t->entry = entry;
     t->arg = arg;
     t->priority = priority;
+    t->base_priority = priority;
     t->state = THREAD_SUSPENDED;
     t->signals = 0;
     t->blocking_wait_queue = NULL;
@@ -227,6 +230,8 @@ thread_t *thread_create_etc(
     list_add_head(&thread_list, &t->thread_list_node);
     THREAD_UNLOCK(state);
 
+    ktrace_thread_name(t);
+
     return t;
 }
 
@@ -622,7 +627,7 @@ void thread_resched(void)
     uint cpu = arch_curr_cpu_num();
 
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
     DEBUG_ASSERT(current_thread->state != THREAD_RUNNING);
 
     THREAD_STATS_INC(reschedules);
@@ -677,6 +682,8 @@ void thread_resched(void)
 #endif
 
     KEVLOG_THREAD_SWITCH(oldthread, newthread);
+    ktrace(MX_KTRACE_CONTEXT_SWITCH, ktrace_thread_id(newthread), oldthread->state,
+           newthread->priority, 0);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     if (thread_is_real_time_or_idle(newthread)) {
@@ -836,7 +843,7 @@ void thread_block(void)
 
     DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_BLOCKED);
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
     DEBUG_ASSERT(!thread_is_idle(current_thread));
 
     /* we are blocking on something. the blocking code should have already stuck us on a queue */
@@ -847,7 +854,7 @@ void thread_unblock(thread_t *t, bool resched)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
     DEBUG_ASSERT(!thread_is_idle(t));
 
     t->state = THREAD_READY;
@@ -879,10 +886,10 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
 
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    spin_lock(&thread_lock);
+    ticket_spin_lock(&thread_lock);
 
     if (t->state != THREAD_SLEEPING) {
-        spin_unlock(&thread_lock);
+        ticket_spin_unlock(&thread_lock);
         return INT_NO_RESCHEDULE;
     }
 
@@ -890,7 +897,7 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
     t->blocked_status = NO_ERROR;
     insert_in_run_queue_head(t);
 
-    spin_unlock(&thread_lock);
+    ticket_spin_unlock(&thread_lock);
 
     return INT_RESCHEDULE;
 }
@@ -964,6 +971,7 @@ void thread_construct_first(thread_t *t, const char *name)
 
     init_thread_struct(t, name);
     t->priority = HIGHEST_PRIORITY;
+    t->base_priority = HIGHEST_PRIORITY;
     t->state = THREAD_RUNNING;
     t->flags = THREAD_FLAG_DETACHED;
     t->signals = 0;
@@ -1020,6 +1028,7 @@ void thread_set_name(const char *name)
 {
     thread_t *current_thread = get_current_thread();
     strlcpy(current_thread->name, name, sizeof(current_thread->name));
+    ktrace_thread_name(current_thread);
 }
 
 /**
@@ -1046,7 +1055,8 @@ void thread_set_priority(int priority)
         priority = IDLE_PRIORITY + 1;
     if (priority > HIGHEST_PRIORITY)
         priority = HIGHEST_PRIORITY;
-    current_thread->priority = priority;
+    current_thread->base_priority = priority;
+    current_thread->priority = MAX(priority, current_thread->inherited_priority);
 
     current_thread->state = THREAD_READY;
     insert_in_run_queue_head(current_thread);
@@ -1055,6 +1065,47 @@ void thread_set_priority(int priority)
     THREAD_UNLOCK(state);
 }
 
+/**
+ * @brief Change the priority a thread inherits from threads waiting on it
+ *
+ * Used by priority inheriting locks: while other threads are blocked on a
+ * lock held by |t|, |t| runs at the higher of its own priority and
+ * |priority|.  Passing a priority of 0 drops any inherited priority.
+ *
+ * If |t| is sitting in the run queue it is moved to the queue for its new
+ * effective priority.
+ */
+void thread_set_inherited_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    if (priority < LOWEST_PRIORITY)
+        priority = LOWEST_PRIORITY;
+    if (priority > HIGHEST_PRIORITY)
+        priority = HIGHEST_PRIORITY;
+
+    THREAD_LOCK(state);
+
+    t->inherited_priority = priority;
+
+    int new_priority = MAX(t->base_priority, priority);
+    if (new_priority != t->priority && !thread_is_idle(t)) {
+        if (t->state == THREAD_READY && list_in_list(&t->queue_node)) {
+            list_delete(&t->queue_node);
+            if (list_is_empty(&run_queue[t->priority]))
+                run_queue_bitmap &= ~(1<<t->priority);
+
+            t->priority = new_priority;
+            insert_in_run_queue_head(t);
+            mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+        } else {
+            t->priority = new_priority;
+        }
+    }
+
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief  Become an idle thread
  *
@@ -1078,6 +1129,7 @@ void thread_become_idle(void)
 
     /* mark ourself as idle */
     t->priority = IDLE_PRIORITY;
+    t->base_priority = IDLE_PRIORITY;
     t->flags |= THREAD_FLAG_IDLE;
     thread_set_pinned_cpu(t, arch_curr_cpu_num());
 
@@ -1160,15 +1212,35 @@ static const char *thread_state_to_str(enum thread_state state)
     }
 }
 
-/**
- * @brief  Dump debugging info about the specified thread.
- */
-void dump_thread(thread_t *t)
+static lk_bigtime_t thread_runtime_locked(const thread_t *t)
 {
     lk_bigtime_t runtime = t->runtime_us;
     if (t->state == THREAD_RUNNING) {
         runtime += current_time_hires() - t->last_started_running_us;
     }
+    return runtime;
+}
+
+/**
+ * @brief  Return the total time a thread has spent running, in microseconds
+ *
+ * Unlike runtime_us, this includes the time since the thread was last
+ * scheduled if it is running now.
+ */
+lk_bigtime_t thread_runtime(const thread_t *t)
+{
+    THREAD_LOCK(state);
+    lk_bigtime_t runtime = thread_runtime_locked(t);
+    THREAD_UNLOCK(state);
+    return runtime;
+}
+
+/**
+ * @brief  Dump debugging info about the specified thread.
+ */
+void dump_thread(thread_t *t)
+{
+    lk_bigtime_t runtime = thread_runtime_locked(t);
 
     dprintf(INFO, "dump_thread: t %p (%s)\n", t, t->name);
 #if WITH_SMP
@@ -1222,6 +1294,22 @@ void dump_all_threads(void)
     THREAD_UNLOCK(state);
 }
 
+/**
+ * @brief  Call a function on every thread in the system
+ *
+ * The thread lock is held across the calls, so |func| must not block.
+ */
+void thread_for_every(void (*func)(thread_t *t, void *arg), void *arg)
+{
+    thread_t *t;
+
+    THREAD_LOCK(state);
+    list_for_every_entry(&thread_list, t, thread_t, thread_list_node) {
+        func(t, arg);
+    }
+    THREAD_UNLOCK(state);
+}
+
 /** @} */
 
 
@@ -1240,14 +1328,14 @@ static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t
 
     DEBUG_ASSERT(thread->magic == THREAD_MAGIC);
 
-    spin_lock(&thread_lock);
+    ticket_spin_lock(&thread_lock);
 
     enum handler_return ret = INT_NO_RESCHEDULE;
     if (thread_unblock_from_wait_queue(thread, ERR_TIMED_OUT) >= NO_ERROR) {
         ret = INT_RESCHEDULE;
     }
 
-    spin_unlock(&thread_lock);
+    ticket_spin_unlock(&thread_lock);
 
     return ret;
 }
@@ -1279,7 +1367,7 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout)
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
 
     if (timeout == 0)
         return ERR_TIMED_OUT;
@@ -1329,7 +1417,7 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
 
     t = list_remove_head_type(&wait->list, thread_t, queue_node);
     if (t) {
@@ -1383,7 +1471,7 @@ int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
 
     if (reschedule && wait->count > 0) {
         /* if we're instructed to reschedule, stick the current thread on the head
@@ -1427,7 +1515,7 @@ void wait_queue_destroy(wait_queue_t *wait, bool reschedule)
 {
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
 
     wait_queue_wake_all(wait, reschedule, ERR_CANCELLED);
     wait->magic = 0;
@@ -1449,7 +1537,7 @@ status_t thread_unblock_from_wait_queue(thread_t *t, status_t wait_queue_error)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(ticket_spin_lock_held(&thread_lock));
 
     if (t->state != THREAD_BLOCKED)
         return ERR_NOT_BLOCKED;
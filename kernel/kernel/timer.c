@@ -27,12 +27,13 @@
 #include <kernel/timer.h>
 #include <kernel/debug.h>
 #include <kernel/spinlock.h>
+#include <kernel/ticketlock.h>
 #include <platform/timer.h>
 #include <platform.h>
 
 #define LOCAL_TRACE 0
 
-spin_lock_t timer_lock;
+ticket_spin_lock_t timer_lock;
 
 struct timer_state {
     struct list_node timer_queue;
@@ -93,7 +94,7 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
     LTRACEF("scheduled time %u\n", timer->scheduled_time);
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    ticket_spin_lock_irqsave(&timer_lock, state);
 
     uint cpu = arch_curr_cpu_num();
     insert_timer_in_queue(cpu, timer);
@@ -106,7 +107,7 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    ticket_spin_unlock_irqrestore(&timer_lock, state);
 }
 
 /**
@@ -159,7 +160,7 @@ void timer_cancel(timer_t *timer)
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    ticket_spin_lock_irqsave(&timer_lock, state);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     uint cpu = arch_curr_cpu_num();
@@ -197,7 +198,7 @@ void timer_cancel(timer_t *timer)
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    ticket_spin_unlock_irqrestore(&timer_lock, state);
 }
 
 /* called at interrupt time to process any pending timers */
@@ -215,7 +216,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
     LTRACEF("cpu %u now %u, sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
+    ticket_spin_lock(&timer_lock);
 
     for (;;) {
         /* see if there's an event to process */
@@ -232,7 +233,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         list_delete(&timer->node);
 
         /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
+        ticket_spin_unlock(&timer_lock);
 
         LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
 
@@ -247,7 +248,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
         DEBUG_ASSERT(arch_ints_disabled());
         /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+        ticket_spin_lock(&timer_lock);
 
         /* if it was a periodic timer and it hasn't been requeued
          * by the callback put it back in the list
@@ -273,10 +274,10 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
     }
 
     /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    ticket_spin_unlock(&timer_lock);
 #else
     /* release the timer lock before calling the tick handler */
-    spin_unlock(&timer_lock);
+    ticket_spin_unlock(&timer_lock);
 
     /* let the scheduler have a shot to do quantum expiration, etc */
     /* in case of dynamic timer, the scheduler will set up a periodic timer */
@@ -290,7 +291,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 void timer_transition_off_cpu(uint old_cpu)
 {
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    ticket_spin_lock_irqsave(&timer_lock, state);
     uint cpu = arch_curr_cpu_num();
 
     timer_t *old_head = list_peek_head_type(&timers[old_cpu].timer_queue, timer_t, node);
@@ -317,7 +318,7 @@ void timer_transition_off_cpu(uint old_cpu)
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    ticket_spin_unlock_irqrestore(&timer_lock, state);
 }
 
 /* This function is to be invoked after resume on each CPU that may have
@@ -326,7 +327,7 @@ void timer_thaw_percpu(void)
 {
 #if PLATFORM_HAS_DYNAMIC_TIMER
     DEBUG_ASSERT(arch_ints_disabled());
-    spin_lock(&timer_lock);
+    ticket_spin_lock(&timer_lock);
 
     uint cpu = arch_curr_cpu_num();
 
@@ -341,13 +342,13 @@ void timer_thaw_percpu(void)
         platform_set_oneshot_timer(timer_tick, NULL, delay);
     }
 
-    spin_unlock(&timer_lock);
+    ticket_spin_unlock(&timer_lock);
 #endif
 }
 
 void timer_init(void)
 {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
+    ticket_spin_lock_init(&timer_lock);
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         list_initialize(&timers[i].timer_queue);
     }
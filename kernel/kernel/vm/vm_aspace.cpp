@@ -14,6 +14,7 @@
 #include <kernel/vm.h>
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_region.h>
+#include <lib/ktrace.h>
 #include <lk/init.h>
 #include <new.h>
 #include <stdlib.h>
@@ -678,16 +679,22 @@ status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("va 0x%lx, flags 0x%x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(lock_);
+    ktrace_ptr(MX_KTRACE_PAGE_FAULT_ENTER, va, flags, 0);
 
-    auto r = FindRegionLocked(va);
-    if (unlikely(!r))
-        return ERR_NOT_FOUND;
+    status_t status = ERR_NOT_FOUND;
+    {
+        // for now, hold the aspace lock across the page fault operation,
+        // which stops any other operations on the address space from moving
+        // the region out from underneath it
+        AutoLock a(lock_);
+
+        auto r = FindRegionLocked(va);
+        if (likely(r))
+            status = r->PageFault(va, flags);
+    }
 
-    return r->PageFault(va, flags);
+    ktrace_ptr(MX_KTRACE_PAGE_FAULT_EXIT, va, flags, static_cast<uint32_t>(status));
+    return status;
 }
 
 void VmAspace::Dump() const {
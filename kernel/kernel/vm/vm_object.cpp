@@ -226,6 +226,32 @@ vm_page_t* VmObject::FaultPage(uint64_t offset, uint pf_flags) {
     return FaultPageLocked(offset, pf_flags);
 }
 
+status_t VmObject::Lookup(uint64_t offset, uint64_t len, paddr_t* pages, size_t page_count) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset 0x%llx, len 0x%llx\n", offset, len);
+
+    AutoLock a(lock_);
+
+    if (len == 0 || offset + len < offset || offset + len > size_)
+        return ERR_OUT_OF_RANGE;
+
+    uint64_t start = ROUNDDOWN(offset, PAGE_SIZE);
+    uint64_t end = ROUNDUP_PAGE_SIZE(offset + len);
+    if ((end - start) / PAGE_SIZE > page_count)
+        return ERR_NOT_ENOUGH_BUFFER;
+
+    // pages are never taken back from an object, so the addresses stay good
+    // for as long as the object is alive
+    for (uint64_t o = start; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = FaultPageLocked(o, VMM_PF_FLAG_WRITE);
+        if (!p)
+            return ERR_NO_MEMORY;
+        *pages++ = vm_page_to_paddr(p);
+    }
+
+    return NO_ERROR;
+}
+
 int64_t VmObject::CommitRange(uint64_t offset, uint64_t len) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("offset 0x%llx, len 0x%llx\n", offset, len);
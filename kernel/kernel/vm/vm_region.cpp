@@ -21,7 +21,8 @@
 
 VmRegion::VmRegion(VmAspace& aspace, vaddr_t base, size_t size, uint arch_mmu_flags,
                    const char* name)
-    : base_(base), size_(size), arch_mmu_flags_(arch_mmu_flags), aspace_(&aspace) {
+    : base_(base), size_(size), arch_mmu_flags_(arch_mmu_flags),
+      initial_arch_mmu_flags_(arch_mmu_flags), aspace_(&aspace) {
     strlcpy(name_, name, sizeof(name_));
     LTRACEF("%p '%s'\n", this, name_);
 }
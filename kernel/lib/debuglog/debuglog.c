@@ -6,157 +6,337 @@
 
 #include <lib/debuglog.h>
 
+#include <arch/defines.h>
+#include <arch/ops.h>
 #include <err.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
+#include <kernel/timer.h>
 #include <lib/user_copy.h>
 #include <lk/init.h>
 #include <platform.h>
 #include <string.h>
 
-#define DLOG_SIZE (64 * 1024)
-
-static uint8_t DLOG_DATA[DLOG_SIZE];
+// Size of each cpu's ring; must be a power of two.
+#define DLOG_CPU_SIZE (8 * 1024)
+#define DLOG_CPU_MASK (DLOG_CPU_SIZE - 1)
+
+// How long wakeups deferred by writers that had interrupts disabled wait
+// to be delivered, in ms.
+#define DLOG_WAKE_INTERVAL 10
+
+// A record as stored in a ring. Records never straddle the end of the
+// ring's storage: a gap too small for a header is skipped implicitly and
+// a larger one is filled with a padding record, which has a zero seq.
+typedef struct dlog_header {
+    uint32_t size; // from this header to the next one
+    uint16_t datalen;
+    uint16_t flags;
+    uint64_t timestamp;
+    uint64_t seq;
+} dlog_header_t;
+
+// Offsets into a ring only ever increase; the byte at offset |off| lives
+// at data[off & DLOG_CPU_MASK]. [tail, head) holds complete records.
+// reserve is the end of the record being written and is published before
+// any of its bytes are stored, so a reader can tell whether a copy it made
+// raced with the writer wrapping around onto it.
+typedef struct dlog_cpu {
+    volatile uint64_t head;
+    volatile uint64_t reserve;
+    volatile uint64_t tail;
+    uint8_t data[DLOG_CPU_SIZE] __ALIGNED(8);
+} __ALIGNED(CACHE_LINE) dlog_cpu_t;
+
+struct dlog {
+    dlog_cpu_t cpu[SMP_MAX_CPUS];
+
+    uint64_t seq;
+
+    // Set by readers about to block. Writers that see it wake every
+    // reader, or, if they can't safely take the scheduler lock, set
+    // wake_pending and leave it to the wake timer. The writer that sets
+    // wake_pending arms the timer, which clears it again when it fires.
+    int waiting;
+    int wake_pending;
+
+    spin_lock_t readers_lock;
+    struct list_node readers;
+    timer_t wake_timer;
+};
 
 static dlog_t DLOG = {
-    .lock = MUTEX_INITIAL_VALUE(DLOG.lock),
-    .size = DLOG_SIZE,
-    .data = DLOG_DATA,
+    .readers_lock = SPIN_LOCK_INITIAL_VALUE,
     .readers = LIST_INITIAL_VALUE(DLOG.readers),
+    .wake_timer = TIMER_INITIAL_VALUE(DLOG.wake_timer),
 };
 
 #define MAX_DATA_SIZE (DLOG_MAX_ENTRY - sizeof(dlog_record_t))
 
 #define ALIGN8(n) (((n) + 7) & (~7))
 
-#define REC(ptr, off) ((dlog_record_t*)((ptr) + (off)))
+#define HDR(cpu, off) ((dlog_header_t*)((cpu)->data + ((off) & DLOG_CPU_MASK)))
 
-// To avoid complexity with splitting record headers, this is
-// a mostly-circular buffer -- each record has a next index
-// that can be used to advance to the next record, allowing the
-// leftover space not large enough for a full record at the end
-// to be skipped easily.
-status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
-    dlog_t* log = &DLOG;
+static inline uint32_t dlog_room(uint64_t off) {
+    return DLOG_CPU_SIZE - (uint32_t)(off & DLOG_CPU_MASK);
+}
 
-    if (arch_ints_disabled()) {
-        return ERR_BAD_STATE;
+// Offset of the record after the one at |off|, which the caller must know
+// to be intact.
+static uint64_t dlog_next(dlog_cpu_t* cpu, uint64_t off) {
+    uint32_t room = dlog_room(off);
+    if (room < sizeof(dlog_header_t)) {
+        return off + room;
     }
+    return off + HDR(cpu, off)->size;
+}
 
-    if (len > MAX_DATA_SIZE) {
-        return ERR_TOO_BIG;
+static void dlog_wake_readers(dlog_t* log) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&log->readers_lock, state);
+
+    __atomic_store_n(&log->waiting, 0, __ATOMIC_RELAXED);
+
+    dlog_reader_t* rdr;
+    list_for_every_entry (&log->readers, rdr, dlog_reader_t, node) {
+        event_signal(&rdr->event, false);
     }
 
-    // Keep record headers uint64 aligned
-    size_t sz = ALIGN8(len + sizeof(dlog_record_t));
+    spin_unlock_irqrestore(&log->readers_lock, state);
+}
 
-    mutex_acquire(&log->lock);
+static enum handler_return dlog_wake_timer(timer_t* timer, lk_time_t now, void* arg) {
+    dlog_t* log = arg;
+
+    __atomic_store_n(&log->wake_pending, 0, __ATOMIC_RELAXED);
+    dlog_wake_readers(log);
+    return INT_RESCHEDULE;
+}
 
-    // Determine location of new record and next record after it
-    uint32_t dst = log->head;
-    uint32_t end = log->head + sz;
-    uint32_t nxt = end;
-    if ((nxt + DLOG_MAX_ENTRY) > log->size) {
-        nxt = 0;
+// Each cpu is the only writer of its own ring, and writes with interrupts
+// disabled, so appending takes no locks and nothing can interleave with
+// it. Writers never wait for readers; a reader that falls behind loses
+// the oldest records instead.
+status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
+    dlog_t* log = &DLOG;
+
+    if (len > MAX_DATA_SIZE) {
+        return ERR_TOO_BIG;
     }
 
-    // Advance our tail if we write past it.
-    if (log->head != log->tail) {
-        while ((log->tail >= dst) && (log->tail < end)) {
-            log->tail = REC(log->data, log->tail)->next;
-        }
+    // Waking readers takes the scheduler lock, which the caller may
+    // already hold if interrupts are disabled.
+    bool can_wake = !arch_ints_disabled();
+
+    // Keep record headers uint64 aligned
+    uint32_t sz = ALIGN8((uint32_t)(len + sizeof(dlog_header_t)));
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    dlog_cpu_t* cpu = &log->cpu[arch_curr_cpu_num()];
+    uint64_t head = cpu->head;
+    uint32_t room = dlog_room(head);
+    uint32_t pad = (room < sz) ? room : 0;
+    uint64_t end = head + pad + sz;
+
+    // Drop the oldest records to make room, then claim the space. Readers
+    // load these in the opposite order.
+    uint64_t tail = cpu->tail;
+    while (end - tail > DLOG_CPU_SIZE) {
+        tail = dlog_next(cpu, tail);
+    }
+    __atomic_store_n(&cpu->tail, tail, __ATOMIC_RELAXED);
+    smp_wmb();
+    __atomic_store_n(&cpu->reserve, end, __ATOMIC_RELAXED);
+    smp_wmb();
+
+    dlog_header_t* hdr;
+    if (pad >= sizeof(dlog_header_t)) {
+        hdr = HDR(cpu, head);
+        hdr->size = pad;
+        hdr->datalen = 0;
+        hdr->flags = 0;
+        hdr->timestamp = 0;
+        hdr->seq = 0;
     }
 
-    // Notify readers and advance their tails if necessary
-    dlog_reader_t* rdr;
-    list_for_every_entry (&log->readers, rdr, dlog_reader_t, node) {
-        if (rdr->tail == log->head) {
-            // Reader view was empty, point reader's tail
-            // at the message we're writing now
-            rdr->tail = dst;
-        } else {
-            // If we're about to overwrite the message at
-            // the reader's tail, advance that tail.
-            // This will never cause the reader view to be "empty".
-            while ((rdr->tail >= dst) && (rdr->tail < end)) {
-                rdr->tail = REC(log->data, rdr->tail)->next;
-            }
+    hdr = HDR(cpu, head + pad);
+    hdr->size = sz;
+    hdr->datalen = (uint16_t)len;
+    hdr->flags = (uint16_t)flags;
+    hdr->timestamp = current_time_hires() * 1000ULL;
+    hdr->seq = __atomic_add_fetch(&log->seq, 1, __ATOMIC_RELAXED);
+    memcpy(hdr + 1, ptr, len);
+
+    __atomic_store_n(&cpu->head, end, __ATOMIC_RELEASE);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Pairs with the barrier in dlog_wait(): either the reader sees the
+    // new record or we see that it is waiting.
+    smp_mb();
+    if (__atomic_load_n(&log->waiting, __ATOMIC_RELAXED)) {
+        if (can_wake) {
+            dlog_wake_readers(log);
+        } else if (!__atomic_exchange_n(&log->wake_pending, 1, __ATOMIC_RELAXED)) {
+            timer_set_oneshot(&log->wake_timer, DLOG_WAKE_INTERVAL, dlog_wake_timer, log);
         }
-        event_signal(&rdr->event, false);
     }
+    return NO_ERROR;
+}
 
-    // Write the new record
-    dlog_record_t* rec = REC(log->data, dst);
-    rec->next = nxt;
-    rec->datalen = len;
-    rec->flags = flags;
-    rec->timestamp = current_time_hires() * 1000ULL;
-    memcpy(rec->data, ptr, len);
+// Whether the bytes copied from offset |off| of |cpu|'s ring since the
+// caller last loaded head are still the ones that were written there.
+static bool dlog_intact(dlog_cpu_t* cpu, uint64_t off) {
+    smp_rmb();
+    return __atomic_load_n(&cpu->reserve, __ATOMIC_RELAXED) - off <= DLOG_CPU_SIZE;
+}
 
-    // Advance the head pointer
-    log->head = nxt;
+// Advances the reader's position in |cpu_num|'s ring to the next record,
+// skipping padding and jumping to the current tail if the writer has
+// lapped the reader, and copies out that record's header. Returns false
+// if the reader has already read everything in the ring.
+static bool dlog_peek(dlog_reader_t* rdr, uint cpu_num, dlog_header_t* hdr) {
+    dlog_cpu_t* cpu = &rdr->log->cpu[cpu_num];
+    uint64_t pos = rdr->pos[cpu_num];
+    bool found = false;
+
+    while (pos != __atomic_load_n(&cpu->head, __ATOMIC_ACQUIRE)) {
+        uint32_t room = dlog_room(pos);
+        if (room < sizeof(dlog_header_t)) {
+            pos += room;
+            continue;
+        }
+        memcpy(hdr, HDR(cpu, pos), sizeof(*hdr));
+        if (!dlog_intact(cpu, pos)) {
+            smp_rmb();
+            pos = __atomic_load_n(&cpu->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (hdr->seq == 0) {
+            pos += hdr->size;
+            continue;
+        }
+        found = true;
+        break;
+    }
 
-    mutex_release(&log->lock);
-    return NO_ERROR;
+    rdr->pos[cpu_num] = pos;
+    return found;
 }
 
 // TODO: support reading multiple messages at a time
 // TODO: filter with flags
 status_t dlog_read_etc(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, bool user) {
-    dlog_t* log = rdr->log;
+    uint8_t buffer[DLOG_MAX_ENTRY];
+    dlog_record_t* rec = (dlog_record_t*)buffer;
+    uint num_cpus = arch_max_num_cpus();
     status_t r = ERR_BAD_STATE;
 
-    mutex_acquire(&log->lock);
-    if (rdr->tail != log->head) {
-        dlog_record_t* rec = REC(log->data, rdr->tail);
-        size_t copylen = rec->datalen + sizeof(dlog_record_t);
+    mutex_acquire(&rdr->lock);
+    for (;;) {
+        // The record with the lowest sequence number at the front of any
+        // ring is the oldest one left. A writer that took a sequence
+        // number but hasn't published its record yet can have it come out
+        // slightly out of order.
+        dlog_header_t hdr;
+        dlog_header_t oldest = {};
+        uint n = num_cpus;
+        for (uint i = 0; i < num_cpus; i++) {
+            if (dlog_peek(rdr, i, &hdr) && (n == num_cpus || hdr.seq < oldest.seq)) {
+                n = i;
+                oldest = hdr;
+            }
+        }
+        if (n == num_cpus) {
+            break;
+        }
+
+        dlog_cpu_t* cpu = &rdr->log->cpu[n];
+        uint64_t pos = rdr->pos[n];
+        memcpy(rec->data, HDR(cpu, pos) + 1, oldest.datalen);
+        if (!dlog_intact(cpu, pos)) {
+            // Overwritten while we were copying it.
+            continue;
+        }
+
+        size_t copylen = oldest.datalen + sizeof(dlog_record_t);
         if (copylen > len) {
             r = ERR_NOT_ENOUGH_BUFFER;
-        } else {
-            if (user) {
-                r = copy_to_user(ptr, rec, copylen);
-                if (r == NO_ERROR) {
-                    r = copylen;
-                }
-            } else {
-                memcpy(ptr, rec, copylen);
+            break;
+        }
+        rec->reserved = 0;
+        rec->datalen = oldest.datalen;
+        rec->flags = oldest.flags;
+        rec->timestamp = oldest.timestamp;
+        if (user) {
+            r = copy_to_user(ptr, rec, copylen);
+            if (r == NO_ERROR) {
                 r = copylen;
             }
-            rdr->tail = rec->next;
-            if (rdr->tail == log->head) {
-                // Nothing left to read, we're in the "empty" state now.
-                event_unsignal(&rdr->event);
-            }
+        } else {
+            memcpy(ptr, rec, copylen);
+            r = copylen;
         }
+        rdr->pos[n] = pos + oldest.size;
+        break;
     }
-    mutex_release(&log->lock);
+    mutex_release(&rdr->lock);
     return r;
 }
 
+static bool dlog_readable(dlog_reader_t* rdr) {
+    bool readable = false;
+
+    mutex_acquire(&rdr->lock);
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        if (rdr->pos[i] != __atomic_load_n(&rdr->log->cpu[i].head, __ATOMIC_ACQUIRE)) {
+            readable = true;
+            break;
+        }
+    }
+    mutex_release(&rdr->lock);
+    return readable;
+}
+
 void dlog_reader_init(dlog_reader_t* rdr) {
     dlog_t* log = &DLOG;
 
     rdr->log = log;
     event_init(&rdr->event, false, 0);
+    mutex_init(&rdr->lock);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        rdr->pos[i] = __atomic_load_n(&log->cpu[i].tail, __ATOMIC_RELAXED);
+    }
 
-    mutex_acquire(&log->lock);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&log->readers_lock, state);
     list_add_tail(&log->readers, &rdr->node);
-    rdr->tail = log->tail;
-    if (log->head != log->tail) {
-        event_signal(&rdr->event, false);
-    }
-    mutex_release(&log->lock);
+    spin_unlock_irqrestore(&log->readers_lock, state);
 }
 
 void dlog_reader_destroy(dlog_reader_t* rdr) {
     dlog_t* log = rdr->log;
 
-    mutex_acquire(&log->lock);
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&log->readers_lock, state);
     list_delete(&rdr->node);
+    spin_unlock_irqrestore(&log->readers_lock, state);
+
     event_destroy(&rdr->event);
-    mutex_release(&log->lock);
+    mutex_destroy(&rdr->lock);
 }
 
 void dlog_wait(dlog_reader_t* rdr) {
+    dlog_t* log = rdr->log;
+
+    event_unsignal(&rdr->event);
+    __atomic_store_n(&log->waiting, 1, __ATOMIC_RELAXED);
+    smp_mb();
+    if (dlog_readable(rdr)) {
+        return;
+    }
     event_wait(&rdr->event);
 }
 
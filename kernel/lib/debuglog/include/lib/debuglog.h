@@ -37,26 +37,28 @@ typedef struct dlog dlog_t;
 typedef struct dlog_record dlog_record_t;
 typedef struct dlog_reader dlog_reader_t;
 
-struct dlog {
-    mutex_t lock;
-
-    uint32_t size;
-    uint32_t head;
-    uint32_t tail;
-    void* data;
-
-    struct list_node readers;
-};
-
+// The log is a set of per-cpu rings. A writer only ever appends to the
+// ring of the cpu it is running on, with interrupts disabled, so writes
+// take no locks and may be made from any context, including interrupt
+// handlers and the scheduler. Every record is stamped with a global
+// sequence number and readers merge the rings back into sequence order.
+//
+// Each reader keeps its own position in every ring. A reader that falls
+// more than a ring behind loses the records that were overwritten.
 struct dlog_reader {
     struct list_node node;
     event_t event;
     dlog_t* log;
-    uint32_t tail;
+
+    // Serializes reads through this reader.
+    mutex_t lock;
+    uint64_t pos[SMP_MAX_CPUS];
 };
 
+// The layout of records as returned by dlog_read(); this matches
+// mx_log_record_t.
 struct dlog_record {
-    uint32_t next;
+    uint32_t reserved;
     uint16_t datalen;
     uint16_t flags;
     uint64_t timestamp;
@@ -75,4 +77,4 @@ static inline status_t dlog_read_user(dlog_reader_t* rdr, uint32_t flags, void*
 }
 void dlog_wait(dlog_reader_t* rdr);
 
-__END_CDECLS
\ No newline at end of file
+__END_CDECLS
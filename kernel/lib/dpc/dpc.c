@@ -8,29 +8,75 @@
 #include <assert.h>
 #include <err.h>
 #include <list.h>
+#include <stdio.h>
+#include <string.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/ticketlock.h>
 #include <lk/init.h>
+#include <platform.h>
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+
+struct dpc_stats {
+    uint64_t queued;
+    uint64_t executed;
+    uint64_t latency_total; // microseconds from dpc_queue() to the call
+    uint64_t latency_max;
+    uint depth;
+    uint depth_max;
+};
+
+// Each cpu has its own queue and worker thread, pinned to that cpu, so
+// that work deferred by an interrupt handler runs where the interrupt was
+// taken and cpus don't contend on a single list. Every queue is set up before
+// the secondary cpus are counted; a cpu's worker is created as it comes up,
+// and anything queued before then waits for it.
+struct dpc_queue {
+    ticket_spin_lock_t lock;
+    struct list_node list;
+    event_t event;
+    thread_t *thread;
+    struct dpc_stats stats; // protected by lock
+};
+
+static struct dpc_queue dpc_queues[SMP_MAX_CPUS];
+static bool dpc_ready;
+
+static void dpc_queue_locked(struct dpc_queue *q, dpc_t *dpc)
+{
+    dpc->queued_time = current_time_hires();
+
+    // put the dpc at the tail of the list and signal the worker
+    list_add_tail(&q->list, &dpc->node);
+    event_signal(&q->event, false);
 
-static spin_lock_t dpc_lock = SPIN_LOCK_INITIAL_VALUE;
-static struct list_node dpc_list = LIST_INITIAL_VALUE(dpc_list);
-static event_t dpc_event = EVENT_INITIAL_VALUE(dpc_event, false, 0);
+    q->stats.queued++;
+    if (++q->stats.depth > q->stats.depth_max)
+        q->stats.depth_max = q->stats.depth;
+}
 
 status_t dpc_queue(dpc_t *dpc, bool reschedule)
 {
     DEBUG_ASSERT(dpc);
     DEBUG_ASSERT(dpc->func);
+    DEBUG_ASSERT(dpc_ready);
 
+    // interrupts go off before picking the queue, so that we can't migrate
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&dpc_lock, state);
-
-    // put the dpc at the tail of the list and signal the worker
-    list_add_tail(&dpc_list, &dpc->node);
-    event_signal(&dpc_event, false);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-    spin_unlock_irqrestore(&dpc_lock, state);
+    struct dpc_queue *q = &dpc_queues[arch_curr_cpu_num()];
+    ticket_spin_lock(&q->lock);
+    dpc_queue_locked(q, dpc);
+    ticket_spin_unlock_irqrestore(&q->lock, state);
 
     // reschedule here if asked to
     if (reschedule)
@@ -39,24 +85,56 @@ status_t dpc_queue(dpc_t *dpc, bool reschedule)
     return NO_ERROR;
 }
 
+status_t dpc_queue_on(uint cpu, dpc_t *dpc, bool reschedule)
+{
+    DEBUG_ASSERT(dpc);
+    DEBUG_ASSERT(dpc->func);
+    DEBUG_ASSERT(dpc_ready);
+
+    if (cpu >= SMP_MAX_CPUS || !mp_is_cpu_online(cpu))
+        return ERR_INVALID_ARGS;
+
+    struct dpc_queue *q = &dpc_queues[cpu];
+
+    spin_lock_saved_state_t state;
+    ticket_spin_lock_irqsave(&q->lock, state);
+    dpc_queue_locked(q, dpc);
+    ticket_spin_unlock_irqrestore(&q->lock, state);
+
+    if (reschedule)
+        thread_yield();
+
+    return NO_ERROR;
+}
+
 static int dpc_thread(void *arg)
 {
+    struct dpc_queue *q = arg;
+
     for (;;) {
         // wait for a dpc to fire
-        __UNUSED status_t err = event_wait(&dpc_event);
+        __UNUSED status_t err = event_wait(&q->event);
         DEBUG_ASSERT(err == NO_ERROR);
 
         spin_lock_saved_state_t state;
-        spin_lock_irqsave(&dpc_lock, state);
+        ticket_spin_lock_irqsave(&q->lock, state);
 
         // pop a dpc off the list
-        dpc_t *dpc = list_remove_head_type(&dpc_list, dpc_t, node);
+        dpc_t *dpc = list_remove_head_type(&q->list, dpc_t, node);
 
         // if the list is now empty, unsignal the event so we block until it is
-        if (!dpc)
-            event_unsignal(&dpc_event);
-
-        spin_unlock_irqrestore(&dpc_lock, state);
+        if (!dpc) {
+            event_unsignal(&q->event);
+        } else {
+            uint64_t latency = current_time_hires() - dpc->queued_time;
+            q->stats.executed++;
+            q->stats.depth--;
+            q->stats.latency_total += latency;
+            if (latency > q->stats.latency_max)
+                q->stats.latency_max = latency;
+        }
+
+        ticket_spin_unlock_irqrestore(&q->lock, state);
 
         // call the dpc
         if (dpc && dpc->func)
@@ -67,10 +145,77 @@ static int dpc_thread(void *arg)
     return 0;
 }
 
-static void dpc_init(unsigned int level)
+// Starts the worker for the calling cpu.
+static void dpc_init_cpu(unsigned int level)
 {
-    thread_t *t = thread_create("dpc", &dpc_thread, NULL, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    uint cpu = arch_curr_cpu_num();
+    struct dpc_queue *q = &dpc_queues[cpu];
+    DEBUG_ASSERT(!q->thread);
+
+    char name[16];
+    snprintf(name, sizeof(name), "dpc %u", cpu);
+    thread_t *t = thread_create(name, &dpc_thread, q, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_set_pinned_cpu(t, (int)cpu);
+    q->thread = t;
     thread_detach_and_resume(t);
 }
 
+static void dpc_init(unsigned int level)
+{
+    // this runs before the platform knows how many cpus there are
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct dpc_queue *q = &dpc_queues[cpu];
+        ticket_spin_lock_init(&q->lock);
+        list_initialize(&q->list);
+        event_init(&q->event, false, 0);
+    }
+    dpc_ready = true;
+
+    dpc_init_cpu(level);
+}
+
 LK_INIT_HOOK(dpc, dpc_init, LK_INIT_LEVEL_THREADING);
+LK_INIT_HOOK_FLAGS(dpc_secondary, dpc_init_cpu, LK_INIT_LEVEL_THREADING, LK_INIT_FLAG_SECONDARY_CPUS);
+
+#if WITH_LIB_CONSOLE
+static int cmd_dpc(int argc, const cmd_args *argv)
+{
+    bool reset = (argc > 1 && !strcmp(argv[1].str, "reset"));
+    if (argc > 1 && !reset) {
+        printf("usage: %s [reset]: per cpu dpc queue statistics\n", argv[0].str);
+        return -1;
+    }
+
+    if (!reset) {
+        printf("%4s %10s %10s %6s %6s %12s %10s\n", "cpu", "queued", "executed", "depth",
+               "max", "avg lat us", "max lat us");
+    }
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct dpc_queue *q = &dpc_queues[cpu];
+        if (!q->thread)
+            continue;
+
+        spin_lock_saved_state_t state;
+        ticket_spin_lock_irqsave(&q->lock, state);
+        struct dpc_stats snapshot = q->stats;
+        if (reset) {
+            memset(&q->stats, 0, sizeof(q->stats));
+            q->stats.depth = q->stats.depth_max = snapshot.depth;
+        }
+        ticket_spin_unlock_irqrestore(&q->lock, state);
+
+        if (reset)
+            continue;
+        printf("%4u %10llu %10llu %6u %6u %12llu %10llu\n", cpu, snapshot.queued,
+               snapshot.executed, snapshot.depth, snapshot.depth_max,
+               snapshot.executed ? snapshot.latency_total / snapshot.executed : 0,
+               snapshot.latency_max);
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("dpc", "dpc queue statistics [reset]", &cmd_dpc)
+STATIC_COMMAND_END(dpc);
+#endif
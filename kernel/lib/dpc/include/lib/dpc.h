@@ -19,9 +19,18 @@ typedef struct dpc {
 
     dpc_func_t func;
     void *arg;
+
+    lk_bigtime_t queued_time; // set by dpc_queue(), for latency stats
 } dpc_t;
 
+// Queue a dpc on the current cpu's dpc thread. Safe to call from an
+// interrupt handler, in which case the dpc runs on the cpu that took the
+// interrupt.
 status_t dpc_queue(dpc_t *dpc, bool reschedule);
 
+// Queue a dpc on a specific cpu. Returns ERR_INVALID_ARGS if that cpu
+// isn't online.
+status_t dpc_queue_on(uint cpu, dpc_t *dpc, bool reschedule);
+
 __END_CDECLS
 
@@ -14,6 +14,8 @@
 #include <string.h>
 #include <err.h>
 #include <list.h>
+#include <arch/ops.h>
+#include <kernel/cmdline.h>
 #include <kernel/spinlock.h>
 #include <lib/console.h>
 #include <lib/page_alloc.h>
@@ -121,6 +123,169 @@ static inline void HEAP_TRIM(void) { dlmalloc_trim(0); }
 #error need to select valid heap implementation or provide wrapper
 #endif
 
+/* sampling allocation profiler */
+#define HEAP_PROFILE_LIVE 1024
+/* bounds the probe sequence in the live table, so that the lockless
+ * lookup in free stays cheap however full the table gets */
+#define HEAP_PROFILE_PROBES 32
+/* marks a live table slot whose allocation has been freed */
+#define HEAP_PROFILE_FREED ((void *)1)
+
+struct heap_profile_live {
+    void *ptr;
+    size_t size;
+    struct heap_profile_site *site;
+};
+
+static uint heap_profile_rate;
+static uint heap_profile_countdown[SMP_MAX_CPUS];
+static spin_lock_t heap_profile_lock = SPIN_LOCK_INITIAL_VALUE;
+static struct heap_profile_site heap_profile_sites[HEAP_PROFILE_MAX_SITES];
+static struct heap_profile_live heap_profile_live[HEAP_PROFILE_LIVE];
+static uint heap_profile_live_count;
+static ulong heap_profile_dropped;
+
+static inline size_t heap_profile_hash(const void *p)
+{
+    return (size_t)(((uintptr_t)p >> 4) * 2654435761u);
+}
+
+static inline bool heap_profile_should_sample(void)
+{
+    uint rate = heap_profile_rate;
+    if (likely(rate == 0))
+        return false;
+
+    /* per cpu and unlocked; a preemption in here at worst shifts a
+     * sample by one allocation */
+    uint *countdown = &heap_profile_countdown[arch_curr_cpu_num()];
+    if (*countdown > 1) {
+        (*countdown)--;
+        return false;
+    }
+    *countdown = rate;
+    return true;
+}
+
+static struct heap_profile_site *heap_profile_site_locked(void *caller)
+{
+    size_t h = heap_profile_hash(caller);
+    for (size_t i = 0; i < HEAP_PROFILE_MAX_SITES; i++) {
+        struct heap_profile_site *site = &heap_profile_sites[(h + i) % HEAP_PROFILE_MAX_SITES];
+        if (site->caller == caller)
+            return site;
+        if (!site->caller) {
+            site->caller = caller;
+            return site;
+        }
+    }
+    return NULL;
+}
+
+static void heap_profile_alloc(void *ptr, size_t size, void *caller)
+{
+    if (!ptr)
+        return;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&heap_profile_lock, state);
+
+    struct heap_profile_site *site = heap_profile_site_locked(caller);
+    struct heap_profile_live *slot = NULL;
+    if (site) {
+        size_t h = heap_profile_hash(ptr);
+        for (size_t i = 0; i < HEAP_PROFILE_PROBES; i++) {
+            struct heap_profile_live *s = &heap_profile_live[(h + i) % HEAP_PROFILE_LIVE];
+            if (!s->ptr || s->ptr == HEAP_PROFILE_FREED) {
+                slot = s;
+                break;
+            }
+        }
+    }
+
+    if (slot) {
+        site->allocs++;
+        site->alloc_bytes += size;
+        site->live++;
+        site->live_bytes += size;
+        slot->size = size;
+        slot->site = site;
+        __atomic_store_n(&slot->ptr, ptr, __ATOMIC_RELEASE);
+        heap_profile_live_count++;
+    } else {
+        heap_profile_dropped++;
+    }
+
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+}
+
+static void heap_profile_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    /* find the slot without the lock, then confirm under it */
+    size_t h = heap_profile_hash(ptr);
+    for (size_t i = 0; i < HEAP_PROFILE_PROBES; i++) {
+        struct heap_profile_live *slot = &heap_profile_live[(h + i) % HEAP_PROFILE_LIVE];
+        void *p = __atomic_load_n(&slot->ptr, __ATOMIC_ACQUIRE);
+        if (!p)
+            return;
+        if (p != ptr)
+            continue;
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&heap_profile_lock, state);
+        if (slot->ptr == ptr) {
+            slot->site->live--;
+            slot->site->live_bytes -= slot->size;
+            __atomic_store_n(&slot->ptr, HEAP_PROFILE_FREED, __ATOMIC_RELAXED);
+            heap_profile_live_count--;
+        }
+        spin_unlock_irqrestore(&heap_profile_lock, state);
+        return;
+    }
+}
+
+void heap_profile_reset(void)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&heap_profile_lock, state);
+    memset(heap_profile_sites, 0, sizeof(heap_profile_sites));
+    memset(heap_profile_live, 0, sizeof(heap_profile_live));
+    heap_profile_live_count = 0;
+    heap_profile_dropped = 0;
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+}
+
+void heap_profile_set_rate(uint rate)
+{
+    heap_profile_rate = 0;
+    heap_profile_reset();
+    memset(heap_profile_countdown, 0, sizeof(heap_profile_countdown));
+    heap_profile_rate = rate;
+}
+
+uint heap_profile_get_rate(void)
+{
+    return heap_profile_rate;
+}
+
+size_t heap_profile_read(struct heap_profile_site *sites, size_t count)
+{
+    size_t n = 0;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&heap_profile_lock, state);
+    for (size_t i = 0; i < HEAP_PROFILE_MAX_SITES && n < count; i++) {
+        if (heap_profile_sites[i].caller)
+            sites[n++] = heap_profile_sites[i];
+    }
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+
+    return n;
+}
+
 static void heap_free_delayed_list(void)
 {
     struct list_node list;
@@ -145,6 +310,10 @@ static void heap_free_delayed_list(void)
 void heap_init(void)
 {
     HEAP_INIT();
+
+    const char *rate = cmdline_get("heap.profile");
+    if (rate)
+        heap_profile_set_rate((uint)atoi(rate));
 }
 
 void heap_trim(void)
@@ -157,7 +326,7 @@ void heap_trim(void)
     HEAP_TRIM();
 }
 
-void *malloc(size_t size)
+void *malloc_debug_caller(size_t size, void *caller)
 {
     LTRACEF("size %zd\n", size);
 
@@ -168,10 +337,17 @@ void *malloc(size_t size)
 
     void *ptr = HEAP_MALLOC(size);
     if (heap_trace)
-        printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
+        printf("caller %p malloc %zu -> %p\n", caller, size, ptr);
+    if (unlikely(heap_profile_should_sample()))
+        heap_profile_alloc(ptr, size, caller);
     return ptr;
 }
 
+void *malloc(size_t size)
+{
+    return malloc_debug_caller(size, __GET_CALLER());
+}
+
 void *memalign(size_t boundary, size_t size)
 {
     LTRACEF("boundary %zu, size %zd\n", boundary, size);
@@ -184,6 +360,8 @@ void *memalign(size_t boundary, size_t size)
     void *ptr = HEAP_MEMALIGN(boundary, size);
     if (heap_trace)
         printf("caller %p memalign %zu, %zu -> %p\n", __GET_CALLER(), boundary, size, ptr);
+    if (unlikely(heap_profile_should_sample()))
+        heap_profile_alloc(ptr, size, __GET_CALLER());
     return ptr;
 }
 
@@ -199,6 +377,8 @@ void *calloc(size_t count, size_t size)
     void *ptr = HEAP_CALLOC(count, size);
     if (heap_trace)
         printf("caller %p calloc %zu, %zu -> %p\n", __GET_CALLER(), count, size, ptr);
+    if (unlikely(heap_profile_should_sample()))
+        heap_profile_alloc(ptr, count * size, __GET_CALLER());
     return ptr;
 }
 
@@ -214,6 +394,11 @@ void *realloc(void *ptr, size_t size)
     void *ptr2 = HEAP_REALLOC(ptr, size);
     if (heap_trace)
         printf("caller %p realloc %p, %zu -> %p\n", __GET_CALLER(), ptr, size, ptr2);
+    /* a successful realloc counts as a free and a fresh allocation */
+    if (unlikely(heap_profile_live_count) && (ptr2 || size == 0))
+        heap_profile_free(ptr);
+    if (unlikely(heap_profile_should_sample()))
+        heap_profile_alloc(ptr2, size, __GET_CALLER());
     return ptr2;
 }
 
@@ -222,6 +407,8 @@ void free(void *ptr)
     LTRACEF("ptr %p\n", ptr);
     if (heap_trace)
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
+    if (unlikely(heap_profile_live_count))
+        heap_profile_free(ptr);
 
     HEAP_FREE(ptr);
 }
@@ -231,6 +418,9 @@ void heap_delayed_free(void *ptr)
 {
     LTRACEF("ptr %p\n", ptr);
 
+    if (unlikely(heap_profile_live_count))
+        heap_profile_free(ptr);
+
     /* throw down a structure on the free block */
     /* XXX assumes the free block is large enough to hold a list node */
     struct list_node *node = (struct list_node *)ptr;
@@ -317,12 +507,6 @@ static void heap_test(void)
 
 #include <lib/console.h>
 
-static int cmd_heap(int argc, const cmd_args *argv);
-
-STATIC_COMMAND_START
-STATIC_COMMAND("heap", "heap debug commands", &cmd_heap)
-STATIC_COMMAND_END(heap);
-
 static int cmd_heap(int argc, const cmd_args *argv)
 {
     if (argc < 2) {
@@ -373,4 +557,65 @@ usage:
 #endif
 #endif
 
+#if WITH_LIB_CONSOLE
+
+static int cmd_heapprof(int argc, const cmd_args *argv)
+{
+    if (argc >= 2 && strcmp(argv[1].str, "rate") == 0) {
+        if (argc < 3) {
+            printf("sample rate is %u\n", heap_profile_get_rate());
+            return 0;
+        }
+        heap_profile_set_rate((uint)argv[2].u);
+        return 0;
+    } else if (argc >= 2 && strcmp(argv[1].str, "reset") == 0) {
+        heap_profile_reset();
+        return 0;
+    } else if (argc >= 2) {
+        printf("usage:\n");
+        printf("\t%s                 : live bytes by call site\n", argv[0].str);
+        printf("\t%s rate [samples]  : sample 1 in every <samples> allocations, 0 is off\n",
+               argv[0].str);
+        printf("\t%s reset\n", argv[0].str);
+        return -1;
+    }
+
+    static struct heap_profile_site sites[HEAP_PROFILE_MAX_SITES];
+    size_t count = heap_profile_read(sites, countof(sites));
+    uint rate = heap_profile_get_rate();
+    if (rate == 0) {
+        printf("heap profiling is off\n");
+        if (count == 0)
+            return 0;
+        rate = 1;
+    }
+
+    /* sort by live bytes, largest first */
+    for (size_t i = 1; i < count; i++) {
+        struct heap_profile_site tmp = sites[i];
+        size_t j = i;
+        for (; j > 0 && sites[j - 1].live_bytes < tmp.live_bytes; j--)
+            sites[j] = sites[j - 1];
+        sites[j] = tmp;
+    }
+
+    printf("estimates from 1 in %u allocations, %lu samples dropped\n",
+           rate, heap_profile_dropped);
+    printf("%-18s %12s %10s %12s %10s\n", "caller", "live bytes", "live", "total bytes", "allocs");
+    for (size_t i = 0; i < count; i++) {
+        printf("%18p %12llu %10llu %12llu %10llu\n", sites[i].caller,
+               sites[i].live_bytes * rate, sites[i].live * rate,
+               sites[i].alloc_bytes * rate, sites[i].allocs * rate);
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+#if LK_DEBUGLEVEL > 1
+STATIC_COMMAND("heap", "heap debug commands", &cmd_heap)
+#endif
+STATIC_COMMAND("heapprof", "sampling heap profiler", &cmd_heapprof)
+STATIC_COMMAND_END(heap);
 
+#endif
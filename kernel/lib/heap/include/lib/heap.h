@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <compiler.h>
 
@@ -20,6 +21,10 @@ void *calloc(size_t count, size_t size) __MALLOC;
 void *realloc(void *ptr, size_t size) __MALLOC;
 void free(void *ptr);
 
+/* malloc() on behalf of another caller, for wrappers such as operator new
+ * that want allocations attributed to their own caller */
+void *malloc_debug_caller(size_t size, void *caller) __MALLOC;
+
 void heap_init(void);
 
 /* critical section time delayed free */
@@ -28,4 +33,30 @@ void heap_delayed_free(void *);
 /* tell the heap to return any free pages it can find */
 void heap_trim(void);
 
+/* sampling allocation profiler
+ *
+ * When the sample rate is non-zero, one in every rate allocations is
+ * recorded against the pc of its caller, and frees of sampled allocations
+ * are subtracted again, so each call site's live count and bytes track
+ * what it currently holds. The counts are in samples; multiply by the
+ * rate for an estimate of the real totals. The rate starts out as the
+ * heap.profile=<rate> kernel command line option, or 0 (off). */
+#define HEAP_PROFILE_MAX_SITES 256
+
+struct heap_profile_site {
+    void *caller;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    uint64_t live;
+    uint64_t live_bytes;
+};
+
+/* changing the rate also resets the profile */
+void heap_profile_set_rate(uint rate);
+uint heap_profile_get_rate(void);
+void heap_profile_reset(void);
+
+/* copies out up to count call sites, returns the number copied */
+size_t heap_profile_read(struct heap_profile_site *sites, size_t count);
+
 __END_CDECLS;
@@ -50,13 +50,13 @@ bool AllocChecker::check() {
 }
 
 void *operator new(size_t s, AllocChecker* ac) {
-    auto mem = malloc(s);
+    auto mem = malloc_debug_caller(s, __GET_CALLER());
     ac->arm(s, mem != nullptr);
     return mem;
 }
 
 void *operator new[](size_t s, AllocChecker* ac) {
-    auto mem = malloc(s);
+    auto mem = malloc_debug_caller(s, __GET_CALLER());
     ac->arm(s, mem != nullptr);
     return mem;
 }
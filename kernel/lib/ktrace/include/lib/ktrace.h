@@ -0,0 +1,68 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <compiler.h>
+#include <magenta/ktrace.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Kernel event tracing.
+//
+// Probes append fixed-size records to a per-cpu ring in a VM object that
+// user mode can map read-only (see magenta/ktrace.h for the layout). The
+// buffer is only allocated the first time tracing is started.
+//
+// Each group of events can be compiled out by leaving it out of
+// KTRACE_COMPILE_GRPS, and the groups that are compiled in are switched
+// on and off at runtime by ktrace_grpmask. A probe for a group that is
+// compiled in but switched off costs one load and one not-taken branch.
+
+#ifndef KTRACE_COMPILE_GRPS
+#define KTRACE_COMPILE_GRPS MX_KTRACE_GRP_ALL
+#endif
+
+__BEGIN_CDECLS
+
+extern uint32_t ktrace_grpmask;
+
+void ktrace_write(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+
+// Records an event if its group is being traced. |tag| should be a
+// constant so that the group test folds.
+static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    if ((KTRACE_COMPILE_GRPS & MX_KTRACE_GROUP(tag)) &&
+        unlikely(ktrace_grpmask & MX_KTRACE_GROUP(tag))) {
+        ktrace_write(tag, a, b, c, d);
+    }
+}
+
+static inline void ktrace_ptr(uint32_t tag, uint64_t ptr, uint32_t c, uint32_t d) {
+    ktrace(tag, (uint32_t)ptr, (uint32_t)(ptr >> 32), c, d);
+}
+
+struct thread;
+
+// The id that records use for thread |t|.
+static inline uint32_t ktrace_thread_id(const struct thread* t) {
+    return (uint32_t)(uintptr_t)t;
+}
+
+// Records the name of thread |t| if thread names are being traced.
+void ktrace_thread_name(struct thread* t);
+
+status_t ktrace_control(uint32_t action, uint32_t options);
+
+__END_CDECLS
+
+#ifdef __cplusplus
+#include <kernel/vm/vm_object.h>
+#include <utils/ref_ptr.h>
+
+// The trace buffer, or null if tracing has never been started.
+utils::RefPtr<VmObject> ktrace_get_vmo();
+#endif
@@ -0,0 +1,256 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/ktrace.h>
+
+#include <arch/ops.h>
+#include <err.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
+#include <lib/console.h>
+#include <lk/init.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if ARCH_X86
+#include <arch/x86.h>
+#endif
+
+// Default ring size per cpu, in KB; ktrace.bufsize overrides it.
+#define KTRACE_DEFAULT_BUFSIZE 256
+
+uint32_t ktrace_grpmask;
+
+namespace {
+
+mutex_t ktrace_lock = MUTEX_INITIAL_VALUE(ktrace_lock);
+
+// Set up by the first start and never torn down, so a probe that saw a
+// nonzero ktrace_grpmask can always write. User mode can see the buffer, so
+// the layout is kept here rather than read back from ktrace_info.
+utils::RefPtr<VmObject> ktrace_vmo;
+mx_ktrace_info_t* ktrace_info;
+mx_ktrace_record_t* ktrace_rings;
+uint64_t ktrace_records_per_cpu;
+uint ktrace_num_cpus;
+
+inline uint64_t ktrace_timestamp() {
+#if ARCH_X86
+    return rdtsc();
+#else
+    return current_time_hires();
+#endif
+}
+
+inline uint64_t ktrace_ticks_to_ns_mult() {
+#if ARCH_X86
+    return platform_user_ticks_to_ns_mult();
+#else
+    return 1000ULL << 32;
+#endif
+}
+
+status_t ktrace_alloc_locked() {
+    DEBUG_ASSERT(is_mutex_held(&ktrace_lock));
+
+    if (ktrace_vmo)
+        return NO_ERROR;
+
+    const char* bufsize = cmdline_get("ktrace.bufsize");
+    uint64_t kb = bufsize ? strtoul(bufsize, nullptr, 0) : KTRACE_DEFAULT_BUFSIZE;
+    uint64_t records = (kb * 1024) / sizeof(mx_ktrace_record_t);
+    if (records < PAGE_SIZE / sizeof(mx_ktrace_record_t))
+        records = PAGE_SIZE / sizeof(mx_ktrace_record_t);
+    // Round down to a power of two so that slots are found with a mask.
+    records = 1ULL << (63 - __builtin_clzll(records));
+
+    uint num_cpus = arch_max_num_cpus();
+    static_assert(sizeof(mx_ktrace_info_t) + SMP_MAX_CPUS * sizeof(mx_ktrace_cpu_t) <=
+                      MX_KTRACE_RING_OFFSET,
+                  "ktrace info doesn't fit in its page");
+    size_t size = static_cast<size_t>(MX_KTRACE_RING_OFFSET +
+                                      num_cpus * records * sizeof(mx_ktrace_record_t));
+
+    auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, size);
+    if (!vmo)
+        return ERR_NO_MEMORY;
+
+    void* ptr;
+    status_t status = VmAspace::kernel_aspace()->MapObject(
+        vmo, "ktrace", 0, size, &ptr, 0, VMM_FLAG_COMMIT, ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (status < 0)
+        return status;
+
+    ktrace_info = static_cast<mx_ktrace_info_t*>(ptr);
+    ktrace_info->version = MX_KTRACE_VERSION;
+    ktrace_info->num_cpus = num_cpus;
+    ktrace_info->records_per_cpu = records;
+    ktrace_info->ticks_to_ns_mult = ktrace_ticks_to_ns_mult();
+    ktrace_rings = reinterpret_cast<mx_ktrace_record_t*>(
+        static_cast<uint8_t*>(ptr) + MX_KTRACE_RING_OFFSET);
+    ktrace_records_per_cpu = records;
+    ktrace_num_cpus = num_cpus;
+    ktrace_vmo = utils::move(vmo);
+    return NO_ERROR;
+}
+
+void ktrace_append(uint32_t tag, uint32_t tid, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Interrupts are off, so nothing else can write to this cpu's ring
+    // until we are done.
+    uint cpu = arch_curr_cpu_num();
+    if (unlikely(cpu >= ktrace_num_cpus)) {
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return;
+    }
+    mx_ktrace_cpu_t* ring = &ktrace_info->cpu[cpu];
+    uint64_t head = ring->head;
+
+    mx_ktrace_record_t* rec =
+        &ktrace_rings[cpu * ktrace_records_per_cpu + (head & (ktrace_records_per_cpu - 1))];
+    rec->tag = tag;
+    rec->tid = tid;
+    rec->ts = ktrace_timestamp();
+    rec->a = a;
+    rec->b = b;
+    rec->c = c;
+    rec->d = d;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void ktrace_name_cb(thread_t* t, void* arg) {
+    ktrace_thread_name(t);
+}
+
+} // namespace
+
+void ktrace_write(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    ktrace_append(tag, ktrace_thread_id(get_current_thread()), a, b, c, d);
+}
+
+void ktrace_thread_name(thread_t* t) {
+    if (!((KTRACE_COMPILE_GRPS & MX_KTRACE_GRP_META) &&
+          unlikely(ktrace_grpmask & MX_KTRACE_GRP_META)))
+        return;
+
+    uint32_t name[4] = {};
+    memcpy(name, t->name, MIN(sizeof(name), sizeof(t->name)));
+    ktrace_append(MX_KTRACE_THREAD_NAME, ktrace_thread_id(t), name[0], name[1], name[2], name[3]);
+}
+
+status_t ktrace_control(uint32_t action, uint32_t options) {
+    AutoLock lock(&ktrace_lock);
+
+    switch (action) {
+    case MX_KTRACE_ACTION_START: {
+        uint32_t grpmask = options & KTRACE_COMPILE_GRPS;
+        if (!grpmask)
+            return ERR_INVALID_ARGS;
+        status_t status = ktrace_alloc_locked();
+        if (status < 0)
+            return status;
+        ktrace_info->grpmask = grpmask;
+        __atomic_store_n(&ktrace_grpmask, grpmask, __ATOMIC_RELEASE);
+        // Name every thread that already exists; new ones are named as
+        // they are created.
+        thread_for_every(ktrace_name_cb, nullptr);
+        return NO_ERROR;
+    }
+    case MX_KTRACE_ACTION_STOP:
+        __atomic_store_n(&ktrace_grpmask, 0u, __ATOMIC_RELEASE);
+        if (ktrace_info)
+            ktrace_info->grpmask = 0;
+        return NO_ERROR;
+    case MX_KTRACE_ACTION_REWIND:
+        // A probe that raced with the stop may still be writing, so this
+        // can leave a stray record behind; that's all it can do.
+        if (__atomic_load_n(&ktrace_grpmask, __ATOMIC_RELAXED))
+            return ERR_BAD_STATE;
+        if (ktrace_info) {
+            for (uint i = 0; i < ktrace_num_cpus; i++)
+                __atomic_store_n(&ktrace_info->cpu[i].head, 0ULL, __ATOMIC_RELAXED);
+        }
+        return NO_ERROR;
+    default:
+        return ERR_INVALID_ARGS;
+    }
+}
+
+utils::RefPtr<VmObject> ktrace_get_vmo() {
+    AutoLock lock(&ktrace_lock);
+    return ktrace_vmo;
+}
+
+static void ktrace_init(uint level) {
+    // ktrace.grpmask=<mask> starts tracing at boot.
+    const char* grpmask = cmdline_get("ktrace.grpmask");
+    if (grpmask) {
+        uint32_t mask = static_cast<uint32_t>(strtoul(grpmask, nullptr, 0));
+        if (mask && ktrace_control(MX_KTRACE_ACTION_START, mask) < 0)
+            printf("ktrace: failed to start\n");
+    }
+}
+
+LK_INIT_HOOK(ktrace, ktrace_init, LK_INIT_LEVEL_APPS - 1);
+
+#if WITH_LIB_CONSOLE
+static int cmd_ktrace(int argc, const cmd_args* argv) {
+    if (argc < 2) {
+    usage:
+        printf("usage:\n");
+        printf("%s start <grpmask>\n", argv[0].str);
+        printf("%s stop\n", argv[0].str);
+        printf("%s rewind\n", argv[0].str);
+        printf("%s status\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    status_t status;
+    if (!strcmp(argv[1].str, "start")) {
+        if (argc < 3)
+            goto usage;
+        status = ktrace_control(MX_KTRACE_ACTION_START, static_cast<uint32_t>(argv[2].u));
+    } else if (!strcmp(argv[1].str, "stop")) {
+        status = ktrace_control(MX_KTRACE_ACTION_STOP, 0);
+    } else if (!strcmp(argv[1].str, "rewind")) {
+        status = ktrace_control(MX_KTRACE_ACTION_REWIND, 0);
+    } else if (!strcmp(argv[1].str, "status")) {
+        AutoLock lock(&ktrace_lock);
+        if (!ktrace_info) {
+            printf("ktrace: never started\n");
+            return 0;
+        }
+        printf("ktrace: grpmask %#x, %llu records per cpu\n", ktrace_grpmask,
+               ktrace_records_per_cpu);
+        for (uint i = 0; i < ktrace_num_cpus; i++)
+            printf("\tcpu %u: %llu records written\n", i, ktrace_info->cpu[i].head);
+        return 0;
+    } else {
+        goto usage;
+    }
+
+    if (status < 0)
+        printf("ktrace: error %d\n", status);
+    return status;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("ktrace", "kernel event tracing", &cmd_ktrace)
+STATIC_COMMAND_END(ktrace);
+#endif
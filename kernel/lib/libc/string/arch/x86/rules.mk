@@ -7,12 +7,14 @@
 
 LOCAL_DIR := $(GET_LOCAL_DIR)
 
-ASM_STRING_OPS := #bcopy bzero memcpy memmove memset
+ifeq ($(SUBARCH),x86-64)
+
+ASM_STRING_OPS := memcpy memset
 
 MODULE_SRCS += \
-	#$(LOCAL_DIR)/memcpy.S \
-	#$(LOCAL_DIR)/memset.S
+	$(LOCAL_DIR)/x86-64/memcpy.S \
+	$(LOCAL_DIR)/x86-64/memset.S
 
 # filter out the C implementation
 C_STRING_OPS := $(filter-out $(ASM_STRING_OPS),$(C_STRING_OPS))
-
+endif
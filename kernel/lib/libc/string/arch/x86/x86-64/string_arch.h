@@ -0,0 +1,12 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+/* Copies and fills at least this big bypass the cache with non-temporal
+ * stores. Below it the destination is likely to be read again soon and
+ * fits comfortably in the last level cache. */
+#define STRING_NT_THRESHOLD (1024 * 1024)
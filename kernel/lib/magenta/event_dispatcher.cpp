@@ -14,6 +14,8 @@
 
 #include <magenta/state_tracker.h>
 
+DEFINE_SLAB_ALLOCATED(EventDispatcher, "event_dispatcher");
+
 constexpr mx_rights_t kDefaultEventRights =
     MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE;
 
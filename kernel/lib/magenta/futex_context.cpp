@@ -8,6 +8,7 @@
 #include <kernel/auto_lock.h>
 #include <lib/user_copy.h>
 #include <magenta/futex_context.h>
+#include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
 #include <trace.h>
@@ -44,10 +45,15 @@ status_t FutexContext::FutexWait(int* value_ptr, int current_value, mx_time_t ti
     if (result != NO_ERROR) return result;
     if (value != current_value) return ERR_BUSY;
 
+    // Ordinary and priority inheritance waiters can't share a futex.
+    FutexNode* head = futex_table_.find(futex_key);
+    if (head && head->pi_owner()) return ERR_INVALID_ARGS;
+
     node = UserThread::GetCurrent()->futex_node();
     node->set_hash_key(futex_key);
     node->set_next(nullptr);
     node->set_tail(node);
+    node->set_pi_waiter(nullptr, 0, nullptr);
 
     QueueNodesLocked(node);
 
@@ -58,39 +64,10 @@ status_t FutexContext::FutexWait(int* value_ptr, int current_value, mx_time_t ti
         return NO_ERROR;
     }
     // If we got a timeout, we need to remove the thread's node from the
-    // wait queue, since FutexWake() didn't do that.  We need to re-get the
-    // hash table key, because it might have changed if the thread was
-    // requeued by FutexRequeue().
-    futex_key = node->GetKey();
-    FutexNode* list_head = futex_table_.find(futex_key);
-    FutexNode* test = list_head;
-    FutexNode* prev = nullptr;
-    while (test) {
-        DEBUG_ASSERT(test->GetKey() == futex_key);
-        FutexNode* next = test->next();
-        if (test == node) {
-            if (prev) {
-                // unlink from linked list
-                prev->set_next(next);
-                if (!next) {
-                    // We have removed the last element, so we need to
-                    // update the tail pointer.
-                    list_head->set_tail(prev);
-                }
-            } else {
-                // reset head of futex
-                futex_table_.erase(futex_key);
-                if (next) {
-                    next->set_tail(list_head->tail());
-                    DEBUG_ASSERT(next->GetKey() == futex_key);
-                    futex_table_.insert(next);
-                }
-            }
-            return ERR_TIMED_OUT;
-        }
-        prev = test;
-        test = next;
-    }
+    // wait queue, since FutexWake() didn't do that.
+    if (UnqueueNodeLocked(node))
+        return ERR_TIMED_OUT;
+
     // The current thread was not found on the wait queue.  This means
     // that, although we got a timeout, we were *also* woken by FutexWake()
     // (which removed the thread from the wait queue) -- the two raced
@@ -123,11 +100,14 @@ status_t FutexContext::FutexWake(int* value_ptr, uint32_t count) {
     {
         AutoLock lock(lock_);
 
-        FutexNode* node = futex_table_.erase(futex_key);
+        FutexNode* node = futex_table_.find(futex_key);
         if (!node) {
             // nothing blocked on this futex if we can't find it
             return NO_ERROR;
         }
+        // PI waiters are only ever woken by handing them the futex.
+        if (node->pi_owner()) return ERR_INVALID_ARGS;
+        futex_table_.erase(futex_key);
         DEBUG_ASSERT(node->GetKey() == futex_key);
 
         FutexNode* wake_head = node;
@@ -167,14 +147,19 @@ status_t FutexContext::FutexRequeue(int* wake_ptr, uint32_t wake_count, int curr
     uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr);
     if (wake_key == requeue_key) return ERR_INVALID_ARGS;
 
+    FutexNode* requeue_head = futex_table_.find(requeue_key);
+    if (requeue_head && requeue_head->pi_owner()) return ERR_INVALID_ARGS;
+
     // This must happen before RemoveFromHead() calls set_hash_key() on
     // nodes below, because operations on futex_table_ look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = futex_table_.find(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return NO_ERROR;
     }
+    if (node->pi_owner()) return ERR_INVALID_ARGS;
+    futex_table_.erase(wake_key);
 
     FutexNode* wake_head;
     if (wake_count == 0) {
@@ -207,6 +192,221 @@ status_t FutexContext::FutexRequeue(int* wake_ptr, uint32_t wake_count, int curr
     return NO_ERROR;
 }
 
+status_t FutexContext::FutexLockPi(int* value_ptr, int current_value, mx_time_t timeout) {
+    LTRACE_ENTRY;
+
+    uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr);
+    UserThread* current = UserThread::GetCurrent();
+
+    // As with FutexWait(), checking the value and queueing must be atomic
+    // with respect to FutexUnlockPi().  Userspace only changes the value of a
+    // futex with MX_FUTEX_PI_WAITERS set by setting that bit again, so the
+    // owner and waiter bit seen here stay valid until we are queued.
+    AutoLock lock(lock_);
+    int value;
+    status_t result = magenta_copy_from_user(value_ptr, &value, sizeof(value));
+    if (result != NO_ERROR) return result;
+    if (value != current_value) return ERR_BUSY;
+
+    int owner_tid = value & MX_FUTEX_PI_TID_MASK;
+    if (!(value & MX_FUTEX_PI_WAITERS) || owner_tid == 0) return ERR_INVALID_ARGS;
+    if (owner_tid == current->futex_tid()) return ERR_BAD_STATE;
+
+    auto owner = current->process()->LookupThreadByFutexTid(owner_tid);
+    if (owner && owner->pi_exited()) owner.reset();
+
+    // The waiters already queued must be PI waiters for the same owner.
+    FutexNode* head = futex_table_.find(futex_key);
+    if (head && head->pi_owner() != owner.get()) return ERR_INVALID_ARGS;
+
+    if (!owner) {
+        // The owner exited without unlocking while nobody was waiting, so
+        // there is no one else to hand the futex to.
+        if (copy_to_user_32(value_ptr, current->futex_tid() | MX_FUTEX_PI_OWNER_DIED) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        return NO_ERROR;
+    }
+
+    FutexNode* node = current->futex_node();
+    node->set_hash_key(futex_key);
+    node->set_next(nullptr);
+    node->set_tail(node);
+    node->set_pi_waiter(current, current->priority(), owner.get());
+
+    // PI waiters are kept in priority order so that FutexUnlockPi() hands
+    // the futex to the most important one.
+    if (head) {
+        futex_table_.erase(futex_key);
+        UnlinkPiHeadLocked(head);
+        head = head->InsertByPriority(node);
+    } else {
+        head = node;
+    }
+    futex_table_.insert(head);
+    LinkPiHeadLocked(head);
+
+    UpdatePiOwnerLocked(owner.get());
+
+    result = node->BlockThread(&lock_, timeout);
+    if (result == NO_ERROR) {
+        // FutexUnlockPi() dequeued us and made us the owner.
+        return NO_ERROR;
+    }
+
+    // The owner may have changed while we were blocked, in which case
+    // HandOffPiLocked() updated our node.
+    UserThread* owner_now = node->pi_owner();
+    if (!UnqueueNodeLocked(node)) {
+        // Raced with FutexUnlockPi(), which already handed us the futex.
+        return NO_ERROR;
+    }
+    UpdatePiOwnerLocked(owner_now);
+    return ERR_TIMED_OUT;
+}
+
+status_t FutexContext::FutexUnlockPi(int* value_ptr) {
+    LTRACE_ENTRY;
+
+    uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr);
+    UserThread* current = UserThread::GetCurrent();
+
+    AutoLock lock(lock_);
+    int value;
+    status_t result = magenta_copy_from_user(value_ptr, &value, sizeof(value));
+    if (result != NO_ERROR) return result;
+    if ((value & MX_FUTEX_PI_TID_MASK) != current->futex_tid()) return ERR_BAD_STATE;
+
+    FutexNode* head = futex_table_.find(futex_key);
+    if (head && head->pi_owner() != current) return ERR_BAD_STATE;
+
+    // The highest priority waiter becomes the owner.  Anyone left behind it
+    // keeps the waiters bit set so that the next unlock comes back here.
+    // Userspace holds off on modifying the value while the waiters bit is
+    // set, so a plain store is sufficient.
+    int new_value = 0;
+    if (head) {
+        new_value = head->waiter()->futex_tid();
+        if (head->next())
+            new_value |= MX_FUTEX_PI_WAITERS;
+    }
+    if (copy_to_user_32(value_ptr, new_value) != NO_ERROR) return ERR_INVALID_ARGS;
+
+    if (head)
+        HandOffPiLocked(head);
+
+    // We may still own other PI futexes with waiters.
+    UpdatePiOwnerLocked(current);
+    return NO_ERROR;
+}
+
+void FutexContext::OnThreadExit(UserThread* thread) {
+    LTRACE_ENTRY;
+
+    AutoLock lock(lock_);
+
+    // From here on FutexLockPi() treats futexes naming us as ownerless.
+    thread->set_pi_exited();
+
+    while (FutexNode* head = thread->pi_futexes()) {
+        int new_value = head->waiter()->futex_tid() | MX_FUTEX_PI_OWNER_DIED;
+        if (head->next())
+            new_value |= MX_FUTEX_PI_WAITERS;
+        // If the futex can't be written any more the address space is going
+        // away with the process, but the waiters still have to be released.
+        copy_to_user_32(reinterpret_cast<int*>(head->GetKey()), new_value);
+        HandOffPiLocked(head);
+    }
+}
+
+void FutexContext::HandOffPiLocked(FutexNode* head) {
+    uintptr_t futex_key = head->GetKey();
+    UserThread* new_owner = head->waiter();
+
+    futex_table_.erase(futex_key);
+    UnlinkPiHeadLocked(head);
+    FutexNode* node = head->RemoveFromHead(1u, futex_key, 0u);
+    if (node) {
+        for (FutexNode* n = node; n; n = n->next())
+            n->set_pi_owner(new_owner);
+        futex_table_.insert(node);
+        LinkPiHeadLocked(node);
+    }
+    UpdatePiOwnerLocked(new_owner);
+
+    FutexNode::WakeThreads(head);
+}
+
+void FutexContext::LinkPiHeadLocked(FutexNode* head) {
+    UserThread* owner = head->pi_owner();
+    FutexNode* first = owner->pi_futexes();
+    head->set_pi_links(nullptr, first);
+    if (first)
+        first->set_pi_links(head, first->pi_next());
+    owner->set_pi_futexes(head);
+}
+
+void FutexContext::UnlinkPiHeadLocked(FutexNode* head) {
+    FutexNode* prev = head->pi_prev();
+    FutexNode* next = head->pi_next();
+    if (prev)
+        prev->set_pi_links(prev->pi_prev(), next);
+    else
+        head->pi_owner()->set_pi_futexes(next);
+    if (next)
+        next->set_pi_links(prev, next->pi_next());
+    head->set_pi_links(nullptr, nullptr);
+}
+
+void FutexContext::UpdatePiOwnerLocked(UserThread* owner) {
+    // The head of each PI wait queue is its highest priority waiter.
+    int priority = 0;
+    for (FutexNode* head = owner->pi_futexes(); head; head = head->pi_next()) {
+        if (head->waiter_priority() > priority)
+            priority = head->waiter_priority();
+    }
+    owner->SetInheritedPriority(priority);
+}
+
+bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
+    // We need to re-get the hash table key, because it might have changed
+    // if the thread was requeued by FutexRequeue().
+    uintptr_t futex_key = node->GetKey();
+    FutexNode* list_head = futex_table_.find(futex_key);
+    FutexNode* test = list_head;
+    FutexNode* prev = nullptr;
+    while (test) {
+        DEBUG_ASSERT(test->GetKey() == futex_key);
+        FutexNode* next = test->next();
+        if (test == node) {
+            if (prev) {
+                // unlink from linked list
+                prev->set_next(next);
+                if (!next) {
+                    // We have removed the last element, so we need to
+                    // update the tail pointer.
+                    list_head->set_tail(prev);
+                }
+            } else {
+                // reset head of futex
+                futex_table_.erase(futex_key);
+                if (node->pi_owner())
+                    UnlinkPiHeadLocked(node);
+                if (next) {
+                    next->set_tail(list_head->tail());
+                    DEBUG_ASSERT(next->GetKey() == futex_key);
+                    futex_table_.insert(next);
+                    if (next->pi_owner())
+                        LinkPiHeadLocked(next);
+                }
+            }
+            return true;
+        }
+        prev = test;
+        test = next;
+    }
+    return false;
+}
+
 void FutexContext::QueueNodesLocked(FutexNode* head) {
     FutexNode* current_head = futex_table_.find(head->GetKey());
 
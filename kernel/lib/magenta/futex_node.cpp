@@ -32,6 +32,28 @@ void FutexNode::AppendList(FutexNode* head) {
     tail_ = head->tail();
 }
 
+FutexNode* FutexNode::InsertByPriority(FutexNode* node) {
+    DEBUG_ASSERT(tail_ != nullptr);
+    DEBUG_ASSERT(node->next_ == nullptr);
+
+    if (node->waiter_priority_ > waiter_priority_) {
+        // new head of the list
+        node->next_ = this;
+        node->tail_ = tail_;
+        return node;
+    }
+
+    FutexNode* prev = this;
+    while (prev->next_ != nullptr && prev->next_->waiter_priority_ >= node->waiter_priority_)
+        prev = prev->next_;
+
+    node->next_ = prev->next_;
+    prev->next_ = node;
+    if (node->next_ == nullptr)
+        tail_ = node;
+    return this;
+}
+
 // remove up to |count| nodes from our head and return new head
 // the removed nodes remain a valid list after this operation
 FutexNode* FutexNode::RemoveFromHead(uint32_t count, uintptr_t old_hash_key,
@@ -13,7 +13,10 @@
 
 #include <sys/types.h>
 
-class EventDispatcher final : public Dispatcher {
+#include <utils/slab.h>
+
+class EventDispatcher final : public Dispatcher,
+                              public utils::SlabAllocated<EventDispatcher> {
 public:
     static status_t Create(uint32_t options, utils::RefPtr<Dispatcher>* dispatcher,
                            mx_rights_t* rights);
@@ -35,3 +38,5 @@ private:
     explicit EventDispatcher(uint32_t options);
     StateTracker state_tracker_;
 };
+
+DECLARE_SLAB_ALLOCATED(EventDispatcher);
@@ -10,6 +10,8 @@
 #include <magenta/futex_node.h>
 #include <magenta/types.h>
 
+class UserThread;
+
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
 // to contain all active futexes.
@@ -46,12 +48,53 @@ public:
     status_t FutexRequeue(int* wake_ptr, uint32_t wake_count, int current_value, int* requeue_ptr,
                           uint32_t requeue_count);
 
+    // FutexLockPi blocks the current thread on the priority inheritance futex
+    // |value_ptr| until ownership is handed to it by FutexUnlockPi, or for up
+    // to |timeout| nanoseconds. |current_value| must still be the value of
+    // the futex and must have MX_FUTEX_PI_WAITERS set, otherwise ERR_BUSY or
+    // ERR_INVALID_ARGS is returned. While blocked, the owning thread named by
+    // the tid bits of |current_value| runs at no less than the priority of
+    // the current thread. If that thread has exited, the current thread
+    // takes the futex over at once, with MX_FUTEX_PI_OWNER_DIED set.
+    status_t FutexLockPi(int* value_ptr, int current_value, mx_time_t timeout);
+
+    // FutexUnlockPi releases the priority inheritance futex |value_ptr| owned
+    // by the current thread, handing it to the highest priority waiter if
+    // there is one, and drops any priority the current thread inherited
+    // through it.
+    status_t FutexUnlockPi(int* value_ptr);
+
+    // Called as |thread| exits. Every priority inheritance futex it still
+    // owns which has waiters is handed to its highest priority waiter, with
+    // MX_FUTEX_PI_OWNER_DIED set in the futex value.
+    void OnThreadExit(UserThread* thread);
+
 private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
     void QueueNodesLocked(FutexNode* head);
 
+    // Removes |node| from the wait queue of the futex it is blocked on.
+    // Returns false if it was not queued, i.e. it has already been woken.
+    bool UnqueueNodeLocked(FutexNode* node);
+
+    // The wait queue of each PI futex with waiters is on a list hanging off
+    // its owner, so that the owner's inherited priority can be recomputed
+    // from its own futexes alone. These add or remove the queue whose head
+    // is |head|, and must be called whenever a PI queue's head changes.
+    void LinkPiHeadLocked(FutexNode* head);
+    void UnlinkPiHeadLocked(FutexNode* head);
+
+    // Makes the first waiter on the PI futex whose wait queue is |head| its
+    // owner and wakes it. The caller has already stored the new owner's tid
+    // in the futex value.
+    void HandOffPiLocked(FutexNode* head);
+
+    // Recomputes the priority |owner| inherits from the waiters on all the
+    // PI futexes it owns.
+    void UpdatePiOwnerLocked(UserThread* owner);
+
     // protects futex_table_
     mutex_t lock_;
 
@@ -13,6 +13,8 @@
 #include <magenta/types.h>
 #include <utils/intrusive_hash_table.h>
 
+class UserThread;
+
 // Node for linked list of threads blocked on a futex
 // Intended to be embedded within a UserThread Instance
 class FutexNode : public utils::SinglyLinkedListable<FutexNode*> {
@@ -28,6 +30,10 @@ public:
     // adds a list of nodes to our tail
     void AppendList(FutexNode* head);
 
+    // inserts |node| into our list behind all nodes of equal or higher
+    // waiter priority and returns the new head
+    FutexNode* InsertByPriority(FutexNode* node);
+
     // remove up to |count| nodes from our head and return new head
     // the removed nodes remain a valid list after this operation
     FutexNode* RemoveFromHead(uint32_t count, uintptr_t old_hash_key,
@@ -60,6 +66,45 @@ public:
         hash_key_ = key;
     }
 
+    // The following are only meaningful while the node is queued on a
+    // priority inheritance futex.
+    UserThread* waiter() const {
+        return waiter_;
+    }
+
+    int waiter_priority() const {
+        return waiter_priority_;
+    }
+
+    UserThread* pi_owner() const {
+        return pi_owner_;
+    }
+
+    void set_pi_owner(UserThread* owner) {
+        pi_owner_ = owner;
+    }
+
+    void set_pi_waiter(UserThread* waiter, int priority, UserThread* owner) {
+        waiter_ = waiter;
+        waiter_priority_ = priority;
+        pi_owner_ = owner;
+    }
+
+    // links in the owner's list of PI wait queues, see
+    // FutexContext::LinkPiHeadLocked(); only valid if this node is the list head
+    FutexNode* pi_prev() const {
+        return pi_prev_;
+    }
+
+    FutexNode* pi_next() const {
+        return pi_next_;
+    }
+
+    void set_pi_links(FutexNode* prev, FutexNode* next) {
+        pi_prev_ = prev;
+        pi_next_ = next;
+    }
+
     // Trait implementation for utils::HashTable
     uintptr_t GetKey() const { return hash_key_; }
     static size_t GetHash(uintptr_t key) { return (key >> 3); }
@@ -82,4 +127,14 @@ private:
     // tail node of the node list
     // only valid if this node is the list head
     FutexNode* tail_;
+
+    // our blocked thread and its scheduler priority, and the thread owning
+    // the futex it is blocked on.  pi_owner_ is null when blocked on an
+    // ordinary futex.
+    UserThread* waiter_ = nullptr;
+    int waiter_priority_ = 0;
+    UserThread* pi_owner_ = nullptr;
+
+    FutexNode* pi_prev_ = nullptr;
+    FutexNode* pi_next_ = nullptr;
 };
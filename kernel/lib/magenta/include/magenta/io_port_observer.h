@@ -13,10 +13,12 @@
 #include <magenta/types.h>
 
 #include <utils/ref_ptr.h>
+#include <utils/slab.h>
 
 class IOPortDispatcher;
 
-class IOPortObserver final: public StateObserver {
+class IOPortObserver final: public StateObserver,
+                            public utils::SlabAllocated<IOPortObserver> {
 public:
     enum {
         NEW,          // Initial state, it transitions to either CANCELLED or UNBOUND.
@@ -68,3 +70,5 @@ struct IOPortObserverListTraits {
         return obj.io_port_list_node_state_;
     }
 };
+
+DECLARE_SLAB_ALLOCATED(IOPortObserver);
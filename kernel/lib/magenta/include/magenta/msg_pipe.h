@@ -15,10 +15,12 @@
 #include <utils/array.h>
 #include <utils/intrusive_double_list.h>
 #include <utils/ref_counted.h>
+#include <utils/slab.h>
 
 class Handle;
 
-struct MessagePacket : public utils::DoublyLinkedListable<utils::unique_ptr<MessagePacket>> {
+struct MessagePacket final : public utils::DoublyLinkedListable<utils::unique_ptr<MessagePacket>>,
+                       public utils::SlabAllocated<MessagePacket> {
     MessagePacket(utils::Array<uint8_t>&& _data,
                   utils::Array<Handle*>&& _handles)
         : data(utils::move(_data)),
@@ -31,6 +33,8 @@ struct MessagePacket : public utils::DoublyLinkedListable<utils::unique_ptr<Mess
     void ReturnHandles();
 };
 
+DECLARE_SLAB_ALLOCATED(MessagePacket);
+
 class MessagePipe : public utils::RefCounted<MessagePipe> {
 public:
     using MessageList = utils::DoublyLinkedList<utils::unique_ptr<MessagePacket>>;
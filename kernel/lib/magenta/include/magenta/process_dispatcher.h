@@ -113,6 +113,10 @@ public:
     uint32_t HandleStats(uint32_t*handle_type, size_t size) const;
     uint32_t ThreadCount() const;
 
+    // Time the threads of this process have spent running, in nanoseconds,
+    // including threads that have exited.
+    mx_time_t GetRuntime() const;
+
     // Look up a process given its koid.
     // Returns nullptr if not found.
     static utils::RefPtr<ProcessDispatcher> LookupProcessById(mx_koid_t koid);
@@ -121,8 +125,15 @@ public:
     // Returns nullptr if not found.
     utils::RefPtr<UserThread> LookupThreadById(mx_koid_t koid);
 
+    // Look up a thread in this process given its futex tid.
+    // Returns nullptr if not found.
+    utils::RefPtr<UserThread> LookupThreadByFutexTid(int futex_tid);
+
     // Outputs via the console the current list of processes;
     static void DebugDumpProcessList();
+    // Outputs via the console how much cpu each process used over the next
+    // |interval| milliseconds.
+    static void DebugDumpProcessRuntimes(lk_time_t interval);
     static void DumpProcessListKeyMap();
 
     uint32_t get_bad_handle_policy() const { return bad_handle_policy_; }
@@ -166,6 +177,15 @@ private:
     // list of threads in this process
     utils::DoublyLinkedList<UserThread*> thread_list_;
 
+    // next futex tid to hand out in AddThread(), protected by thread_list_lock_
+    int next_futex_tid_ = 1;
+    // set once next_futex_tid_ has wrapped, protected by thread_list_lock_
+    bool futex_tid_wrapped_ = false;
+
+    // runtime of the threads that have left thread_list_, protected by
+    // thread_list_lock_
+    mx_time_t dead_thread_runtime_ = 0;
+
     // a ref to the main thread
     utils::RefPtr<UserThread> main_thread_;
 
@@ -6,6 +6,12 @@
 
 #pragma once
 
+#include <assert.h>
+#include <err.h>
+#include <new.h>
+#include <stddef.h>
+
+#include <lib/user_copy.h>
 #include <utils/string_piece.h>
 
 status_t magenta_copy_from_user(const void* src, void* dest, size_t len);
@@ -14,3 +20,63 @@ status_t magenta_copy_user_string(const char* src, size_t src_len, char* buf, si
                                   utils::StringPiece* sp);
 
 status_t magenta_copy_user_dynamic(const void* src, uint8_t** dst, size_t len, size_t max_len);
+
+// A kernel copy of an array that a syscall reads from or writes to user
+// memory. Up to N elements are held inline, so a syscall that keeps one on
+// its stack handles the usual small arrays without touching the heap;
+// longer ones are allocated. Elements are left uninitialized, since they
+// are either copied in from user memory or written before being copied
+// out, so T should be a plain data type.
+template <typename T, size_t N>
+class UserArray {
+public:
+    UserArray() : data_(inline_), count_(0u) {}
+    ~UserArray() { if (data_ != inline_) delete[] data_; }
+
+    UserArray(const UserArray&) = delete;
+    UserArray& operator=(const UserArray&) = delete;
+
+    // Make room for |count| elements, discarding the current contents.
+    status_t Reset(size_t count) {
+        if (data_ != inline_) delete[] data_;
+        data_ = inline_;
+        count_ = 0u;
+        if (count > N) {
+            AllocChecker ac;
+            data_ = new (&ac) T[count];
+            if (!ac.check()) {
+                data_ = inline_;
+                return ERR_NO_MEMORY;
+            }
+        }
+        count_ = count;
+        return NO_ERROR;
+    }
+
+    // Reset to |count| elements copied from |src| in user memory. |src| may
+    // be null if |count| is zero.
+    status_t CopyFromUser(const T* src, size_t count) {
+        status_t status = Reset(count);
+        if (status != NO_ERROR || count == 0u)
+            return status;
+        return magenta_copy_from_user(src, data_, count * sizeof(T));
+    }
+
+    status_t CopyToUser(T* dst) const {
+        return copy_to_user(dst, data_, count_ * sizeof(T)) == NO_ERROR ? NO_ERROR
+                                                                        : ERR_INVALID_ARGS;
+    }
+
+    T* get() const { return data_; }
+    size_t size() const { return count_; }
+
+    T& operator[](size_t i) const {
+        DEBUG_ASSERT(i < count_);
+        return data_[i];
+    }
+
+private:
+    T inline_[N];
+    T* data_;
+    size_t count_;
+};
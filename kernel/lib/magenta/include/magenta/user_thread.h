@@ -71,6 +71,30 @@ public:
 
     mx_koid_t get_koid() const { return koid_; }
 
+    // Identifies the thread as the owner of a priority inheritance futex.
+    // Unique among the live threads of a process and never zero.
+    int futex_tid() const { return futex_tid_; }
+    void set_futex_tid(int tid) { futex_tid_ = tid; }
+
+    // Scheduler priority of the underlying LK thread, including any
+    // inherited priority.
+    int priority() const { return thread_.priority; }
+
+    // Time the underlying LK thread has spent running, in nanoseconds.
+    mx_time_t runtime() const { return thread_runtime(&thread_) * 1000; }
+
+    // Boost (or drop the boost of) the underlying LK thread on behalf of the
+    // threads blocked on priority inheritance futexes it owns.
+    void SetInheritedPriority(int priority);
+
+    // Head of the list of wait queues of the priority inheritance futexes
+    // this thread owns, and whether it has handed them off on its way out.
+    // Both are protected by the futex context lock of our process.
+    FutexNode* pi_futexes() const { return pi_futexes_; }
+    void set_pi_futexes(FutexNode* head) { pi_futexes_ = head; }
+    bool pi_exited() const { return pi_exited_; }
+    void set_pi_exited() { pi_exited_ = true; }
+
 private:
     UserThread(const UserThread&) = delete;
     UserThread& operator=(const UserThread&) = delete;
@@ -108,6 +132,12 @@ private:
     // Node for linked list of threads blocked on a futex
     FutexNode futex_node_;
 
+    // assigned by our process in AddThread()
+    int futex_tid_ = 0;
+
+    FutexNode* pi_futexes_ = nullptr;
+    bool pi_exited_ = false;
+
     StateTracker state_tracker_;
 
     // A thread-level exception port for this thread.
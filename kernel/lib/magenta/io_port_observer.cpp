@@ -14,6 +14,8 @@
 
 #include <utils/type_support.h>
 
+DEFINE_SLAB_ALLOCATED(IOPortObserver, "io_port_observer");
+
 bool SendIOPortPacket(IOPortDispatcher* io_port,
                              uint64_t key,
                              mx_signals_t signals) {
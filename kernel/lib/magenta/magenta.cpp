@@ -149,6 +149,7 @@ static int cmd_magenta(int argc, const cmd_args* argv) {
     usage:
         printf("%s ps  : list processes\n", argv[0].str);
         printf("%s ps  help: display keymap\n", argv[0].str);
+        printf("%s top [ms]: cpu usage of each process over an interval\n", argv[0].str);
         return -1;
     }
 
@@ -158,6 +159,11 @@ static int cmd_magenta(int argc, const cmd_args* argv) {
         } else {
             ProcessDispatcher::DebugDumpProcessList();
         }
+    } else if (strcmp(argv[1].str, "top") == 0) {
+        lk_time_t interval = (argc > 2) ? static_cast<lk_time_t>(argv[2].u) : 1000u;
+        if (interval == 0)
+            goto usage;
+        ProcessDispatcher::DebugDumpProcessRuntimes(interval);
     } else {
         printf("unrecognized subcommand\n");
         goto usage;
@@ -12,6 +12,8 @@
 #include <magenta/magenta.h>
 #include <magenta/msg_pipe.h>
 
+DEFINE_SLAB_ALLOCATED(MessagePacket, "message_packet");
+
 namespace {
 
 size_t other_side(size_t side) {
@@ -14,6 +14,7 @@
 #include <trace.h>
 
 #include <kernel/auto_lock.h>
+#include <lib/ktrace.h>
 
 #include <magenta/handle.h>
 #include <magenta/msg_pipe.h>
@@ -90,11 +91,16 @@ status_t MessagePipeDispatcher::AcceptRead(utils::Array<uint8_t>* data,
         *data = utils::move(msg->data);
         *handles = utils::move(msg->handles);
     }
+    ktrace(MX_KTRACE_MSGPIPE_READ, static_cast<uint32_t>(get_koid()),
+           static_cast<uint32_t>(data->size()), static_cast<uint32_t>(handles->size()), 0);
     return NO_ERROR;
 }
 
 status_t MessagePipeDispatcher::Write(utils::Array<uint8_t> data, utils::Array<Handle*> handles) {
     LTRACE_ENTRY;
+    ktrace(MX_KTRACE_MSGPIPE_WRITE, static_cast<uint32_t>(get_koid()),
+           static_cast<uint32_t>(data.size()), static_cast<uint32_t>(handles.size()), 0);
+
     AllocChecker ac;
     utils::unique_ptr<MessagePacket> msg(
         new (&ac) MessagePacket(utils::move(data), utils::move(handles)));
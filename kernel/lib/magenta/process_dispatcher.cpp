@@ -22,6 +22,8 @@
 #include <magenta/magenta.h>
 #include <magenta/user_copy.h>
 
+#include <utils/unique_ptr.h>
+
 #define LOCAL_TRACE 0
 
 static constexpr mx_rights_t kDefaultProcessRights = MX_RIGHT_READ  |
@@ -203,6 +205,27 @@ status_t ProcessDispatcher::AddThread(UserThread* t) {
     AutoLock lock(&thread_list_lock_);
     thread_list_.push_back(t);
 
+    // hand out the next futex tid, skipping zero (unowned) when the
+    // counter wraps around the tid field of a futex value. Once it has
+    // wrapped, tids still held by live threads must be skipped too, or a
+    // futex could name the wrong owner.
+    for (;;) {
+        int tid = next_futex_tid_;
+        next_futex_tid_ = (next_futex_tid_ + 1) & MX_FUTEX_PI_TID_MASK;
+        if (next_futex_tid_ == 0) {
+            next_futex_tid_ = 1;
+            futex_tid_wrapped_ = true;
+        }
+        if (futex_tid_wrapped_ &&
+            thread_list_.find_if([tid](const UserThread& other) {
+                return other.futex_tid() == tid;
+            })) {
+            continue;
+        }
+        t->set_futex_tid(tid);
+        break;
+    }
+
     DEBUG_ASSERT(t->process() == this);
 
     return NO_ERROR;
@@ -218,6 +241,7 @@ void ProcessDispatcher::RemoveThread(UserThread* t) {
     AutoLock lock(&thread_list_lock_);
     DEBUG_ASSERT(t != nullptr);
     thread_list_.erase(*t);
+    dead_thread_runtime_ += t->runtime();
 
     // drop the ref from the main_thread_ pointer if its being removed
     if (t == main_thread_.get()) {
@@ -409,6 +433,14 @@ uint32_t ProcessDispatcher::ThreadCount() const {
     return static_cast<uint32_t>(thread_list_.size_slow());
 }
 
+mx_time_t ProcessDispatcher::GetRuntime() const {
+    AutoLock lock(&thread_list_lock_);
+    mx_time_t runtime = dead_thread_runtime_;
+    for (const auto& thread : thread_list_)
+        runtime += thread.runtime();
+    return runtime;
+}
+
 void ProcessDispatcher::AddProcess(ProcessDispatcher* process) {
     // Don't call any method of |process|, it is not yet fully constructed.
     AutoLock lock(&global_process_list_mutex_);
@@ -447,6 +479,16 @@ utils::RefPtr<UserThread> ProcessDispatcher::LookupThreadById(mx_koid_t koid) {
     return utils::RefPtr<UserThread>(thread);
 }
 
+utils::RefPtr<UserThread> ProcessDispatcher::LookupThreadByFutexTid(int futex_tid) {
+    LTRACE_ENTRY_OBJ;
+    AutoLock lock(&thread_list_lock_);
+    UserThread* thread =
+        thread_list_.find_if([futex_tid](const UserThread& t) {
+            return t.futex_tid() == futex_tid;
+    });
+    return utils::RefPtr<UserThread>(thread);
+}
+
 void ProcessDispatcher::DebugDumpProcessList() {
     AutoLock lock(&global_process_list_mutex_);
     printf("%8s-s  #t  #h:  #pr #th #vm #mp #ev #ip #dp #it #io[name]\n", "id");
@@ -482,6 +524,78 @@ char* ProcessDispatcher::DebugDumpHandleTypeCount_NoLock() const {
     return buf;
 }
 
+void ProcessDispatcher::DebugDumpProcessRuntimes(lk_time_t interval) {
+    struct Usage {
+        mx_koid_t koid;
+        mx_time_t runtime;
+        mx_time_t delta;
+        char name[sizeof(name_)];
+    };
+
+    AllocChecker ac;
+    utils::unique_ptr<Usage[]> before;
+    size_t num_before;
+    {
+        AutoLock lock(&global_process_list_mutex_);
+        num_before = global_process_list_.size_slow();
+        before.reset(new (&ac) Usage[num_before]);
+        if (!ac.check())
+            return;
+        size_t i = 0;
+        for (const auto& process : global_process_list_) {
+            before[i].koid = process.get_koid();
+            before[i].runtime = process.GetRuntime();
+            i++;
+        }
+    }
+
+    thread_sleep(interval);
+
+    utils::unique_ptr<Usage[]> after;
+    size_t num_after;
+    {
+        AutoLock lock(&global_process_list_mutex_);
+        num_after = global_process_list_.size_slow();
+        after.reset(new (&ac) Usage[num_after]);
+        if (!ac.check())
+            return;
+        size_t i = 0;
+        for (const auto& process : global_process_list_) {
+            Usage& usage = after[i++];
+            usage.koid = process.get_koid();
+            usage.runtime = process.GetRuntime();
+            // Processes created while we slept ran only during the interval.
+            usage.delta = usage.runtime;
+            for (size_t j = 0; j < num_before; j++) {
+                if (before[j].koid == usage.koid) {
+                    usage.delta -= before[j].runtime;
+                    break;
+                }
+            }
+            strlcpy(usage.name, process.name().data(), sizeof(usage.name));
+        }
+    }
+
+    // Busiest first.
+    for (size_t i = 1; i < num_after; i++) {
+        for (size_t j = i; j > 0 && after[j].delta > after[j - 1].delta; j--) {
+            Usage tmp = after[j];
+            after[j] = after[j - 1];
+            after[j - 1] = tmp;
+        }
+    }
+
+    mx_time_t interval_ns = static_cast<mx_time_t>(interval) * 1000000;
+    printf("cpu usage over %u ms, 100%% is one cpu\n", interval);
+    printf("%8s %7s %12s [name]\n", "id", "cpu", "total ms");
+    for (size_t i = 0; i < num_after; i++) {
+        const Usage& usage = after[i];
+        mx_time_t permille = usage.delta * 1000 / interval_ns;
+        printf("%8llu %4llu.%llu%% %12llu [%s]\n", usage.koid, permille / 10, permille % 10,
+               usage.runtime / 1000000, usage.name);
+    }
+}
+
 void ProcessDispatcher::DumpProcessListKeyMap() {
     printf("id  : process id number\n");
     printf("-s  : state: R = running D = dead\n");
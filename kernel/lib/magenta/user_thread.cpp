@@ -164,6 +164,10 @@ void UserThread::Kill() {
     SetState(State::DYING);
 }
 
+void UserThread::SetInheritedPriority(int priority) {
+    thread_set_inherited_priority(&thread_, priority);
+}
+
 void UserThread::DispatcherClosed() {
     LTRACE_ENTRY_OBJ;
 
@@ -182,6 +186,9 @@ static void ThreadCleanupDpc(dpc_t *d) {
 void UserThread::Exiting() {
     LTRACE_ENTRY_OBJ;
 
+    // release whoever is waiting for a priority inheritance futex we hold
+    process_->futex_context()->OnThreadExit(this);
+
     AutoLock lock(state_lock_);
 
     DEBUG_ASSERT(state_ == State::DYING);
@@ -8,6 +8,7 @@
 
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <magenta/magenta.h>
 
 #include <assert.h>
 #include <new.h>
@@ -65,6 +66,10 @@ mx_status_t VmObjectDispatcher::GetSize(uint64_t* size) {
     return NO_ERROR;
 }
 
+mx_status_t VmObjectDispatcher::Lookup(uint64_t offset, mx_size_t len, paddr_t* pages, size_t page_count) {
+    return vmo_->Lookup(offset, len, pages, page_count);
+}
+
 mx_status_t VmObjectDispatcher::Map(utils::RefPtr<VmAspace> aspace, uint32_t vmo_rights, uint64_t offset, mx_size_t len,
                                     uintptr_t* _ptr, uint32_t flags) {
     DEBUG_ASSERT(aspace);
@@ -83,6 +88,8 @@ mx_status_t VmObjectDispatcher::Map(utils::RefPtr<VmAspace> aspace, uint32_t vmo
         arch_mmu_flags |= ARCH_MMU_FLAG_PERM_RO;
         break;
     case MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE:
+        if (!magenta_rights_check(vmo_rights, MX_RIGHT_WRITE))
+            return ERR_ACCESS_DENIED;
         // default flags
         break;
     case 0: // no way to express no permissions
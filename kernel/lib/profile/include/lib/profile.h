@@ -0,0 +1,69 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <compiler.h>
+#include <magenta/profile.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Sampling cpu profiler.
+//
+// While started, a periodic timer on every cpu records what that cpu was
+// running when the timer interrupt arrived: the process and thread, the
+// pc, and a short stack found by following frame pointers. Samples go to
+// a per-cpu ring in a VM object that user mode can map read-only (see
+// magenta/profile.h for the layout).
+//
+// The timer callback can't see the registers of the code it interrupted,
+// so the arch interrupt entry code hands them over with profile_irq().
+
+__BEGIN_CDECLS
+
+extern uint32_t profile_rate;
+
+void profile_irq_regs(uintptr_t pc, uintptr_t fp, bool user);
+
+// Called by arch code on entry to every interrupt with the interrupted
+// pc and frame pointer. Costs one load and one not-taken branch while
+// the profiler is stopped.
+static inline void profile_irq(uintptr_t pc, uintptr_t fp, bool user) {
+    if (unlikely(profile_rate))
+        profile_irq_regs(pc, fp, user);
+}
+
+status_t profile_control(uint32_t action, uint32_t options);
+
+__END_CDECLS
+
+#ifdef __cplusplus
+#include <kernel/vm/vm_object.h>
+#include <utils/ref_ptr.h>
+
+// The sample buffer, or null if the profiler has never been started.
+utils::RefPtr<VmObject> profile_get_vmo();
+
+// The samples in a set of per-cpu rings, counted by process. Backs the
+// "profile top" console command.
+struct ProfileTop {
+    uint64_t total;
+    uint64_t idle;
+    uint64_t kernel; // kernel threads
+    uint64_t other;  // processes that didn't fit in procs
+    uint num_procs;
+    struct {
+        uint64_t pid;
+        uint64_t count;
+    } procs[32]; // busiest first
+};
+
+// heads[n] is the head of cpu n's ring, which starts at
+// samples + n * samples_per_cpu; only the samples still in the ring count.
+void profile_count_top(const mx_profile_sample_t* samples, uint64_t samples_per_cpu,
+                       const uint64_t* heads, uint num_cpus, ProfileTop* top);
+#endif
@@ -0,0 +1,425 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/profile.h>
+
+#include <arch/mmu.h>
+#include <arch/ops.h>
+#include <err.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
+#include <lib/console.h>
+#include <lk/init.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <magenta/process_dispatcher.h>
+#include <magenta/user_thread.h>
+
+// Default ring size per cpu, in KB; profile.bufsize overrides it.
+#define PROFILE_DEFAULT_BUFSIZE 128
+
+// Kernel timers have millisecond resolution.
+#define PROFILE_MAX_RATE 1000u
+#define PROFILE_DEFAULT_RATE 1000u
+
+uint32_t profile_rate;
+
+namespace {
+
+struct __ALIGNED(CACHE_LINE) ProfileCpu {
+    timer_t timer;
+    // The interrupted context, stashed by profile_irq() and used up by the
+    // next tick on this cpu.
+    uintptr_t pc;
+    uintptr_t fp;
+    bool user;
+    bool valid;
+};
+
+mutex_t profile_lock = MUTEX_INITIAL_VALUE(profile_lock);
+
+ProfileCpu profile_cpus[SMP_MAX_CPUS];
+
+// Set up by the first start and never torn down, so a tick that raced
+// with a stop can always write. User mode can see the buffer, so the
+// layout is kept here rather than read back from profile_info.
+utils::RefPtr<VmObject> profile_vmo;
+mx_profile_info_t* profile_info;
+mx_profile_sample_t* profile_samples;
+uint64_t profile_samples_per_cpu;
+uint profile_num_cpus;
+
+status_t profile_alloc_locked() {
+    DEBUG_ASSERT(is_mutex_held(&profile_lock));
+
+    if (profile_vmo)
+        return NO_ERROR;
+
+    const char* bufsize = cmdline_get("profile.bufsize");
+    uint64_t kb = bufsize ? strtoul(bufsize, nullptr, 0) : PROFILE_DEFAULT_BUFSIZE;
+    uint64_t samples = (kb * 1024) / sizeof(mx_profile_sample_t);
+    if (samples < PAGE_SIZE / sizeof(mx_profile_sample_t))
+        samples = PAGE_SIZE / sizeof(mx_profile_sample_t);
+    // Round down to a power of two so that slots are found with a mask.
+    samples = 1ULL << (63 - __builtin_clzll(samples));
+
+    uint num_cpus = arch_max_num_cpus();
+    static_assert(sizeof(mx_profile_info_t) + SMP_MAX_CPUS * sizeof(mx_profile_cpu_t) <=
+                      MX_PROFILE_RING_OFFSET,
+                  "profile info doesn't fit in its page");
+    size_t size = static_cast<size_t>(MX_PROFILE_RING_OFFSET +
+                                      num_cpus * samples * sizeof(mx_profile_sample_t));
+
+    auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, size);
+    if (!vmo)
+        return ERR_NO_MEMORY;
+
+    void* ptr;
+    status_t status = VmAspace::kernel_aspace()->MapObject(
+        vmo, "profile", 0, size, &ptr, 0, VMM_FLAG_COMMIT, ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (status < 0)
+        return status;
+
+    profile_info = static_cast<mx_profile_info_t*>(ptr);
+    profile_info->version = MX_PROFILE_VERSION;
+    profile_info->num_cpus = num_cpus;
+    profile_info->samples_per_cpu = samples;
+    profile_samples = reinterpret_cast<mx_profile_sample_t*>(
+        static_cast<uint8_t*>(ptr) + MX_PROFILE_RING_OFFSET);
+    profile_samples_per_cpu = samples;
+    profile_num_cpus = num_cpus;
+    profile_vmo = utils::move(vmo);
+    return NO_ERROR;
+}
+
+// Frames are laid out the same way on x86-64 and arm64: the frame pointer
+// points at the caller's frame pointer, with the return address above it.
+struct Frame {
+    uintptr_t fp;
+    uintptr_t ret;
+};
+
+uint16_t walk_kernel_stack(const thread_t* t, uintptr_t fp, uint64_t* frames) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(t->stack);
+    size_t size = t->stack_size;
+    if (size < sizeof(Frame))
+        return 0;
+
+    // Interrupts run on the thread's stack, so the chain never leaves it.
+    uint16_t n = 0;
+    while (n < MX_PROFILE_MAX_FRAMES && fp >= base && fp - base <= size - sizeof(Frame) &&
+           !(fp & (sizeof(uintptr_t) - 1))) {
+        const Frame* frame = reinterpret_cast<const Frame*>(fp);
+        if (!frame->ret)
+            break;
+        frames[n++] = frame->ret;
+        // Callers' frames are always further up the stack.
+        if (frame->fp <= fp)
+            break;
+        fp = frame->fp;
+    }
+    return n;
+}
+
+// Reads a word of user memory through the physmap so that a bad or
+// unmapped address can't fault in interrupt context. The page tables are
+// walked without the aspace lock; a page that is being unmapped at the
+// same moment can give a stale value, which only costs a bogus frame.
+bool read_user_word(VmAspace* aspace, uintptr_t va, uintptr_t* out) {
+    if (va & (sizeof(uintptr_t) - 1))
+        return false;
+    if (va < aspace->base() || va - aspace->base() >= aspace->size())
+        return false;
+
+    paddr_t pa;
+    uint flags;
+    if (arch_mmu_query(&aspace->arch_aspace(), va, &pa, &flags) < 0)
+        return false;
+    if (!(flags & ARCH_MMU_FLAG_PERM_USER))
+        return false;
+
+    auto ptr = static_cast<const uintptr_t*>(paddr_to_kvaddr(pa));
+    if (!ptr)
+        return false;
+    *out = *ptr;
+    return true;
+}
+
+uint16_t walk_user_stack(const thread_t* t, uintptr_t fp, uint64_t* frames) {
+    if (!t->aspace)
+        return 0;
+    VmAspace* aspace = vmm_aspace_to_obj(t->aspace);
+
+    uint16_t n = 0;
+    while (n < MX_PROFILE_MAX_FRAMES) {
+        uintptr_t next, ret;
+        if (!read_user_word(aspace, fp, &next) ||
+            !read_user_word(aspace, fp + sizeof(uintptr_t), &ret) || !ret)
+            break;
+        frames[n++] = ret;
+        if (next <= fp)
+            break;
+        fp = next;
+    }
+    return n;
+}
+
+enum handler_return profile_tick(timer_t* timer, lk_time_t now, void* arg) {
+    uint cpu = arch_curr_cpu_num();
+    if (unlikely(cpu >= profile_num_cpus))
+        return INT_NO_RESCHEDULE;
+    ProfileCpu& pcpu = profile_cpus[cpu];
+    mx_profile_cpu_t* ring = &profile_info->cpu[cpu];
+
+    // Arches that don't call profile_irq() never get samples.
+    if (!pcpu.valid) {
+        ring->dropped++;
+        return INT_NO_RESCHEDULE;
+    }
+    pcpu.valid = false;
+
+    // Interrupts are off, so nothing else can write to this cpu's ring
+    // until we are done.
+    uint64_t head = ring->head;
+    mx_profile_sample_t* s =
+        &profile_samples[cpu * profile_samples_per_cpu + (head & (profile_samples_per_cpu - 1))];
+
+    thread_t* t = get_current_thread();
+    auto ut = reinterpret_cast<UserThread*>(t->tls[TLS_ENTRY_LKUSER]);
+
+    s->ts = current_time_hires();
+    s->pid = ut ? ut->process()->get_koid() : 0;
+    s->tid = ut ? ut->get_koid() : 0;
+    s->cpu = cpu;
+    s->flags = 0;
+    if (t->flags & THREAD_FLAG_IDLE)
+        s->flags |= MX_PROFILE_SAMPLE_IDLE;
+    if (pcpu.user) {
+        s->flags |= MX_PROFILE_SAMPLE_USER;
+        s->user_pc = pcpu.pc;
+        s->kernel_pc = 0;
+        s->num_frames = walk_user_stack(t, pcpu.fp, s->frames);
+    } else {
+        s->user_pc = 0;
+        s->kernel_pc = pcpu.pc;
+        s->num_frames = walk_kernel_stack(t, pcpu.fp, s->frames);
+    }
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return INT_NO_RESCHEDULE;
+}
+
+void profile_start_task(void* arg) {
+    lk_time_t period = *static_cast<lk_time_t*>(arg);
+    ProfileCpu& pcpu = profile_cpus[arch_curr_cpu_num()];
+    pcpu.valid = false;
+    timer_set_periodic(&pcpu.timer, period, profile_tick, nullptr);
+}
+
+void profile_stop_task(void* arg) {
+    timer_cancel(&profile_cpus[arch_curr_cpu_num()].timer);
+}
+
+} // namespace
+
+void profile_irq_regs(uintptr_t pc, uintptr_t fp, bool user) {
+    ProfileCpu& pcpu = profile_cpus[arch_curr_cpu_num()];
+    pcpu.pc = pc;
+    pcpu.fp = fp;
+    pcpu.user = user;
+    pcpu.valid = true;
+}
+
+status_t profile_control(uint32_t action, uint32_t options) {
+    AutoLock lock(&profile_lock);
+
+    switch (action) {
+    case MX_PROFILE_ACTION_START: {
+        if (profile_rate)
+            return ERR_BAD_STATE;
+        uint32_t rate = options ? options : PROFILE_DEFAULT_RATE;
+        if (rate > PROFILE_MAX_RATE)
+            return ERR_INVALID_ARGS;
+        status_t status = profile_alloc_locked();
+        if (status < 0)
+            return status;
+
+        lk_time_t period = PROFILE_MAX_RATE / rate;
+        profile_info->rate = PROFILE_MAX_RATE / period;
+        // Turn on the register hooks before the first tick can arrive.
+        __atomic_store_n(&profile_rate, profile_info->rate, __ATOMIC_RELEASE);
+        mp_sync_exec(MP_CPU_ALL, profile_start_task, &period);
+        return NO_ERROR;
+    }
+    case MX_PROFILE_ACTION_STOP:
+        if (!profile_rate)
+            return NO_ERROR;
+        mp_sync_exec(MP_CPU_ALL, profile_stop_task, nullptr);
+        __atomic_store_n(&profile_rate, 0u, __ATOMIC_RELEASE);
+        profile_info->rate = 0;
+        return NO_ERROR;
+    case MX_PROFILE_ACTION_REWIND:
+        if (profile_rate)
+            return ERR_BAD_STATE;
+        if (profile_info) {
+            for (uint i = 0; i < profile_num_cpus; i++) {
+                profile_info->cpu[i].head = 0;
+                profile_info->cpu[i].dropped = 0;
+            }
+        }
+        return NO_ERROR;
+    default:
+        return ERR_INVALID_ARGS;
+    }
+}
+
+utils::RefPtr<VmObject> profile_get_vmo() {
+    AutoLock lock(&profile_lock);
+    return profile_vmo;
+}
+
+static void profile_init(uint level) {
+    for (auto& pcpu : profile_cpus)
+        timer_initialize(&pcpu.timer);
+}
+
+LK_INIT_HOOK(profile, profile_init, LK_INIT_LEVEL_THREADING);
+
+void profile_count_top(const mx_profile_sample_t* samples, uint64_t samples_per_cpu,
+                       const uint64_t* heads, uint num_cpus, ProfileTop* top) {
+    memset(top, 0, sizeof(*top));
+
+    for (uint cpu = 0; cpu < num_cpus; cpu++) {
+        uint64_t head = heads[cpu];
+        uint64_t first = head > samples_per_cpu ? head - samples_per_cpu : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const mx_profile_sample_t& s =
+                samples[cpu * samples_per_cpu + (i & (samples_per_cpu - 1))];
+            top->total++;
+            if (s.flags & MX_PROFILE_SAMPLE_IDLE) {
+                top->idle++;
+                continue;
+            }
+            if (!s.pid) {
+                top->kernel++;
+                continue;
+            }
+            uint j;
+            for (j = 0; j < top->num_procs && top->procs[j].pid != s.pid; j++)
+                ;
+            if (j == top->num_procs) {
+                if (top->num_procs == countof(top->procs)) {
+                    top->other++;
+                    continue;
+                }
+                top->procs[top->num_procs++] = {s.pid, 0};
+            }
+            top->procs[j].count++;
+        }
+    }
+
+    // Few enough to sort by selection. Ties keep the order they were seen in.
+    for (uint n = 0; n < top->num_procs; n++) {
+        uint best = n;
+        for (uint j = n + 1; j < top->num_procs; j++) {
+            if (top->procs[j].count > top->procs[best].count)
+                best = j;
+        }
+        auto tmp = top->procs[best];
+        for (uint j = best; j > n; j--)
+            top->procs[j] = top->procs[j - 1];
+        top->procs[n] = tmp;
+    }
+}
+
+#if WITH_LIB_CONSOLE
+// Prints the processes that were sampled most often, by name.
+static void profile_dump_top(uint max) {
+    uint64_t heads[SMP_MAX_CPUS];
+    for (uint cpu = 0; cpu < profile_num_cpus; cpu++)
+        heads[cpu] = __atomic_load_n(&profile_info->cpu[cpu].head, __ATOMIC_ACQUIRE);
+
+    ProfileTop top;
+    profile_count_top(profile_samples, profile_samples_per_cpu, heads, profile_num_cpus, &top);
+    if (!top.total) {
+        printf("profile: no samples\n");
+        return;
+    }
+
+    printf("%llu samples: %llu%% idle, %llu%% kernel threads\n", top.total,
+           top.idle * 100 / top.total, top.kernel * 100 / top.total);
+    printf("%8s %8s %5s %s\n", "pid", "samples", "%", "name");
+    for (uint n = 0; n < max && n < top.num_procs; n++) {
+        utils::RefPtr<ProcessDispatcher> process =
+            ProcessDispatcher::LookupProcessById(top.procs[n].pid);
+        printf("%8llu %8llu %5llu %s\n", top.procs[n].pid, top.procs[n].count,
+               top.procs[n].count * 100 / top.total,
+               process ? process->name().data() : "<exited>");
+    }
+    if (top.other)
+        printf("%8s %8llu %5llu (more processes)\n", "", top.other, top.other * 100 / top.total);
+}
+
+static int cmd_profile(int argc, const cmd_args* argv) {
+    if (argc < 2) {
+    usage:
+        printf("usage:\n");
+        printf("%s start [samples per second]\n", argv[0].str);
+        printf("%s stop\n", argv[0].str);
+        printf("%s rewind\n", argv[0].str);
+        printf("%s status\n", argv[0].str);
+        printf("%s top [count]\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    status_t status;
+    if (!strcmp(argv[1].str, "start")) {
+        uint32_t rate = argc > 2 ? static_cast<uint32_t>(argv[2].u) : 0;
+        status = profile_control(MX_PROFILE_ACTION_START, rate);
+    } else if (!strcmp(argv[1].str, "stop")) {
+        status = profile_control(MX_PROFILE_ACTION_STOP, 0);
+    } else if (!strcmp(argv[1].str, "rewind")) {
+        status = profile_control(MX_PROFILE_ACTION_REWIND, 0);
+    } else if (!strcmp(argv[1].str, "status") || !strcmp(argv[1].str, "top")) {
+        AutoLock lock(&profile_lock);
+        if (!profile_info) {
+            printf("profile: never started\n");
+            return 0;
+        }
+        if (!strcmp(argv[1].str, "top")) {
+            profile_dump_top(argc > 2 ? static_cast<uint>(argv[2].u) : 10);
+            return 0;
+        }
+        printf("profile: %u samples per second, %llu samples per cpu\n", profile_rate,
+               profile_samples_per_cpu);
+        for (uint i = 0; i < profile_num_cpus; i++) {
+            printf("\tcpu %u: %llu samples, %llu dropped\n", i, profile_info->cpu[i].head,
+                   profile_info->cpu[i].dropped);
+        }
+        return 0;
+    } else {
+        goto usage;
+    }
+
+    if (status < 0)
+        printf("profile: error %d\n", status);
+    return status;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("profile", "sampling cpu profiler", &cmd_profile)
+STATIC_COMMAND_END(profile);
+#endif
@@ -0,0 +1,109 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/profile.h>
+
+#include <string.h>
+#include <unittest.h>
+
+namespace {
+
+constexpr uint kCpus = 2;
+constexpr uint64_t kSamplesPerCpu = 8;
+
+mx_profile_sample_t samples[kCpus * kSamplesPerCpu];
+
+void set_sample(uint cpu, uint64_t i, uint64_t pid, uint16_t flags) {
+    mx_profile_sample_t& s = samples[cpu * kSamplesPerCpu + (i & (kSamplesPerCpu - 1))];
+    memset(&s, 0, sizeof(s));
+    s.pid = pid;
+    s.cpu = cpu;
+    s.flags = flags;
+}
+
+bool count_test(void* context) {
+    BEGIN_TEST;
+
+    // cpu 0 has taken 5 samples: idle, a kernel thread, then pids 10, 20, 20
+    set_sample(0, 0, 0, MX_PROFILE_SAMPLE_IDLE);
+    set_sample(0, 1, 0, 0);
+    set_sample(0, 2, 10, MX_PROFILE_SAMPLE_USER);
+    set_sample(0, 3, 20, MX_PROFILE_SAMPLE_USER);
+    set_sample(0, 4, 20, 0);
+    // cpu 1 has taken 11 and lapped its ring; samples 0-2 were overwritten
+    // by 8-10, so only 3-10 count
+    for (uint64_t i = 0; i < 11; i++)
+        set_sample(1, i, i < 3 ? 40 : (i < 9 ? 30 : 20), MX_PROFILE_SAMPLE_USER);
+    uint64_t heads[kCpus] = {5, 11};
+
+    ProfileTop top;
+    profile_count_top(samples, kSamplesPerCpu, heads, kCpus, &top);
+
+    EXPECT_EQ(13u, top.total, "total");
+    EXPECT_EQ(1u, top.idle, "idle");
+    EXPECT_EQ(1u, top.kernel, "kernel threads");
+    EXPECT_EQ(0u, top.other, "other");
+    REQUIRE_EQ(3u, top.num_procs, "processes");
+    // 30 has 6 samples on cpu 1, 20 has 2 on cpu 0 and 2 on cpu 1, and the
+    // lapped samples of 40 are gone
+    EXPECT_EQ(30u, top.procs[0].pid, "busiest");
+    EXPECT_EQ(6u, top.procs[0].count, "busiest count");
+    EXPECT_EQ(20u, top.procs[1].pid, "second");
+    EXPECT_EQ(4u, top.procs[1].count, "second count");
+    EXPECT_EQ(10u, top.procs[2].pid, "third");
+    EXPECT_EQ(1u, top.procs[2].count, "third count");
+
+    END_TEST;
+}
+
+bool overflow_test(void* context) {
+    BEGIN_TEST;
+
+    // more processes than fit: the ones seen after the table fills are
+    // counted as other
+    constexpr uint64_t kPerCpu = 64;
+    static mx_profile_sample_t ring[kPerCpu];
+    for (uint64_t i = 0; i < kPerCpu; i++) {
+        memset(&ring[i], 0, sizeof(ring[i]));
+        ring[i].pid = 100 + i % 40;
+    }
+    uint64_t head = kPerCpu;
+
+    ProfileTop top;
+    profile_count_top(ring, kPerCpu, &head, 1, &top);
+
+    EXPECT_EQ(kPerCpu, top.total, "total");
+    REQUIRE_EQ((uint)countof(top.procs), top.num_procs, "processes");
+    // pids 100-123 were sampled twice, 124-131 once, 132-139 didn't fit
+    EXPECT_EQ(8u, top.other, "other");
+    EXPECT_EQ(100u, top.procs[0].pid, "busiest");
+    EXPECT_EQ(2u, top.procs[0].count, "busiest count");
+    EXPECT_EQ(124u, top.procs[24].pid, "first seen once");
+    EXPECT_EQ(1u, top.procs[24].count, "seen once count");
+
+    END_TEST;
+}
+
+bool empty_test(void* context) {
+    BEGIN_TEST;
+
+    uint64_t heads[kCpus] = {0, 0};
+    ProfileTop top;
+    profile_count_top(samples, kSamplesPerCpu, heads, kCpus, &top);
+    EXPECT_EQ(0u, top.total, "total");
+    EXPECT_EQ(0u, top.num_procs, "processes");
+
+    END_TEST;
+}
+
+} // namespace
+
+UNITTEST_START_TESTCASE(profile_tests)
+UNITTEST("Count samples by process", count_test)
+UNITTEST("More processes than fit", overflow_test)
+UNITTEST("No samples", empty_test)
+UNITTEST_END_TESTCASE(profile_tests, "profile", "Cpu profiler sample counting",
+                      NULL, NULL);
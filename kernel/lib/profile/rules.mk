@@ -0,0 +1,19 @@
+# Copyright 2016 The Fuchsia Authors
+#
+# Use of this source code is governed by a MIT-style
+# license that can be found in the LICENSE file or at
+# https://opensource.org/licenses/MIT
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_SRCS := \
+    $(LOCAL_DIR)/profile.cpp \
+    $(LOCAL_DIR)/profile_unittest.cpp \
+
+MODULE_DEPS := \
+    lib/magenta \
+    lib/unittest \
+
+include make/module.mk
@@ -12,7 +12,9 @@ MODULE := $(LOCAL_DIR)
 MODULE_DEPS := \
     lib/console \
     lib/crypto \
+    lib/ktrace \
     lib/magenta \
+    lib/profile \
     lib/user_copy \
 
 MODULE_SRCS := \
@@ -21,6 +23,7 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/syscalls_ddk.cpp \
     $(LOCAL_DIR)/syscalls_exceptions.cpp \
     $(LOCAL_DIR)/syscalls_magenta.cpp \
+    $(LOCAL_DIR)/syscalls_stats.cpp \
     $(LOCAL_DIR)/syscalls_test.cpp \
 
 include make/module.mk
@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 
 #include <err.h>
+#include <lib/ktrace.h>
 #include <lib/user_copy.h>
 
 #include <magenta/magenta.h>
@@ -20,6 +21,7 @@
 #include <trace.h>
 
 #include "syscalls_priv.h"
+#include "syscalls_stats.h"
 
 #define LOCAL_TRACE 0
 
@@ -58,20 +60,29 @@ extern "C" void arm_syscall_handler(struct arm_fault_frame* frame) {
      * uses them or not, which is safe for simple arg passing.
      */
     syscall_func sfunc;
+    uint32_t stats_index;
+    lk_bigtime_t start;
 
     switch (syscall_num) {
 #define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...)                               \
     case n:                                                                                        \
         sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
+        stats_index = kSyscallIndex_##name;                                                        \
         break;
 #include <magenta/syscalls.inc>
         default:
             sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
+            stats_index = kSyscallIndexInvalid;
     }
 
     /* call the routine */
+    ktrace(MX_KTRACE_SYSCALL_ENTER, syscall_num, 0, 0, 0);
+    start = syscall_stats_begin();
     ret = sfunc(frame->r[0], frame->r[1], frame->r[2], frame->r[3], frame->r[4],
                          frame->r[5], frame->r[6], frame->r[7]);
+    syscall_stats_record(stats_index, start);
+    ktrace(MX_KTRACE_SYSCALL_EXIT, syscall_num, static_cast<uint32_t>(ret),
+           static_cast<uint32_t>(ret >> 32), 0);
 
     LTRACEF_LEVEL(2, "ret 0x%llx\n", ret);
 
@@ -111,20 +122,28 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
      * uses them or not, which is safe for simple arg passing.
      */
     syscall_func sfunc;
+    uint32_t stats_index;
 
     switch (syscall_num) {
 #define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...)                               \
     case n:                                                                                        \
         sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
+        stats_index = kSyscallIndex_##name;                                                        \
         break;
 #include <magenta/syscalls.inc>
         default:
             sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
+            stats_index = kSyscallIndexInvalid;
     }
 
     /* call the routine */
+    ktrace(MX_KTRACE_SYSCALL_ENTER, static_cast<uint32_t>(syscall_num), 0, 0, 0);
+    lk_bigtime_t start = syscall_stats_begin();
     uint64_t ret = sfunc(frame->r[0], frame->r[1], frame->r[2], frame->r[3], frame->r[4],
                          frame->r[5], frame->r[6], frame->r[7]);
+    syscall_stats_record(stats_index, start);
+    ktrace(MX_KTRACE_SYSCALL_EXIT, static_cast<uint32_t>(syscall_num), static_cast<uint32_t>(ret),
+           static_cast<uint32_t>(ret >> 32), 0);
 
     LTRACEF_LEVEL(2, "ret 0x%llx\n", ret);
 
@@ -167,19 +186,27 @@ extern "C" uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3,
      * uses them or not, which is safe for simple arg passing.
      */
     syscall_func sfunc;
+    uint32_t stats_index;
 
     switch (syscall_num) {
 #define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...)                               \
     case n:                                                                                        \
         sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
+        stats_index = kSyscallIndex_##name;                                                        \
         break;
 #include <magenta/syscalls.inc>
         default:
             sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
+            stats_index = kSyscallIndexInvalid;
     }
 
     /* call the routine */
+    ktrace(MX_KTRACE_SYSCALL_ENTER, static_cast<uint32_t>(syscall_num), 0, 0, 0);
+    lk_bigtime_t start = syscall_stats_begin();
     uint64_t ret = sfunc(arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8);
+    syscall_stats_record(stats_index, start);
+    ktrace(MX_KTRACE_SYSCALL_EXIT, static_cast<uint32_t>(syscall_num), static_cast<uint32_t>(ret),
+           static_cast<uint32_t>(ret >> 32), 0);
 
     /* check to see if there are any pending signals */
     thread_process_pending_signals();
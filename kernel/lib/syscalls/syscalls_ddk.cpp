@@ -22,6 +22,7 @@
 #include <magenta/pci_interrupt_dispatcher.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
+#include <magenta/vm_object_dispatcher.h>
 
 #include "syscalls_priv.h"
 
@@ -114,6 +115,52 @@ mx_status_t sys_mmap_device_memory(uintptr_t paddr, uint32_t len, void** out_vad
     return NO_ERROR;
 }
 
+mx_status_t sys_vm_object_lookup(mx_handle_t handle, uint64_t offset, mx_size_t len,
+                                 mx_paddr_t* pages, mx_size_t page_count) {
+    LTRACEF("handle %d, offset 0x%llx, len 0x%lx, page_count %lu\n", handle, offset, len, page_count);
+
+    if (!pages || len == 0)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return ERR_BAD_HANDLE;
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    // the device may both read and write the pages
+    if (!magenta_rights_check(rights, MX_RIGHT_READ | MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    // a page at a time through a small buffer, so any length can be looked up
+    // without a kernel allocation
+    const size_t kChunk = 32;
+    paddr_t buf[kChunk];
+    uint64_t end = offset + len;
+    if (end < offset)
+        return ERR_OUT_OF_RANGE;
+    uint64_t start = ROUNDDOWN(offset, PAGE_SIZE);
+    if ((ROUNDUP_PAGE_SIZE(end) - start) / PAGE_SIZE > page_count)
+        return ERR_NOT_ENOUGH_BUFFER;
+
+    for (uint64_t o = start; o < end; o += kChunk * PAGE_SIZE) {
+        uint64_t chunk_end = MIN(end, o + kChunk * PAGE_SIZE);
+        size_t count = (ROUNDUP_PAGE_SIZE(chunk_end) - o) / PAGE_SIZE;
+        mx_status_t status = vmo->Lookup(o, chunk_end - o, buf, count);
+        if (status != NO_ERROR)
+            return status;
+        if (copy_to_user(reinterpret_cast<uint8_t*>(pages), buf, count * sizeof(paddr_t)) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        pages += count;
+    }
+
+    return NO_ERROR;
+}
+
 mx_status_t sys_alloc_device_memory(uint32_t len, mx_paddr_t* out_paddr, void** out_vaddr) {
     LTRACEF("len 0x%x\n", len);
 
@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 
 #include <err.h>
+#include <kernel/cmdline.h>
 #include <platform.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -13,12 +14,17 @@
 #include <trace.h>
 
 #include <lib/console.h>
+#include <lib/ktrace.h>
+#include <lib/profile.h>
 #include <lib/user_copy.h>
 
 #include <lk/init.h>
 #include <platform/debug.h>
 
+#include <magenta/magenta.h>
+#include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
+#include <magenta/vm_object_dispatcher.h>
 
 #include "syscalls_priv.h"
 
@@ -30,6 +36,35 @@ constexpr uint32_t kMaxDebugWriteSize = 256u;
 #include <lib/debuglog.h>
 #endif
 
+bool debug_syscalls_enabled() {
+    return cmdline_get_bool("kernel.debug-syscalls", false);
+}
+
+// Returns a new handle in the current process to a kernel buffer that the
+// kernel keeps writing to, without MX_RIGHT_WRITE so user mode can only
+// look at it.
+static mx_handle_t make_read_only_vmo_handle(utils::RefPtr<VmObject> vmo) {
+    if (!vmo)
+        return ERR_BAD_STATE;
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    mx_status_t result = VmObjectDispatcher::Create(utils::move(vmo), &dispatcher, &rights);
+    if (result != NO_ERROR)
+        return result;
+
+    HandleUniquePtr handle(MakeHandle(utils::move(dispatcher), rights & ~MX_RIGHT_WRITE));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mx_handle_t hv = up->MapHandleToValue(handle.get());
+    up->AddHandle(utils::move(handle));
+
+    return hv;
+}
+
 int sys_debug_read(void* ptr, uint32_t len) {
     LTRACEF("ptr %p\n", ptr);
 
@@ -83,3 +118,39 @@ int sys_debug_send_command(const void* ptr, uint32_t len) {
     buf[len + 1] = 0;
     return console_run_script(buf);
 }
+
+mx_status_t sys_ktrace_control(uint32_t action, uint32_t options) {
+    LTRACEF("action %u, options 0x%x\n", action, options);
+
+    if (!debug_syscalls_enabled())
+        return ERR_ACCESS_DENIED;
+
+    return ktrace_control(action, options);
+}
+
+mx_handle_t sys_ktrace_get_vmo(void) {
+    LTRACE_ENTRY;
+
+    if (!debug_syscalls_enabled())
+        return ERR_ACCESS_DENIED;
+
+    return make_read_only_vmo_handle(ktrace_get_vmo());
+}
+
+mx_status_t sys_profile_control(uint32_t action, uint32_t options) {
+    LTRACEF("action %u, options %u\n", action, options);
+
+    if (!debug_syscalls_enabled())
+        return ERR_ACCESS_DENIED;
+
+    return profile_control(action, options);
+}
+
+mx_handle_t sys_profile_get_vmo(void) {
+    LTRACE_ENTRY;
+
+    if (!debug_syscalls_enabled())
+        return ERR_ACCESS_DENIED;
+
+    return make_read_only_vmo_handle(profile_get_vmo());
+}
@@ -14,6 +14,7 @@
 #include <kernel/vm/vm_object.h>
 #include <lib/console.h>
 #include <lib/crypto/global_prng.h>
+#include <lib/heap.h>
 #include <lib/user_copy.h>
 #include <list.h>
 
@@ -42,21 +43,27 @@
 #include <string.h>
 #include <trace.h>
 #include <utils/string_piece.h>
+#include <utils/unique_ptr.h>
 
 #include "syscalls_priv.h"
+#include "syscalls_stats.h"
 
 #define LOCAL_TRACE 0
 
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 1024u;
+// Handle arrays up to this long are copied through the syscall's stack.
+constexpr size_t kInlineMessageHandles = 16u;
 
 constexpr uint32_t kMaxWaitHandleCount = 256u;
+constexpr size_t kInlineWaitHandleCount = 8u;
 constexpr mx_size_t kDefaultDataPipeCapacity = 32 * 1024u;
 
 constexpr mx_size_t kMaxCPRNGDraw = MX_CPRNG_DRAW_MAX_LEN;
 constexpr mx_size_t kMaxCPRNGSeed = MX_CPRNG_ADD_ENTROPY_MAX_LEN;
 
 constexpr uint32_t kMaxWaitSetWaitResults = 1024u;
+constexpr size_t kInlineWaitSetWaitResults = 8u;
 
 namespace {
 // TODO(cpu): Move this handler to a common place.
@@ -159,32 +166,28 @@ mx_status_t sys_handle_wait_many(uint32_t count,
     if (count > kMaxWaitHandleCount)
         return ERR_INVALID_ARGS;
 
-    uint32_t max_size = kMaxWaitHandleCount * sizeof(uint32_t);
-    uint32_t bytes_size = static_cast<uint32_t>(sizeof(uint32_t) * count);
-
-    uint8_t* copy;
     status_t result;
 
-    result = magenta_copy_user_dynamic(_handle_values, &copy, bytes_size, max_size);
+    UserArray<mx_handle_t, kInlineWaitHandleCount> handle_values;
+    result = handle_values.CopyFromUser(_handle_values, count);
     if (result != NO_ERROR)
         return result;
-    utils::unique_ptr<int32_t[]> handle_values(reinterpret_cast<mx_handle_t*>(copy));
 
-    result = magenta_copy_user_dynamic(_signals, &copy, bytes_size, max_size);
+    UserArray<mx_signals_t, kInlineWaitHandleCount> signals;
+    result = signals.CopyFromUser(_signals, count);
     if (result != NO_ERROR)
         return result;
-    utils::unique_ptr<uint32_t[]> signals(reinterpret_cast<mx_signals_t*>(copy));
 
     AllocChecker ac;
     utils::unique_ptr<WaitStateObserver[]> wait_state_observers(new (&ac) WaitStateObserver[count]);
     if (!ac.check())
         return ERR_NO_MEMORY;
 
-    utils::unique_ptr<mx_signals_state_t[]> signals_states;
+    UserArray<mx_signals_state_t, kInlineWaitHandleCount> signals_states;
     if (_signals_states) {
-        signals_states.reset(new (&ac) mx_signals_state_t[count]);
-        if (!ac.check())
-            return ERR_NO_MEMORY;
+        result = signals_states.Reset(count);
+        if (result != NO_ERROR)
+            return result;
     }
 
     WaitEvent event;
@@ -231,7 +234,7 @@ mx_status_t sys_handle_wait_many(uint32_t count,
     // Regardless of wait outcome, we must call End().
     for (size_t ix = 0; ix != count; ++ix) {
         auto s = wait_state_observers[ix].End();
-        if (signals_states)
+        if (_signals_states)
             signals_states[ix] = s;
     }
 
@@ -241,8 +244,7 @@ mx_status_t sys_handle_wait_many(uint32_t count,
     }
 
     if (_signals_states) {
-        if (copy_to_user(_signals_states, signals_states.get(),
-                         sizeof(mx_signals_state_t) * count) != NO_ERROR)
+        if (signals_states.CopyToUser(_signals_states) != NO_ERROR)
             return ERR_INVALID_ARGS;
     }
 
@@ -290,6 +292,42 @@ mx_handle_t sys_handle_duplicate(mx_handle_t handle_value, mx_rights_t rights) {
     return dup_hv;
 }
 
+static mx_ssize_t HeapProfileCopyToUser(void* _info, mx_size_t info_size) {
+    if (!_info)
+        return ERR_INVALID_ARGS;
+
+    size_t max_sites = info_size / sizeof(mx_heap_profile_site_t);
+    if (max_sites == 0)
+        return ERR_NOT_ENOUGH_BUFFER;
+    if (max_sites > HEAP_PROFILE_MAX_SITES)
+        max_sites = HEAP_PROFILE_MAX_SITES;
+
+    uint rate = heap_profile_get_rate();
+    if (rate == 0)
+        return 0;
+
+    AllocChecker ac;
+    utils::unique_ptr<heap_profile_site[]> sites(new (&ac) heap_profile_site[max_sites]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    size_t count = heap_profile_read(sites.get(), max_sites);
+
+    auto dst = reinterpret_cast<mx_heap_profile_site_t*>(_info);
+    for (size_t i = 0; i < count; i++) {
+        mx_heap_profile_site_t site = {
+            reinterpret_cast<uintptr_t>(sites[i].caller),
+            sites[i].allocs * rate,
+            sites[i].alloc_bytes * rate,
+            sites[i].live * rate,
+            sites[i].live_bytes * rate,
+        };
+        if (copy_to_user(reinterpret_cast<uint8_t*>(dst + i), &site, sizeof(site)) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+
+    return static_cast<mx_ssize_t>(count * sizeof(mx_heap_profile_site_t));
+}
+
 mx_ssize_t sys_handle_get_info(mx_handle_t handle, uint32_t topic, void* _info, mx_size_t info_size) {
     auto up = ProcessDispatcher::GetCurrent();
     utils::RefPtr<Dispatcher> dispatcher;
@@ -346,6 +384,55 @@ mx_ssize_t sys_handle_get_info(mx_handle_t handle, uint32_t topic, void* _info,
 
             return sizeof(mx_process_info_t);
         }
+        case MX_INFO_SYSCALL_STATS: {
+            // The counts are system wide; any process handle that can be
+            // read is enough to see them.
+            if (!dispatcher->get_process_dispatcher())
+                return ERR_WRONG_TYPE;
+
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            return syscall_stats_copy_to_user(_info, info_size);
+        }
+        case MX_INFO_HEAP_PROFILE: {
+            if (!dispatcher->get_process_dispatcher())
+                return ERR_WRONG_TYPE;
+
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            // The sites are kernel pcs, so any process could use them to
+            // find the kernel's layout.
+            if (!debug_syscalls_enabled())
+                return ERR_ACCESS_DENIED;
+
+            return HeapProfileCopyToUser(_info, info_size);
+        }
+        case MX_INFO_RUNTIME: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            if (info_size < sizeof(mx_runtime_info_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            mx_runtime_info_t info = {};
+            if (auto process = dispatcher->get_process_dispatcher()) {
+                info.cpu_time = process->GetRuntime();
+            } else if (auto thread = dispatcher->get_thread_dispatcher()) {
+                info.cpu_time = thread->thread()->runtime();
+            } else {
+                return ERR_WRONG_TYPE;
+            }
+
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), &info, sizeof(info)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return sizeof(mx_runtime_info_t);
+        }
         default:
             return ERR_INVALID_ARGS;
     }
@@ -459,15 +546,6 @@ mx_status_t sys_message_read(mx_handle_t handle_value, void* _bytes, uint32_t* _
     if (_handles != 0u && !_num_handles)
         return ERR_INVALID_ARGS;
 
-    utils::unique_ptr<uint32_t[]> handles;
-
-    AllocChecker ac;
-    if (num_handles) {
-        handles.reset(new (&ac) uint32_t[num_handles]());
-        if (!ac.check())
-            return ERR_NO_MEMORY;
-    }
-
     uint32_t next_message_size = 0u;
     uint32_t next_message_num_handles = 0u;
     status_t result = msg_pipe->BeginRead(&next_message_size, &next_message_num_handles);
@@ -488,6 +566,12 @@ mx_status_t sys_message_read(mx_handle_t handle_value, void* _bytes, uint32_t* _
     if (num_bytes < next_message_size || num_handles < next_message_num_handles)
         return ERR_NOT_ENOUGH_BUFFER;
 
+    // Get the room for the handle values now, since the message can't be put back.
+    UserArray<mx_handle_t, kInlineMessageHandles> handles;
+    result = handles.Reset(next_message_num_handles);
+    if (result != NO_ERROR)
+        return result;
+
     // OK, now we can accept the message.
     utils::Array<uint8_t> bytes;
     utils::Array<Handle*> handle_list;
@@ -502,12 +586,11 @@ mx_status_t sys_message_read(mx_handle_t handle_value, void* _bytes, uint32_t* _
     }
 
     if (next_message_num_handles != 0u) {
-        for (size_t ix = 0u; ix < next_message_num_handles; ++ix) {
-            auto hv = up->MapHandleToValue(handle_list[ix]);
-            if (copy_to_user_32(&_handles[ix], hv) != NO_ERROR) {
-                // $$$ free handles.
-                return ERR_INVALID_ARGS;
-            }
+        for (size_t ix = 0u; ix < next_message_num_handles; ++ix)
+            handles[ix] = up->MapHandleToValue(handle_list[ix]);
+        if (handles.CopyToUser(_handles) != NO_ERROR) {
+            // $$$ free handles.
+            return ERR_INVALID_ARGS;
         }
     }
 
@@ -563,17 +646,11 @@ mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint
         bytes.reset(copy, num_bytes);
     }
 
-    utils::unique_ptr<mx_handle_t[], utils::free_delete> handles;
-    if (num_handles) {
-        void* c_handles;
-        status_t status = copy_from_user_dynamic(
-            &c_handles, _handles, num_handles * sizeof(_handles[0]), kMaxMessageHandles);
-        // |status| can be ERR_NO_MEMORY or ERR_INVALID_ARGS.
-        if (status != NO_ERROR)
-            return status;
-
-        handles.reset(static_cast<mx_handle_t*>(c_handles));
-    }
+    UserArray<mx_handle_t, kInlineMessageHandles> handles;
+    result = handles.CopyFromUser(_handles, num_handles);
+    // |result| can be ERR_NO_MEMORY or ERR_INVALID_ARGS.
+    if (result != NO_ERROR)
+        return result;
 
     AllocChecker ac;
     utils::Array<Handle*> handle_list(new (&ac) Handle*[num_handles], num_handles);
@@ -925,6 +1002,18 @@ mx_status_t sys_futex_requeue(int* wake_ptr, uint32_t wake_count, int current_va
         wake_ptr, wake_count, current_value, requeue_ptr, requeue_count);
 }
 
+mx_status_t sys_futex_lock_pi(int* value_ptr, int current_value, mx_time_t timeout) {
+    return ProcessDispatcher::GetCurrent()->futex_context()->FutexLockPi(value_ptr, current_value, timeout);
+}
+
+mx_status_t sys_futex_unlock_pi(int* value_ptr) {
+    return ProcessDispatcher::GetCurrent()->futex_context()->FutexUnlockPi(value_ptr);
+}
+
+int sys_futex_self_tid() {
+    return UserThread::GetCurrent()->futex_tid();
+}
+
 mx_handle_t sys_vm_object_create(uint64_t size) {
     LTRACEF("size 0x%llx\n", size);
 
@@ -1202,6 +1291,13 @@ mx_status_t sys_process_vm_protect(mx_handle_t proc_handle, uintptr_t address, m
         arch_mmu_flags |= ARCH_MMU_FLAG_PERM_NO_EXECUTE;
     }
 
+    // the rights of the vmo handle were checked against the permissions the
+    // region was mapped with, so it can't be given any more than those
+    uint initial = r->initial_arch_mmu_flags();
+    uint restrictions = ARCH_MMU_FLAG_PERM_RO | ARCH_MMU_FLAG_PERM_NO_EXECUTE;
+    if ((initial & restrictions) & ~(arch_mmu_flags & restrictions))
+        return ERR_ACCESS_DENIED;
+
     return r->Protect(arch_mmu_flags);
 }
 
@@ -1736,17 +1832,16 @@ mx_status_t sys_wait_set_wait(mx_handle_t ws_handle,
     if (copy_from_user_u32(&num_results, _num_results) != NO_ERROR)
         return ERR_INVALID_ARGS;
 
-    utils::unique_ptr<mx_wait_set_result_t[]> results;
+    UserArray<mx_wait_set_result_t, kInlineWaitSetWaitResults> results;
     if (num_results > 0u) {
         if (num_results > kMaxWaitSetWaitResults)
             return ERR_TOO_BIG;
 
         // TODO(vtl): It kind of sucks that we always have to allocate the indicated maximum size
         // here (namely, |num_results|).
-        AllocChecker ac;
-        results.reset(new (&ac) mx_wait_set_result_t[num_results]);
-        if (!ac.check())
-            return ERR_NO_MEMORY;
+        mx_status_t status = results.Reset(num_results);
+        if (status != NO_ERROR)
+            return status;
     }
 
     auto up = ProcessDispatcher::GetCurrent();
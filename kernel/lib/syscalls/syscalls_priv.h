@@ -14,3 +14,7 @@
 #define MAGENTA_DDKCALL_DEF(a...) MAGENTA_SYSCALL_DEF(a)
 #define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) ret sys_##name(args);
 #include <magenta/syscalls.inc>
+
+// Whether user mode may use the syscalls that expose kernel addresses and
+// event timing, which needs kernel.debug-syscalls on the kernel commandline.
+bool debug_syscalls_enabled();
@@ -0,0 +1,178 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "syscalls_stats.h"
+
+#include <err.h>
+#include <arch/ops.h>
+#include <kernel/mp.h>
+#include <lib/console.h>
+#include <lib/heap.h>
+#include <lib/user_copy.h>
+#include <lk/init.h>
+#include <stdio.h>
+#include <string.h>
+
+#if SYSCALL_STATS
+
+namespace {
+
+#define MAGENTA_DDKCALL_DEF(a...) MAGENTA_SYSCALL_DEF(a)
+#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) n,
+const uint32_t kSyscallNums[kSyscallIndexCount] = {
+#include <magenta/syscalls.inc>
+    UINT32_MAX,
+};
+
+#define MAGENTA_DDKCALL_DEF(a...) MAGENTA_SYSCALL_DEF(a)
+#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) #name,
+const char* const kSyscallNames[kSyscallIndexCount] = {
+#include <magenta/syscalls.inc>
+    "invalid",
+};
+
+// One cpu's counters for one syscall. The call count is the sum of the
+// histogram, so it isn't kept separately.
+struct SyscallCpuStats {
+    uint64_t total_time;
+    uint32_t latency[MX_SYSCALL_LATENCY_BUCKETS];
+};
+
+// One cpu's counters for every syscall, padded so that cpus never share a
+// cache line.
+struct __ALIGNED(CACHE_LINE) SyscallCpuRow {
+    SyscallCpuStats stats[kSyscallIndexCount];
+};
+
+// Allocated for the cpus actually present before user space starts.
+SyscallCpuRow* cpu_rows;
+uint num_cpu_rows;
+
+inline uint latency_bucket(lk_bigtime_t us) {
+    if (us == 0)
+        return 0;
+    uint bucket = 64u - static_cast<uint>(__builtin_clzll(us));
+    return bucket < MX_SYSCALL_LATENCY_BUCKETS ? bucket : MX_SYSCALL_LATENCY_BUCKETS - 1;
+}
+
+// Sums the counters for |index| over all cpus into |out|.
+void syscall_stats_sum(uint32_t index, mx_syscall_stats_t* out) {
+    memset(out, 0, sizeof(*out));
+    out->num = kSyscallNums[index];
+    for (uint cpu = 0; cpu < num_cpu_rows; cpu++) {
+        const SyscallCpuStats& stats = cpu_rows[cpu].stats[index];
+        out->total_time += stats.total_time;
+        for (uint i = 0; i < MX_SYSCALL_LATENCY_BUCKETS; i++) {
+            out->latency[i] += stats.latency[i];
+            out->count += stats.latency[i];
+        }
+    }
+}
+
+void syscall_stats_init(uint level) {
+    uint num_cpus = arch_max_num_cpus();
+
+    cpu_rows = static_cast<SyscallCpuRow*>(
+        memalign(alignof(SyscallCpuRow), sizeof(SyscallCpuRow) * num_cpus));
+    if (!cpu_rows) {
+        printf("syscall stats: failed to allocate counters\n");
+        return;
+    }
+    memset(cpu_rows, 0, sizeof(SyscallCpuRow) * num_cpus);
+    num_cpu_rows = num_cpus;
+}
+
+} // namespace
+
+void syscall_stats_record(uint32_t index, lk_bigtime_t start) {
+    lk_bigtime_t elapsed = current_time_hires() - start;
+
+    // If the thread migrates between here and the update the counts land
+    // on the wrong cpu, which only matters for the per-cpu view.
+    uint cpu = arch_curr_cpu_num();
+    if (unlikely(cpu >= num_cpu_rows))
+        return;
+
+    SyscallCpuStats& stats = cpu_rows[cpu].stats[index];
+    stats.total_time += elapsed;
+    stats.latency[latency_bucket(elapsed)]++;
+}
+
+mx_ssize_t syscall_stats_copy_to_user(void* _info, mx_size_t info_size) {
+    if (!_info)
+        return ERR_INVALID_ARGS;
+
+    if (info_size < sizeof(mx_syscall_stats_t))
+        return ERR_NOT_ENOUGH_BUFFER;
+
+    auto dst = reinterpret_cast<uint8_t*>(_info);
+    mx_size_t written = 0;
+    for (uint32_t index = 0; index < kSyscallIndexInvalid; index++) {
+        if (info_size - written < sizeof(mx_syscall_stats_t))
+            break;
+
+        mx_syscall_stats_t stats;
+        syscall_stats_sum(index, &stats);
+        if (stats.count == 0)
+            continue;
+
+        if (copy_to_user(dst + written, &stats, sizeof(stats)) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        written += sizeof(stats);
+    }
+
+    return static_cast<mx_ssize_t>(written);
+}
+
+LK_INIT_HOOK(syscall_stats, syscall_stats_init, LK_INIT_LEVEL_APPS - 2);
+
+#if WITH_LIB_CONSOLE
+static int cmd_syscallstats(int argc, const cmd_args* argv) {
+    if (argc > 1 && !strcmp(argv[1].str, "reset")) {
+        // Racy against syscalls in flight, which is fine for counters.
+        memset(cpu_rows, 0, sizeof(SyscallCpuRow) * num_cpu_rows);
+        return 0;
+    }
+
+    bool histograms = argc > 1 && !strcmp(argv[1].str, "hist");
+
+    printf("%-28s %6s %12s %12s %10s\n", "syscall", "num", "count", "total us", "avg us");
+    for (uint32_t index = 0; index < kSyscallIndexCount; index++) {
+        mx_syscall_stats_t stats;
+        syscall_stats_sum(index, &stats);
+        if (stats.count == 0)
+            continue;
+
+        printf("%-28s %6u %12llu %12llu %10llu\n", kSyscallNames[index], stats.num,
+               stats.count, stats.total_time, stats.total_time / stats.count);
+
+        if (!histograms)
+            continue;
+        for (uint i = 0; i < MX_SYSCALL_LATENCY_BUCKETS; i++) {
+            if (stats.latency[i] == 0)
+                continue;
+            if (i == MX_SYSCALL_LATENCY_BUCKETS - 1)
+                printf("\t>= %8lluus %12llu\n", 1ull << (i - 1), stats.latency[i]);
+            else
+                printf("\t<  %8lluus %12llu\n", 1ull << i, stats.latency[i]);
+        }
+    }
+
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("syscallstats", "syscall counts and latencies [hist|reset]", &cmd_syscallstats)
+STATIC_COMMAND_END(syscallstats);
+#endif
+
+#else // !SYSCALL_STATS
+
+mx_ssize_t syscall_stats_copy_to_user(void* _info, mx_size_t info_size) {
+    return ERR_NOT_SUPPORTED;
+}
+
+#endif
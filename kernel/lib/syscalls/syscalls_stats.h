@@ -0,0 +1,58 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/types.h>
+#include <magenta/syscalls-types.h>
+#include <platform.h>
+#include <stdint.h>
+
+// Per-syscall call counts and latency histograms.
+//
+// Every syscall gets a dense index, generated from syscalls.inc in table
+// order, and the dispatchers record each call against that index on the
+// current cpu. The counters are plain per-cpu increments with no atomics,
+// so a thread preempted in the middle of an update can occasionally lose a
+// count; that is the price of keeping them cheap enough to leave on.
+//
+// Latency is wall time from dispatch to return, so syscalls that block
+// (waits, futexes, sleeps) include the time spent blocked.
+
+#ifndef SYSCALL_STATS
+#define SYSCALL_STATS 1
+#endif
+
+enum : uint32_t {
+#define MAGENTA_DDKCALL_DEF(a...) MAGENTA_SYSCALL_DEF(a)
+#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) kSyscallIndex_##name,
+#include <magenta/syscalls.inc>
+    kSyscallIndexInvalid,
+    kSyscallIndexCount,
+};
+
+#if SYSCALL_STATS
+
+static inline lk_bigtime_t syscall_stats_begin(void) {
+    return current_time_hires();
+}
+
+void syscall_stats_record(uint32_t index, lk_bigtime_t start);
+
+#else
+
+static inline lk_bigtime_t syscall_stats_begin(void) {
+    return 0;
+}
+
+static inline void syscall_stats_record(uint32_t index, lk_bigtime_t start) {}
+
+#endif
+
+// Copies out one mx_syscall_stats_t, summed over all cpus, for every
+// syscall that has been called at least once. Returns the number of bytes
+// written or an error.
+mx_ssize_t syscall_stats_copy_to_user(void* _info, mx_size_t info_size);
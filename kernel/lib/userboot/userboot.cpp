@@ -4,6 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
@@ -22,6 +23,7 @@
 #include <magenta/msg_pipe_dispatcher.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/processargs.h>
+#include <magenta/vdso-data.h>
 #include <magenta/vm_object_dispatcher.h>
 
 #include "code-start.h"
@@ -56,6 +58,25 @@ static utils::RefPtr<VmObject> make_vmo_from_memory(const void* data,
     return vmo;
 }
 
+// Fill in the vDSO's read-only data page, which lets it answer some
+// system calls without entering the kernel.  Every process maps this
+// same VM object, so it only holds system-wide constants.
+static mx_status_t fill_vdso_data(utils::RefPtr<VmObject> vmo) {
+    static_assert(VDSO_DATA_END - VDSO_DATA_START >= sizeof(mx_vdso_data),
+                  "vDSO data page is too small");
+
+    mx_vdso_data data = {};
+    data.num_cpus = arch_max_num_cpus();
+    data.ticks_to_ns_mult = platform_user_ticks_to_ns_mult();
+
+    size_t written;
+    mx_status_t status = vmo->Write(&data, VDSO_DATA_START, sizeof(data),
+                                    &written);
+    if (status < 0)
+        return status;
+    return written == sizeof(data) ? NO_ERROR : ERR_IO;
+}
+
 // Get a handle to a VM object, with full rights except perhaps for writing.
 static mx_status_t get_vmo_handle(utils::RefPtr<VmObject> vmo, bool readonly,
                                   HandleUniquePtr* ptr) {
@@ -241,8 +262,12 @@ static int attempt_userboot(const void* bootfs, size_t bfslen) {
     if (!vdso_vmo || !userboot_vmo)
         return ERR_NO_MEMORY;
 
+    mx_status_t status = fill_vdso_data(vdso_vmo);
+    if (status != NO_ERROR)
+        return status;
+
     HandleUniquePtr handles[BOOTSTRAP_HANDLES];
-    mx_status_t status = get_vmo_handle(make_vmo_from_memory(bootfs, bfslen),
+    status = get_vmo_handle(make_vmo_from_memory(bootfs, bfslen),
                                         false, &handles[BOOTSTRAP_BOOTFS]);
     if (status == NO_ERROR)
         status = get_vmo_handle(make_vmo_from_memory(rbase, rsize),
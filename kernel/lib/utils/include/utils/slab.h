@@ -0,0 +1,145 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <assert.h>
+#include <new.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arch/defines.h>
+#include <kernel/mutex.h>
+#include <list.h>
+
+namespace utils {
+
+// Slab is an object cache for objects of a single size, meant for the
+// kernel objects that are created and destroyed on every IPC and so would
+// otherwise hammer the global heap lock.
+//
+// Each cpu keeps a small cache of free objects that it can allocate from
+// and free to with interrupts briefly disabled and no locks taken. When a
+// cpu cache runs dry it grabs a batch of objects from the shared depot,
+// and when it grows too large it hands a batch back, so the depot mutex
+// is only taken once per batch. The depot carves whole pages into
+// objects. Pages are only returned to the system when the slab itself is
+// destroyed with no objects outstanding.
+//
+// Alloc() and Free() may block and so can't be called from interrupt
+// context. Objects must be no larger than a page.
+class Slab {
+public:
+    struct Stats {
+        size_t ob_size;
+        uint64_t allocs;
+        uint64_t frees;
+        uint64_t cpu_hits;      // allocations served from a cpu cache
+        uint64_t depot_refills; // batches moved from the depot to a cpu
+        uint64_t depot_returns; // batches moved from a cpu to the depot
+        size_t depot_free;      // free objects sitting in the depot
+        size_t pages;
+    };
+
+    Slab(const char* name, size_t ob_size);
+    ~Slab();
+
+    void* Alloc();
+    void Free(void* addr);
+
+    // Counters are summed over cpus without synchronization, so they are
+    // only approximately consistent with each other.
+    void GetStats(Stats* stats) const;
+
+    const char* name() const { return name_; }
+
+    // Prints the stats of every slab in the system.
+    static void DumpAll();
+
+private:
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    // Free objects are threaded through their first word.
+    struct FreeObject {
+        FreeObject* next;
+    };
+
+    struct __ALIGNED(CACHE_LINE) CpuCache {
+        FreeObject* head;
+        size_t count;
+        uint64_t allocs;
+        uint64_t frees;
+        uint64_t hits;
+    };
+
+    void* AllocSlow();
+    void ReturnToDepot(FreeObject* head, FreeObject* tail, size_t count);
+    bool GrowLocked();
+
+    const char* const name_;
+    const size_t ob_size_;
+
+    CpuCache cpu_[SMP_MAX_CPUS];
+
+    mutable mutex_t depot_lock_;
+    FreeObject* depot_;
+    size_t depot_count_;
+    uint64_t depot_refills_;
+    uint64_t depot_returns_;
+    size_t pages_;
+    // Every page the depot has carved up, threaded through its vm_page.
+    list_node page_list_;
+
+    // Global list of slabs, for DumpAll().
+    Slab* next_;
+};
+
+// Opts a type into its own slab cache, replacing the AllocChecker form of
+// operator new and the matching operator delete:
+//
+//   struct Foo : public utils::SlabAllocated<Foo> { ... };
+//   DECLARE_SLAB_ALLOCATED(Foo);
+//
+//   // in exactly one .cpp file
+//   DEFINE_SLAB_ALLOCATED(Foo, "foo");
+//
+//   AllocChecker ac;
+//   auto foo = new (&ac) Foo(...);
+//
+// Only final types may opt in; every object of the cache is sizeof(T).
+template <typename T>
+class SlabAllocated {
+public:
+    static void* operator new(size_t size, AllocChecker* ac) {
+        // T is still incomplete in the class body, so check it here.
+        static_assert(__is_final(T), "only final types can be slab allocated");
+        DEBUG_ASSERT(size == sizeof(T));
+        void* mem = slab_.Alloc();
+        ac->arm(size, mem != nullptr);
+        return mem;
+    }
+
+    static void* operator new(size_t, void* ptr) {
+        return ptr;
+    }
+
+    static void operator delete(void* mem) {
+        if (mem)
+            slab_.Free(mem);
+    }
+
+private:
+    static Slab slab_;
+};
+
+}
+
+#define DECLARE_SLAB_ALLOCATED(type) \
+    template <> utils::Slab utils::SlabAllocated<type>::slab_
+
+#define DEFINE_SLAB_ALLOCATED(type, name) \
+    template <> utils::Slab utils::SlabAllocated<type>::slab_(name, sizeof(type))
@@ -24,6 +24,8 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/intrusive_singly_linked_list_tests.cpp \
     $(LOCAL_DIR)/ref_counted_tests.cpp \
     $(LOCAL_DIR)/ref_ptr_tests.cpp \
+    $(LOCAL_DIR)/slab.cpp \
+    $(LOCAL_DIR)/slab_tests.cpp \
     $(LOCAL_DIR)/unique_ptr_tests.cpp \
 
 include make/module.mk
@@ -0,0 +1,243 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <utils/slab.h>
+
+#include <arch/ops.h>
+#include <err.h>
+#include <kernel/auto_lock.h>
+#include <kernel/spinlock.h>
+#include <kernel/vm.h>
+#include <lib/console.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace utils {
+
+namespace {
+
+// Objects moved between a cpu cache and the depot at a time.
+constexpr size_t kBatch = 16;
+// A cpu cache hands a batch back to the depot when it grows past this.
+constexpr size_t kCpuCacheMax = 2 * kBatch;
+
+mutex_t slab_list_lock = MUTEX_INITIAL_VALUE(slab_list_lock);
+Slab* slab_list;
+
+} // namespace
+
+Slab::Slab(const char* name, size_t ob_size)
+    : name_(name),
+      ob_size_(ROUNDUP(ob_size < sizeof(FreeObject) ? sizeof(FreeObject) : ob_size, 16u)),
+      depot_(nullptr),
+      depot_count_(0u),
+      depot_refills_(0u),
+      depot_returns_(0u),
+      pages_(0u),
+      page_list_(LIST_INITIAL_VALUE(page_list_)) {
+    DEBUG_ASSERT(ob_size_ <= PAGE_SIZE);
+    memset(cpu_, 0, sizeof(cpu_));
+    mutex_init(&depot_lock_);
+
+    AutoLock lock(&slab_list_lock);
+    next_ = slab_list;
+    slab_list = this;
+}
+
+Slab::~Slab() {
+    {
+        AutoLock lock(&slab_list_lock);
+        for (Slab** s = &slab_list; *s; s = &(*s)->next_) {
+            if (*s == this) {
+                *s = next_;
+                break;
+            }
+        }
+    }
+
+    // Every object sits in a cpu cache or the depot once allocs and frees
+    // balance, so the pages can go back wholesale. Otherwise something
+    // still points into them and they have to be leaked.
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    for (const CpuCache& cache : cpu_) {
+        allocs += cache.allocs;
+        frees += cache.frees;
+    }
+    if (allocs == frees) {
+        pmm_free(&page_list_);
+    } else {
+        printf("slab %s: destroyed with %llu objects outstanding, leaking %zu pages\n",
+               name_, allocs - frees, pages_);
+    }
+    mutex_destroy(&depot_lock_);
+}
+
+void* Slab::Alloc() {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    CpuCache& cache = cpu_[arch_curr_cpu_num()];
+    FreeObject* obj = cache.head;
+    if (likely(obj)) {
+        cache.head = obj->next;
+        cache.count--;
+        cache.allocs++;
+        cache.hits++;
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return obj ? obj : AllocSlow();
+}
+
+void* Slab::AllocSlow() {
+    FreeObject* head;
+    FreeObject* tail;
+    size_t count;
+    {
+        AutoLock lock(&depot_lock_);
+        if (!depot_ && !GrowLocked())
+            return nullptr;
+
+        // Detach up to a batch from the front of the depot.
+        head = depot_;
+        tail = head;
+        count = 1;
+        while (count < kBatch && tail->next) {
+            tail = tail->next;
+            count++;
+        }
+        depot_ = tail->next;
+        depot_count_ -= count;
+        depot_refills_++;
+    }
+
+    // Keep the first object and give the rest to whichever cpu we are on
+    // now, which needn't be the one whose cache was empty.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    CpuCache& cache = cpu_[arch_curr_cpu_num()];
+    cache.allocs++;
+    if (count > 1) {
+        tail->next = cache.head;
+        cache.head = head->next;
+        cache.count += count - 1;
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return head;
+}
+
+void Slab::Free(void* addr) {
+    if (!addr)
+        return;
+
+    FreeObject* obj = static_cast<FreeObject*>(addr);
+    FreeObject* batch = nullptr;
+    FreeObject* batch_tail = nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    CpuCache& cache = cpu_[arch_curr_cpu_num()];
+    obj->next = cache.head;
+    cache.head = obj;
+    cache.count++;
+    cache.frees++;
+
+    if (cache.count > kCpuCacheMax) {
+        // Return the batch at the front of the list; walking it only
+        // touches objects that were just freed on this cpu.
+        batch = cache.head;
+        batch_tail = batch;
+        for (size_t i = 1; i < kBatch; i++)
+            batch_tail = batch_tail->next;
+        cache.head = batch_tail->next;
+        cache.count -= kBatch;
+        batch_tail->next = nullptr;
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (batch)
+        ReturnToDepot(batch, batch_tail, kBatch);
+}
+
+void Slab::ReturnToDepot(FreeObject* head, FreeObject* tail, size_t count) {
+    AutoLock lock(&depot_lock_);
+    tail->next = depot_;
+    depot_ = head;
+    depot_count_ += count;
+    depot_returns_++;
+}
+
+bool Slab::GrowLocked() {
+    DEBUG_ASSERT(is_mutex_held(&depot_lock_));
+
+    paddr_t pa;
+    char* page = static_cast<char*>(pmm_alloc_kpages(1, &page_list_, &pa));
+    if (!page)
+        return false;
+
+    // Thread the page onto the depot back to front so that objects are
+    // handed out in address order.
+    size_t count = PAGE_SIZE / ob_size_;
+    for (size_t i = count; i > 0; i--) {
+        FreeObject* obj = reinterpret_cast<FreeObject*>(page + (i - 1) * ob_size_);
+        obj->next = depot_;
+        depot_ = obj;
+    }
+    depot_count_ += count;
+    pages_++;
+    return true;
+}
+
+void Slab::GetStats(Stats* stats) const {
+    memset(stats, 0, sizeof(*stats));
+    stats->ob_size = ob_size_;
+    for (const CpuCache& cache : cpu_) {
+        stats->allocs += cache.allocs;
+        stats->frees += cache.frees;
+        stats->cpu_hits += cache.hits;
+    }
+
+    AutoLock lock(&depot_lock_);
+    stats->depot_refills = depot_refills_;
+    stats->depot_returns = depot_returns_;
+    stats->depot_free = depot_count_;
+    stats->pages = pages_;
+}
+
+void Slab::DumpAll() {
+    printf("%-20s %6s %10s %10s %10s %8s %8s %8s %6s\n", "name", "size", "in use",
+           "allocs", "cpu hits", "refills", "returns", "depot", "pages");
+
+    AutoLock lock(&slab_list_lock);
+    for (Slab* s = slab_list; s; s = s->next_) {
+        Stats stats;
+        s->GetStats(&stats);
+        printf("%-20s %6zu %10llu %10llu %10llu %8llu %8llu %8zu %6zu\n", s->name_,
+               stats.ob_size, stats.allocs - stats.frees, stats.allocs, stats.cpu_hits,
+               stats.depot_refills, stats.depot_returns, stats.depot_free, stats.pages);
+    }
+}
+
+}
+
+#if WITH_LIB_CONSOLE
+static int cmd_slabs(int argc, const cmd_args* argv) {
+    utils::Slab::DumpAll();
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("slabs", "kernel object slab cache statistics", &cmd_slabs)
+STATIC_COMMAND_END(slabs);
+#endif
@@ -0,0 +1,88 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <app/tests.h>
+#include <string.h>
+#include <unittest.h>
+
+#include <utils/slab.h>
+
+static int slab_dtor_count = 0;
+
+struct SlabFoo final : public utils::SlabAllocated<SlabFoo> {
+    int xx, yy, zz;
+
+    SlabFoo(int x, int y, int z) : xx(x), yy(y), zz(z) {}
+    ~SlabFoo() { ++slab_dtor_count; }
+};
+
+DECLARE_SLAB_ALLOCATED(SlabFoo);
+DEFINE_SLAB_ALLOCATED(SlabFoo, "slab_tests_foo");
+
+static bool slab_test(void* context)
+{
+    BEGIN_TEST;
+    utils::Slab slab("slab_tests", 40);
+
+    const int count = 200;
+    void* objs[count] = {0};
+
+    for (int times = 0; times != 3; ++times) {
+        for (int ix = 0; ix != count; ++ix) {
+            objs[ix] = slab.Alloc();
+            EXPECT_TRUE(objs[ix] != nullptr, "");
+            EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(objs[ix]) % 16u, "misaligned object");
+            memset(objs[ix], 0xa5, 40);
+        }
+
+        for (int ix = 0; ix != count; ++ix) {
+            for (int jx = ix + 1; jx != count; ++jx)
+                EXPECT_NEQ(objs[ix], objs[jx], "object handed out twice");
+        }
+
+        for (int ix = 0; ix != count; ++ix)
+            slab.Free(objs[ix]);
+    }
+
+    utils::Slab::Stats stats;
+    slab.GetStats(&stats);
+    EXPECT_EQ(48u, stats.ob_size, "");
+    EXPECT_EQ(3u * count, stats.allocs, "");
+    EXPECT_EQ(stats.allocs, stats.frees, "");
+    EXPECT_GT(stats.cpu_hits, 0u, "");
+    EXPECT_GE(stats.pages, (count * 48u + PAGE_SIZE - 1) / PAGE_SIZE, "");
+
+    END_TEST;
+}
+
+static bool slab_allocated_test(void* context)
+{
+    BEGIN_TEST;
+    const int count = 30;
+    SlabFoo* foos[count] = {0};
+    slab_dtor_count = 0;
+
+    for (int ix = 0; ix != count; ++ix) {
+        AllocChecker ac;
+        foos[ix] = new (&ac) SlabFoo(17, 5, ix + 100);
+        EXPECT_TRUE(ac.check(), "");
+    }
+
+    for (int ix = 0; ix != count; ++ix) {
+        EXPECT_EQ(17, foos[ix]->xx, "");
+        EXPECT_EQ(5, foos[ix]->yy, "");
+        EXPECT_EQ(ix + 100, foos[ix]->zz, "");
+        delete foos[ix];
+    }
+
+    EXPECT_EQ(count, slab_dtor_count, "");
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(slab_tests)
+UNITTEST("Slab allocator test", slab_test)
+UNITTEST("Slab allocated type test", slab_allocated_test)
+UNITTEST_END_TESTCASE(slab_tests, "slabtests", "Slab allocator test", NULL, NULL);
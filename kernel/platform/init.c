@@ -35,3 +35,8 @@ __WEAK void *platform_get_ramdisk(size_t *size)
     *size = 0;
     return NULL;
 }
+
+__WEAK uint64_t platform_user_ticks_to_ns_mult(void)
+{
+    return 0;
+}
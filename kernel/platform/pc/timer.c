@@ -60,6 +60,11 @@ static uint8_t apic_divisor = 0;
 // TSC timer calibration values
 static uint64_t tsc_ticks_per_ms;
 
+// Fixed-point (32.32) nanoseconds per TSC tick, so that converting the
+// TSC doesn't need a 64-bit division. The vDSO scales the TSC with the
+// same multiplier, so kernel and userspace time can't drift apart.
+static uint64_t tsc_ns_mult;
+
 uint64_t get_tsc_ticks_per_ms(void) {
     return tsc_ticks_per_ms;
 }
@@ -90,13 +95,21 @@ lk_time_t current_time(void)
     return time;
 }
 
+static inline uint64_t tsc_scale(uint64_t tsc, uint64_t mult)
+{
+#if __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)tsc * mult) >> 32);
+#else
+    return ((tsc >> 32) * mult) + (((tsc & 0xffffffff) * mult) >> 32);
+#endif
+}
+
 lk_bigtime_t current_time_hires(void)
 {
     lk_bigtime_t time;
 
     if (invariant_tsc) {
-        uint64_t tsc = rdtsc();
-        time = tsc / (tsc_ticks_per_ms / 1000);
+        time = tsc_scale(rdtsc(), tsc_ns_mult) / 1000;
     } else {
         // XXX slight race
         time = (lk_bigtime_t) ((timer_current_time >> 22) * 1000) >> 10;
@@ -326,10 +339,16 @@ static void calibrate_tsc(void)
     }
 
     tsc_ticks_per_ms = best_time;
+    tsc_ns_mult = (1000000ULL << 32) / tsc_ticks_per_ms;
 
     LTRACEF("TSC calibrated: %llu ticks/ms\n", tsc_ticks_per_ms);
 }
 
+uint64_t platform_user_ticks_to_ns_mult(void)
+{
+    return invariant_tsc ? tsc_ns_mult : 0;
+}
+
 void platform_init_timer(uint level)
 {
     invariant_tsc = x86_feature_test(X86_FEATURE_INVAR_TSC);
@@ -13,6 +13,8 @@ MODULES += \
     lib/syscalls \
     lib/userboot \
     lib/debuglog \
+    lib/ktrace \
+    lib/profile \
 
 # include all ulib, uapp, and utest from system/...
 MODULES += $(patsubst %/rules.mk,%,$(wildcard system/ulib/*/rules.mk))
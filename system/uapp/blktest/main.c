@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <magenta/syscalls.h>
 #include <magenta/types.h>
 #include <mxio/io.h>
 #include <sys/param.h>
@@ -22,6 +23,7 @@
 #include <unistd.h>
 #include <limits.h>
 
+#include <ddk/iotxn.h>
 #include <ddk/protocol/block.h>
 
 static int do_test(const char* dev, mx_off_t offset, mx_off_t count, uint8_t pattern) {
@@ -99,6 +101,168 @@ fail:
     return rc;
 }
 
+typedef struct {
+    mx_handle_t pipe;
+    block_ring_t* ring;
+    void* data;
+    size_t chunk;
+    bool busy[BLOCK_RING_ENTRIES];
+} ring_client_t;
+
+// Moves count bytes at offset through the ring in chunk sized requests, one
+// data slot per ring entry. Writes fill each slot with pattern, reads check it.
+static int ring_transfer(ring_client_t* rc, uint32_t opcode, mx_off_t offset, mx_off_t count, uint8_t pattern) {
+    block_ring_t* ring = rc->ring;
+    uint32_t nchunks = (count + rc->chunk - 1) / rc->chunk;
+    uint32_t next = 0;
+    uint32_t done = 0;
+    int rc_status = 0;
+
+    while (done < nchunks) {
+        // queue as many chunks as there are free slots
+        bool kick = false;
+        while (next < nchunks && !rc->busy[next % BLOCK_RING_ENTRIES]) {
+            uint32_t slot = next % BLOCK_RING_ENTRIES;
+            mx_off_t off = (mx_off_t)next * rc->chunk;
+            block_ring_req_t* req = &ring->sq[ring->sq_tail % BLOCK_RING_ENTRIES];
+            req->opcode = opcode;
+            req->cookie = next;
+            req->offset = offset + off;
+            req->data_offset = slot * rc->chunk;
+            req->length = MIN(rc->chunk, count - off);
+            if (opcode == IOTXN_OP_WRITE) {
+                memset(rc->data + req->data_offset, pattern, req->length);
+            }
+            rc->busy[slot] = true;
+            __atomic_store_n(&ring->sq_tail, ring->sq_tail + 1, __ATOMIC_SEQ_CST);
+            next++;
+            kick = true;
+        }
+
+        // reap everything that has completed
+        bool reaped = false;
+        uint32_t head;
+        while ((head = ring->cq_head) != __atomic_load_n(&ring->cq_tail, __ATOMIC_SEQ_CST)) {
+            block_ring_resp_t* resp = &ring->cq[head % BLOCK_RING_ENTRIES];
+            uint32_t slot = resp->cookie % BLOCK_RING_ENTRIES;
+            mx_off_t off = (mx_off_t)resp->cookie * rc->chunk;
+            size_t length = MIN(rc->chunk, count - off);
+            if (resp->status != NO_ERROR || resp->actual != length) {
+                printf("request at offset %llu failed: status %d, %llu of %zu bytes\n",
+                       offset + off, resp->status, resp->actual, length);
+                rc_status = -1;
+            } else if (opcode == IOTXN_OP_READ) {
+                uint8_t* p = rc->data + slot * rc->chunk;
+                for (size_t i = 0; i < length; i++) {
+                    if (p[i] != pattern) {
+                        rc_status = -1;
+                        break;
+                    }
+                }
+            }
+            rc->busy[slot] = false;
+            __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_SEQ_CST);
+            done++;
+            reaped = true;
+        }
+        // reaping may let the server take requests it has been holding back
+        if (kick || (reaped && ring->sq_head != ring->sq_tail)) {
+            uint32_t msg = 0;
+            mx_message_write(rc->pipe, &msg, sizeof(msg), NULL, 0, 0);
+        }
+        if (reaped || done == nchunks) continue;
+
+        // wait for the server to post completions
+        mx_signals_state_t state;
+        mx_status_t status = mx_handle_wait_one(rc->pipe, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                                MX_TIME_INFINITE, &state);
+        if (status != NO_ERROR || !(state.satisfied & MX_SIGNAL_READABLE)) {
+            printf("block ring server went away\n");
+            return -1;
+        }
+        uint32_t msg;
+        uint32_t sz;
+        do {
+            sz = sizeof(msg);
+        } while (mx_message_read(rc->pipe, &msg, &sz, NULL, NULL, 0) == NO_ERROR);
+    }
+    return rc_status;
+}
+
+static int do_ring_test(const char* dev, mx_off_t offset, mx_off_t count, uint8_t pattern) {
+    int fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("Cannot open %s!\n", dev);
+        return fd;
+    }
+    int rc;
+    uint64_t size;
+    uint64_t blksize;
+    rc = mxio_ioctl(fd, BLOCK_OP_GET_SIZE, NULL, 0, &size, sizeof(size));
+    if (rc != sizeof(size)) {
+        printf("Error getting size for %s\n", dev);
+        goto fail;
+    }
+    rc = mxio_ioctl(fd, BLOCK_OP_GET_BLOCKSIZE, NULL, 0, &blksize, sizeof(blksize));
+    if (rc != sizeof(blksize)) {
+        printf("Error getting block size for %s\n", dev);
+        goto fail;
+    }
+    if (count == UINT64_MAX) {
+        count = size;
+    }
+    count = MIN(count, size - offset);
+
+    ioctl_block_ring_t reply;
+    rc = mxio_ioctl(fd, BLOCK_OP_GET_RING, NULL, 0, &reply, sizeof(reply));
+    if (rc != sizeof(reply)) {
+        printf("Error %d getting block ring for %s\n", rc, dev);
+        goto fail;
+    }
+
+    // the first message carries the ring vmo
+    ring_client_t client;
+    memset(&client, 0, sizeof(client));
+    client.pipe = reply.pipe;
+    mx_handle_t vmo;
+    uint32_t sz = 0;
+    uint32_t n = 1;
+    mx_handle_wait_one(client.pipe, MX_SIGNAL_READABLE, MX_TIME_INFINITE, NULL);
+    if ((rc = mx_message_read(client.pipe, NULL, &sz, &vmo, &n, 0)) < 0 || n != 1) {
+        printf("Error %d reading block ring vmo\n", rc);
+        mx_handle_close(client.pipe);
+        goto fail;
+    }
+    uint64_t vmo_size;
+    uintptr_t mapping;
+    mx_vm_object_get_size(vmo, &vmo_size);
+    rc = mx_process_vm_map(0, vmo, 0, vmo_size, &mapping, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    mx_handle_close(vmo);
+    if (rc < 0) {
+        printf("Error %d mapping block ring\n", rc);
+        mx_handle_close(client.pipe);
+        goto fail;
+    }
+    client.ring = (block_ring_t*)mapping;
+    client.data = (void*)mapping + client.ring->data_offset;
+    client.chunk = MAX(client.ring->data_size / BLOCK_RING_ENTRIES / blksize, 1) * blksize;
+
+    printf("Writing 0x%02x from offset %llu to %llu (%llu bytes) through the ring...", pattern, offset, offset + count, count);
+    rc = ring_transfer(&client, IOTXN_OP_WRITE, offset, count, pattern);
+    printf(rc ? "Fail\n" : "OK\n");
+    if (rc == 0) {
+        printf("Reading back...");
+        rc = ring_transfer(&client, IOTXN_OP_READ, offset, count, pattern);
+        printf(rc ? "Fail\n" : "OK\n");
+    }
+
+    mx_process_vm_unmap(0, mapping, 0);
+    mx_handle_close(client.pipe);
+fail:
+    close(fd);
+    return rc;
+}
+
 static uint64_t arg_to_u64(const char* arg) {
     int base = 10;
     if ((arg[0] == '0') && ((arg[1] == 'x') || arg[1] == 'X')) {
@@ -109,6 +273,12 @@ static uint64_t arg_to_u64(const char* arg) {
 }
 
 int main(int argc, const char** argv) {
+    bool ring = false;
+    if (argc > 1 && !strcmp(argv[1], "-r")) {
+        ring = true;
+        argc--;
+        argv++;
+    }
     if (argc == 1) {
         printf("not enough arguments!\n");
         goto usage;
@@ -117,14 +287,16 @@ int main(int argc, const char** argv) {
     mx_off_t offset = argc >= 3 ? arg_to_u64(argv[2]) : 0;
     mx_off_t count = argc >= 4 ? arg_to_u64(argv[3]) : UINT64_MAX;
 
-    do_test(dev, offset, count, 0x55);
-    do_test(dev, offset, count, 0xaa);
-    do_test(dev, offset, count, 0xff);
-    do_test(dev, offset, count, 0x00);
+    int (*test)(const char*, mx_off_t, mx_off_t, uint8_t) = ring ? do_ring_test : do_test;
+    test(dev, offset, count, 0x55);
+    test(dev, offset, count, 0xaa);
+    test(dev, offset, count, 0xff);
+    test(dev, offset, count, 0x00);
 
     return 0;
 usage:
     printf("Usage:\n");
-    printf("%s <dev> [<offset>] [<count>]\n", argv[0]);
+    printf("%s [-r] <dev> [<offset>] [<count>]\n", argv[0]);
+    printf("  -r: transfer through the shared memory block ring\n");
     return 0;
 }
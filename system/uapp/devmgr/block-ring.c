@@ -0,0 +1,228 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "devmgr.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ddk/device.h>
+#include <ddk/iotxn.h>
+#include <ddk/protocol/block.h>
+#include <ddk/ring-server.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+
+#include <runtime/completion.h>
+#include <runtime/mutex.h>
+
+// Serves the block ring from BLOCK_OP_GET_RING for one client. The ring
+// server's thread takes requests off the submission queue whenever the
+// client kicks the pipe and queues an iotxn over the request's part of the data area for
+// each, so the device transfers straight to and from the client's pages;
+// completions are posted from whatever thread the device completes the
+// iotxn on.
+
+typedef struct block_ring_server {
+    mx_device_t* dev;
+    ring_server_t rs;
+
+    block_ring_t* ring;
+    // our copy of where the data area is, the one in the ring is the client's
+    uint64_t data_offset;
+    uint64_t data_size;
+
+    // the ring's indices are client-writable too, so the server keeps its
+    // own counts and only uses the client's to learn how far it has got
+    mxr_mutex_t lock; // protects the cq and the counts below
+    uint32_t taken;   // requests taken off the sq, ever
+    uint32_t posted;  // completions posted to the cq, ever
+    uint32_t inflight;
+    bool closing;
+    mxr_completion_t idle; // signaled once closing and nothing is in flight
+} block_ring_server_t;
+
+typedef struct block_ring_txn {
+    block_ring_server_t* server;
+    uint32_t cookie;
+} block_ring_txn_t;
+
+static void block_ring_post(block_ring_server_t* server, uint32_t cookie, mx_status_t status, uint64_t actual) {
+    block_ring_t* ring = server->ring;
+
+    mxr_mutex_lock(&server->lock);
+    uint32_t tail = server->posted++;
+    block_ring_resp_t* resp = &ring->cq[tail % BLOCK_RING_ENTRIES];
+    resp->cookie = cookie;
+    resp->status = status;
+    resp->actual = actual;
+    __atomic_store_n(&ring->cq_tail, tail + 1, __ATOMIC_SEQ_CST);
+    // tell the client if it had reaped everything before this one
+    if (__atomic_load_n(&ring->cq_head, __ATOMIC_SEQ_CST) == tail) {
+        ring_server_notify(&server->rs);
+    }
+    // the server may be torn down as soon as this drops to zero
+    if (--server->inflight == 0 && server->closing) {
+        mxr_completion_signal(&server->idle);
+    }
+    mxr_mutex_unlock(&server->lock);
+}
+
+static void block_ring_txn_complete(iotxn_t* txn) {
+    block_ring_txn_t* brt = iotxn_to(txn, block_ring_txn_t);
+    block_ring_server_t* server = brt->server;
+    uint32_t cookie = brt->cookie;
+    mx_status_t status = txn->status;
+    uint64_t actual = txn->status == NO_ERROR ? txn->actual : 0;
+    txn->ops->release(txn);
+    block_ring_post(server, cookie, status, actual);
+}
+
+static void block_ring_start(block_ring_server_t* server, const block_ring_req_t* req) {
+    uint64_t data_size = server->data_size;
+    if ((req->opcode != IOTXN_OP_READ && req->opcode != IOTXN_OP_WRITE) ||
+        req->length == 0 || req->length > data_size || req->data_offset > data_size - req->length) {
+        block_ring_post(server, req->cookie, ERR_INVALID_ARGS, 0);
+        return;
+    }
+
+    iotxn_t* txn;
+    mx_status_t status = iotxn_alloc_vmo(&txn, 0, server->rs.vmo, server->data_offset + req->data_offset,
+                                         req->length, sizeof(block_ring_txn_t));
+    if (status != NO_ERROR) {
+        block_ring_post(server, req->cookie, status, 0);
+        return;
+    }
+    block_ring_txn_t* brt = iotxn_to(txn, block_ring_txn_t);
+    brt->server = server;
+    brt->cookie = req->cookie;
+
+    txn->opcode = req->opcode;
+    txn->offset = req->offset;
+    txn->length = req->length;
+    txn->complete_cb = block_ring_txn_complete;
+    iotxn_queue(server->dev, txn);
+}
+
+// Takes every waiting request the cq has room to complete.
+static void block_ring_submit(void* cookie) {
+    block_ring_server_t* server = cookie;
+    block_ring_t* ring = server->ring;
+    for (;;) {
+        uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_SEQ_CST);
+        uint32_t head = server->taken;
+        if (head == tail) return;
+
+        mxr_mutex_lock(&server->lock);
+        // a cq_head past what we've posted is bogus, treat the cq as full
+        uint32_t unreaped = server->posted - __atomic_load_n(&ring->cq_head, __ATOMIC_SEQ_CST);
+        if (unreaped > BLOCK_RING_ENTRIES) {
+            unreaped = BLOCK_RING_ENTRIES;
+        }
+        if (server->inflight + unreaped >= BLOCK_RING_ENTRIES) {
+            // wait for the client to reap, it kicks us when it does
+            mxr_mutex_unlock(&server->lock);
+            return;
+        }
+        server->taken++;
+        server->inflight++;
+        mxr_mutex_unlock(&server->lock);
+
+        // copy it out so the client can't change it under us
+        block_ring_req_t req = ring->sq[head % BLOCK_RING_ENTRIES];
+        __atomic_store_n(&ring->sq_head, head + 1, __ATOMIC_SEQ_CST);
+        block_ring_start(server, &req);
+    }
+}
+
+static void block_ring_destroy(block_ring_server_t* server) {
+    ring_server_release(&server->rs);
+    DM_LOCK();
+    dev_ref_release(server->dev);
+    DM_UNLOCK();
+    free(server);
+}
+
+// The client is gone, wait for the device to finish with its requests.
+static void block_ring_close(void* cookie) {
+    block_ring_server_t* server = cookie;
+
+    mxr_mutex_lock(&server->lock);
+    server->closing = true;
+    bool busy = server->inflight > 0;
+    mxr_mutex_unlock(&server->lock);
+    if (busy) {
+        mxr_completion_wait(&server->idle, MX_TIME_INFINITE);
+        // let the last completion drop the lock
+        mxr_mutex_lock(&server->lock);
+        mxr_mutex_unlock(&server->lock);
+    }
+
+    block_ring_destroy(server);
+}
+
+static const ring_server_ops_t block_ring_ops = {
+    .kick = block_ring_submit,
+    .close = block_ring_close,
+};
+
+mx_status_t devmgr_block_ring_create(mx_device_t* dev, const void* in_buf, size_t in_len, mx_handle_t* out) {
+    uint64_t data_size = BLOCK_RING_DEFAULT_DATA_SIZE;
+    if (in_len >= sizeof(ioctl_block_get_ring_t)) {
+        const ioctl_block_get_ring_t* args = in_buf;
+        if (args->data_size) data_size = args->data_size;
+    }
+    if (data_size > BLOCK_RING_MAX_DATA_SIZE) {
+        return ERR_INVALID_ARGS;
+    }
+    data_size = (data_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    block_ring_server_t* server = calloc(1, sizeof(block_ring_server_t));
+    if (!server) {
+        return ERR_NO_MEMORY;
+    }
+    server->lock = MXR_MUTEX_INIT;
+    server->idle = MXR_COMPLETION_INIT;
+    DM_LOCK();
+    dev_ref_acquire(dev);
+    DM_UNLOCK();
+    server->dev = dev;
+
+    // the data area starts on the page after the rings
+    uint64_t data_offset = (sizeof(block_ring_t) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    mx_handle_t h;
+    mx_status_t status = ring_server_init(&server->rs, data_offset + data_size, &h);
+    if (status < 0) {
+        block_ring_destroy(server);
+        return status;
+    }
+    server->ring = server->rs.mapping;
+    server->data_offset = data_offset;
+    server->data_size = data_size;
+    server->ring->data_offset = data_offset;
+    server->ring->data_size = data_size;
+
+    if ((status = ring_server_start(&server->rs, "block-ring", &block_ring_ops, server)) < 0) {
+        mx_handle_close(h);
+        block_ring_destroy(server);
+        return status;
+    }
+
+    *out = h;
+    return NO_ERROR;
+}
@@ -16,12 +16,14 @@
 #include "vfs.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <ddk/device.h>
 #include <ddk/driver.h>
+#include <ddk/iostats.h>
 
 #include <system/listnode.h>
 
@@ -106,6 +108,10 @@ static void default_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     ssize_t rc;
     void* buf;
     txn->ops->mmap(txn, &buf);
+    if (buf == NULL) {
+        txn->ops->complete(txn, ERR_NO_MEMORY, 0);
+        return;
+    }
     if (txn->opcode == IOTXN_OP_READ) {
         rc = dev->ops->read(dev, buf, txn->length, txn->offset);
     } else if (txn->opcode == IOTXN_OP_WRITE) {
@@ -315,6 +321,7 @@ mx_status_t devmgr_device_init(mx_device_t* dev, mx_driver_t* driver,
     dev->name = dev->namedata;
     dev->ops = ops;
     dev->driver = driver;
+    dev->iostats.since = mx_current_time();
     list_initialize(&dev->children);
     return NO_ERROR;
 }
@@ -715,10 +722,61 @@ void devmgr_dump(void) {
     DM_UNLOCK();
 }
 
+static void devmgr_iostats_device(mx_device_t* dev) {
+    static const char* const op_names[IOSTATS_OPS] = { "read", "write", "other" };
+
+    mx_iostats_t stats;
+    iostats_get(&dev->iostats, &stats);
+    if (stats.queued == 0 && stats.inflight == 0) {
+        return;
+    }
+    printf("%s: queued %" PRIu64 " inflight %u (max %u) over %" PRIu64 "ms\n", dev->name,
+           stats.queued, stats.inflight, stats.inflight_max, stats.since / 1000000);
+    for (int i = 0; i < IOSTATS_OPS; i++) {
+        mx_iostats_op_t* op = &stats.ops[i];
+        if (op->count == 0) {
+            continue;
+        }
+        printf("  %-5s %10" PRIu64 " done %6" PRIu64 " errors %12" PRIu64 " bytes"
+               " avg %8" PRIu64 "us max %8" PRIu64 "us\n", op_names[i], op->count, op->errors,
+               op->bytes, op->latency_total / op->count / 1000, op->latency_max / 1000);
+        // each bucket by its lower bound, the first is everything under 2us
+        printf("        us:");
+        for (int b = 0; b < IOSTATS_BUCKETS; b++) {
+            if (op->latency[b]) {
+                uint64_t us = b ? UINT64_C(1) << b : 2;
+                printf(" %s%" PRIu64 ":%" PRIu64, b ? "" : "<", us, op->latency[b]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+static void devmgr_iostats_recursive(mx_device_t* _dev, bool reset) {
+    if (reset) {
+        iostats_reset(&_dev->iostats);
+    } else {
+        devmgr_iostats_device(_dev);
+    }
+    mx_device_t* dev = NULL;
+    list_for_every_entry (&_dev->children, dev, mx_device_t, node) {
+        devmgr_iostats_recursive(dev, reset);
+    }
+}
+
+// Only devices in the devmgr process are counted here, the ones in a devhost
+// answer IOCTL_DEVICE_GET_IOSTATS themselves.
+static void devmgr_iostats(bool reset) {
+    DM_LOCK();
+    devmgr_iostats_recursive(root_dev, reset);
+    DM_UNLOCK();
+}
+
 mx_status_t devmgr_control(const char* cmd) {
     if (!strcmp(cmd, "help")) {
         printf("dump   - dump device tree\n"
                "lsof   - list open remoteio files and devices\n"
+               "iostats [reset] - iotxn counts and latencies of each device\n"
                "crash  - crash the device manager\n"
                );
         return NO_ERROR;
@@ -731,6 +789,14 @@ mx_status_t devmgr_control(const char* cmd) {
         vfs_dump_handles();
         return NO_ERROR;
     }
+    if (!strcmp(cmd, "iostats")) {
+        devmgr_iostats(false);
+        return NO_ERROR;
+    }
+    if (!strcmp(cmd, "iostats reset")) {
+        devmgr_iostats(true);
+        return NO_ERROR;
+    }
     if (!strcmp(cmd, "crash")) {
         *((int*)0x1234) = 42;
         return NO_ERROR;
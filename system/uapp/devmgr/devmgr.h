@@ -103,6 +103,9 @@ extern mxio_dispatcher_t* devmgr_devhost_dispatcher;
 
 mx_status_t devmgr_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie);
 
+// creates a block ring server for dev, returning the client's end of its pipe
+mx_status_t devmgr_block_ring_create(mx_device_t* dev, const void* in_buf, size_t in_len, mx_handle_t* out);
+
 extern bool __dm_locked;
 
 #if 0
@@ -24,7 +24,9 @@
 
 #include <ddk/device.h>
 #include <ddk/driver.h>
+#include <ddk/iostats.h>
 #include <ddk/iotxn.h>
+#include <ddk/protocol/block.h>
 
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
@@ -170,7 +172,7 @@ static ssize_t do_sync_io(mx_device_t* dev, uint32_t opcode, void* buf, size_t c
         txn->ops->copyto(txn, buf, txn->length, 0);
     }
 
-    dev->ops->iotxn_queue(dev, txn);
+    iotxn_queue(dev, txn);
     mxr_completion_wait(&completion, MX_TIME_INFINITE);
 
     if (txn->status != NO_ERROR) {
@@ -188,6 +190,27 @@ static ssize_t do_sync_io(mx_device_t* dev, uint32_t opcode, void* buf, size_t c
     return actual;
 }
 
+static ssize_t do_get_iostats(mx_device_t* dev, void* out_buf, size_t out_len) {
+    if (out_len < sizeof(mx_iostats_t)) {
+        return ERR_NOT_ENOUGH_BUFFER;
+    }
+    iostats_get(&dev->iostats, out_buf);
+    return sizeof(mx_iostats_t);
+}
+
+static ssize_t do_get_block_ring(mx_device_t* dev, const void* in_buf, size_t in_len,
+                                 void* out_buf, size_t out_len) {
+    if (out_len < sizeof(ioctl_block_ring_t)) {
+        return ERR_NOT_ENOUGH_BUFFER;
+    }
+    ioctl_block_ring_t* reply = out_buf;
+    mx_status_t r = devmgr_block_ring_create(dev, in_buf, in_len, &reply->pipe);
+    if (r < 0) {
+        return r;
+    }
+    return sizeof(ioctl_block_ring_t);
+}
+
 mx_status_t devmgr_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
     iostate_t* ios = cookie;
     mx_device_t* dev = ios->dev;
@@ -312,7 +335,18 @@ mx_status_t devmgr_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
         }
         char in_buf[MXIO_IOCTL_MAX_INPUT];
         memcpy(in_buf, msg->data, len);
-        mx_status_t r = dev->ops->ioctl(dev, msg->arg2.op, in_buf, len, msg->data, arg);
+        mx_status_t r;
+        if (msg->arg2.op == BLOCK_OP_GET_RING && dev->protocol_id == MX_PROTOCOL_BLOCK) {
+            // served here for every block device, on top of iotxn_queue
+            r = do_get_block_ring(dev, in_buf, len, msg->data, arg);
+        } else if (msg->arg2.op == IOCTL_DEVICE_GET_IOSTATS) {
+            r = do_get_iostats(dev, msg->data, arg);
+        } else if (msg->arg2.op == IOCTL_DEVICE_RESET_IOSTATS) {
+            iostats_reset(&dev->iostats);
+            r = NO_ERROR;
+        } else {
+            r = dev->ops->ioctl(dev, msg->arg2.op, in_buf, len, msg->data, arg);
+        }
         if (r >= 0) {
             if (msg->arg2.op == IOCTL_DEVICE_GET_HANDLE) {
                 msg->hcount = 1;
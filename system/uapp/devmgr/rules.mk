@@ -35,6 +35,7 @@ MODULE_SRCS := \
 MODULE_SRCS += \
     $(LOCAL_DIR)/devmgr.c \
     $(LOCAL_DIR)/binding.c \
+    $(LOCAL_DIR)/block-ring.c \
     $(LOCAL_DIR)/rpc-device.c \
     $(LOCAL_DIR)/rpc-devhost.c \
     $(LOCAL_DIR)/devhost.c \
@@ -0,0 +1,262 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+#include <mxio/io.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ddk/protocol/ethernet.h>
+
+// Sends broadcast frames through a device's packet ring and counts what it
+// receives through the same ring, as a client for ETHERNET_OP_GET_RING.
+
+// the first half of the buffers are for rx, the second half for tx
+#define RX_BUFFERS (ETH_RING_BUFFERS / 2)
+#define TX_BUFFERS (ETH_RING_BUFFERS - RX_BUFFERS)
+
+#define FRAME_SIZE 64
+#define ETHERTYPE_TEST 0x88B5 // IEEE 802 local experimental
+
+// how long to keep receiving after the last frame was sent
+#define RX_LINGER (1000ULL * 1000 * 1000)
+
+typedef struct {
+    mx_handle_t pipe;
+    eth_ring_t* ring;
+    uint8_t* buffers;
+    uint8_t mac[ETH_MAC_SIZE];
+    bool tx_busy[TX_BUFFERS];
+
+    uint32_t sent;
+    uint32_t tx_failed;
+    uint32_t received;
+    uint32_t rx_failed;
+} ring_client_t;
+
+static uint8_t* buffer(ring_client_t* rc, uint16_t n) {
+    return rc->buffers + (size_t)n * ETH_RING_BUFFER_SIZE;
+}
+
+static void fifo_put(eth_fifo_t* fifo, uint32_t cookie, uint16_t buf, uint16_t length) {
+    eth_ring_entry_t* e = &fifo->entries[fifo->tail % ETH_RING_ENTRIES];
+    e->cookie = cookie;
+    e->buffer = buf;
+    e->length = length;
+    e->status = NO_ERROR;
+    __atomic_store_n(&fifo->tail, fifo->tail + 1, __ATOMIC_SEQ_CST);
+}
+
+static void kick(ring_client_t* rc) {
+    uint32_t msg = 0;
+    mx_message_write(rc->pipe, &msg, sizeof(msg), NULL, 0, 0);
+}
+
+// Queues a frame in the tx buffer |n|.
+static void send_frame(ring_client_t* rc, uint32_t n, uint32_t seq) {
+    uint16_t buf = RX_BUFFERS + n;
+    uint8_t* frame = buffer(rc, buf);
+    memset(frame, 0xff, ETH_MAC_SIZE);
+    memcpy(frame + ETH_MAC_SIZE, rc->mac, ETH_MAC_SIZE);
+    frame[12] = ETHERTYPE_TEST >> 8;
+    frame[13] = ETHERTYPE_TEST & 0xff;
+    memset(frame + 14, 0, FRAME_SIZE - 14);
+    memcpy(frame + 14, &seq, sizeof(seq));
+    rc->tx_busy[n] = true;
+    fifo_put(&rc->ring->tx, n, buf, FRAME_SIZE);
+}
+
+// Reaps both done fifos, handing rx buffers straight back to the device.
+// Returns whether anything was reaped.
+static bool reap(ring_client_t* rc) {
+    eth_ring_t* ring = rc->ring;
+    bool reaped = false;
+    uint32_t head;
+
+    while ((head = ring->tx_done.head) != __atomic_load_n(&ring->tx_done.tail, __ATOMIC_SEQ_CST)) {
+        eth_ring_entry_t* e = &ring->tx_done.entries[head % ETH_RING_ENTRIES];
+        if (e->cookie < TX_BUFFERS) {
+            rc->tx_busy[e->cookie] = false;
+        }
+        if (e->status == NO_ERROR) {
+            rc->sent++;
+        } else {
+            rc->tx_failed++;
+        }
+        __atomic_store_n(&ring->tx_done.head, head + 1, __ATOMIC_SEQ_CST);
+        reaped = true;
+    }
+
+    while ((head = ring->rx_done.head) != __atomic_load_n(&ring->rx_done.tail, __ATOMIC_SEQ_CST)) {
+        eth_ring_entry_t e = ring->rx_done.entries[head % ETH_RING_ENTRIES];
+        __atomic_store_n(&ring->rx_done.head, head + 1, __ATOMIC_SEQ_CST);
+        if (e.status == NO_ERROR && e.buffer < RX_BUFFERS) {
+            const uint8_t* frame = buffer(rc, e.buffer);
+            printf("rx %u bytes from %02x:%02x:%02x:%02x:%02x:%02x type 0x%02x%02x\n",
+                   e.length, frame[6], frame[7], frame[8], frame[9], frame[10], frame[11],
+                   frame[12], frame[13]);
+            rc->received++;
+        } else {
+            rc->rx_failed++;
+        }
+        if (e.buffer < RX_BUFFERS) {
+            fifo_put(&ring->rx, e.cookie, e.buffer, 0);
+        }
+        reaped = true;
+    }
+    return reaped;
+}
+
+// Waits for the device to give entries back, up to |timeout|. Returns
+// false if the device went away.
+static bool wait_for_device(ring_client_t* rc, mx_time_t timeout) {
+    mx_signals_state_t state;
+    mx_status_t status = mx_handle_wait_one(rc->pipe, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                            timeout, &state);
+    if (status == ERR_TIMED_OUT) {
+        return true;
+    }
+    if (status != NO_ERROR || !(state.satisfied & MX_SIGNAL_READABLE)) {
+        return false;
+    }
+    uint32_t msg;
+    uint32_t sz;
+    do {
+        sz = sizeof(msg);
+    } while (mx_message_read(rc->pipe, &msg, &sz, NULL, NULL, 0) == NO_ERROR);
+    return true;
+}
+
+static int ring_test(ring_client_t* rc, uint32_t count) {
+    // give the device every rx buffer up front
+    for (uint16_t i = 0; i < RX_BUFFERS; i++) {
+        fifo_put(&rc->ring->rx, i, i, 0);
+    }
+    kick(rc);
+
+    uint32_t seq = 0;
+    while (rc->sent + rc->tx_failed < count) {
+        bool queued = false;
+        for (uint32_t n = 0; n < TX_BUFFERS && seq < count; n++) {
+            if (!rc->tx_busy[n]) {
+                send_frame(rc, n, seq++);
+                queued = true;
+            }
+        }
+        if (reap(rc) || queued) {
+            kick(rc);
+            continue;
+        }
+        if (!wait_for_device(rc, MX_TIME_INFINITE)) {
+            printf("ethernet ring server went away\n");
+            return -1;
+        }
+    }
+
+    // pick up any frames that are still arriving
+    mx_time_t end = mx_current_time() + RX_LINGER;
+    mx_time_t now;
+    while ((now = mx_current_time()) < end) {
+        if (reap(rc)) {
+            kick(rc);
+            continue;
+        }
+        if (!wait_for_device(rc, end - now)) {
+            printf("ethernet ring server went away\n");
+            return -1;
+        }
+    }
+
+    printf("sent %u frames (%u failed), received %u frames (%u failed)\n",
+           rc->sent, rc->tx_failed, rc->received, rc->rx_failed);
+    return rc->tx_failed ? -1 : 0;
+}
+
+static int do_test(const char* dev, uint32_t count) {
+    int fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("Cannot open %s!\n", dev);
+        return fd;
+    }
+
+    ring_client_t client;
+    memset(&client, 0, sizeof(client));
+    int rc;
+    if ((rc = read(fd, client.mac, ETH_MAC_SIZE)) != ETH_MAC_SIZE) {
+        printf("Error getting MAC address for %s\n", dev);
+        goto fail;
+    }
+
+    ioctl_ethernet_ring_t reply;
+    rc = mxio_ioctl(fd, ETHERNET_OP_GET_RING, NULL, 0, &reply, sizeof(reply));
+    if (rc != sizeof(reply)) {
+        printf("Error %d getting ethernet ring for %s\n", rc, dev);
+        goto fail;
+    }
+    client.pipe = reply.pipe;
+
+    // the first message carries the ring vmo
+    mx_handle_t vmo;
+    uint32_t sz = 0;
+    uint32_t n = 1;
+    mx_handle_wait_one(client.pipe, MX_SIGNAL_READABLE, MX_TIME_INFINITE, NULL);
+    if ((rc = mx_message_read(client.pipe, NULL, &sz, &vmo, &n, 0)) < 0 || n != 1) {
+        printf("Error %d reading ethernet ring vmo\n", rc);
+        mx_handle_close(client.pipe);
+        goto fail;
+    }
+    uint64_t vmo_size;
+    uintptr_t mapping;
+    mx_vm_object_get_size(vmo, &vmo_size);
+    rc = mx_process_vm_map(0, vmo, 0, vmo_size, &mapping, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    mx_handle_close(vmo);
+    if (rc < 0) {
+        printf("Error %d mapping ethernet ring\n", rc);
+        mx_handle_close(client.pipe);
+        goto fail;
+    }
+    client.ring = (eth_ring_t*)mapping;
+    client.buffers = (uint8_t*)mapping + client.ring->buffer_offset;
+
+    printf("Sending %u frames through the ring of %s...\n", count, dev);
+    rc = ring_test(&client, count);
+
+    mx_process_vm_unmap(0, mapping, 0);
+    mx_handle_close(client.pipe);
+fail:
+    close(fd);
+    return rc;
+}
+
+int main(int argc, const char** argv) {
+    if (argc < 2) {
+        printf("not enough arguments!\n");
+        goto usage;
+    }
+    const char* dev = argv[1];
+    uint32_t count = argc >= 3 ? strtoul(argv[2], NULL, 0) : 100;
+
+    return do_test(dev, count) ? 1 : 0;
+usage:
+    printf("Usage:\n");
+    printf("%s <dev> [<count>]\n", argv[0]);
+    printf("  sends <count> (default 100) broadcast frames through the\n");
+    printf("  device's packet ring and prints the frames it receives\n");
+    return 0;
+}
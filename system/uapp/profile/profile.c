@@ -0,0 +1,407 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs the kernel's sampling profiler for a while and prints the hottest
+// pcs, symbolized against ELF files such as the ones in /boot.
+//
+// The kernel doesn't know which file a mapping came from, so the load
+// address of each module to symbolize against is given on the command
+// line, e.g. -m /boot/lib/libc.so@0x1000000.
+
+#include <elf.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <magenta/profile.h>
+#include <magenta/syscalls.h>
+
+#if UINTPTR_MAX == UINT64_MAX
+typedef Elf64_Ehdr elf_ehdr_t;
+typedef Elf64_Phdr elf_phdr_t;
+typedef Elf64_Shdr elf_shdr_t;
+typedef Elf64_Sym elf_sym_t;
+#define ELF_ST_TYPE ELF64_ST_TYPE
+#else
+typedef Elf32_Ehdr elf_ehdr_t;
+typedef Elf32_Phdr elf_phdr_t;
+typedef Elf32_Shdr elf_shdr_t;
+typedef Elf32_Sym elf_sym_t;
+#define ELF_ST_TYPE ELF32_ST_TYPE
+#endif
+
+typedef struct symbol {
+    uint64_t addr;
+    uint64_t size;
+    const char* name;
+} symbol_t;
+
+typedef struct module {
+    const char* path;
+    uint64_t base;
+    // Range of link-time addresses covered by the module's segments.
+    uint64_t start;
+    uint64_t end;
+    char* image;
+    symbol_t* syms;
+    size_t num_syms;
+} module_t;
+
+// Samples are counted by pc and mode.
+typedef struct pc_count {
+    uint64_t pc;
+    bool user;
+    uint64_t count;
+} pc_count_t;
+
+typedef struct pid_count {
+    uint64_t pid;
+    uint64_t count;
+} pid_count_t;
+
+static void option_usage(FILE* out,
+                         const char* option, const char* description) {
+    fprintf(out, "\t%-16s%s\n", option, description);
+}
+
+static _Noreturn void usage(const char* progname, bool error) {
+    FILE* out = error ? stderr : stdout;
+    fprintf(out, "Usage: %s [OPTIONS]\n", progname);
+    option_usage(out, "-h", "display this usage message and exit");
+    option_usage(out, "-m FILE@BASE", "symbolize against ELF FILE loaded at BASE");
+    option_usage(out, "-n COUNT", "print the COUNT hottest pcs (default 20)");
+    option_usage(out, "-r RATE", "take RATE samples per second per cpu");
+    option_usage(out, "-t SECONDS", "profile for SECONDS (default 5)");
+    exit(error ? 1 : 0);
+}
+
+static int compare_symbols(const void* a, const void* b) {
+    const symbol_t* sa = a;
+    const symbol_t* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+static char* read_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    size_t len = 0;
+    size_t cap = 64 * 1024;
+    char* buf = malloc(cap);
+    for (;;) {
+        if (buf == NULL)
+            break;
+        if (len == cap) {
+            cap *= 2;
+            char* bigger = realloc(buf, cap);
+            if (bigger == NULL) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = bigger;
+        }
+        ssize_t r = read(fd, buf + len, cap - len);
+        if (r < 0) {
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        if (r == 0)
+            break;
+        len += r;
+    }
+    close(fd);
+    *size = len;
+    return buf;
+}
+
+// Loads the function symbols of |m|, preferring the full symbol table to
+// the dynamic one, which is all a stripped file has left.
+static bool load_module(module_t* m) {
+    size_t size;
+    char* image = read_file(m->path, &size);
+    if (image == NULL) {
+        fprintf(stderr, "profile: cannot read %s\n", m->path);
+        return false;
+    }
+    m->image = image;
+
+    const elf_ehdr_t* ehdr = (const elf_ehdr_t*)image;
+    if (size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+        ehdr->e_phoff + ehdr->e_phnum * sizeof(elf_phdr_t) > size ||
+        ehdr->e_shoff + ehdr->e_shnum * sizeof(elf_shdr_t) > size) {
+        fprintf(stderr, "profile: %s is not a usable ELF file\n", m->path);
+        return false;
+    }
+
+    const elf_phdr_t* phdrs = (const elf_phdr_t*)(image + ehdr->e_phoff);
+    m->start = UINT64_MAX;
+    m->end = 0;
+    for (unsigned i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_type != PT_LOAD)
+            continue;
+        if (phdrs[i].p_vaddr < m->start)
+            m->start = phdrs[i].p_vaddr;
+        if (phdrs[i].p_vaddr + phdrs[i].p_memsz > m->end)
+            m->end = phdrs[i].p_vaddr + phdrs[i].p_memsz;
+    }
+
+    const elf_shdr_t* shdrs = (const elf_shdr_t*)(image + ehdr->e_shoff);
+    const elf_shdr_t* symtab = NULL;
+    for (unsigned i = 0; i < ehdr->e_shnum; i++) {
+        if (shdrs[i].sh_type == SHT_SYMTAB ||
+            (shdrs[i].sh_type == SHT_DYNSYM && symtab == NULL))
+            symtab = &shdrs[i];
+    }
+    if (symtab == NULL || symtab->sh_link >= ehdr->e_shnum ||
+        symtab->sh_offset + symtab->sh_size > size)
+        return true;
+    const elf_shdr_t* strtab = &shdrs[symtab->sh_link];
+    if (strtab->sh_offset + strtab->sh_size > size)
+        return true;
+
+    const elf_sym_t* syms = (const elf_sym_t*)(image + symtab->sh_offset);
+    size_t count = symtab->sh_size / sizeof(elf_sym_t);
+    m->syms = calloc(count, sizeof(symbol_t));
+    if (m->syms == NULL)
+        return true;
+    for (size_t i = 0; i < count; i++) {
+        if (ELF_ST_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_value == 0 ||
+            syms[i].st_name >= strtab->sh_size)
+            continue;
+        symbol_t* sym = &m->syms[m->num_syms++];
+        sym->addr = syms[i].st_value;
+        sym->size = syms[i].st_size;
+        sym->name = image + strtab->sh_offset + syms[i].st_name;
+    }
+    qsort(m->syms, m->num_syms, sizeof(symbol_t), compare_symbols);
+    return true;
+}
+
+// Prints |pc| as module!symbol+offset when some module covers it.
+static void print_pc(const module_t* modules, size_t num_modules, uint64_t pc) {
+    for (size_t i = 0; i < num_modules; i++) {
+        const module_t* m = &modules[i];
+        if (pc < m->base || pc - m->base < m->start || pc - m->base >= m->end)
+            continue;
+        uint64_t addr = pc - m->base;
+        const char* name = strrchr(m->path, '/') ? strrchr(m->path, '/') + 1 : m->path;
+
+        // Find the last symbol that starts at or before addr.
+        size_t lo = 0, hi = m->num_syms;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (m->syms[mid].addr <= addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > 0) {
+            const symbol_t* sym = &m->syms[lo - 1];
+            if (sym->size == 0 || addr < sym->addr + sym->size) {
+                printf("%s!%s+%#" PRIx64, name, sym->name, addr - sym->addr);
+                return;
+            }
+        }
+        printf("%s+%#" PRIx64, name, addr);
+        return;
+    }
+    printf("%#" PRIx64, pc);
+}
+
+static int compare_pcs(const void* a, const void* b) {
+    const pc_count_t* pa = a;
+    const pc_count_t* pb = b;
+    if (pa->user != pb->user)
+        return pa->user - pb->user;
+    return pa->pc < pb->pc ? -1 : pa->pc > pb->pc;
+}
+
+static int compare_pc_counts(const void* a, const void* b) {
+    const pc_count_t* pa = a;
+    const pc_count_t* pb = b;
+    return pa->count > pb->count ? -1 : pa->count < pb->count;
+}
+
+static int compare_pids(const void* a, const void* b) {
+    const pid_count_t* pa = a;
+    const pid_count_t* pb = b;
+    return pa->pid < pb->pid ? -1 : pa->pid > pb->pid;
+}
+
+static int compare_pid_counts(const void* a, const void* b) {
+    const pid_count_t* pa = a;
+    const pid_count_t* pb = b;
+    return pa->count > pb->count ? -1 : pa->count < pb->count;
+}
+
+int main(int argc, char** argv) {
+    module_t* modules = NULL;
+    size_t num_modules = 0;
+    unsigned rate = 0;
+    unsigned seconds = 5;
+    unsigned top = 20;
+
+    for (int opt; (opt = getopt(argc, argv, "hm:n:r:t:")) != -1;) {
+        switch (opt) {
+        case 'h':
+            usage(argv[0], false);
+            break;
+        case 'm': {
+            char* at = strrchr(optarg, '@');
+            if (at == NULL)
+                usage(argv[0], true);
+            *at = '\0';
+            modules = realloc(modules, ++num_modules * sizeof(modules[0]));
+            if (modules == NULL) {
+                perror("realloc");
+                return 2;
+            }
+            memset(&modules[num_modules - 1], 0, sizeof(modules[0]));
+            modules[num_modules - 1].path = optarg;
+            modules[num_modules - 1].base = strtoull(at + 1, NULL, 0);
+            break;
+        }
+        case 'n':
+            top = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            seconds = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0], true);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0], true);
+
+    for (size_t i = 0; i < num_modules; i++) {
+        if (!load_module(&modules[i]))
+            return 1;
+    }
+
+    mx_status_t status = mx_profile_control(MX_PROFILE_ACTION_REWIND, 0);
+    if (status == NO_ERROR)
+        status = mx_profile_control(MX_PROFILE_ACTION_START, rate);
+    if (status < 0) {
+        fprintf(stderr, "profile: cannot start the profiler: %d\n", status);
+        return 1;
+    }
+
+    mx_handle_t vmo = mx_profile_get_vmo();
+    uint64_t size;
+    uintptr_t addr = 0;
+    if (vmo < 0 || mx_vm_object_get_size(vmo, &size) < 0 ||
+        mx_process_vm_map(0, vmo, 0, size, &addr, MX_VM_FLAG_PERM_READ) < 0) {
+        mx_profile_control(MX_PROFILE_ACTION_STOP, 0);
+        fprintf(stderr, "profile: cannot map the sample buffer\n");
+        return 1;
+    }
+
+    const mx_profile_info_t* info = (const mx_profile_info_t*)addr;
+    const mx_profile_sample_t* rings =
+        (const mx_profile_sample_t*)(addr + MX_PROFILE_RING_OFFSET);
+    // The rate is only reported while the profiler runs.
+    rate = info->rate;
+    mx_nanosleep(seconds * 1000000000ULL);
+    mx_profile_control(MX_PROFILE_ACTION_STOP, 0);
+
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < info->num_cpus; cpu++) {
+        uint64_t head = info->cpu[cpu].head;
+        total += head < info->samples_per_cpu ? head : info->samples_per_cpu;
+    }
+
+    pc_count_t* pcs = calloc(total ? total : 1, sizeof(pc_count_t));
+    pid_count_t* pids = calloc(total ? total : 1, sizeof(pid_count_t));
+    if (pcs == NULL || pids == NULL) {
+        fprintf(stderr, "profile: out of memory\n");
+        return 1;
+    }
+
+    size_t n = 0;
+    uint64_t idle = 0, dropped = 0;
+    for (uint32_t cpu = 0; cpu < info->num_cpus; cpu++) {
+        uint64_t head = info->cpu[cpu].head;
+        uint64_t count = head < info->samples_per_cpu ? head : info->samples_per_cpu;
+        const mx_profile_sample_t* ring = rings + cpu * info->samples_per_cpu;
+        for (uint64_t i = head - count; i < head; i++) {
+            const mx_profile_sample_t* s = &ring[i % info->samples_per_cpu];
+            if (s->flags & MX_PROFILE_SAMPLE_IDLE) {
+                idle++;
+                continue;
+            }
+            bool user = s->flags & MX_PROFILE_SAMPLE_USER;
+            pcs[n].pc = user ? s->user_pc : s->kernel_pc;
+            pcs[n].user = user;
+            pcs[n].count = 1;
+            pids[n].pid = s->pid;
+            pids[n].count = 1;
+            n++;
+        }
+        dropped += info->cpu[cpu].dropped;
+    }
+
+    printf("%" PRIu64 " samples at %u/s on %u cpus, %" PRIu64 " idle, %" PRIu64 " dropped\n",
+           total, rate, info->num_cpus, idle, dropped);
+    if (n == 0)
+        return 0;
+
+    // Fold equal keys together, then sort by count.
+    qsort(pids, n, sizeof(pid_count_t), compare_pids);
+    size_t num_pids = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (num_pids > 0 && pids[num_pids - 1].pid == pids[i].pid)
+            pids[num_pids - 1].count++;
+        else
+            pids[num_pids++] = pids[i];
+    }
+    qsort(pids, num_pids, sizeof(pid_count_t), compare_pid_counts);
+
+    qsort(pcs, n, sizeof(pc_count_t), compare_pcs);
+    size_t num_pcs = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (num_pcs > 0 && pcs[num_pcs - 1].pc == pcs[i].pc &&
+            pcs[num_pcs - 1].user == pcs[i].user)
+            pcs[num_pcs - 1].count++;
+        else
+            pcs[num_pcs++] = pcs[i];
+    }
+    qsort(pcs, num_pcs, sizeof(pc_count_t), compare_pc_counts);
+
+    printf("\n%10s %8s %6s\n", "pid", "samples", "%");
+    for (size_t i = 0; i < num_pids && i < top; i++) {
+        printf("%10" PRIu64 " %8" PRIu64 " %5" PRIu64 "%%%s\n", pids[i].pid, pids[i].count,
+               pids[i].count * 100 / n, pids[i].pid ? "" : " (kernel threads)");
+    }
+
+    printf("\n%8s %6s %4s  %s\n", "samples", "%", "mode", "pc");
+    for (size_t i = 0; i < num_pcs && i < top; i++) {
+        printf("%8" PRIu64 " %5" PRIu64 "%% %4s  ", pcs[i].count, pcs[i].count * 100 / n,
+               pcs[i].user ? "user" : "kern");
+        print_pc(modules, num_modules, pcs[i].pc);
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include <ddk/binding.h>
 #include <ddk/protocol/pci.h>
 #include <ddk/protocol/ethernet.h>
+#include <ddk/ring-server.h>
 #include <hw/pci.h>
 
 #include <system/listnode.h>
@@ -27,6 +28,7 @@
 #include <magenta/syscalls.h>
 #include <magenta/syscalls-ddk.h>
 #include <magenta/types.h>
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +39,7 @@ typedef mx_status_t status_t;
 #define INTERVAL 10000000000ULL
 
 typedef struct ethernet_device ethernet_device_t;
+typedef struct eth_ring_server eth_ring_server_t;
 
 struct ethernet_device {
     ethdev_t eth;
@@ -47,10 +50,209 @@ struct ethernet_device {
     mx_handle_t ioh;
     mx_handle_t irqh;
     mxr_thread_t* thread;
+    eth_ring_server_t* ring; // while a client has the ring open
 };
 
 #define get_eth_device(d) containerof(d, ethernet_device_t, dev)
 
+// The entries of one of the client's fifos that we've taken, until they're
+// given back on the matching done fifo. The hw finishes with buffers in the
+// order they were queued, so these are too.
+typedef struct eth_ring_queue {
+    eth_fifo_t* fifo;
+    eth_fifo_t* done;
+    uint32_t taken;    // entries taken off fifo, ever
+    uint32_t returned; // of which given back on done
+    eth_ring_entry_t entries[ETH_RING_ENTRIES];
+} eth_ring_queue_t;
+
+struct eth_ring_server {
+    ethernet_device_t* edev;
+    ring_server_t rs;
+    eth_ring_t* ring;
+    mx_paddr_t buffer_phys[ETH_RING_BUFFERS];
+
+    eth_ring_queue_t tx;
+    eth_ring_queue_t rx;
+};
+
+#define ETH_RING_BUFFERS_SIZE (ETH_RING_BUFFERS * ETH_RING_BUFFER_SIZE)
+
+// Queues as many of the client's entries to the hw as it and the done fifos
+// have room for. Must hold edev->lock.
+static void eth_ring_take(eth_ring_server_t* server) {
+    ethdev_t* eth = &server->edev->eth;
+
+    eth_ring_queue_t* q = &server->tx;
+    while (q->taken != __atomic_load_n(&q->fifo->tail, __ATOMIC_SEQ_CST) &&
+           q->taken - __atomic_load_n(&q->done->head, __ATOMIC_SEQ_CST) < ETH_RING_ENTRIES) {
+        // copy it out so the client can't change it under us
+        eth_ring_entry_t e = q->fifo->entries[q->taken % ETH_RING_ENTRIES];
+        e.status = NO_ERROR;
+        if (e.buffer >= ETH_RING_BUFFERS) {
+            e.status = ERR_INVALID_ARGS;
+        } else {
+            mx_status_t r = eth_queue_tx(eth, server->buffer_phys[e.buffer], e.length);
+            if (r == ERR_NO_RESOURCES) break;
+            e.status = r;
+        }
+        q->entries[q->taken++ % ETH_RING_ENTRIES] = e;
+        __atomic_store_n(&q->fifo->head, q->taken, __ATOMIC_SEQ_CST);
+    }
+    eth_tx_flush(eth);
+
+    q = &server->rx;
+    while (q->taken != __atomic_load_n(&q->fifo->tail, __ATOMIC_SEQ_CST) &&
+           q->taken - __atomic_load_n(&q->done->head, __ATOMIC_SEQ_CST) < ETH_RING_ENTRIES) {
+        eth_ring_entry_t e = q->fifo->entries[q->taken % ETH_RING_ENTRIES];
+        e.status = NO_ERROR;
+        e.length = 0;
+        if (e.buffer >= ETH_RING_BUFFERS) {
+            e.status = ERR_INVALID_ARGS;
+        } else if (eth_queue_rx(eth, server->buffer_phys[e.buffer]) != NO_ERROR) {
+            break;
+        }
+        q->entries[q->taken++ % ETH_RING_ENTRIES] = e;
+        __atomic_store_n(&q->fifo->head, q->taken, __ATOMIC_SEQ_CST);
+    }
+    eth_rx_flush(eth);
+}
+
+// Gives back every entry the hw is done with, kicking the client once if a
+// done fifo it had emptied gets any. Must hold edev->lock.
+static void eth_ring_return(eth_ring_server_t* server) {
+    ethdev_t* eth = &server->edev->eth;
+    bool kick = false;
+
+    for (int dir = 0; dir < 2; dir++) {
+        eth_ring_queue_t* q = dir ? &server->rx : &server->tx;
+        while (q->returned != q->taken) {
+            eth_ring_entry_t* e = &q->entries[q->returned % ETH_RING_ENTRIES];
+            // entries that never made it to the hw go straight back
+            if (e->status == NO_ERROR) {
+                if (dir) {
+                    mx_status_t r = eth_rx_done(eth);
+                    if (r == ERR_BAD_STATE) break;
+                    if (r < 0) {
+                        e->status = r;
+                    } else {
+                        e->length = r;
+                    }
+                } else if (eth_tx_done(eth) != NO_ERROR) {
+                    break;
+                }
+            }
+            // our own count, the tail in the ring is client-writable
+            uint32_t tail = q->returned;
+            if (__atomic_load_n(&q->done->head, __ATOMIC_SEQ_CST) == tail) {
+                kick = true;
+            }
+            q->done->entries[tail % ETH_RING_ENTRIES] = *e;
+            __atomic_store_n(&q->done->tail, tail + 1, __ATOMIC_SEQ_CST);
+            q->returned++;
+        }
+    }
+
+    if (kick) {
+        ring_server_notify(&server->rs);
+    }
+}
+
+static void eth_ring_kick(void* cookie) {
+    eth_ring_server_t* server = cookie;
+    ethernet_device_t* edev = server->edev;
+
+    mxr_mutex_lock(&edev->lock);
+    eth_ring_take(server);
+    eth_ring_return(server);
+    mxr_mutex_unlock(&edev->lock);
+}
+
+// The client is gone, take the hw back before its buffers go away.
+static void eth_ring_close(void* cookie) {
+    eth_ring_server_t* server = cookie;
+    ethernet_device_t* edev = server->edev;
+
+    mxr_mutex_lock(&edev->lock);
+    eth_set_zero_copy(&edev->eth, false);
+    edev->ring = NULL;
+    mxr_mutex_unlock(&edev->lock);
+
+    ring_server_release(&server->rs);
+    free(server);
+}
+
+static const ring_server_ops_t eth_ring_ops = {
+    .kick = eth_ring_kick,
+    .close = eth_ring_close,
+};
+
+static mx_status_t eth_ring_create(ethernet_device_t* edev, mx_handle_t* out) {
+    eth_ring_server_t* server = calloc(1, sizeof(eth_ring_server_t));
+    if (!server) {
+        return ERR_NO_MEMORY;
+    }
+    server->edev = edev;
+
+    // the buffers start on the page after the fifos
+    uint64_t buffer_offset = (sizeof(eth_ring_t) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    mx_handle_t h;
+    mx_status_t status = ring_server_init(&server->rs, buffer_offset + ETH_RING_BUFFERS_SIZE, &h);
+    if (status < 0) {
+        free(server);
+        return status;
+    }
+    server->ring = server->rs.mapping;
+    server->ring->buffer_offset = buffer_offset;
+    server->tx.fifo = &server->ring->tx;
+    server->tx.done = &server->ring->tx_done;
+    server->rx.fifo = &server->ring->rx;
+    server->rx.done = &server->ring->rx_done;
+
+    // buffers are page aligned and a power of two no bigger than a page, so
+    // none crosses a page and each is physically contiguous
+    static_assert(PAGE_SIZE % ETH_RING_BUFFER_SIZE == 0, "ring buffers cross pages");
+    mx_paddr_t pages[ETH_RING_BUFFERS_SIZE / PAGE_SIZE];
+    status = mx_vm_object_lookup(server->rs.vmo, buffer_offset, ETH_RING_BUFFERS_SIZE,
+                                 pages, countof(pages));
+    if (status < 0) {
+        goto fail;
+    }
+    for (uint32_t i = 0; i < ETH_RING_BUFFERS; i++) {
+        size_t offset = i * ETH_RING_BUFFER_SIZE;
+        server->buffer_phys[i] = pages[offset / PAGE_SIZE] + offset % PAGE_SIZE;
+    }
+
+    mxr_mutex_lock(&edev->lock);
+    if (edev->ring) {
+        mxr_mutex_unlock(&edev->lock);
+        status = ERR_ALREADY_BOUND;
+        goto fail;
+    }
+    edev->ring = server;
+    eth_set_zero_copy(&edev->eth, true);
+    device_state_clr(&edev->dev, DEV_STATE_READABLE);
+    mxr_mutex_unlock(&edev->lock);
+
+    if ((status = ring_server_start(&server->rs, "eth-ring-thread", &eth_ring_ops, server)) < 0) {
+        mxr_mutex_lock(&edev->lock);
+        eth_set_zero_copy(&edev->eth, false);
+        edev->ring = NULL;
+        mxr_mutex_unlock(&edev->lock);
+        goto fail;
+    }
+
+    *out = h;
+    return NO_ERROR;
+
+fail:
+    mx_handle_close(h);
+    ring_server_release(&server->rs);
+    free(server);
+    return status;
+}
+
 static int irq_thread(void* arg) {
     ethernet_device_t* edev = arg;
     for (;;) {
@@ -60,7 +262,15 @@ static int irq_thread(void* arg) {
             break;
         }
         mxr_mutex_lock(&edev->lock);
-        if (eth_handle_irq(&edev->eth) & ETH_IRQ_RX) {
+        unsigned irq = eth_handle_irq(&edev->eth);
+        if (edev->ring) {
+            // give back everything that's done, then refill the rx ring
+            // from buffers that were waiting for descriptors
+            if (irq & (ETH_IRQ_RX | ETH_IRQ_TX)) {
+                eth_ring_return(edev->ring);
+                eth_ring_take(edev->ring);
+            }
+        } else if (irq & ETH_IRQ_RX) {
             device_state_set(&edev->dev, DEV_STATE_READABLE);
         }
         mxr_mutex_unlock(&edev->lock);
@@ -72,6 +282,10 @@ static mx_status_t eth_recv(mx_device_t* dev, void* data, size_t len) {
     ethernet_device_t* edev = get_eth_device(dev);
     mx_status_t r = ERR_BAD_STATE;
     mxr_mutex_lock(&edev->lock);
+    if (edev->ring) {
+        mxr_mutex_unlock(&edev->lock);
+        return ERR_BAD_STATE;
+    }
     r = eth_rx(&edev->eth, data);
     if (r <= 0) {
         device_state_clr(dev, DEV_STATE_READABLE);
@@ -87,6 +301,10 @@ static mx_status_t eth_send(mx_device_t* dev, const void* data, size_t len) {
     }
     mx_status_t r = len;
     mxr_mutex_lock(&edev->lock);
+    if (edev->ring) {
+        mxr_mutex_unlock(&edev->lock);
+        return ERR_BAD_STATE;
+    }
     r = eth_tx(&edev->eth, data, len);
     mxr_mutex_unlock(&edev->lock);
     return r;
@@ -132,6 +350,25 @@ static ssize_t eth_write(mx_device_t* dev, const void* data, size_t len, mx_off_
     return eth_send(dev, data, len);
 }
 
+static ssize_t eth_ioctl(mx_device_t* dev, uint32_t op, const void* in_buf, size_t in_len,
+                         void* out_buf, size_t out_len) {
+    switch (op) {
+    case ETHERNET_OP_GET_RING: {
+        if (out_len < sizeof(ioctl_ethernet_ring_t)) {
+            return ERR_NOT_ENOUGH_BUFFER;
+        }
+        ioctl_ethernet_ring_t* reply = out_buf;
+        mx_status_t r = eth_ring_create(get_eth_device(dev), &reply->pipe);
+        if (r < 0) {
+            return r;
+        }
+        return sizeof(ioctl_ethernet_ring_t);
+    }
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+}
+
 static mx_status_t eth_release(mx_device_t* dev) {
     ethernet_device_t* edev = get_eth_device(dev);
     eth_reset_hw(&edev->eth);
@@ -146,6 +383,7 @@ static mx_protocol_device_t device_ops = {
     .release = eth_release,
     .read = eth_read,
     .write = eth_write,
+    .ioctl = eth_ioctl,
 };
 
 static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev) {
@@ -98,7 +98,7 @@ status_t eth_tx(ethdev_t* eth, const void* data, size_t len) {
         // TODO: verify that this is the matching buffer to txd[n] addr?
         list_add_tail(&eth->free_frames, &frame->node);
         eth->txd[n].info = 0;
-        n = (n + 1) & (ETH_TXBUF_COUNT - 1);
+        n = (n + 1) & (ETH_TXD_COUNT - 1);
     }
     eth->tx_rd_ptr = n;
 
@@ -115,13 +115,98 @@ status_t eth_tx(ethdev_t* eth, const void* data, size_t len) {
     list_add_tail(&eth->busy_frames, &frame->node);
 
     // inform hw of buffer availability
-    n = (n + 1) & (ETH_TXBUF_COUNT - 1);
+    n = (n + 1) & (ETH_TXD_COUNT - 1);
     eth->tx_wr_ptr = n;
     writel(n, IE_TDT);
 
     return len;
 }
 
+status_t eth_queue_tx(ethdev_t* eth, uint64_t phys, size_t len) {
+    if ((len < 64) || (len > ETH_RXBUF_SIZE)) {
+        return ERR_INVALID_ARGS;
+    }
+    uint32_t n = eth->tx_wr_ptr;
+    uint32_t next = (n + 1) & (ETH_TXD_COUNT - 1);
+    if (next == eth->tx_rd_ptr) {
+        return ERR_NO_RESOURCES;
+    }
+    eth->txd[n].addr = phys;
+    eth->txd[n].info = IE_TXD_LEN(len) | IE_TXD_EOP | IE_TXD_IFCS | IE_TXD_RS;
+    eth->tx_wr_ptr = next;
+    return NO_ERROR;
+}
+
+void eth_tx_flush(ethdev_t* eth) {
+    writel(eth->tx_wr_ptr, IE_TDT);
+}
+
+status_t eth_tx_done(ethdev_t* eth) {
+    uint32_t n = eth->tx_rd_ptr;
+    if ((n == eth->tx_wr_ptr) || !(eth->txd[n].info & IE_TXD_DONE)) {
+        return ERR_BAD_STATE;
+    }
+    eth->txd[n].info = 0;
+    eth->tx_rd_ptr = (n + 1) & (ETH_TXD_COUNT - 1);
+    return NO_ERROR;
+}
+
+status_t eth_queue_rx(ethdev_t* eth, uint64_t phys) {
+    uint32_t n = eth->rx_wr_ptr;
+    uint32_t next = (n + 1) & (ETH_RXD_COUNT - 1);
+    if (next == eth->rx_rd_ptr) {
+        return ERR_NO_RESOURCES;
+    }
+    eth->rxd[n].addr = phys;
+    eth->rxd[n].info = 0;
+    eth->rx_wr_ptr = next;
+    return NO_ERROR;
+}
+
+void eth_rx_flush(ethdev_t* eth) {
+    writel(eth->rx_wr_ptr, IE_RDT);
+}
+
+status_t eth_rx_done(ethdev_t* eth) {
+    uint32_t n = eth->rx_rd_ptr;
+    uint64_t info = eth->rxd[n].info;
+    if ((n == eth->rx_wr_ptr) || !(info & IE_RXD_DONE)) {
+        return ERR_BAD_STATE;
+    }
+    mx_status_t r = IE_RXD_LEN(info);
+    if (r > ETH_RXBUF_SIZE) {
+        r = ERR_IO;
+    }
+    eth->rxd[n].info = 0;
+    eth->rx_rd_ptr = (n + 1) & (ETH_RXD_COUNT - 1);
+    return r;
+}
+
+static void eth_fill_rx_ring(ethdev_t* eth) {
+    for (int n = 0; n < ETH_RXBUF_COUNT; n++) {
+        eth->rxd[n].addr = eth->rxb_phys + ETH_RXBUF_SIZE * n;
+    }
+}
+
+void eth_set_zero_copy(ethdev_t* eth, bool enable) {
+    // stop the hw before taking the rings back from it
+    writel(0, IE_RCTL);
+    writel(0, IE_TCTL);
+
+    framebuf_t* frame;
+    while ((frame = list_remove_head_type(&eth->busy_frames, framebuf_t, node)) != NULL) {
+        list_add_tail(&eth->free_frames, &frame->node);
+    }
+    memset(eth->rxd, 0, ETH_DRING_SIZE);
+    memset(eth->txd, 0, ETH_DRING_SIZE);
+    if (!enable) {
+        eth_fill_rx_ring(eth);
+    }
+
+    eth->zero_copy = enable;
+    eth_init_hw(eth);
+}
+
 status_t eth_reset_hw(ethdev_t* eth) {
     // TODO: don't rely on bootloader having initialized the
     // controller in order to obtain the mac address
@@ -151,14 +236,16 @@ void eth_init_hw(ethdev_t* eth) {
     //TODO: TCTL COLD should be based on link state
     //TODO: use address filtering for multicast
 
-    // setup rx ring
+    // setup rx ring, empty until buffers are queued if it's zero-copy
     eth->rx_rd_ptr = 0;
+    eth->rx_wr_ptr = 0;
     writel(0, IE_RXCSUM);
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_RXDCTL);
     writel(eth->rxd_phys, IE_RDBAL);
     writel(eth->rxd_phys >> 32, IE_RDBAH);
-    writel(ETH_RXBUF_COUNT * 16, IE_RDLEN);
-    writel(ETH_RXBUF_COUNT - 1, IE_RDT);
+    writel((eth->zero_copy ? ETH_RXD_COUNT : ETH_RXBUF_COUNT) * 16, IE_RDLEN);
+    writel(0, IE_RDH);
+    writel(eth->zero_copy ? 0 : ETH_RXBUF_COUNT - 1, IE_RDT);
     writel(IE_RCTL_BSIZE2048 | IE_RCTL_DPF | IE_RCTL_SECRC | IE_RCTL_BAM | IE_RCTL_MPE | IE_RCTL_EN, IE_RCTL);
 
     // setup tx ring
@@ -167,13 +254,16 @@ void eth_init_hw(ethdev_t* eth) {
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_TXDCTL);
     writel(eth->txd_phys, IE_TDBAL);
     writel(eth->txd_phys >> 32, IE_TDBAH);
-    writel(ETH_TXBUF_COUNT * 16, IE_TDLEN);
+    writel(ETH_TXD_COUNT * 16, IE_TDLEN);
+    writel(0, IE_TDH);
+    writel(0, IE_TDT);
     writel(IE_TCTL_CT(15) | IE_TCTL_COLD_FD | IE_TCTL_EN, IE_TCTL);
 
     // disable all irqs (write to "clear" mask)
     writel(0xFFFF, IE_IMC);
-    // enable rx irq (write to "set" mask)
-    writel(IE_INT_RXT0, IE_IMS);
+    // enable rx irq (write to "set" mask), and tx for zero-copy, where
+    // buffers go back to their owner as soon as they're sent
+    writel(eth->zero_copy ? (IE_INT_RXT0 | IE_INT_TXDW) : IE_INT_RXT0, IE_IMS);
 }
 
 void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
@@ -199,9 +289,7 @@ void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
     iomem += ETH_RXBUF_SIZE * ETH_RXBUF_COUNT;
     iophys += ETH_RXBUF_SIZE * ETH_RXBUF_COUNT;
 
-    for (int n = 0; n < ETH_RXBUF_COUNT; n++) {
-        eth->rxd[n].addr = eth->rxb_phys + ETH_RXBUF_SIZE * n;
-    }
+    eth_fill_rx_ring(eth);
     for (int n = 0; n < ETH_TXBUF_COUNT - 1; n++) {
         framebuf_t *txb = iomem;
         txb->phys = iophys + ETH_TXBUF_HSIZE;
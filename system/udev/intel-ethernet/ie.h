@@ -22,6 +22,10 @@ struct ethdev {
     uint32_t tx_wr_ptr;
     uint32_t tx_rd_ptr;
     uint32_t rx_rd_ptr;
+    uint32_t rx_wr_ptr; // zero-copy only
+
+    // rings are filled from the caller's buffers rather than our own
+    bool zero_copy;
 
     list_node_t free_frames;
     list_node_t busy_frames;
@@ -47,6 +51,11 @@ struct ethdev {
 
 #define ETH_DRING_SIZE 2048
 
+// descriptors in each hw ring (rx only uses ETH_RXBUF_COUNT of them unless
+// it's zero-copy)
+#define ETH_TXD_COUNT (ETH_DRING_SIZE / 16)
+#define ETH_RXD_COUNT (ETH_DRING_SIZE / 16)
+
 #define ETH_ALLOC ((ETH_RXBUF_SIZE * ETH_RXBUF_COUNT) + \
                    (ETH_TXBUF_SIZE * ETH_TXBUF_COUNT) + \
                    (ETH_DRING_SIZE * 2))
@@ -61,4 +70,21 @@ status_t eth_rx(ethdev_t* eth, void* data);
 status_t eth_tx(ethdev_t* eth, const void* data, size_t len);
 
 #define ETH_IRQ_RX IE_INT_RXT0
+#define ETH_IRQ_TX IE_INT_TXDW
 unsigned eth_handle_irq(ethdev_t* eth);
+
+// Zero-copy mode hands the caller's buffers straight to the hw rings in
+// place of eth_rx() and eth_tx(). Switching either way stops rx and tx and
+// drops whatever was in flight. Buffers are given back in the order they
+// were queued, and eth_tx_flush()/eth_rx_flush() pass everything queued
+// since the last flush to the hw with a single register write.
+void eth_set_zero_copy(ethdev_t* eth, bool enable);
+status_t eth_queue_tx(ethdev_t* eth, uint64_t phys, size_t len);
+void eth_tx_flush(ethdev_t* eth);
+// NO_ERROR once the oldest queued frame has gone out
+status_t eth_tx_done(ethdev_t* eth);
+// buffers must be ETH_RXBUF_SIZE bytes, physically contiguous
+status_t eth_queue_rx(ethdev_t* eth, uint64_t phys);
+void eth_rx_flush(ethdev_t* eth);
+// length of the frame received into the oldest queued buffer
+status_t eth_rx_done(ethdev_t* eth);
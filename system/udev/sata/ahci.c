@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/param.h>
 #include <unistd.h>
 
 #include "ahci.h"
@@ -70,12 +71,16 @@ typedef struct ahci_port {
     ahci_port_reg_t* regs;
     ahci_cl_t* cl;
     ahci_fis_t* fis;
-    ahci_ct_t* ct;
+    ahci_ct_t* ct[AHCI_MAX_COMMANDS]; // one command table + PRDT per slot
 
-    iotxn_t* running;
-
-    mxr_mutex_t lock; // protects txn_list
+    mxr_mutex_t lock; // protects txn_list and the fields below
     list_node_t txn_list;
+
+    int depth;                            // slots in use at most, >1 only with NCQ
+    uint32_t running;                     // bitmask of issued slots
+    bool running_ncq;                     // the running commands are queued commands
+    iotxn_t* commands[AHCI_MAX_COMMANDS]; // txn in each running slot
+    bool needs_reset;                     // nothing is issued until the worker resets the port
 } ahci_port_t;
 
 typedef struct ahci_device {
@@ -84,6 +89,7 @@ typedef struct ahci_device {
     ahci_hba_t* regs;
     uint64_t regs_size;
     mx_handle_t regs_handle;
+    uint32_t cap;
 
     pci_protocol_t* pci;
 
@@ -182,78 +188,111 @@ static void ahci_port_reset(ahci_port_t* port) {
     ahci_write(&port->regs->serr, ahci_read(&port->regs->serr));
 }
 
-static bool ahci_port_cmd_busy(ahci_port_t* port, int slot) {
-    return (ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci)) & slot;
+static bool ahci_cmd_is_ncq(uint8_t cmd) {
+    return cmd == SATA_CMD_READ_FPDMA_QUEUED || cmd == SATA_CMD_WRITE_FPDMA_QUEUED;
+}
+
+// Queued commands may run alongside each other up to the port's depth, any
+// other command needs the port to itself. Called with the port lock held.
+static bool ahci_port_can_issue(ahci_port_t* port, iotxn_t* txn) {
+    if (port->needs_reset) return false;
+    if (!port->running) return true;
+    if (!port->running_ncq || !ahci_cmd_is_ncq(sata_iotxn_pdata(txn)->cmd)) return false;
+    return __builtin_popcount(port->running) < port->depth;
 }
 
-static mx_status_t ahci_port_do_txn(ahci_port_t* port, iotxn_t* txn) {
-    assert(port->running == NULL);
-    assert(!ahci_port_cmd_busy(port, 0));
+// Called with the port lock held.
+static mx_status_t ahci_port_do_txn(ahci_port_t* port, int slot, iotxn_t* txn) {
+    assert(!(port->running & (1u << slot)));
 
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    mx_paddr_t phys;
-    txn->ops->physmap(txn, &phys);
 
-    //xprintf("ahci.%d: do_txn cmd=0x%x device=0x%x lba=0x%llx count=%u phys=0x%lx data_sz=0x%llx offset=0x%llx\n", port->nr, pdata->cmd, pdata->device, pdata->lba, pdata->count, phys, txn->length, txn->offset);
+    //xprintf("ahci.%d: do_txn slot=%d cmd=0x%x device=0x%x lba=0x%llx count=%u data_sz=0x%llx offset=0x%llx\n", port->nr, slot, pdata->cmd, pdata->device, pdata->lba, pdata->count, txn->length, txn->offset);
+
+    bool ncq = ahci_cmd_is_ncq(pdata->cmd);
 
     // build the command
-    ahci_cl_t* cl = port->cl;
+    ahci_cl_t* cl = port->cl + slot;
+    ahci_ct_t* ct = port->ct[slot];
     // don't clear the cl since we set up ctba/ctbau at init
     cl->prdtl_flags_cfl = 0;
     cl->cfl = 5; // 20 bytes
-    cl->w = pdata->cmd == SATA_CMD_WRITE_DMA_EXT ? 1 : 0;
-    cl->prdtl = txn->length / AHCI_PRD_MAX_SIZE + 1;
+    cl->w = (pdata->cmd == SATA_CMD_WRITE_DMA_EXT || pdata->cmd == SATA_CMD_WRITE_FPDMA_QUEUED) ? 1 : 0;
     cl->prdbc = 0;
-    memset(port->ct, 0, sizeof(ahci_ct_t));
+    memset(ct, 0, sizeof(ahci_ct_t));
 
-    uint8_t* cfis = port->ct->cfis;
+    uint8_t* cfis = ct->cfis;
     cfis[0] = 0x27; // host-to-device
     cfis[1] = 0x80; // command
     cfis[2] = pdata->cmd;
     cfis[7] = pdata->device;
 
     // some commands have lba/count fields
-    if (pdata->cmd == SATA_CMD_READ_DMA_EXT || pdata->cmd == SATA_CMD_WRITE_DMA_EXT) {
+    if (pdata->cmd == SATA_CMD_READ_DMA_EXT || pdata->cmd == SATA_CMD_WRITE_DMA_EXT || ncq) {
         cfis[4] = pdata->lba & 0xff;
         cfis[5] = (pdata->lba >> 8) & 0xff;
         cfis[6] = (pdata->lba >> 16) & 0xff;
         cfis[8] = (pdata->lba >> 24) & 0xff;
         cfis[9] = (pdata->lba >> 32) & 0xff;
         cfis[10] = (pdata->lba >> 40) & 0xff;
+    }
+    if (ncq) {
+        // queued commands carry the count in the features field and the tag
+        // in the count field
+        cfis[3] = pdata->count & 0xff;
+        cfis[11] = (pdata->count >> 8) & 0xff;
+        cfis[12] = (slot << 3) & 0xff;
+    } else if (pdata->cmd == SATA_CMD_READ_DMA_EXT || pdata->cmd == SATA_CMD_WRITE_DMA_EXT) {
         cfis[12] = pdata->count & 0xff;
         cfis[13] = (pdata->count >> 8) & 0xff;
     }
 
-    ahci_prd_t* prd;
-    for (int i = 0; i < cl->prdtl - 1; i++) {
-        prd = (ahci_prd_t*)((void*)port->ct + sizeof(ahci_ct_t)) + i;
-        prd->dba = LO32(phys);
-        prd->dbau = HI32(phys);
-        prd->dbc = ((txn->length - 1) & 0x3fffff); // 0-based byte count
-
-        phys += AHCI_PRD_MAX_SIZE;
+    // a PRD for each physically contiguous piece of each iotxn in the chain,
+    // more if a piece is bigger than a PRD can hold
+    ahci_prd_t* prd = (ahci_prd_t*)((void*)ct + sizeof(ahci_ct_t));
+    int prdtl = 0;
+    for (iotxn_t* t = txn; t != NULL; t = sata_iotxn_pdata(t)->next) {
+        iotxn_sg_t* sg;
+        uint32_t sg_count;
+        t->ops->physmap_sg(t, &sg, &sg_count);
+        size_t remaining = t->length;
+        for (uint32_t i = 0; i < sg_count && remaining > 0; i++) {
+            mx_paddr_t phys = sg[i].paddr;
+            size_t piece = MIN(sg[i].length, remaining);
+            remaining -= piece;
+            while (piece > 0) {
+                assert(prdtl < AHCI_MAX_PRDS);
+                size_t length = MIN(piece, AHCI_PRD_MAX_SIZE);
+                prd->dba = LO32(phys);
+                prd->dbau = HI32(phys);
+                prd->dbc = ((length - 1) & 0x3fffff); // 0-based byte count
+
+                phys += length;
+                piece -= length;
+                prd++;
+                prdtl++;
+            }
+        }
     }
+    cl->prdtl = prdtl;
     // interrupt on last prd completion
-    prd = (ahci_prd_t*)((void*)port->ct + sizeof(ahci_ct_t)) + cl->prdtl - 1;
-    prd->dba = LO32(phys);
-    prd->dbau = HI32(phys);
-    prd->dbc = (1 << 31) | ((txn->length - 1) & 0x3fffff); // interrupt on completion
+    if (prdtl > 0) {
+        prd--;
+        prd->dbc |= (1u << 31);
+    }
 
     // start command
-    port->running = txn;
-    ahci_write(&port->regs->ci, 0x1);
+    port->commands[slot] = txn;
+    if (!port->running) port->running_ncq = ncq;
+    port->running |= (1u << slot);
+    if (ncq) {
+        // sact must be set before ci for queued commands
+        ahci_write(&port->regs->sact, 1u << slot);
+    }
+    ahci_write(&port->regs->ci, 1u << slot);
     return NO_ERROR;
 }
 
-static void ahci_port_complete_txn(ahci_device_t* dev, int nr, mx_status_t status) {
-    ahci_port_t* port = &dev->ports[nr];
-    iotxn_t* txn = port->running;
-    port->running = NULL;
-    txn->ops->complete(txn, status, txn->length); // TODO read out the actual bytes transferred
-    // hit the worker thread to do the next txn
-    mxr_completion_signal(&dev->worker_completion);
-}
-
 static mx_status_t ahci_port_initialize(ahci_port_t* port) {
     uint32_t cmd = ahci_read(&port->regs->cmd);
     if (cmd & (AHCI_PORT_CMD_ST | AHCI_PORT_CMD_FRE | AHCI_PORT_CMD_CR | AHCI_PORT_CMD_FR)) {
@@ -261,8 +300,10 @@ static mx_status_t ahci_port_initialize(ahci_port_t* port) {
         return ERR_BUSY;
     }
 
-    // allocate memory for the command list, FIS receive area, command table and PRDT
-    size_t mem_sz = sizeof(ahci_fis_t) + sizeof(ahci_cl_t) + 0xec + 0x74 + sizeof(ahci_ct_t) + sizeof(ahci_prd_t) * AHCI_MAX_PRDS; // TODO 1 command at a time for now
+    // allocate memory for the command list, FIS receive area and a command
+    // table and PRDT for every slot
+    size_t ct_sz = sizeof(ahci_ct_t) + sizeof(ahci_prd_t) * AHCI_MAX_PRDS;
+    size_t mem_sz = sizeof(ahci_cl_t) * AHCI_MAX_COMMANDS + sizeof(ahci_fis_t) + ct_sz * AHCI_MAX_COMMANDS;
     mx_paddr_t mem_phys;
     void* mem;
     mx_status_t status = mx_alloc_device_memory(mem_sz, &mem_phys, &mem);
@@ -272,29 +313,37 @@ static mx_status_t ahci_port_initialize(ahci_port_t* port) {
     }
 
     // clear memory area
-    // order is command list (1024-byte aligned) / 0xec bytes padding
-    //          FIS receive area (256-byte aligned) / 0x74 bytes padding
-    //          command table + PRDT (127-byte aligned)
+    // order is command list (1024-byte aligned, 32 entries)
+    //          FIS receive area (256-byte aligned)
+    //          32 x (command table + PRDT) (128-byte aligned)
+    // the sizes of each keep the next one aligned
+    static_assert(sizeof(ahci_cl_t) * AHCI_MAX_COMMANDS == 1024, "unexpected command list size");
+    static_assert((sizeof(ahci_ct_t) + sizeof(ahci_prd_t) * AHCI_MAX_PRDS) % 128 == 0, "unaligned command table");
     memset(mem, 0, mem_sz);
 
     // command list
     ahci_write(&port->regs->clb, LO32(mem_phys));
     ahci_write(&port->regs->clbu, HI32(mem_phys));
-    mem_phys += sizeof(ahci_cl_t) + 0xec; // alignment padding
+    mem_phys += sizeof(ahci_cl_t) * AHCI_MAX_COMMANDS;
     port->cl = mem;
-    mem += sizeof(ahci_cl_t) + 0xec;
+    mem += sizeof(ahci_cl_t) * AHCI_MAX_COMMANDS;
 
     // FIS receive area
     ahci_write(&port->regs->fb, LO32(mem_phys));
     ahci_write(&port->regs->fbu, HI32(mem_phys));
-    mem_phys += sizeof(ahci_fis_t) + 0x74; // alignment padding
+    mem_phys += sizeof(ahci_fis_t);
     port->fis = mem;
-    mem += sizeof(ahci_fis_t) + 0x74;
-
-    // command table, followed by PRDT
-    port->cl[0].ctba = LO32(mem_phys);
-    port->cl[0].ctbau = HI32(mem_phys);
-    port->ct = mem;
+    mem += sizeof(ahci_fis_t);
+
+    // command tables, each followed by its PRDT
+    for (int i = 0; i < AHCI_MAX_COMMANDS; i++) {
+        port->cl[i].ctba = LO32(mem_phys);
+        port->cl[i].ctbau = HI32(mem_phys);
+        port->ct[i] = mem;
+        mem_phys += ct_sz;
+        mem += ct_sz;
+    }
+    port->depth = 1;
 
     // clear port interrupts
     ahci_write(&port->regs->is, ahci_read(&port->regs->is));
@@ -363,32 +412,58 @@ void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     mxr_completion_signal(&device->worker_completion);
 }
 
+int ahci_port_set_ncq_depth(mx_device_t* dev, int nr, int depth) {
+    ahci_device_t* device = get_ahci_device(dev);
+    ahci_port_t* port = &device->ports[nr];
+
+    assert(nr < AHCI_MAX_PORTS);
+
+    if (!(device->cap & AHCI_CAP_SNCQ)) depth = 0;
+    int slots = ((device->cap >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    if (depth > slots) depth = slots;
+
+    mxr_mutex_lock(&port->lock);
+    port->depth = depth > 0 ? depth : 1;
+    mxr_mutex_unlock(&port->lock);
+
+    if (depth > 0) {
+        xprintf("ahci.%d: ncq queue depth %d\n", nr, depth);
+    }
+    return depth;
+}
+
 // worker thread (for iotxn queue):
 
 static int ahci_worker_thread(void* arg) {
     ahci_device_t* dev = (ahci_device_t*)arg;
     ahci_port_t* port;
-    list_node_t* node;
+    iotxn_t* txn;
     for (;;) {
         // iterate all the ports and run commands
         for (int i = 0; i < AHCI_MAX_PORTS; i++) {
             port = &dev->ports[i];
             if (!(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT))) continue;
 
-            // check for port busy
-            // FIXME multiple commands
-            if (ahci_port_cmd_busy(port, 0)) continue;
-
-            // run the next command if not busy
             mxr_mutex_lock(&port->lock);
-            node = list_remove_head(&port->txn_list);
-            mxr_mutex_unlock(&port->lock);
-
-            if (!node) continue;
+            if (port->needs_reset) {
+                // the reset waits up to a couple of seconds for the device;
+                // nothing is running and nothing is issued until it's done,
+                // so the lock needn't be held
+                mxr_mutex_unlock(&port->lock);
+                ahci_port_reset(port);
+                mxr_mutex_lock(&port->lock);
+                port->needs_reset = false;
+            }
 
-            ahci_port_do_txn(port, containerof(node, iotxn_t, node));
+            // issue commands in order for as long as there are free slots
+            while ((txn = list_peek_head_type(&port->txn_list, iotxn_t, node)) != NULL) {
+                if (!ahci_port_can_issue(port, txn)) break;
+                list_delete(&txn->node);
+                ahci_port_do_txn(port, __builtin_ctz(~port->running), txn);
+            }
+            mxr_mutex_unlock(&port->lock);
         }
-        // wait here until more commands are queued, or a port becomes idle
+        // wait here until more commands are queued, or a slot frees up
         mxr_completion_wait(&dev->worker_completion, MX_TIME_INFINITE);
         mxr_completion_reset(&dev->worker_completion);
     }
@@ -402,26 +477,48 @@ static void ahci_port_irq(ahci_device_t* dev, int nr) {
     // clear interrupt
     uint32_t is = ahci_read(&port->regs->is);
     ahci_write(&port->regs->is, is);
-    if (is & AHCI_PORT_INT_DHR) { // RFIS rcv
-        if (port->running) {
-            ahci_port_complete_txn(dev, nr, NO_ERROR);
-        }
-    }
-    if (is & AHCI_PORT_INT_PS) { // PSFIS rcv
-        if (port->running) {
-            ahci_port_complete_txn(dev, nr, NO_ERROR);
-        }
-    }
+
     if (is & AHCI_PORT_INT_PRC) { // PhyRdy change
         uint32_t serr = ahci_read(&port->regs->serr);
         ahci_write(&port->regs->serr, serr & ~0x1);
     }
+
+    iotxn_t* done[AHCI_MAX_COMMANDS];
+    mx_status_t done_status[AHCI_MAX_COMMANDS];
+    int done_count = 0;
+
+    mxr_mutex_lock(&port->lock);
+    // a slot is done when the hba has cleared it from both sact and ci
+    uint32_t completed = port->running & ~(ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci));
+    uint32_t failed = 0;
     if (is & AHCI_PORT_INT_TFE) { // taskfile error
-        if (port->running) {
-            // the current command errored
-            ahci_port_complete_txn(dev, nr, ERR_INTERNAL);
+        // the device aborts every outstanding queued command on error, so
+        // fail the rest and have the worker restart the port to clear ci
+        // and sact
+        failed = port->running & ~completed;
+        port->needs_reset = true;
+    }
+    port->running &= ~(completed | failed);
+    for (int slot = 0; slot < AHCI_MAX_COMMANDS; slot++) {
+        if (!((completed | failed) & (1u << slot))) continue;
+        done[done_count] = port->commands[slot];
+        done_status[done_count++] = (failed & (1u << slot)) ? ERR_INTERNAL : NO_ERROR;
+        port->commands[slot] = NULL;
+    }
+    mxr_mutex_unlock(&port->lock);
+
+    for (int i = 0; i < done_count; i++) {
+        iotxn_t* txn = done[i];
+        while (txn) {
+            iotxn_t* next = sata_iotxn_pdata(txn)->next;
+            txn->ops->complete(txn, done_status[i], done_status[i] == NO_ERROR ? txn->length : 0); // TODO read out the actual bytes transferred
+            txn = next;
         }
     }
+    if (done_count || port->needs_reset) {
+        // hit the worker thread to reset the port or issue more commands
+        mxr_completion_signal(&dev->worker_completion);
+    }
 }
 
 static int ahci_irq_thread(void* arg) {
@@ -459,6 +556,8 @@ static mx_status_t ahci_initialize(ahci_device_t* dev) {
     // enable ahci mode
     ahci_enable_ahci(dev);
 
+    dev->cap = ahci_read(&dev->regs->cap);
+
     // count number of ports
     uint32_t port_map = ahci_read(&dev->regs->pi);
 
@@ -20,7 +20,7 @@
 
 #define AHCI_MAX_PORTS    32
 #define AHCI_MAX_COMMANDS 32
-#define AHCI_MAX_PRDS     128 // just a random choice, hardware max is 64k-1
+#define AHCI_MAX_PRDS     512 // a 2mb transfer in scattered pages, hardware max is 64k-1
 
 #define AHCI_PRD_MAX_SIZE 0x400000 // 4mb
 
@@ -94,6 +94,10 @@ typedef struct {
     uint32_t vendor[4];     // vendor specific
 } __attribute__((packed)) ahci_port_reg_t;
 
+#define AHCI_CAP_NCS_SHIFT 8
+#define AHCI_CAP_NCS_MASK  0x1f
+#define AHCI_CAP_SNCQ      (1 << 30)
+
 #define AHCI_GHC_HR (1 << 0)
 #define AHCI_GHC_IE (1 << 1)
 #define AHCI_GHC_AE (1 << 31)
@@ -168,3 +172,9 @@ static_assert(sizeof(ahci_ct_t) == 0x80, "unexpected command table header size")
 static_assert(sizeof(ahci_prd_t) == 0x10, "unexpected prd entry size");
 
 void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn);
+
+// Called by the sata layer once the device on a port has been identified.
+// depth is the number of queued commands the device accepts, 0 if it does not
+// support NCQ. Returns the queue depth the port will use, or 0 if queued
+// commands must not be sent to it.
+int ahci_port_set_ncq_depth(mx_device_t* dev, int port, int depth);
@@ -74,75 +74,50 @@ static void gpt_read_sync_complete(iotxn_t* txn) {
 
 // implement device protocol:
 
-static ssize_t gpt_partdev_read(mx_device_t* dev, void* buf, size_t count, mx_off_t off) {
-    gpt_partdev_t* device = get_gpt_device(dev);
-    iotxn_t* txn;
-    mx_status_t status = iotxn_alloc(&txn, 0, TXN_SIZE, 0);
-    if (status != NO_ERROR) {
-        xprintf("%s: error %d allocating iotxn\n", dev->name, status);
-        return status;
-    }
+static void gpt_partdev_iotxn_complete(iotxn_t* clone) {
+    iotxn_t* txn = (iotxn_t*)clone->context;
+    mx_status_t status = clone->status;
+    mx_off_t actual = clone->actual;
+    clone->ops->release(clone);
+    txn->ops->complete(txn, status, actual);
+}
 
-    mxr_completion_t completion = MXR_COMPLETION_INIT;
+static void gpt_partdev_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
+    gpt_partdev_t* device = get_gpt_device(dev);
 
     // offset must be aligned to block size
-    if (off % device->blksize) {
-        xprintf("%s: offset 0x%llx is not aligned to blksize=%llu!\n", dev->name, off, device->blksize);
-        return ERR_INVALID_ARGS;
+    if (txn->offset % device->blksize) {
+        xprintf("%s: offset 0x%llx is not aligned to blksize=%llu!\n", dev->name, txn->offset, device->blksize);
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
     }
 
     // sanity check
-    uint64_t off_lba = off / device->blksize;
+    uint64_t off_lba = txn->offset / device->blksize;
     uint64_t first = device->gpt_entry.first_lba;
     uint64_t last = device->gpt_entry.last_lba;
     if (first + off_lba > last) {
-        xprintf("%s: offset 0x%llx is past the end of partition!\n", dev->name, off);
-        return ERR_INVALID_ARGS;
+        xprintf("%s: offset 0x%llx is past the end of partition!\n", dev->name, txn->offset);
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
     }
-    // constrain if too many bytes are requested
-    uint64_t c = MIN((last - (first + off_lba)) * device->blksize, count);
-
-    // queue iotxn's until c bytes is read
-    mx_off_t offset = off;
-    mx_off_t toff = 0;
-    void* ptr = buf;
-    while (c > 0) {
-        txn->opcode = IOTXN_OP_READ;
-        txn->offset = first * device->blksize + offset;
-        txn->length = c > TXN_SIZE ? TXN_SIZE : c;
-        txn->complete_cb = gpt_read_sync_complete;
-        txn->context = &completion;
-
-        iotxn_queue(dev->parent, txn);
-        mxr_completion_wait(&completion, MX_TIME_INFINITE);
-
-        if (txn->status != NO_ERROR) {
-            xprintf("%s: error %d in iotxn\n", dev->name, txn->status);
-            txn->ops->release(txn);
-            return txn->status;
-        }
-
-        // get the data!
-        txn->ops->copyfrom(txn, ptr, txn->actual, toff);
-
-        ptr += txn->actual;
-        offset += txn->actual;
-        toff += txn->actual;
-        c -= txn->actual;
 
-        // give up if the device read fewer bytes than requested
-        if (txn->actual < txn->length) break;
-
-        // reset so we can keep reading
-        mxr_completion_reset(&completion);
+    // the clone shares the data buffer, so the parent transfers straight
+    // into the caller's iotxn
+    iotxn_t* clone;
+    mx_status_t status = txn->ops->clone(txn, &clone, 0);
+    if (status != NO_ERROR) {
+        txn->ops->complete(txn, status, 0);
+        return;
     }
 
-    txn->ops->release(txn);
-    return toff;
-}
+    // constrain if too many bytes are requested, last LBA is inclusive
+    clone->length = MIN((last - (first + off_lba) + 1) * device->blksize, txn->length);
+    clone->offset = txn->offset + first * device->blksize;
+    clone->complete_cb = gpt_partdev_iotxn_complete;
+    clone->context = txn;
 
-static ssize_t gpt_partdev_write(mx_device_t* dev, const void* buf, size_t count, mx_off_t off) {
-    return ERR_NOT_SUPPORTED;
+    iotxn_queue(dev->parent, clone);
 }
 
 static ssize_t gpt_partdev_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen, void* reply, size_t max) {
@@ -183,8 +158,7 @@ static mx_off_t gpt_partdev_getsize(mx_device_t* dev) {
 }
 
 static mx_protocol_device_t gpt_partdev_proto = {
-    .read = gpt_partdev_read,
-    .write = gpt_partdev_write,
+    .iotxn_queue = gpt_partdev_iotxn_queue,
     .ioctl = gpt_partdev_ioctl,
     .get_size = gpt_partdev_getsize,
 };
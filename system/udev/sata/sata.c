@@ -15,6 +15,7 @@
 #include <ddk/device.h>
 #include <ddk/driver.h>
 #include <ddk/binding.h>
+#include <ddk/block-queue.h>
 #include <ddk/hexdump.h>
 #include <ddk/protocol/block.h>
 
@@ -46,6 +47,11 @@
 
 #define SATA_FLAG_DMA   (1 << 0)
 #define SATA_FLAG_LBA48 (1 << 1)
+#define SATA_FLAG_NCQ   (1 << 2)
+
+// every merged iotxn takes at least one PRD, this keeps a merged command well
+// within AHCI_MAX_PRDS
+#define SATA_MAX_MERGE_TXNS 32
 
 typedef struct sata_device {
     mx_device_t device;
@@ -55,6 +61,11 @@ typedef struct sata_device {
 
     mx_size_t sector_sz;
     mx_off_t capacity; // bytes
+    int depth;         // commands in flight, more than one with NCQ
+    mx_off_t max_transfer;   // bytes per command
+    uint32_t max_segments;   // physically contiguous pieces per command
+
+    block_queue_t* queue;
 } sata_device_t;
 
 #define get_sata_device(dev) containerof(dev, sata_device_t, device)
@@ -78,6 +89,7 @@ static mx_status_t sata_device_identify(sata_device_t* dev, mx_device_t* control
     pdata->cmd = SATA_CMD_IDENTIFY_DEVICE;
     pdata->device = 0;
     pdata->port = dev->port;
+    pdata->next = NULL;
     txn->protocol = MX_PROTOCOL_SATA;
     txn->complete_cb = sata_device_identify_complete;
     txn->context = &completion;
@@ -137,6 +149,20 @@ static mx_status_t sata_device_identify(sata_device_t* dev, mx_device_t* control
     } else {
         xprintf("  CHS unsupported!\n");
     }
+
+    // queued commands address with 48-bit lba, so only use them together
+    if (flags & SATA_FLAG_LBA48) {
+        int depth = 0;
+        if (*(devinfo + SATA_DEVINFO_SATA_CAP) & (1 << 8)) {
+            depth = (*(devinfo + SATA_DEVINFO_QUEUE_DEPTH) & 0x1f) + 1;
+        }
+        depth = ahci_port_set_ncq_depth(controller, dev->port, depth);
+        if (depth > 0) {
+            flags |= SATA_FLAG_NCQ;
+            dev->depth = depth;
+            xprintf("  NCQ depth=%d\n", depth);
+        }
+    }
     dev->flags = flags;
 
     return NO_ERROR;
@@ -160,6 +186,15 @@ static ssize_t sata_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
          *blksize = device->sector_sz;
          return sizeof(*blksize);
     }
+    case BLOCK_OP_GET_QUEUE_STATS: {
+        block_queue_stats_t* stats = reply;
+        if (max < sizeof(*stats)) return ERR_NOT_ENOUGH_BUFFER;
+        block_queue_get_stats(device->queue, stats);
+        return sizeof(*stats);
+    }
+    case BLOCK_OP_RESET_QUEUE_STATS:
+        block_queue_reset_stats(device->queue);
+        return NO_ERROR;
     default:
         return ERR_NOT_SUPPORTED;
     }
@@ -178,16 +213,59 @@ static void sata_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     // constrain to device capacity
     txn->length = MIN(txn->length, device->capacity - txn->offset);
 
-    sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    // and to what a single command can transfer
+    txn->length = MIN(txn->length, device->max_transfer);
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+    txn->ops->physmap_sg(txn, &sg, &sg_count);
+    if (sg_count > device->max_segments) {
+        mx_off_t length = 0;
+        for (uint32_t i = 0; i < device->max_segments; i++) {
+            length += sg[i].length;
+        }
+        length -= length % device->sector_sz;
+        if (length == 0) {
+            txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+            return;
+        }
+        txn->length = MIN(txn->length, length);
+    }
+
+    block_queue_iotxn_queue(device->queue, txn);
+}
+
+// issue a block queue request as a single command, with the iotxns chained
+// so that the controller gives each of them its own PRDs
+static void sata_dispatch(block_queue_t* bq, block_request_t* req, void* cookie) {
+    sata_device_t* device = cookie;
+
+    iotxn_t* head = NULL;
+    iotxn_t** tail = &head;
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(&req->txn_list, iotxn_t, node)) != NULL) {
+        sata_iotxn_pdata(txn)->next = NULL;
+        *tail = txn;
+        tail = &sata_iotxn_pdata(txn)->next;
+    }
+
+    sata_pdata_t* pdata = sata_iotxn_pdata(head);
+    if (device->flags & SATA_FLAG_NCQ) {
+        pdata->cmd = req->opcode == IOTXN_OP_READ ? SATA_CMD_READ_FPDMA_QUEUED : SATA_CMD_WRITE_FPDMA_QUEUED;
+    } else {
+        pdata->cmd = req->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    }
     pdata->device = 0x40;
-    pdata->lba = txn->offset / device->sector_sz;
-    pdata->count = txn->length / device->sector_sz;
+    pdata->lba = req->offset / device->sector_sz;
+    pdata->count = req->length / device->sector_sz;
     pdata->port = device->port;
 
-    ahci_iotxn_queue(dev->parent, txn);
+    ahci_iotxn_queue(device->device.parent, head);
 }
 
+static block_queue_ops_t sata_queue_ops = {
+    .dispatch = sata_dispatch,
+};
+
 static mx_off_t sata_getsize(mx_device_t* dev) {
     sata_device_t* device = get_sata_device(dev);
     return device->capacity;
@@ -216,10 +294,28 @@ mx_status_t sata_bind(mx_device_t* dev, int port) {
     }
 
     device->port = port;
+    device->depth = 1;
 
     // send device identify
     sata_device_identify(device, dev);
 
+    // requests are merged up to what a single command can transfer. Every
+    // piece of an iotxn's data takes a PRD, plus one for each 4mb it has to
+    // be split at.
+    device->max_transfer = 0xffff * device->sector_sz;
+    device->max_segments = AHCI_MAX_PRDS - device->max_transfer / AHCI_PRD_MAX_SIZE;
+    block_queue_config_t config = {
+        .depth = device->depth,
+        .max_merge_txns = SATA_MAX_MERGE_TXNS,
+        .max_merge_bytes = device->max_transfer,
+        .max_merge_segments = device->max_segments,
+    };
+    status = block_queue_create(&config, &sata_queue_ops, device, &device->queue);
+    if (status) {
+        xprintf("sata: failed to create block queue\n");
+        goto fail;
+    }
+
     // add the device
     device->device.protocol_id = MX_PROTOCOL_BLOCK;
     device_add(&device->device, dev);
@@ -21,12 +21,15 @@
 #define SATA_CMD_READ_DMA_EXT    0x25
 #define SATA_CMD_WRITE_DMA       0xca
 #define SATA_CMD_WRITE_DMA_EXT   0x35
+#define SATA_CMD_READ_FPDMA_QUEUED  0x60
+#define SATA_CMD_WRITE_FPDMA_QUEUED 0x61
 
 #define SATA_DEVINFO_SERIAL              10
 #define SATA_DEVINFO_FW_REV              23
 #define SATA_DEVINFO_MODEL_ID            27
 #define SATA_DEVINFO_CAP                 49
 #define SATA_DEVINFO_LBA_CAPACITY        60
+#define SATA_DEVINFO_QUEUE_DEPTH         75
 #define SATA_DEVINFO_SATA_CAP            76
 #define SATA_DEVINFO_SATA_CAP2           77
 #define SATA_DEVINFO_MAJOR_VERS          80
@@ -45,6 +48,9 @@ typedef struct sata_pdata {
     uint8_t cmd;
     uint8_t device;
     int port;
+    // further iotxns transferred by the same command, each following on
+    // from the data of the one before
+    iotxn_t* next;
 } sata_pdata_t;
 
 #define sata_iotxn_pdata(txn) iotxn_pdata(txn, sata_pdata_t)
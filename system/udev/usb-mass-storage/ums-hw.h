@@ -34,7 +34,7 @@
 #define MS_READ16                   0x88
 #define MS_WRITE16                  0x8A
 #define MS_READ_CAPACITY16          0x9E
-#define MS_READ12                   0x8A
+#define MS_READ12                   0xA8
 #define MS_WRITE12                  0xAA
 
 // control request values
@@ -45,10 +45,8 @@
 // so not sure what that means
 #define FS_ENDPOINT_HALT            0x00
 
-// read flag enums
-#define USE_READ10                  1
-#define USE_READ12                  2
-#define USE_READ16                  3
+// interface protocols
+#define MSC_PROTOCOL_BULK_ONLY      0x50
 
 // error codes for CSW processing
 typedef enum {CSW_SUCCESS, CSW_FAILED, CSW_PHASE_ERROR, CSW_INVALID,
@@ -64,7 +62,7 @@ typedef enum {CSW_SUCCESS, CSW_FAILED, CSW_PHASE_ERROR, CSW_INVALID,
 #define MS_REQUEST_SENSE_COMMAND_LENGTH           6
 #define MS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH  10
 #define MS_READ_CAPACITY10_COMMAND_LENGTH         10
-#define MS_READ_CAPACITY16_COMMAND_LENGTH         10
+#define MS_READ_CAPACITY16_COMMAND_LENGTH         16
 #define MS_READ10_COMMAND_LENGTH                  10
 #define MS_READ12_COMMAND_LENGTH                  12
 #define MS_READ16_COMMAND_LENGTH                  16
@@ -72,6 +70,10 @@ typedef enum {CSW_SUCCESS, CSW_FAILED, CSW_PHASE_ERROR, CSW_INVALID,
 #define MS_WRITE12_COMMAND_LENGTH                 12
 #define MS_WRITE16_COMMAND_LENGTH                 16
 #define MS_TOGGLE_REMOVABLE_COMMAND_LENGTH        12
+#define MS_MAX_COMMAND_LENGTH                     16
+
+// READ CAPACITY(16) is a service action of SERVICE ACTION IN(16)
+#define MS_READ_CAPACITY16_SERVICE_ACTION         0x10
 
 // transfer lengths
 #define MS_NO_TRANSFER_LENGTH                     0
@@ -15,6 +15,7 @@
 #include <ddk/device.h>
 #include <ddk/driver.h>
 #include <ddk/binding.h>
+#include <ddk/iotxn.h>
 #include <ddk/protocol/usb-device.h>
 #include <hw/usb.h>
 #include <runtime/completion.h>
@@ -22,23 +23,30 @@
 #include <runtime/thread.h>
 #include <system/listnode.h>
 
+#include <assert.h>
 #include <endian.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <unistd.h>
 
 #include "ums-hw.h"
 
 #define READ_REQ_COUNT 8
-#define WRITE_REQ_COUNT 4
+#define WRITE_REQ_COUNT 8
+#define CBW_REQ_COUNT 2
+#define CSW_REQ_COUNT 1
 #define INTR_REQ_COUNT 4
 #define USB_BUF_SIZE 0x8000
 #define INTR_REQ_SIZE 8
 #define MSD_COMMAND_BLOCK_WRAPPER_SIZE 31
 #define MSD_COMMAND_STATUS_WRAPPER_SIZE 13
 
+// the most a single command transfers, larger iotxns are cut short
+#define UMS_MAX_TRANSFER (1024 * 1024)
+
 // comment the next line if you don't want debug messages
 // #define DEBUG 0
 #ifdef DEBUG
@@ -47,39 +55,97 @@
 # define DEBUG_PRINT(x) do {} while (0)
 #endif
 
+// The bulk-only transport runs one command at a time, but the CBW, the data
+// and the CSW of a command are queued to the host controller together rather
+// than one phase after another, and the data is moved through up to
+// READ_REQ_COUNT or WRITE_REQ_COUNT requests at once, each requeued for the
+// next piece as it completes. The CBW of the next command is built while the
+// current one runs so it goes out as soon as the CSW comes back. Every
+// command, including the ones issued while binding, is an iotxn with its
+// SCSI command in the protocol data.
+//
+// When a pipe stalls or the device gets out of step, the requests still
+// queued for the command are cancelled and the device recovered as the
+// bulk-only spec asks, see ums_recovery_thread().
+
+typedef struct ums_pdata {
+    uint8_t cdb[MS_MAX_COMMAND_LENGTH];
+    uint8_t cdb_len;
+    uint8_t dir;        // USB_DIR_IN or USB_DIR_OUT
+    uint8_t lun;
+    uint32_t tag;       // set when the CBW is built
+    // result, held until the iotxn is completed outside the lock
+    mx_status_t status;
+    mx_off_t actual;
+} ums_pdata_t;
+
+static_assert(sizeof(ums_pdata_t) <= sizeof(((iotxn_t*)0)->protocol_data),
+              "ums_pdata_t doesn't fit in the iotxn's protocol data");
+
+#define ums_iotxn_pdata(txn) iotxn_pdata(txn, ums_pdata_t)
+
+// What has to happen before the current command can finish, worst last.
+// Clearing a stall and resetting the device are control requests, which
+// can't be made from a completion, so they're left to ums_recovery_thread().
+enum {
+    UMS_RECOVERY_NONE,
+    // cancel the requests the device won't answer after a short read
+    UMS_RECOVERY_CANCEL,
+    // clear the stalled pipes, then read the CSW
+    UMS_RECOVERY_CLEAR_HALT,
+    // the device is out of step with us, Bulk-Only Mass Storage Reset
+    UMS_RECOVERY_RESET,
+};
+
 typedef struct {
     mx_device_t device;
     mx_device_t* udev;
     usb_device_protocol_t* usb_p;
     mx_driver_t* driver;
 
-    bool busy;
-    uint8_t tag;
-    uint32_t total_blocks;
+    uint32_t tag;
+    uint64_t total_blocks;
     uint32_t block_size;
-    uint8_t capacity_descriptor;
-    uint8_t read_flag;
+    bool use_read16;        // the lbas don't all fit READ(10)/WRITE(10)
+    mx_off_t max_transfer;
 
     usb_endpoint_t* bulk_in;
     usb_endpoint_t* bulk_out;
     usb_endpoint_t* intr_ep;
+    uint8_t interface_number;
 
     // pool of free USB requests
+    list_node_t free_cbw_reqs;
     list_node_t free_csw_reqs;
     list_node_t free_read_reqs;
     list_node_t free_write_reqs;
     list_node_t free_intr_reqs;
-    list_node_t queued_reqs;
 
-    // list of received packets not yet read by upper layer
-    list_node_t completed_reads;
-    list_node_t completed_csws;
-
-    // the last signals we reported
-    mx_signals_t signals;
     mxr_mutex_t mutex;
-    mxr_completion_t read_completion;
-
+    // iotxns waiting for the device
+    list_node_t queued_txns;
+    // the CBW for the head of queued_txns, built ahead of time
+    usb_request_t* next_cbw;
+
+    // the command the device is working on
+    iotxn_t* curr_txn;
+    mx_off_t curr_length;   // of the data phase
+    mx_off_t data_queued;   // bytes of the data phase handed to a request
+    mx_off_t data_done;     // bytes of the data phase the device has moved
+    uint32_t data_pending;  // data phase requests at the host controller
+    bool data_short;        // a read came back short, the data phase is over
+    bool csw_queued;
+    bool csw_done;          // the CSW is back, good or bad
+    bool csw_retried;       // the CSW was asked for again after a stall
+    uint32_t curr_pending;  // requests at the host controller
+    mx_status_t curr_status;
+    uint32_t curr_residue;
+
+    // asked for by the completions, carried out by ums_recovery_thread()
+    int recovery;
+    bool in_halted;
+    bool out_halted;
+    mxr_completion_t recovery_wake;
 } ums_t;
 #define get_ums(dev) containerof(dev, ums_t, device)
 
@@ -107,22 +173,30 @@ static inline void write64be(uint8_t* ptr, uint64_t n) {
     *((uint64_t*)ptr) = htobe64(n);
 }
 
+// Clears a stall on the device's side of a pipe.
+static mx_status_t ums_clear_halt(ums_t* msd, usb_endpoint_t* ep) {
+    mx_status_t status = msd->usb_p->control(msd->udev, USB_DIR_OUT | USB_TYPE_STANDARD
+                                             | USB_RECIP_ENDPOINT, USB_REQ_CLEAR_FEATURE,
+                                             FS_ENDPOINT_HALT, ep->endpoint, NULL, 0);
+    DEBUG_PRINT(("clearing halt on %02x, status is: %d\n", ep->endpoint, (int)status));
+    return status;
+}
+
+// Reset recovery: a Bulk-Only Mass Storage Reset, then clear the halt on
+// both pipes.
 static mx_status_t ums_reset(ums_t* msd) {
-    // for all these control requests, data is null, length is 0 because nothing is passed back
-    // value and index not used for first command, though index is supposed to be set to interface number
-    // TODO: check interface number, see if index needs to be set
     mx_status_t status = msd->usb_p->control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                            | USB_RECIP_INTERFACE, USB_REQ_RESET, 0x00, 0x00, NULL, 0);
+                                             | USB_RECIP_INTERFACE, USB_REQ_RESET, 0x00,
+                                             msd->interface_number, NULL, 0);
     DEBUG_PRINT(("resetting, status is: %d\n", (int)status));
-    status = msd->usb_p->control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                           | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
-                                           msd->bulk_in->endpoint, NULL, 0);
-    DEBUG_PRINT(("halting in, status is: %d\n", (int)status));
-    status = msd->usb_p->control(msd->udev, USB_DIR_OUT | USB_TYPE_CLASS
-                                           | USB_RECIP_INTERFACE, USB_REQ_CLEAR_FEATURE, FS_ENDPOINT_HALT,
-                                           msd->bulk_out->endpoint, NULL, 0);
-    DEBUG_PRINT(("halting out, status is: %d\n", (int)status));
-    return status;
+    if (status < 0) {
+        return status;
+    }
+    status = ums_clear_halt(msd, msd->bulk_in);
+    if (status < 0) {
+        return status;
+    }
+    return ums_clear_halt(msd, msd->bulk_out);
 }
 
 static mx_status_t ums_get_max_lun(ums_t* msd, void* data) {
@@ -140,656 +214,538 @@ static mx_status_t ums_get_endpoint_status(ums_t* msd, usb_endpoint_t* endpoint,
     return status;
 }
 
-static usb_request_t* get_free_write(ums_t* msd) {
-    list_node_t* node = list_remove_head(&msd->free_write_reqs);
-    if (!node) {
-        return 0;
-    }
-    // zero out memory so buffer is clean
-    usb_request_t* request = containerof(node, usb_request_t, node);
-    memset(request->buffer, 0, USB_BUF_SIZE);
-    return request;
-}
-
-static usb_request_t* get_free_read(ums_t* msd) {
-    list_node_t* node = list_remove_head(&msd->free_read_reqs);
-    if (!node) {
-        return 0;
-    }
-    usb_request_t* request = containerof(node, usb_request_t, node);
-    memset(request->buffer, 0, USB_BUF_SIZE);
-    return request;
-}
-
-static mx_status_t ums_queue_request(ums_t* msd, usb_request_t* request) {
-    // necessary to make this function because MSD cannot deal with out of order requests
-    DEBUG_PRINT(("in queue request\n"));
-    if (!(msd->busy)) {
-        DEBUG_PRINT(("not busy case\n"));
-        msd->busy = true;
-        return msd->usb_p->queue_request(msd->udev, request);
-    } else {
-        DEBUG_PRINT(("busy case\n"));
-        list_add_tail(&msd->queued_reqs, &request->node);
-        return 0;
-    }
-}
-
-static mx_status_t ums_send_cbw(ums_t* msd, uint32_t tag, uint32_t transfer_length, uint8_t flags,
-                                uint8_t lun, uint8_t command_len, void* command) {
-    usb_request_t* request = get_free_write(msd);
+// Builds the CBW for txn in a free request.
+static usb_request_t* ums_build_cbw(ums_t* msd, iotxn_t* txn) {
+    usb_request_t* request = list_remove_head_type(&msd->free_cbw_reqs, usb_request_t, node);
     if (!request) {
-        return ERR_NOT_ENOUGH_BUFFER;
+        return NULL;
     }
+    ums_pdata_t* pdata = ums_iotxn_pdata(txn);
+    pdata->tag = msd->tag++;
+
     // CBWs always have 31 bytes
-    request->transfer_length = 31;
+    memset(request->buffer, 0, MSD_COMMAND_BLOCK_WRAPPER_SIZE);
+    request->transfer_length = MSD_COMMAND_BLOCK_WRAPPER_SIZE;
 
     // first three blocks are 4 byte
     uint32_t* ptr_32 = (uint32_t*)request->buffer;
     ptr_32[0] = htole32(CBW_SIGNATURE);
-    ptr_32[1] = htole32(tag);
-    ptr_32[2] = htole32(transfer_length);
+    ptr_32[1] = htole32(pdata->tag);
+    ptr_32[2] = htole32(txn->length);
 
     // get a 1 byte pointer and start at 12 because of uint32's
     uint8_t* ptr_8 = (uint8_t*)request->buffer;
-    ptr_8[12] = flags;
-    ptr_8[13] = lun;
-    ptr_8[14] = command_len;
-
-    // copy command_len bytes from the command passed in into the command_len
-    memcpy(ptr_8 + 15, command, (size_t)command_len);
-    return ums_queue_request(msd, request);
+    ptr_8[12] = pdata->dir;
+    ptr_8[13] = pdata->lun;
+    ptr_8[14] = pdata->cdb_len;
+    memcpy(ptr_8 + 15, pdata->cdb, pdata->cdb_len);
+    return request;
 }
 
-static mx_status_t ums_recv_csw(ums_t* msd) {
-    list_node_t* csw_node = list_remove_head(&msd->free_csw_reqs);
-    if (!csw_node) {
-        return ERR_NOT_ENOUGH_BUFFER;
+static void ums_recover_locked(ums_t* msd, int recovery) {
+    if (recovery > msd->recovery) {
+        msd->recovery = recovery;
+        mxr_completion_signal(&msd->recovery_wake);
     }
-    usb_request_t* csw_request = containerof(csw_node, usb_request_t, node);
-    csw_request->transfer_length = MSD_COMMAND_STATUS_WRAPPER_SIZE;
-    memset(csw_request->buffer, 0, csw_request->transfer_length);
-    DEBUG_PRINT(("queued csw request\n"));
-    return ums_queue_request(msd, csw_request);
 }
 
-static mx_status_t ums_queue_read(ums_t* msd, uint16_t transfer_length) {
-    // read request sense response
-    list_node_t* read_node = list_remove_head(&msd->free_read_reqs);
-    if (!read_node) {
-        return ERR_NOT_ENOUGH_BUFFER;
+// A request came back with an error, so its pipe is halted. The requests
+// cancelled by the recovery itself don't count.
+static void ums_request_failed_locked(ums_t* msd, usb_request_t* request) {
+    if (request->status == ERR_CANCELLED) {
+        return;
+    }
+    DEBUG_PRINT(("request on %02x failed: %d\n", request->endpoint->endpoint, request->status));
+    if (request->endpoint == msd->bulk_in) {
+        msd->in_halted = true;
+    } else {
+        msd->out_halted = true;
     }
-    usb_request_t* read_request = containerof(read_node, usb_request_t, node);
-    read_request->transfer_length = transfer_length;
-    return ums_queue_request(msd, read_request);
+    ums_recover_locked(msd, UMS_RECOVERY_CLEAR_HALT);
 }
 
-static mx_status_t ums_queue_write(ums_t* msd, uint16_t transfer_length, const void* data) {
-    list_node_t* write_node = list_remove_head(&msd->free_write_reqs);
-    if (!write_node) {
-        return ERR_NOT_ENOUGH_BUFFER;
+static mx_status_t ums_queue_locked(ums_t* msd, list_node_t* free_list, usb_request_t* request) {
+    mx_status_t status = msd->usb_p->queue_request(msd->udev, request);
+    if (status < 0) {
+        DEBUG_PRINT(("queue_request failed: %d\n", status));
+        msd->curr_status = status;
+        list_add_head(free_list, &request->node);
+        // once the CBW is out the device is waiting for the rest
+        if (free_list != &msd->free_cbw_reqs) {
+            ums_recover_locked(msd, UMS_RECOVERY_RESET);
+        }
+        return status;
     }
-    usb_request_t* write_request = containerof(write_node, usb_request_t, node);
-    write_request->transfer_length = transfer_length;
-    memcpy(write_request->buffer, data, (size_t)transfer_length);
-    return ums_queue_request(msd, write_request);
+    msd->curr_pending++;
+    return NO_ERROR;
 }
 
-// return true if valid CSW, else false
-// maybe called process csw?
-static csw_status_t ums_verify_csw(usb_request_t* csw_request, usb_request_t* data_request,
-                                  uint32_t prevtag) {
-    // check signature is "USBS"
-    uint32_t* ptr_32 = (uint32_t*)csw_request->buffer;
-    if (letoh32(ptr_32[0]) != CSW_SIGNATURE) {
-        return CSW_INVALID;
-    }
-    // check if tag matches the tag of last CBW
-    if (letoh32(ptr_32[1]) != prevtag) {
-        return CSW_TAG_MISMATCH;
-    }
-    // check if success is true or not?
-    uint8_t* ptr_8 = (uint8_t*)(csw_request->buffer);
-    if (ptr_8[12] == CSW_FAILED) {
-        return CSW_FAILED;
-    } else if (ptr_8[12] == CSW_PHASE_ERROR) {
-        return CSW_PHASE_ERROR;
+static void ums_queue_csw_locked(ums_t* msd) {
+    usb_request_t* request = list_remove_head_type(&msd->free_csw_reqs, usb_request_t, node);
+    if (!request) {
+        msd->curr_status = ERR_NO_RESOURCES;
+        ums_recover_locked(msd, UMS_RECOVERY_RESET);
+        return;
+    }
+    request->transfer_length = MSD_COMMAND_STATUS_WRAPPER_SIZE;
+    memset(request->buffer, 0, MSD_COMMAND_STATUS_WRAPPER_SIZE);
+    msd->csw_queued = true;
+    ums_queue_locked(msd, &msd->free_csw_reqs, request);
+}
+
+// Hands as much of the data phase to free requests as there are, and queues
+// the CSW behind the last of it.
+static void ums_queue_data_locked(ums_t* msd) {
+    iotxn_t* txn = msd->curr_txn;
+    bool in = ums_iotxn_pdata(txn)->dir == USB_DIR_IN;
+    list_node_t* free_list = in ? &msd->free_read_reqs : &msd->free_write_reqs;
+
+    if (msd->recovery != UMS_RECOVERY_NONE || msd->csw_done) {
+        return;
+    }
+    while (msd->data_queued < msd->curr_length && !msd->data_short &&
+           msd->curr_status == NO_ERROR) {
+        usb_request_t* request = list_remove_head_type(free_list, usb_request_t, node);
+        if (!request) {
+            // requeued from the completion of an earlier piece
+            return;
+        }
+        size_t length = MIN(USB_BUF_SIZE, msd->curr_length - msd->data_queued);
+        if (!in) {
+            txn->ops->copyfrom(txn, request->buffer, length, msd->data_queued);
+        }
+        request->transfer_length = length;
+        msd->data_queued += length;
+        if (ums_queue_locked(msd, free_list, request) != NO_ERROR) {
+            return;
+        }
+        msd->data_pending++;
+    }
+
+    // after a short read, the reads already queued have to come back first
+    // or one of them would take the CSW
+    bool data_over = msd->data_queued == msd->curr_length ||
+                     (msd->data_short && msd->data_pending == 0);
+    if (data_over && !msd->csw_queued && msd->curr_status == NO_ERROR) {
+        ums_queue_csw_locked(msd);
+    }
+}
+
+// Starts the command at the head of the queue. Returns false if there isn't one.
+static bool ums_start_locked(ums_t* msd) {
+    iotxn_t* txn = list_remove_head_type(&msd->queued_txns, iotxn_t, node);
+    if (!txn) {
+        return false;
+    }
+    msd->curr_txn = txn;
+    msd->curr_length = txn->length;
+    msd->data_queued = 0;
+    msd->data_done = 0;
+    msd->data_pending = 0;
+    msd->data_short = false;
+    msd->csw_queued = false;
+    msd->csw_done = false;
+    msd->csw_retried = false;
+    msd->curr_pending = 0;
+    msd->curr_status = NO_ERROR;
+    msd->curr_residue = 0;
+
+    // the prefetched CBW is always for the head of the queue
+    usb_request_t* cbw = msd->next_cbw;
+    msd->next_cbw = NULL;
+    if (!cbw) {
+        cbw = ums_build_cbw(msd, txn);
+    }
+    if (!cbw) {
+        msd->curr_status = ERR_NO_RESOURCES;
+        return true;
+    }
+    ums_queue_locked(msd, &msd->free_cbw_reqs, cbw);
+    ums_queue_data_locked(msd);
+
+    // the protocol doesn't allow the next CBW out before this CSW is back,
+    // but it can be ready to go
+    iotxn_t* next = list_peek_head_type(&msd->queued_txns, iotxn_t, node);
+    if (next) {
+        msd->next_cbw = ums_build_cbw(msd, next);
+    }
+    return true;
+}
+
+// Moves the current command along once all its requests are back, and
+// starts the next. Finished iotxns are put on done, to be completed once
+// the lock is dropped.
+static void ums_advance_locked(ums_t* msd, list_node_t* done) {
+    for (;;) {
+        iotxn_t* txn = msd->curr_txn;
+        if (txn) {
+            if (msd->curr_pending > 0 || msd->recovery != UMS_RECOVERY_NONE) {
+                return;
+            }
+            ums_pdata_t* pdata = ums_iotxn_pdata(txn);
+            pdata->status = msd->curr_status;
+            if (pdata->status == NO_ERROR && !msd->csw_done) {
+                pdata->status = ERR_IO;
+            }
+            // what the device says it moved, but no more than we saw
+            mx_off_t residue = MIN(msd->curr_residue, msd->curr_length);
+            pdata->actual = pdata->status == NO_ERROR ?
+                            MIN(msd->data_done, msd->curr_length - residue) : 0;
+            list_add_tail(done, &txn->node);
+            msd->curr_txn = NULL;
+        }
+        if (!ums_start_locked(msd)) {
+            return;
+        }
     }
-    // if yes then success, and check data residue, modify transfer length so valid data only is read
-    data_request->transfer_length -= letoh32(ptr_32[2]);
-    // to complete read method so that completed read's transfer length is changed to appropriate
-    return CSW_SUCCESS;
 }
 
-static mx_status_t ums_next_request(ums_t* msd) {
-    DEBUG_PRINT(("Trying to dequeue next request\n"));
-    DEBUG_PRINT(("number of requests in list: %d\n", (int)(list_length(&msd->queued_reqs))));
-    list_node_t* node = list_remove_head(&msd->queued_reqs);
-    if (!node) {
-        DEBUG_PRINT(("no more nodes\n"));
-        msd->busy = false;
-        return 0;
+static void ums_complete_txns(list_node_t* done) {
+    iotxn_t* txn;
+    while ((txn = list_remove_head_type(done, iotxn_t, node)) != NULL) {
+        ums_pdata_t* pdata = ums_iotxn_pdata(txn);
+        txn->ops->complete(txn, pdata->status, pdata->actual);
     }
-    DEBUG_PRINT(("got node, queuing request\n"));
-    usb_request_t* request = containerof(node, usb_request_t, node);
-    mx_status_t status = msd->usb_p->queue_request(msd->udev, request);
-    return status;
 }
 
-static void ums_read_complete(usb_request_t* request) {
-    DEBUG_PRINT(("STARTING READ COMPLETE\n"));
-
-    ums_t* msd = (ums_t*)request->client_data;
-
+static void ums_queue_txn(ums_t* msd, iotxn_t* txn) {
+    list_node_t done = LIST_INITIAL_VALUE(done);
     mxr_mutex_lock(&msd->mutex);
-    if (request->status == NO_ERROR) {
-        list_add_tail(&msd->completed_reads, &request->node);
-        mxr_completion_signal(&(msd->read_completion));
+    list_add_tail(&msd->queued_txns, &txn->node);
+    if (msd->curr_txn) {
+        if (!msd->next_cbw && list_peek_head_type(&msd->queued_txns, iotxn_t, node) == txn) {
+            msd->next_cbw = ums_build_cbw(msd, txn);
+        }
     } else {
-        list_add_head(&msd->queued_reqs, &request->node);
+        ums_advance_locked(msd, &done);
     }
-    ums_next_request(msd);
     mxr_mutex_unlock(&msd->mutex);
-    DEBUG_PRINT(("ENDING READ COMPLETE\n"));
-}
-
-static void ums_csw_complete(usb_request_t* request) {
-    DEBUG_PRINT(("STARTING CSW COMPLETE\n"));
-
-    ums_t* msd = (ums_t*)request->client_data;
-
-    mxr_mutex_lock(&msd->mutex);
-    if (request->status == NO_ERROR) {
-        //TODO: verify csw against info
-        list_add_tail(&msd->free_csw_reqs, &request->node);
+    ums_complete_txns(&done);
+}
+
+// Checks the CSW the device sent back. One that isn't valid or reports a
+// phase error means the device and the host disagree about where the command
+// is, which only a reset recovery fixes.
+static void ums_parse_csw_locked(ums_t* msd, uint8_t* csw, size_t length) {
+    uint32_t* ptr_32 = (uint32_t*)csw;
+    msd->csw_done = true;
+    if (length != MSD_COMMAND_STATUS_WRAPPER_SIZE || letoh32(ptr_32[0]) != CSW_SIGNATURE ||
+        letoh32(ptr_32[1]) != ums_iotxn_pdata(msd->curr_txn)->tag) {
+        DEBUG_PRINT(("bad CSW\n"));
+        msd->curr_status = ERR_IO;
+        ums_recover_locked(msd, UMS_RECOVERY_RESET);
+    } else if (csw[12] == CSW_PHASE_ERROR) {
+        DEBUG_PRINT(("CSW phase error\n"));
+        msd->curr_status = ERR_IO;
+        ums_recover_locked(msd, UMS_RECOVERY_RESET);
+    } else if (csw[12] != CSW_SUCCESS) {
+        DEBUG_PRINT(("CSW status %d\n", csw[12]));
+        msd->curr_status = ERR_IO;
     } else {
-        list_add_head(&msd->queued_reqs, &request->node);
+        msd->curr_residue = letoh32(ptr_32[2]);
     }
-    ums_next_request(msd);
-    mxr_mutex_unlock(&msd->mutex);
-    DEBUG_PRINT(("ENDING CSW COMPLETE\n"));
 }
 
-static void ums_write_complete(usb_request_t* request) {
-    DEBUG_PRINT(("STARTING WRITE COMPLETE\n"));
+static void ums_cbw_complete(usb_request_t* request) {
     ums_t* msd = (ums_t*)request->client_data;
-    // FIXME what to do with error here?
+    list_node_t done = LIST_INITIAL_VALUE(done);
+
     mxr_mutex_lock(&msd->mutex);
-    list_add_tail(&msd->free_write_reqs, &request->node);
-    ums_next_request(msd);
+    msd->curr_pending--;
+    if (request->status != NO_ERROR && request->status != ERR_CANCELLED) {
+        // the device refused the command
+        ums_request_failed_locked(msd, request);
+        msd->curr_status = ERR_IO;
+        ums_recover_locked(msd, UMS_RECOVERY_RESET);
+    }
+    list_add_head(&msd->free_cbw_reqs, &request->node);
+    ums_advance_locked(msd, &done);
     mxr_mutex_unlock(&msd->mutex);
-    DEBUG_PRINT(("ENDING WRITE COMPLETE\n"));
+    ums_complete_txns(&done);
 }
 
-static void ums_interrupt_complete(usb_request_t* request) {
-    DEBUG_PRINT(("INTERRUPT HAPPENING?\n"));
+// Requests on an endpoint complete in the order they were queued, so until
+// a read comes back short this is always the piece of the data phase at
+// data_done.
+static void ums_data_complete(usb_request_t* request) {
     ums_t* msd = (ums_t*)request->client_data;
-    mxr_mutex_lock(&msd->mutex);
-    list_add_head(&msd->free_intr_reqs, &request->node);
-    mxr_mutex_unlock(&msd->mutex);
-}
+    list_node_t done = LIST_INITIAL_VALUE(done);
 
-mx_status_t ums_inquiry(mx_device_t* device, uint8_t lun) {
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
     mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint8_t command[MS_INQUIRY_COMMAND_LENGTH];
-    memset(command, 0, MS_INQUIRY_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_INQUIRY;
-    // set allocated length in scsi command
-    command[4] = MS_INQUIRY_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, (msd->tag)++, MS_INQUIRY_TRANSFER_LENGTH, USB_DIR_IN, lun,
-                          MS_INQUIRY_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    iotxn_t* txn = msd->curr_txn;
+    bool in = ums_iotxn_pdata(txn)->dir == USB_DIR_IN;
+    msd->curr_pending--;
+    msd->data_pending--;
+    if (request->status != NO_ERROR) {
+        ums_request_failed_locked(msd, request);
+    } else if (msd->data_short) {
+        // the device has gone on to the CSW, and it landed here
+        if (in && !msd->csw_done) {
+            ums_parse_csw_locked(msd, request->buffer, request->transfer_length);
+        } else if (in) {
+            msd->curr_status = ERR_IO;
+            ums_recover_locked(msd, UMS_RECOVERY_RESET);
+        }
+    } else {
+        size_t length = MIN(USB_BUF_SIZE, msd->curr_length - msd->data_done);
+        size_t actual = MIN(request->transfer_length, length);
+        if (in) {
+            txn->ops->copyto(txn, request->buffer, actual, msd->data_done);
+        }
+        msd->data_done += actual;
+        if (actual < length) {
+            DEBUG_PRINT(("short packet, %zu of %zu\n", actual, length));
+            msd->data_short = true;
+        }
     }
-
-    // read inquiry response
-    status = ums_queue_read(msd, MS_INQUIRY_TRANSFER_LENGTH);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    if (msd->csw_done && msd->curr_pending > 0) {
+        // the rest of what was queued for the command won't be answered
+        ums_recover_locked(msd, UMS_RECOVERY_CANCEL);
     }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
+    list_add_head(in ? &msd->free_read_reqs : &msd->free_write_reqs, &request->node);
+    ums_queue_data_locked(msd);
+    ums_advance_locked(msd, &done);
     mxr_mutex_unlock(&msd->mutex);
-    return status;
+    ums_complete_txns(&done);
 }
 
-mx_status_t ums_test_unit_ready(mx_device_t* device, uint8_t lun) {
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint8_t command[MS_TEST_UNIT_READY_COMMAND_LENGTH];
-    memset(command, 0, MS_TEST_UNIT_READY_COMMAND_LENGTH);
-    // set command type
-    command[0] = (char)MS_TEST_UNIT_READY;
-    status = ums_send_cbw(msd, (msd->tag)++, MS_NO_TRANSFER_LENGTH, USB_DIR_IN, lun,
-                          MS_TEST_UNIT_READY_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
-}
+static void ums_csw_complete(usb_request_t* request) {
+    ums_t* msd = (ums_t*)request->client_data;
+    list_node_t done = LIST_INITIAL_VALUE(done);
 
-mx_status_t ums_request_sense(mx_device_t* device, uint8_t lun) {
-    DEBUG_PRINT(("starting request sense\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
     mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint8_t command[MS_REQUEST_SENSE_COMMAND_LENGTH];
-    memset(command, 0, MS_REQUEST_SENSE_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_REQUEST_SENSE;
-    // set allocated length in scsi command
-    command[4] = MS_REQUEST_SENSE_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, (msd->tag)++, MS_REQUEST_SENSE_TRANSFER_LENGTH, USB_DIR_IN, lun,
-                            MS_REQUEST_SENSE_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    msd->curr_pending--;
+    if (request->status == NO_ERROR) {
+        ums_parse_csw_locked(msd, request->buffer, request->transfer_length);
+    } else if (request->status != ERR_CANCELLED && msd->csw_retried) {
+        // still no CSW after clearing the stall
+        msd->curr_status = ERR_IO;
+        ums_recover_locked(msd, UMS_RECOVERY_RESET);
+    } else {
+        ums_request_failed_locked(msd, request);
     }
-
-    // read request sense response
-    status = ums_queue_read(msd, MS_REQUEST_SENSE_TRANSFER_LENGTH);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    if (msd->csw_done && msd->curr_pending > 0) {
+        ums_recover_locked(msd, UMS_RECOVERY_CANCEL);
     }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
+    list_add_head(&msd->free_csw_reqs, &request->node);
+    ums_advance_locked(msd, &done);
     mxr_mutex_unlock(&msd->mutex);
-    return status;
+    ums_complete_txns(&done);
 }
 
-mx_status_t ums_read_format_capacities(mx_device_t* device, uint8_t lun) {
-    DEBUG_PRINT(("starting request sense\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
+// Recovers the device for the current command. The host's side of both
+// pipes is reset first, which cancels whatever the command still has
+// queued, so by the time the device is dealt with nothing of the command
+// is left at the host controller. After a stall the CSW is read once more;
+// if that fails too, or the CSW is bad, the device is reset.
+static int ums_recovery_thread(void* arg) {
+    ums_t* msd = (ums_t*)arg;
 
-    // CBW Configuration
-    uint8_t command[MS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH];
-    memset(command, 0, MS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_READ_FORMAT_CAPACITIES;
-    // set allocated length in scsi command
-    command[8] = MS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH;
-    status = ums_send_cbw(msd, (msd->tag)++, MS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH, USB_DIR_IN, lun,
-                            MS_READ_FORMAT_CAPACITIES_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
+    for (;;) {
+        mxr_completion_wait(&msd->recovery_wake, MX_TIME_INFINITE);
+        mxr_completion_reset(&msd->recovery_wake);
 
-    // read request sense response
-    status = ums_queue_read(msd, MS_READ_FORMAT_CAPACITIES_TRANSFER_LENGTH);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
+        mxr_mutex_lock(&msd->mutex);
+        bool needed = msd->recovery != UMS_RECOVERY_NONE;
+        mxr_mutex_unlock(&msd->mutex);
+        if (!needed) {
+            continue;
+        }
 
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
-}
+        msd->usb_p->reset_endpoint(msd->udev, msd->bulk_in);
+        msd->usb_p->reset_endpoint(msd->udev, msd->bulk_out);
 
-mx_status_t ums_read_capacity10(mx_device_t* device, uint8_t lun) {
-    DEBUG_PRINT(("starting request sense\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
+        mxr_mutex_lock(&msd->mutex);
+        int recovery = msd->recovery;
+        bool in_halted = msd->in_halted;
+        bool out_halted = msd->out_halted;
+        mxr_mutex_unlock(&msd->mutex);
 
-    // CBW Configuration
-    uint8_t command[MS_READ_CAPACITY10_COMMAND_LENGTH];
-    memset(command, 0, MS_READ_CAPACITY10_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_READ_CAPACITY10;
-    status = ums_send_cbw(msd, (msd->tag)++, MS_READ_CAPACITY10_TRANSFER_LENGTH, USB_DIR_IN, lun,
-                            MS_READ_CAPACITY10_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
+        mx_status_t status = NO_ERROR;
+        if (recovery == UMS_RECOVERY_CLEAR_HALT) {
+            if (in_halted) {
+                status = ums_clear_halt(msd, msd->bulk_in);
+            }
+            if (out_halted && status == NO_ERROR) {
+                status = ums_clear_halt(msd, msd->bulk_out);
+            }
+            if (status != NO_ERROR) {
+                recovery = UMS_RECOVERY_RESET;
+            }
+        }
+        if (recovery == UMS_RECOVERY_RESET) {
+            status = ums_reset(msd);
+            if (status != NO_ERROR) {
+                printf("ums: reset recovery failed: %d\n", status);
+            }
+        }
 
-    // read capacity10 response
-    status = ums_queue_read(msd, MS_READ_CAPACITY10_TRANSFER_LENGTH);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+        list_node_t done = LIST_INITIAL_VALUE(done);
+        mxr_mutex_lock(&msd->mutex);
+        msd->recovery = UMS_RECOVERY_NONE;
+        msd->in_halted = false;
+        msd->out_halted = false;
+        if (recovery == UMS_RECOVERY_RESET) {
+            if (msd->curr_status == NO_ERROR) {
+                msd->curr_status = ERR_IO;
+            }
+        } else if (!msd->csw_done && msd->curr_status == NO_ERROR) {
+            msd->csw_retried = true;
+            ums_queue_csw_locked(msd);
+        }
+        ums_advance_locked(msd, &done);
+        mxr_mutex_unlock(&msd->mutex);
+        ums_complete_txns(&done);
     }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
+    return NO_ERROR;
 }
 
-mx_status_t ums_read_capacity16(mx_device_t* device, uint8_t lun) {
-    DEBUG_PRINT(("starting request sense\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
+static void ums_interrupt_complete(usb_request_t* request) {
+    DEBUG_PRINT(("INTERRUPT HAPPENING?\n"));
+    ums_t* msd = (ums_t*)request->client_data;
     mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint8_t command[MS_READ_CAPACITY16_COMMAND_LENGTH];
-    memset(command, 0, MS_READ_CAPACITY16_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_READ_CAPACITY16;
-    // service action = 10, not sure what that means
-    command[1] = 0x10;
-    status = ums_send_cbw(msd, (msd->tag)++, MS_READ_CAPACITY16_TRANSFER_LENGTH, USB_DIR_IN, lun,
-                            MS_READ_CAPACITY16_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, MS_READ_CAPACITY16_TRANSFER_LENGTH);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
+    list_add_head(&msd->free_intr_reqs, &request->node);
     mxr_mutex_unlock(&msd->mutex);
-    return status;
 }
 
-mx_status_t ums_read10(mx_device_t* device, uint8_t lun, uint32_t lba, uint16_t num_blocks) {
-    DEBUG_PRINT(("starting read10\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint32_t transfer_length = num_blocks * msd->block_size;
-    uint8_t command[MS_READ10_COMMAND_LENGTH];
-    memset(command, 0, MS_READ10_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_READ10;
-    // set lba
-    write32be(command + 2, lba);
-    // set transfer length in blocks
-    write16be(command + 7, num_blocks);
-
-    status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_IN, lun, MS_READ10_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
-
-    // read request sense response
-    status = ums_queue_read(msd, transfer_length);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
+static void ums_sync_complete(iotxn_t* txn) {
+    mxr_completion_signal((mxr_completion_t*)txn->context);
 }
 
-mx_status_t ums_read12(mx_device_t* device, uint8_t lun, uint32_t lba, uint32_t num_blocks) {
-    DEBUG_PRINT(("starting read12\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint32_t transfer_length = num_blocks * msd->block_size;
-    uint8_t command[MS_READ12_COMMAND_LENGTH];
-    memset(command, 0, MS_READ12_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_READ12;
-    // set lba
-    write32be(command + 2, lba);
-    // set transfer length in blocks
-    write32be(command + 6, num_blocks);
-
-    status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_IN, lun,
-        MS_READ12_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+// Runs a command and waits for it. Returns the bytes transferred in the
+// data phase, or an error.
+static ssize_t ums_command_sync(ums_t* msd, const uint8_t* cdb, uint8_t cdb_len, uint8_t dir,
+                                void* data, size_t length) {
+    iotxn_t* txn;
+    mx_status_t status = iotxn_alloc(&txn, 0, length, 0);
+    if (status != NO_ERROR) {
+        return status;
     }
-
-    // read request sense response
-    status = ums_queue_read(msd, transfer_length);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    ums_pdata_t* pdata = ums_iotxn_pdata(txn);
+    memcpy(pdata->cdb, cdb, cdb_len);
+    pdata->cdb_len = cdb_len;
+    pdata->dir = dir;
+    pdata->lun = 0;
+    if (dir == USB_DIR_OUT) {
+        txn->ops->copyto(txn, data, length, 0);
+    }
+
+    mxr_completion_t completion = MXR_COMPLETION_INIT;
+    txn->opcode = dir == USB_DIR_IN ? IOTXN_OP_READ : IOTXN_OP_WRITE;
+    txn->length = length;
+    txn->complete_cb = ums_sync_complete;
+    txn->context = &completion;
+    ums_queue_txn(msd, txn);
+    mxr_completion_wait(&completion, MX_TIME_INFINITE);
+
+    ssize_t result = txn->status;
+    if (result == NO_ERROR) {
+        if (dir == USB_DIR_IN) {
+            txn->ops->copyfrom(txn, data, txn->actual, 0);
+        }
+        result = txn->actual;
     }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
+    txn->ops->release(txn);
+    return result;
 }
 
-mx_status_t ums_read16(mx_device_t* device, uint8_t lun, uint64_t lba, uint32_t num_blocks) {
-    DEBUG_PRINT(("starting read16\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint32_t transfer_length = num_blocks * msd->block_size;
-    uint8_t command[MS_READ16_COMMAND_LENGTH];
-    memset(command, 0, MS_READ16_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_READ16;
-    // set lba
-    write64be(command + 2, lba);
-    // set transfer length in blocks
-    write32be(command + 10, num_blocks);
-
-    status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_IN, lun,
-                            MS_READ16_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+static mx_status_t ums_read_capacity(ums_t* msd) {
+    uint8_t command[MS_READ_CAPACITY16_COMMAND_LENGTH];
+    memset(command, 0, sizeof(command));
+    command[0] = MS_READ_CAPACITY10;
+    uint8_t data[MS_READ_CAPACITY16_TRANSFER_LENGTH];
+    ssize_t result = ums_command_sync(msd, command, MS_READ_CAPACITY10_COMMAND_LENGTH, USB_DIR_IN,
+                                      data, MS_READ_CAPACITY10_TRANSFER_LENGTH);
+    if (result < 0) {
+        return result;
+    }
+    if (result < MS_READ_CAPACITY10_TRANSFER_LENGTH) {
+        return ERR_IO;
+    }
+    // the last lba, and the block size
+    uint32_t last_lba = read32be(data);
+    msd->block_size = read32be(data + 4);
+    msd->total_blocks = (uint64_t)last_lba + 1;
+    msd->use_read16 = false;
+
+    if (last_lba == 0xFFFFFFFF) {
+        // too big to say, ask again with the 64-bit version
+        memset(command, 0, sizeof(command));
+        command[0] = MS_READ_CAPACITY16;
+        command[1] = MS_READ_CAPACITY16_SERVICE_ACTION;
+        write32be(command + 10, MS_READ_CAPACITY16_TRANSFER_LENGTH);
+        result = ums_command_sync(msd, command, MS_READ_CAPACITY16_COMMAND_LENGTH, USB_DIR_IN,
+                                  data, MS_READ_CAPACITY16_TRANSFER_LENGTH);
+        if (result < 0) {
+            return result;
+        }
+        if (result < 12) {
+            return ERR_IO;
+        }
+        msd->total_blocks = read64be(data) + 1;
+        msd->block_size = read32be(data + 8);
+        msd->use_read16 = true;
     }
-
-    // read request sense response
-    status = ums_queue_read(msd, transfer_length);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    if (msd->block_size == 0) {
+        return ERR_IO;
     }
 
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
-}
-
-mx_status_t ums_write10(mx_device_t* device, uint8_t lun, uint32_t lba, uint16_t num_blocks,
-                        const void* data) {
-    DEBUG_PRINT(("starting write10\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint32_t transfer_length = num_blocks * msd->block_size;
-    uint8_t command[MS_WRITE10_COMMAND_LENGTH];
-    memset(command, 0, MS_WRITE10_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_WRITE10;
-    // set lba
-    uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-    *lba_ptr = htobe32(lba);
-    // set transfer length in blocks
-    uint16_t* transfer_len_ptr = (uint16_t*)&(command[7]);
-    *transfer_len_ptr = htobe16(num_blocks);
-    status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_OUT, lun,
-                            MS_WRITE10_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    // READ(10) and WRITE(10) carry a 16-bit block count
+    msd->max_transfer = UMS_MAX_TRANSFER - UMS_MAX_TRANSFER % msd->block_size;
+    if (!msd->use_read16) {
+        msd->max_transfer = MIN(msd->max_transfer, (mx_off_t)0xFFFF * msd->block_size);
     }
-
-    // read request sense response
-    status = ums_queue_write(msd, transfer_length, data);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
+    return NO_ERROR;
 }
 
-mx_status_t ums_write12(mx_device_t* device, uint8_t lun, uint32_t lba, uint32_t num_blocks,
-                        const void* data) {
-    DEBUG_PRINT(("starting write12\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
+static void ums_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
+    ums_t* msd = get_ums(dev);
 
-    // CBW Configuration
-    uint32_t transfer_length = num_blocks * msd->block_size;
-    uint8_t command[MS_WRITE12_COMMAND_LENGTH];
-    memset(command, 0, MS_WRITE12_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_WRITE12;
-    // set lba
-    uint32_t* lba_ptr = (uint32_t*)&(command[2]);
-    *lba_ptr = htobe32(lba);
-    // set transfer length
-    uint32_t* transfer_len_ptr = (uint32_t*)&(command[7]);
-    *transfer_len_ptr = htobe32(num_blocks);
-    status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_OUT, lun,
-                            MS_WRITE12_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    if (txn->opcode != IOTXN_OP_READ && txn->opcode != IOTXN_OP_WRITE) {
+        txn->ops->complete(txn, ERR_NOT_SUPPORTED, 0);
+        return;
     }
-
-    // read request sense response
-    status = ums_queue_write(msd, transfer_length, data);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    if (txn->offset % msd->block_size) {
+        DEBUG_PRINT(("offset 0x%" PRIx64 " not block aligned\n", txn->offset));
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
     }
-
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
-}
-
-mx_status_t ums_write16(mx_device_t* device, uint8_t lun, uint64_t lba, uint32_t num_blocks,
-                        const void* data) {
-    DEBUG_PRINT(("starting write16\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint32_t transfer_length = num_blocks * msd->block_size;
-    uint8_t command[MS_WRITE16_COMMAND_LENGTH];
-    memset(command, 0, MS_WRITE16_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_WRITE16;
-    // set lba
-    uint64_t* lba_ptr = (uint64_t*)&(command[2]);
-    *lba_ptr = htobe64(lba);
-    // set transfer length
-    uint32_t* transfer_len_ptr = (uint32_t*)&(command[7]);
-    *transfer_len_ptr = htobe32(num_blocks);
-    status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_OUT, lun,
-                            MS_WRITE16_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
-    }
-
-    // read request sense response
-    status = ums_queue_write(msd, transfer_length, data);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    mx_off_t capacity = msd->total_blocks * msd->block_size;
+    if (txn->offset >= capacity) {
+        txn->ops->complete(txn, NO_ERROR, 0);
+        return;
     }
 
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
-}
-
-mx_status_t ums_toggle_removable(mx_device_t* device, uint8_t lun, bool removable) {
-    DEBUG_PRINT(("starting toggle removable\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    // CBW Configuration
-    uint8_t command[MS_TOGGLE_REMOVABLE_COMMAND_LENGTH];
-    memset(command, 0, MS_TOGGLE_REMOVABLE_COMMAND_LENGTH);
-    // set command type
-    command[0] = MS_TOGGLE_REMOVABLE;
-    status = ums_send_cbw(msd, (msd->tag)++, MS_NO_TRANSFER_LENGTH, USB_DIR_OUT, lun,
-                            MS_TOGGLE_REMOVABLE_COMMAND_LENGTH, command);
-    if (status == ERR_NOT_ENOUGH_BUFFER) {
-        goto out;
+    // constrain to device capacity and to what a single command can transfer
+    txn->length = MIN(txn->length, capacity - txn->offset);
+    txn->length = MIN(txn->length, msd->max_transfer);
+    txn->length -= txn->length % msd->block_size;
+    if (txn->length == 0) {
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
     }
 
-    // recieve CSW
-    status = ums_recv_csw(msd);
-out:
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
-}
+    uint64_t lba = txn->offset / msd->block_size;
+    uint32_t num_blocks = txn->length / msd->block_size;
+    bool read = txn->opcode == IOTXN_OP_READ;
 
-mx_status_t ums_recv(mx_device_t* device, void* buffer, size_t length) {
-    DEBUG_PRINT(("start of ums_recv\n"));
-    ums_t* msd = get_ums(device);
-    mx_status_t status = NO_ERROR;
-    mxr_mutex_lock(&msd->mutex);
-
-    list_node_t* node = list_remove_head(&msd->completed_reads);
-    if (!node) {
-        mxr_mutex_unlock(&msd->mutex);
-        DEBUG_PRINT(("before wait\n"));
-        mx_status_t wait_status = mxr_completion_wait(&(msd->read_completion), MX_TIME_INFINITE);
-        DEBUG_PRINT(("after wait\n"));
-        mxr_mutex_lock(&msd->mutex);
-        if (wait_status == ERR_TIMED_OUT) {
-            DEBUG_PRINT(("no node :(\n"));
-            // is this right error code to use?
-            status = ERR_NOT_FOUND;
-            goto out;
-        }
-        mxr_completion_reset(&(msd->read_completion));
-        node = list_remove_head(&msd->completed_reads);
+    ums_pdata_t* pdata = ums_iotxn_pdata(txn);
+    memset(pdata, 0, sizeof(*pdata));
+    // TODO: deal with lun
+    pdata->lun = 0;
+    pdata->dir = read ? USB_DIR_IN : USB_DIR_OUT;
+    if (msd->use_read16) {
+        pdata->cdb[0] = read ? MS_READ16 : MS_WRITE16;
+        write64be(pdata->cdb + 2, lba);
+        write32be(pdata->cdb + 10, num_blocks);
+        pdata->cdb_len = MS_READ16_COMMAND_LENGTH;
+    } else {
+        pdata->cdb[0] = read ? MS_READ10 : MS_WRITE10;
+        write32be(pdata->cdb + 2, lba);
+        write16be(pdata->cdb + 7, num_blocks);
+        pdata->cdb_len = MS_READ10_COMMAND_LENGTH;
     }
-    usb_request_t* request = containerof(node, usb_request_t, node);
-    memcpy(buffer, request->buffer, request->transfer_length);
-out:
-    DEBUG_PRINT(("got to recv out\n"));
-    mxr_mutex_unlock(&msd->mutex);
-    return status;
-}
-
-static mx_status_t ums_open(mx_device_t* dev, uint32_t flags) {
-    return NO_ERROR;
-}
-
-static mx_status_t ums_close(mx_device_t* dev) {
-    return NO_ERROR;
+    ums_queue_txn(msd, txn);
 }
 
 static mx_status_t ums_release(mx_device_t* device) {
@@ -799,84 +755,13 @@ static mx_status_t ums_release(mx_device_t* device) {
     return NO_ERROR;
 }
 
-static ssize_t ums_read(mx_device_t* dev, void* data, size_t len, mx_off_t off) {
-    DEBUG_PRINT(("starting read\n"));
-    uint32_t block_size = get_ums(dev)->block_size;
-    if (off % block_size != 0) {
-        DEBUG_PRINT(("ERROR: offset not block aligned, read returning 0 bytes\n"));
-        return 0;
-    }
-    if (len % block_size != 0) {
-        DEBUG_PRINT(("ERROR: length of read not block aligned, read returning 0 bytes\n"));
-        return 0;
-    }
-    // TODO: deal with lun
-    uint8_t lun = 0;
-    switch (get_ums(dev)->read_flag) {
-    case USE_READ10:
-        ums_read10(dev, lun, off/block_size, len/block_size);
-        break;
-    case USE_READ12:
-        ums_read12(dev, lun, off/block_size, len/block_size);
-        break;
-    case USE_READ16:
-        ums_read16(dev, lun, off/block_size, len/block_size);
-        break;
-    }
-    DEBUG_PRINT(("data: %p\n", data));
-    DEBUG_PRINT(("len: %d\n", (uint8_t)len));
-    DEBUG_PRINT(("block size: %d\n", block_size));
-
-    for (int i = 0; i < 18; i++) {
-        DEBUG_PRINT(("%02x ", ((unsigned char*)(data))[i]));
-    }
-    DEBUG_PRINT(("\n"));
-    ums_recv(dev, data, len);
-    DEBUG_PRINT(("data post recv in read\n"));
-    for (int i = 0; i < 18; i++) {
-        DEBUG_PRINT(("%02x ", ((unsigned char*)(data))[i]));
-    }
-    DEBUG_PRINT(("returning this size: %d\n", (uint32_t)(len)));
-    return len;
-}
-
-static ssize_t ums_write(mx_device_t* dev, const void* data, size_t len, mx_off_t off) {
-    DEBUG_PRINT(("starting write\n"));
-    // TODO: deal with lun
-    uint8_t lun = 0;
-    uint32_t block_size = get_ums(dev)->block_size;
-
-    if (off % block_size != 0) {
-        DEBUG_PRINT(("ERROR: offset not block aligned, read returning 0 bytes\n"));
-        return 0;
-    }
-    if (len % block_size != 0) {
-        DEBUG_PRINT(("ERROR: length of read not block aligned, read returning 0 bytes\n"));
-        return 0;
-    }
-
-    switch (get_ums(dev)->read_flag) {
-    case USE_READ10:
-        ums_write10(dev, lun, off/block_size, len/block_size, data);
-        break;
-    case USE_READ12:
-        ums_write12(dev, lun, off/block_size, len/block_size, data);
-        break;
-    case USE_READ16:
-        ums_write16(dev, lun, off/block_size, len/block_size, data);
-        break;
-    }
-    return len;
-}
-
 static mx_off_t ums_get_size(mx_device_t* dev) {
     ums_t* msd = get_ums(dev);
     return msd->block_size * msd->total_blocks;
 }
 
 static mx_protocol_device_t ums_device_proto = {
-    .read = ums_read,
-    .write = ums_write,
+    .iotxn_queue = ums_iotxn_queue,
     .release = ums_release,
     .get_size = ums_get_size,
 };
@@ -890,23 +775,17 @@ static int ums_start_thread(void* arg) {
         return status;
     }
     DEBUG_PRINT(("starting start_thread\n"));
-    ums_read_capacity10(&(msd->device), 0);
-    uint32_t read_capacity[MS_READ_CAPACITY10_TRANSFER_LENGTH];
-
-    ums_recv(&(msd->device), (void*)read_capacity, MS_READ_CAPACITY10_TRANSFER_LENGTH);
-    msd->total_blocks = betoh32(read_capacity[0]);
-    msd->block_size = betoh32(read_capacity[1]);
-    msd->read_flag = USE_READ10;
-    if (read_capacity[0] == 0xFFFFFFFF) {
-        ums_read_capacity16(&(msd->device), 0);
-        uint32_t read_capacity[2];
-        ums_recv(&(msd->device), (void*)read_capacity, 8);
-        msd->total_blocks = betoh32(read_capacity[0]);
-        msd->block_size = betoh32(read_capacity[1]);
-        msd->read_flag = USE_READ12;
+    // the first command after a reset may fail with a unit attention
+    for (int i = 0; i < 3; i++) {
+        status = ums_read_capacity(msd);
+        if (status == NO_ERROR) break;
+    }
+    if (status != NO_ERROR) {
+        printf("ums: read capacity failed: %d\n", status);
+        return status;
     }
     DEBUG_PRINT(("block size is: 0x%08x\n", msd->block_size));
-    DEBUG_PRINT(("total blocks is: 0x%08x\n", msd->total_blocks));
+    DEBUG_PRINT(("total blocks is: 0x%016" PRIx64 "\n", msd->total_blocks));
     device_add(&msd->device, msd->udev);
     DEBUG_PRINT(("reached end of start thread\n"));
     return NO_ERROR;
@@ -925,6 +804,10 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
 
     usb_configuration_t* config = &device_config->configurations[0];
     usb_interface_t* intf = &config->interfaces[0];
+    if (intf->descriptor->bInterfaceProtocol != MSC_PROTOCOL_BULK_ONLY) {
+        DEBUG_PRINT(("ums_bind unsupported protocol: %02x\n", intf->descriptor->bInterfaceProtocol));
+        return ERR_NOT_SUPPORTED;
+    }
     // find our endpoints
     if (intf->num_endpoints < 2) {
         DEBUG_PRINT(("ums_bind wrong number of endpoints: %d\n", intf->num_endpoints));
@@ -960,13 +843,12 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
         return ERR_NO_MEMORY;
     }
 
-    list_initialize(&msd->free_read_reqs);
+    list_initialize(&msd->free_cbw_reqs);
     list_initialize(&msd->free_csw_reqs);
+    list_initialize(&msd->free_read_reqs);
     list_initialize(&msd->free_write_reqs);
     list_initialize(&msd->free_intr_reqs);
-    list_initialize(&msd->queued_reqs);
-    list_initialize(&msd->completed_reads);
-    list_initialize(&msd->completed_csws);
+    list_initialize(&msd->queued_txns);
 
     msd->udev = device;
     msd->driver = driver;
@@ -974,16 +856,26 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
     msd->bulk_in = bulk_in;
     msd->bulk_out = bulk_out;
     msd->intr_ep = intr_ep;
+    msd->interface_number = intf->descriptor->bInterfaceNumber;
+    msd->recovery_wake = MXR_COMPLETION_INIT;
 
+    for (int i = 0; i < CBW_REQ_COUNT; i++) {
+        usb_request_t* req = protocol->alloc_request(device, bulk_out, MSD_COMMAND_BLOCK_WRAPPER_SIZE);
+        if (!req)
+            return ERR_NO_MEMORY;
+        req->complete_cb = ums_cbw_complete;
+        req->client_data = msd;
+        list_add_head(&msd->free_cbw_reqs, &req->node);
+    }
     for (int i = 0; i < READ_REQ_COUNT; i++) {
         usb_request_t* req = protocol->alloc_request(device, bulk_in, USB_BUF_SIZE);
         if (!req)
             return ERR_NO_MEMORY;
-        req->complete_cb = ums_read_complete;
+        req->complete_cb = ums_data_complete;
         req->client_data = msd;
         list_add_head(&msd->free_read_reqs, &req->node);
     }
-    for (int i = 0; i < READ_REQ_COUNT; i++) {
+    for (int i = 0; i < CSW_REQ_COUNT; i++) {
         usb_request_t* req = protocol->alloc_request(device, bulk_in, MSD_COMMAND_STATUS_WRAPPER_SIZE);
         if (!req)
             return ERR_NO_MEMORY;
@@ -995,7 +887,7 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
         usb_request_t* req = protocol->alloc_request(device, bulk_out, USB_BUF_SIZE);
         if (!req)
             return ERR_NO_MEMORY;
-        req->complete_cb = ums_write_complete;
+        req->complete_cb = ums_data_complete;
         req->client_data = msd;
         list_add_head(&msd->free_write_reqs, &req->node);
     }
@@ -1015,10 +907,10 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
     ums_get_max_lun(msd, (void*)&lun);
     DEBUG_PRINT(("Max lun is: %02x\n", (unsigned char)lun));
 
-    msd->busy = false;
     msd->tag = 8;
-    msd->read_completion = MXR_COMPLETION_INIT;
     mxr_thread_t* thread;
+    mxr_thread_create(ums_recovery_thread, msd, "ums_recovery_thread", &thread);
+    mxr_thread_detach(thread);
     mxr_thread_create(ums_start_thread, msd, "ums_start_thread", &thread);
     mxr_thread_detach(thread);
 
@@ -0,0 +1,277 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ddk/block-queue.h>
+#include <magenta/syscalls.h>
+#include <runtime/mutex.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct block_queue {
+    block_queue_config_t config;
+    const block_queue_ops_t* ops;
+    void* cookie;
+
+    mxr_mutex_t lock;
+    // pending requests, sorted by epoch and then offset
+    list_node_t pending;
+    list_node_t free_requests;
+
+    // iotxns flagged IOTXN_SYNC_* start a new epoch. A request is only
+    // dispatched once every request from an earlier epoch has completed.
+    uint64_t epoch;
+    uint64_t dispatched_epoch;
+    // where the elevator is, the end of the last dispatched request
+    mx_off_t position;
+
+    block_queue_stats_t stats;
+};
+
+// kept in the extra space of each clone
+typedef struct block_queue_txn {
+    iotxn_t* txn;
+    block_request_t* req;
+    mx_time_t queued;
+} block_queue_txn_t;
+
+mx_status_t block_queue_create(const block_queue_config_t* config, const block_queue_ops_t* ops,
+                               void* cookie, block_queue_t** out) {
+    block_queue_t* bq = calloc(1, sizeof(block_queue_t));
+    if (!bq) return ERR_NO_MEMORY;
+
+    bq->config = *config;
+    if (bq->config.depth == 0) bq->config.depth = 1;
+    if (bq->config.max_merge_txns == 0) bq->config.max_merge_txns = 1;
+    if (bq->config.deadline == 0) bq->config.deadline = BLOCK_QUEUE_DEFAULT_DEADLINE;
+    bq->ops = ops;
+    bq->cookie = cookie;
+    bq->lock = MXR_MUTEX_INIT;
+    list_initialize(&bq->pending);
+    list_initialize(&bq->free_requests);
+
+    *out = bq;
+    return NO_ERROR;
+}
+
+void block_queue_destroy(block_queue_t* bq) {
+    block_request_t* req;
+    while ((req = list_remove_head_type(&bq->free_requests, block_request_t, node)) != NULL) {
+        free(req);
+    }
+    free(bq);
+}
+
+void block_queue_set_depth(block_queue_t* bq, uint32_t depth) {
+    mxr_mutex_lock(&bq->lock);
+    bq->config.depth = depth ? depth : 1;
+    mxr_mutex_unlock(&bq->lock);
+}
+
+// Keeps the pending list sorted by epoch, then offset.
+static void block_queue_insert_locked(block_queue_t* bq, block_request_t* req) {
+    block_request_t* entry;
+    list_for_every_entry (&bq->pending, entry, block_request_t, node) {
+        if (entry->epoch > req->epoch || (entry->epoch == req->epoch && entry->offset > req->offset)) {
+            list_add_before(&entry->node, &req->node);
+            return;
+        }
+    }
+    list_add_tail(&bq->pending, &req->node);
+}
+
+// The number of physically contiguous pieces the first txn->length bytes of
+// txn's data are in.
+static uint32_t block_queue_segments(iotxn_t* txn) {
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+    txn->ops->physmap_sg(txn, &sg, &sg_count);
+    mx_off_t remaining = txn->length;
+    uint32_t i;
+    for (i = 0; i < sg_count && remaining > sg[i].length; i++) {
+        remaining -= sg[i].length;
+    }
+    return i < sg_count ? i + 1 : sg_count;
+}
+
+// Adds clone to a pending request it is contiguous with. Returns false if
+// there isn't one it fits in.
+static bool block_queue_merge_locked(block_queue_t* bq, iotxn_t* clone, uint32_t segments) {
+    uint32_t max_segments = bq->config.max_merge_segments;
+    block_request_t* req;
+    list_for_every_entry (&bq->pending, req, block_request_t, node) {
+        if (req->epoch != bq->epoch || req->opcode != clone->opcode) continue;
+        if (req->txn_count >= bq->config.max_merge_txns) continue;
+        if (req->length + clone->length > bq->config.max_merge_bytes) continue;
+        if (max_segments && req->segments + segments > max_segments) continue;
+
+        if (req->offset + req->length == clone->offset) {
+            list_add_tail(&req->txn_list, &clone->node);
+        } else if (clone->offset + clone->length == req->offset) {
+            list_add_head(&req->txn_list, &clone->node);
+            req->offset = clone->offset;
+            // the new offset may sort before a neighbour
+            list_delete(&req->node);
+            block_queue_insert_locked(bq, req);
+        } else {
+            continue;
+        }
+        req->length += clone->length;
+        req->segments += segments;
+        req->txn_count++;
+        req->remaining++;
+        iotxn_to(clone, block_queue_txn_t)->req = req;
+        bq->stats.merged++;
+        return true;
+    }
+    return false;
+}
+
+// Picks the next request to dispatch, or NULL if none may go now.
+static block_request_t* block_queue_next_locked(block_queue_t* bq) {
+    if (bq->stats.inflight >= bq->config.depth) return NULL;
+
+    block_request_t* first = list_peek_head_type(&bq->pending, block_request_t, node);
+    if (!first) return NULL;
+    // wait for the previous epoch to drain
+    if (first->epoch != bq->dispatched_epoch && bq->stats.inflight > 0) return NULL;
+
+    // next request in the sweep, else wrap around to the lowest offset
+    block_request_t* next = NULL;
+    block_request_t* oldest = first;
+    block_request_t* req;
+    list_for_every_entry (&bq->pending, req, block_request_t, node) {
+        if (req->epoch != first->epoch) break;
+        if (req->queued < oldest->queued) oldest = req;
+        if (!next && req->offset >= bq->position) next = req;
+    }
+    if (!next) next = first;
+
+    if (oldest != next && mx_current_time() - oldest->queued >= bq->config.deadline) {
+        bq->stats.deadline++;
+        next = oldest;
+    }
+    return next;
+}
+
+static void block_queue_run(block_queue_t* bq) {
+    for (;;) {
+        mxr_mutex_lock(&bq->lock);
+        block_request_t* req = block_queue_next_locked(bq);
+        if (!req) {
+            mxr_mutex_unlock(&bq->lock);
+            return;
+        }
+        list_delete(&req->node);
+        bq->dispatched_epoch = req->epoch;
+        bq->position = req->offset + req->length;
+        bq->stats.pending -= req->txn_count;
+        bq->stats.dispatched++;
+        if (++bq->stats.inflight > bq->stats.inflight_max) {
+            bq->stats.inflight_max = bq->stats.inflight;
+        }
+        mxr_mutex_unlock(&bq->lock);
+
+        // req may complete and be reused as soon as it is dispatched
+        bq->ops->dispatch(bq, req, bq->cookie);
+    }
+}
+
+static void block_queue_txn_complete(iotxn_t* clone) {
+    block_queue_txn_t* bqt = iotxn_to(clone, block_queue_txn_t);
+    iotxn_t* txn = bqt->txn;
+    block_request_t* req = bqt->req;
+    block_queue_t* bq = req->bq;
+    mx_status_t status = clone->status;
+    mx_off_t actual = clone->actual;
+    clone->ops->release(clone);
+
+    mxr_mutex_lock(&bq->lock);
+    if (--req->remaining == 0) {
+        bq->stats.inflight--;
+        list_add_head(&bq->free_requests, &req->node);
+    }
+    mxr_mutex_unlock(&bq->lock);
+
+    txn->ops->complete(txn, status, actual);
+
+    // a slot may have opened up
+    block_queue_run(bq);
+}
+
+void block_queue_iotxn_queue(block_queue_t* bq, iotxn_t* txn) {
+    iotxn_t* clone;
+    mx_status_t status = txn->ops->clone(txn, &clone, sizeof(block_queue_txn_t));
+    if (status != NO_ERROR) {
+        txn->ops->complete(txn, status, 0);
+        return;
+    }
+    block_queue_txn_t* bqt = iotxn_to(clone, block_queue_txn_t);
+    bqt->txn = txn;
+    bqt->req = NULL;
+    bqt->queued = mx_current_time();
+    clone->complete_cb = block_queue_txn_complete;
+    clone->context = NULL;
+    uint32_t segments = bq->config.max_merge_segments ? block_queue_segments(clone) : 0;
+
+    mxr_mutex_lock(&bq->lock);
+    if (txn->flags & IOTXN_SYNC_BEFORE) bq->epoch++;
+
+    bq->stats.pending++;
+    if (!block_queue_merge_locked(bq, clone, segments)) {
+        block_request_t* req = list_remove_head_type(&bq->free_requests, block_request_t, node);
+        if (!req) req = malloc(sizeof(block_request_t));
+        if (!req) {
+            bq->stats.pending--;
+            mxr_mutex_unlock(&bq->lock);
+            clone->ops->release(clone);
+            txn->ops->complete(txn, ERR_NO_MEMORY, 0);
+            return;
+        }
+        req->opcode = clone->opcode;
+        req->offset = clone->offset;
+        req->length = clone->length;
+        req->segments = segments;
+        req->txn_count = 1;
+        list_initialize(&req->txn_list);
+        list_add_tail(&req->txn_list, &clone->node);
+        req->bq = bq;
+        req->epoch = bq->epoch;
+        req->queued = bqt->queued;
+        req->remaining = 1;
+        bqt->req = req;
+        block_queue_insert_locked(bq, req);
+    }
+
+    if (txn->flags & IOTXN_SYNC_AFTER) bq->epoch++;
+    mxr_mutex_unlock(&bq->lock);
+
+    block_queue_run(bq);
+}
+
+void block_queue_get_stats(block_queue_t* bq, block_queue_stats_t* out) {
+    mxr_mutex_lock(&bq->lock);
+    *out = bq->stats;
+    mxr_mutex_unlock(&bq->lock);
+}
+
+void block_queue_reset_stats(block_queue_t* bq) {
+    mxr_mutex_lock(&bq->lock);
+    block_queue_stats_t* stats = &bq->stats;
+    uint32_t pending = stats->pending;
+    uint32_t inflight = stats->inflight;
+    memset(stats, 0, sizeof(*stats));
+    stats->pending = pending;
+    stats->inflight = stats->inflight_max = inflight;
+    mxr_mutex_unlock(&bq->lock);
+}
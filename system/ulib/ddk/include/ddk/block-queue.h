@@ -0,0 +1,101 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <ddk/iotxn.h>
+#include <magenta/types.h>
+#include <system/listnode.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A block queue sits between a block driver's iotxn_queue() and its hardware
+// submission. Incoming iotxns are cloned (the clones share the caller's data
+// buffer), merged with pending iotxns they are contiguous with and handed to
+// the driver in LBA order, one elevator sweep at a time, with no more than
+// the configured number of requests at the device. A request that has waited
+// longer than the deadline is dispatched ahead of the sweep.
+//
+// iotxns without IOTXN_SYNC_BEFORE or IOTXN_SYNC_AFTER may be reordered with
+// respect to each other; those flags order an iotxn against everything queued
+// before or after it.
+
+typedef struct block_queue block_queue_t;
+
+typedef struct block_request {
+    uint32_t opcode;
+    mx_off_t offset;        // byte offset of the first iotxn
+    mx_off_t length;        // total bytes of all the iotxns
+    uint32_t txn_count;
+
+    // The iotxns making up the request, contiguous and in offset order. The
+    // driver owns them once the request is dispatched, may take them off this
+    // list and reuse their node and protocol data, and must complete each one
+    // with txn->ops->complete().
+    list_node_t txn_list;
+
+    // private to the queue
+    list_node_t node;
+    block_queue_t* bq;
+    uint64_t epoch;
+    mx_time_t queued;
+    uint32_t remaining;
+    uint32_t segments;
+} block_request_t;
+
+typedef struct block_queue_ops {
+    // Starts a request on the hardware. Called without any queue locks held,
+    // possibly from the thread completing an earlier request.
+    void (*dispatch)(block_queue_t* bq, block_request_t* req, void* cookie);
+} block_queue_ops_t;
+
+typedef struct block_queue_config {
+    uint32_t depth;            // requests at the device at once
+    uint32_t max_merge_txns;   // iotxns per request, 1 disables merging
+    mx_off_t max_merge_bytes;  // bytes per request
+    uint32_t max_merge_segments; // physmap_sg() pieces per request, 0 for no limit
+    mx_time_t deadline;        // 0 for BLOCK_QUEUE_DEFAULT_DEADLINE
+} block_queue_config_t;
+
+#define BLOCK_QUEUE_DEFAULT_DEADLINE (100 * 1000 * 1000) // 100ms
+
+// What the queue did with the iotxns queued to it. Their counts and latency
+// are in the device's iostats.
+typedef struct block_queue_stats {
+    uint64_t merged;        // iotxns merged into an existing request
+    uint64_t dispatched;    // requests handed to the driver
+    uint64_t deadline;      // requests dispatched out of order for the deadline
+
+    uint32_t pending;       // iotxns waiting to be dispatched
+    uint32_t inflight;      // requests at the device
+    uint32_t inflight_max;
+} block_queue_stats_t;
+
+mx_status_t block_queue_create(const block_queue_config_t* config, const block_queue_ops_t* ops,
+                               void* cookie, block_queue_t** out);
+// The queue must be idle.
+void block_queue_destroy(block_queue_t* bq);
+
+// Changes the number of requests allowed at the device, eg once the device
+// has been identified. Takes effect for the next dispatch.
+void block_queue_set_depth(block_queue_t* bq, uint32_t depth);
+
+// Queues txn and dispatches as many requests as the depth allows. The driver
+// validates and clamps txn before calling this.
+void block_queue_iotxn_queue(block_queue_t* bq, iotxn_t* txn);
+
+// For BLOCK_OP_GET_QUEUE_STATS and BLOCK_OP_RESET_QUEUE_STATS.
+void block_queue_get_stats(block_queue_t* bq, block_queue_stats_t* out);
+void block_queue_reset_stats(block_queue_t* bq);
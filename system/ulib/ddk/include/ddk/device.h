@@ -16,6 +16,7 @@
 
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
+#include <ddk/iostats.h>
 #include <ddk/iotxn.h>
 #include <system/listnode.h>
 
@@ -82,6 +83,9 @@ struct mx_device {
     // properties for driver binding
 
     char namedata[MX_DEVICE_NAME_MAX + 1];
+
+    // counts of the iotxns queued with iotxn_queue()
+    mx_iostats_t iostats;
 };
 
 // mx_device_t objects must be created or initialized by the driver manager's
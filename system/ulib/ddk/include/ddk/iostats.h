@@ -0,0 +1,68 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <magenta/types.h>
+#include <stdint.h>
+
+// Every device counts the iotxns queued to it with iotxn_queue(), from the
+// call to the iotxn's completion. An iotxn is counted against the first
+// device it is queued to, so a driver passing an iotxn on to its parent
+// doesn't count it twice; clones are counted separately.
+
+// Latency histogram buckets. Bucket 0 counts iotxns that took less than 2us,
+// bucket n those that took [2^n, 2^(n+1)) us, and the last bucket everything
+// slower.
+#define IOSTATS_BUCKETS 24
+
+// ops[] indices
+#define IOSTATS_OP_READ  0
+#define IOSTATS_OP_WRITE 1
+#define IOSTATS_OP_OTHER 2
+#define IOSTATS_OPS      3
+
+typedef struct mx_iostats_op {
+    uint64_t count;         // completed iotxns
+    uint64_t errors;        // of which completed with an error
+    uint64_t bytes;         // actual bytes of the successful ones
+    uint64_t latency_total; // ns
+    uint64_t latency_max;
+    uint64_t latency[IOSTATS_BUCKETS];
+} mx_iostats_op_t;
+
+typedef struct mx_iostats {
+    mx_time_t since;        // when counting started or was last reset
+    uint64_t queued;
+    uint32_t inflight;
+    uint32_t inflight_max;
+    mx_iostats_op_t ops[IOSTATS_OPS];
+} mx_iostats_t;
+
+// Handled by the device manager for every device.
+// IOCTL_DEVICE_GET_IOSTATS returns an mx_iostats_t with since replaced by the
+// ns it covers. IOCTL_DEVICE_RESET_IOSTATS zeroes everything but inflight.
+#define IOCTL_DEVICE_GET_IOSTATS   0x7FFF0002
+#define IOCTL_DEVICE_RESET_IOSTATS 0x7FFF0003
+
+// The counters are updated with atomics so these may be called from any
+// thread, but a snapshot taken while iotxns are completing may be off by the
+// ones in progress.
+void iostats_get(mx_iostats_t* stats, mx_iostats_t* out);
+void iostats_reset(mx_iostats_t* stats);
+
+// Called by iotxn_queue() and iotxn completion.
+void iostats_queued(mx_iostats_t* stats);
+void iostats_completed(mx_iostats_t* stats, uint32_t opcode, mx_status_t status,
+                       uint64_t actual, mx_time_t latency);
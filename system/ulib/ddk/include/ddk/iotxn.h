@@ -99,11 +99,40 @@ struct iotxn {
 #define iotxn_to(txn, type) ((type*) (txn)->extra)
 #define iotxn_pdata(txn, type) ((type*) (txn)->protocol_data)
 
+// a physically contiguous piece of an iotxn's data, see physmap_sg()
+typedef struct iotxn_sg {
+    mx_paddr_t paddr;
+    mx_size_t length;
+} iotxn_sg_t;
+
 
 // create a new iotxn with payload space of data_size
 // and extra storage space of extra_size
+// the iotxn's fields and the extra space are zeroed, the payload is not
+// safe to call from any thread
 mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size);
 
+// iotxns are released back to the pool they were allocated from, to be
+// reused by later allocations of a similar size. iotxn_alloc() uses one
+// shared by the whole process; a driver can keep its own so its iotxns
+// don't compete with other devices' for cached memory.
+typedef struct iotxn_pool iotxn_pool_t;
+
+mx_status_t iotxn_pool_create(iotxn_pool_t** out);
+// every iotxn allocated from the pool, and every clone of one, must have
+// been released
+void iotxn_pool_destroy(iotxn_pool_t* pool);
+mx_status_t iotxn_pool_alloc(iotxn_pool_t* pool, iotxn_t** out, uint32_t flags, size_t data_size,
+                             size_t extra_size);
+
+// create a new iotxn whose payload is data_size bytes of vmo starting at
+// vmo_offset, with extra storage space of extra_size. The pages backing that
+// range are committed and looked up up front, so the device transfers straight
+// to and from the vmo. The handle is not consumed and must stay open until the
+// iotxn is released.
+mx_status_t iotxn_alloc_vmo(iotxn_t** out, uint32_t flags, mx_handle_t vmo, uint64_t vmo_offset,
+                            size_t data_size, size_t extra_size);
+
 // queue an iotxn against a device
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn);
 
@@ -134,12 +163,21 @@ struct iotxn_ops {
     // the iotxn's buffer data (on WRITE ops) or a buffer that will be
     // copied back to the iotxn's buffer data (on READ ops).  This may
     // be the buffer itself, or a temporary, depending on conditions.
-    void (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
+    // Returns ERR_NO_MEMORY if a temporary is needed and can't be allocated;
+    // the caller should complete the iotxn with that status.
+    mx_status_t (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
+
+    // physmap_sg() returns the physically contiguous pieces making up the
+    // iotxn's buffer data, in order, without copying. A buffer from
+    // iotxn_alloc() is one piece; one from iotxn_alloc_vmo() is a piece per
+    // run of contiguous pages. The list is owned by the iotxn and is valid
+    // until it is released.
+    void (*physmap_sg)(iotxn_t* txn, iotxn_sg_t** sg, uint32_t* sg_count);
 
     // mmap() returns a void* pointing at the data in the iotxn's buffer.
     // This may have to do an expensive memory map operation or copy data
     // to a local buffer.  copyfrom(), copyto(), or physmap() are almost
-    // always a better option.
+    // always a better option.  *data is NULL if the buffer can't be mapped.
     void (*mmap)(iotxn_t* txn, void** data);
 
 
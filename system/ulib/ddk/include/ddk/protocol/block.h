@@ -12,7 +12,76 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#pragma once
+
+#include <magenta/types.h>
+#include <mxio/io.h>
+#include <stdint.h>
+
 #define BLOCK_OP_GET_SIZE      1
 #define BLOCK_OP_GET_BLOCKSIZE 2
 #define BLOCK_OP_GET_GUID      3
 #define BLOCK_OP_GET_NAME      4
+
+// For drivers with a block queue, returns its block_queue_stats_t (see
+// ddk/block-queue.h) or zeroes the counters.
+#define BLOCK_OP_GET_QUEUE_STATS   5
+#define BLOCK_OP_RESET_QUEUE_STATS 6
+
+// Returns a message pipe to a block ring for the device, so that a client
+// can keep many transfers in flight without a message or copy per transfer.
+// The optional input is an ioctl_block_get_ring_t, the reply a
+// ioctl_block_ring_t. The first message on the pipe carries the handle of a
+// VMO laid out as a block_ring_t followed by the data area.
+//
+// Ioctl replies are plain bytes; devmgr and mxio only transfer a handle in
+// the reply of IOCTL_DEVICE_GET_HANDLE, so the op has to be that one.
+#define BLOCK_OP_GET_RING IOCTL_DEVICE_GET_HANDLE
+typedef struct {
+    uint64_t data_size; // 0 for BLOCK_RING_DEFAULT_DATA_SIZE
+} ioctl_block_get_ring_t;
+
+typedef struct {
+    mx_handle_t pipe;
+} ioctl_block_ring_t;
+
+#define BLOCK_RING_ENTRIES           64
+#define BLOCK_RING_DEFAULT_DATA_SIZE (1024 * 1024)
+#define BLOCK_RING_MAX_DATA_SIZE     (64 * 1024 * 1024)
+
+typedef struct {
+    uint32_t opcode;      // IOTXN_OP_READ or IOTXN_OP_WRITE
+    uint32_t cookie;      // returned in the completion
+    uint64_t offset;      // byte offset on the device
+    uint64_t data_offset; // byte offset in the data area
+    uint64_t length;
+} block_ring_req_t;
+
+typedef struct {
+    uint32_t cookie;
+    mx_status_t status;
+    uint64_t actual;
+} block_ring_resp_t;
+
+// The indices count up forever, entry i lives in slot i % BLOCK_RING_ENTRIES.
+// The client fills sq entries and advances sq_tail, the server advances
+// sq_head as it takes them; the server fills cq entries and advances cq_tail,
+// the client advances cq_head as it reaps them. Indices are published with
+// sequentially consistent atomics.
+//
+// The client writes a message (any content) to the pipe after advancing
+// sq_tail, and after advancing cq_head while sq entries are waiting, since
+// the server takes no more than BLOCK_RING_ENTRIES requests that haven't been
+// reaped. The server writes a message after adding a completion to a cq the
+// client had emptied, so a client should reap until cq_head == cq_tail
+// before waiting on the pipe again.
+typedef struct {
+    uint32_t sq_head;
+    uint32_t sq_tail;
+    uint32_t cq_head;
+    uint32_t cq_tail;
+    uint64_t data_offset; // start of the data area in the VMO
+    uint64_t data_size;
+    block_ring_req_t sq[BLOCK_RING_ENTRIES];
+    block_ring_resp_t cq[BLOCK_RING_ENTRIES];
+} block_ring_t;
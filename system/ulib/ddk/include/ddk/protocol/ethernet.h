@@ -16,6 +16,7 @@
 
 #include <ddk/driver.h>
 #include <hw/usb.h>
+#include <mxio/io.h>
 #include <stdbool.h>
 
 typedef struct ethernet_protocol {
@@ -28,3 +29,60 @@ typedef struct ethernet_protocol {
 } ethernet_protocol_t;
 
 #define ETH_MAC_SIZE 6
+
+// Returns a message pipe to a packet ring for the device, so that a client
+// can queue and reap many frames per syscall and the device can transfer
+// them straight to and from the client's memory. The reply is an
+// ioctl_ethernet_ring_t. The first message on the pipe carries the handle of
+// a VMO laid out as an eth_ring_t followed by the buffers. Only one ring can
+// be open at a time, and while it is the device's other read and write paths
+// fail with ERR_BAD_STATE. Devices that don't support rings return
+// ERR_NOT_SUPPORTED.
+//
+// Like BLOCK_OP_GET_RING, this is IOCTL_DEVICE_GET_HANDLE because that is
+// the only op whose reply devmgr and mxio carry a handle in.
+#define ETHERNET_OP_GET_RING IOCTL_DEVICE_GET_HANDLE
+typedef struct {
+    mx_handle_t pipe;
+} ioctl_ethernet_ring_t;
+
+#define ETH_RING_ENTRIES     64
+#define ETH_RING_BUFFERS     128
+#define ETH_RING_BUFFER_SIZE 2048
+
+typedef struct {
+    uint32_t cookie;    // the client's, returned with the entry
+    uint16_t buffer;    // index of the buffer holding the frame
+    uint16_t length;    // of the frame, filled in by the device for rx
+    mx_status_t status; // filled in by the device
+} eth_ring_entry_t;
+
+// The indices count up forever, entry i lives in slot i % ETH_RING_ENTRIES.
+// The producer fills entries and advances tail, the consumer advances head
+// as it takes them. Indices are published with sequentially consistent
+// atomics.
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    eth_ring_entry_t entries[ETH_RING_ENTRIES];
+} eth_fifo_t;
+
+// The client puts frames to send on tx and empty buffers to receive into on
+// rx. The device gives every entry back, in order, on tx_done or rx_done once
+// it is finished with the buffer; a buffer belongs to the device from when
+// its entry is queued until then. The device takes no more than
+// ETH_RING_ENTRIES entries from a fifo that haven't been reaped from the
+// matching done fifo.
+//
+// The client writes a message (any content) to the pipe after advancing
+// tx.tail or rx.tail, and after advancing a done head while entries are
+// waiting. The device writes a message after adding entries to a done fifo
+// the client had emptied, so a client should reap both done fifos until
+// they are empty before waiting on the pipe again.
+typedef struct {
+    eth_fifo_t tx;
+    eth_fifo_t tx_done;
+    eth_fifo_t rx;
+    eth_fifo_t rx_done;
+    uint64_t buffer_offset; // start of the buffers in the VMO, page aligned
+} eth_ring_t;
@@ -15,6 +15,7 @@
 #pragma once
 
 #include <ddk/driver.h>
+#include <ddk/iotxn.h>
 #include <hw/usb.h>
 #include <system/listnode.h>
 
@@ -71,6 +72,10 @@ typedef struct usb_request {
     uint8_t* buffer;          // pointer to DMA memory
     uint16_t buffer_length;   // size of DMA buffer
     uint16_t transfer_length; // number of bytes to transfer
+    // if set, the data is transferred to or from these physical pieces
+    // (eg, from an iotxn's physmap_sg()) rather than buffer
+    const iotxn_sg_t* sg;
+    uint32_t sg_count;
     mx_status_t status;
     void (*complete_cb)(struct usb_request* request);
     usb_endpoint_t* endpoint;
@@ -88,6 +93,10 @@ typedef struct usb_device_protocol {
     mx_status_t (*queue_request)(mx_device_t* dev, usb_request_t* request);
     mx_status_t (*control)(mx_device_t* dev, uint8_t request_type, uint8_t request, uint16_t value,
                            uint16_t index, void* data, uint16_t length);
+    // completes the requests queued on ep with ERR_CANCELLED and resets the
+    // host's side of it, eg after a stall. The device's side is reset with a
+    // CLEAR_FEATURE(ENDPOINT_HALT) control request.
+    mx_status_t (*reset_endpoint)(mx_device_t* dev, usb_endpoint_t* ep);
 
     mx_status_t (*get_config)(mx_device_t* dev, usb_device_config_t** config);
     usb_speed_t (*get_speed)(mx_device_t* device);
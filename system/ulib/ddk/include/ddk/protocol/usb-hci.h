@@ -25,6 +25,11 @@ typedef struct usb_hci_protocol {
     int (*control)(mx_device_t* hcidev, int devaddr, usb_setup_t* devreq, int data_length,
                    uint8_t* data);
 
+    /* reset_endpoint(): Stop the endpoint, complete the requests queued on it with
+                         ERR_CANCELLED and get it ready for new ones. Only the host's
+                         side is reset. */
+    int (*reset_endpoint)(mx_device_t* hcidev, int devaddr, usb_endpoint_t* ep);
+
     /* set_address(): Tell the usb device its address
                       Also, allocate the usbdev structure, initialize enpoint 0
                       (including MPS) and return its address. */
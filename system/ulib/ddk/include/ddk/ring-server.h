@@ -0,0 +1,61 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <magenta/types.h>
+#include <stddef.h>
+
+// The plumbing shared by drivers that serve a shared memory ring to a
+// client: a VMO mapped into the server and handed to the client as the
+// first message on a message pipe, and a thread that runs the driver's
+// kick callback whenever the client writes to the pipe. The layout of the
+// VMO and the meaning of the kicks are up to the driver.
+
+typedef struct ring_server_ops {
+    // Called on the server thread after the client has written any number
+    // of messages to the pipe since the last call.
+    void (*kick)(void* cookie);
+    // Called on the server thread once the client has closed its end of
+    // the pipe. No more kicks follow. The driver must call
+    // ring_server_release() once it is done with the mapping.
+    void (*close)(void* cookie);
+} ring_server_ops_t;
+
+typedef struct ring_server {
+    mx_handle_t pipe;
+    mx_handle_t vmo;
+    void* mapping;
+    size_t mapping_size;
+
+    // private to the ring server
+    const ring_server_ops_t* ops;
+    void* cookie;
+} ring_server_t;
+
+// Creates and maps a VMO of |size| bytes, zero filled, and a message pipe
+// whose first message carries a duplicate of the VMO's handle. The client
+// end of the pipe is returned in |out|; the caller closes it if it fails
+// to hand it out. On failure everything is released again.
+mx_status_t ring_server_init(ring_server_t* rs, size_t size, mx_handle_t* out);
+
+// Starts the server thread, after which |ops| are called with |cookie|.
+mx_status_t ring_server_start(ring_server_t* rs, const char* name,
+                              const ring_server_ops_t* ops, void* cookie);
+
+// Writes a message to the client, to wake it up.
+void ring_server_notify(ring_server_t* rs);
+
+// Unmaps the VMO and closes the server's handles.
+void ring_server_release(ring_server_t* rs);
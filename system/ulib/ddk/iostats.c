@@ -0,0 +1,103 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ddk/iostats.h>
+#include <ddk/iotxn.h>
+#include <magenta/syscalls.h>
+
+#define load(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define store(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define add(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+
+static void iostats_raise(uint64_t* max, uint64_t v) {
+    uint64_t old = load(max);
+    while (v > old && !__atomic_compare_exchange_n(max, &old, v, true, __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+        ;
+}
+
+static uint32_t iostats_bucket(mx_time_t latency) {
+    uint64_t us = latency / 1000;
+    if (us < 2) return 0;
+    uint32_t bucket = 63 - __builtin_clzll(us);
+    return bucket < IOSTATS_BUCKETS ? bucket : IOSTATS_BUCKETS - 1;
+}
+
+void iostats_queued(mx_iostats_t* stats) {
+    add(&stats->queued, 1);
+    uint32_t inflight = add(&stats->inflight, 1) + 1;
+    uint32_t max = load(&stats->inflight_max);
+    while (inflight > max && !__atomic_compare_exchange_n(&stats->inflight_max, &max, inflight, true,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void iostats_completed(mx_iostats_t* stats, uint32_t opcode, mx_status_t status,
+                       uint64_t actual, mx_time_t latency) {
+    mx_iostats_op_t* op;
+    if (opcode == IOTXN_OP_READ) {
+        op = &stats->ops[IOSTATS_OP_READ];
+    } else if (opcode == IOTXN_OP_WRITE) {
+        op = &stats->ops[IOSTATS_OP_WRITE];
+    } else {
+        op = &stats->ops[IOSTATS_OP_OTHER];
+    }
+    add(&op->count, 1);
+    if (status != NO_ERROR) {
+        add(&op->errors, 1);
+    } else {
+        add(&op->bytes, actual);
+    }
+    add(&op->latency_total, latency);
+    iostats_raise(&op->latency_max, latency);
+    add(&op->latency[iostats_bucket(latency)], 1);
+    add(&stats->inflight, -1);
+}
+
+void iostats_get(mx_iostats_t* stats, mx_iostats_t* out) {
+    mx_time_t since = load(&stats->since);
+    out->since = since ? mx_current_time() - since : 0;
+    out->queued = load(&stats->queued);
+    out->inflight = load(&stats->inflight);
+    out->inflight_max = load(&stats->inflight_max);
+    for (int i = 0; i < IOSTATS_OPS; i++) {
+        mx_iostats_op_t* op = &stats->ops[i];
+        mx_iostats_op_t* out_op = &out->ops[i];
+        out_op->count = load(&op->count);
+        out_op->errors = load(&op->errors);
+        out_op->bytes = load(&op->bytes);
+        out_op->latency_total = load(&op->latency_total);
+        out_op->latency_max = load(&op->latency_max);
+        for (int b = 0; b < IOSTATS_BUCKETS; b++) {
+            out_op->latency[b] = load(&op->latency[b]);
+        }
+    }
+}
+
+void iostats_reset(mx_iostats_t* stats) {
+    store(&stats->since, mx_current_time());
+    store(&stats->queued, 0);
+    store(&stats->inflight_max, load(&stats->inflight));
+    for (int i = 0; i < IOSTATS_OPS; i++) {
+        mx_iostats_op_t* op = &stats->ops[i];
+        store(&op->count, 0);
+        store(&op->errors, 0);
+        store(&op->bytes, 0);
+        store(&op->latency_total, 0);
+        store(&op->latency_max, 0);
+        for (int b = 0; b < IOSTATS_BUCKETS; b++) {
+            store(&op->latency[b], 0);
+        }
+    }
+}
@@ -14,8 +14,12 @@
 
 #include <ddk/iotxn.h>
 #include <ddk/device.h>
+#include <magenta/syscalls.h>
 #include <magenta/syscalls-ddk.h>
+#include <runtime/mutex.h>
 #include <sys/param.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -31,39 +35,152 @@
 #endif
 
 #define IOTXN_FLAG_CLONE (1 << 0)
+#define IOTXN_FLAG_VMO   (1 << 1) // data is in priv->vmo rather than a buffer of our own
+
+// pages looked up per mx_vm_object_lookup() call
+#define IOTXN_LOOKUP_PAGES 32
+
+// Pools keep released iotxns on a free list per power of two size class, so
+// allocation is a pop off the right list. iotxns with a buffer come out of
+// device memory, which is handed out in pages, from 4k up to 1mb; clones
+// come off the heap, from 512 bytes (a little more than an iotxn_priv_t) up
+// to 4k. Anything larger is allocated to size and freed on release.
+#define IOTXN_BUFFER_MIN_SHIFT 12
+#define IOTXN_BUFFER_CLASSES   9
+#define IOTXN_CLONE_MIN_SHIFT  9
+#define IOTXN_CLONE_CLASSES    4
+#define IOTXN_NO_CLASS         UINT32_MAX
+
+// a class keeps at most this many bytes of released iotxns, and at least two
+#define IOTXN_CLASS_CACHE_BYTES (1024 * 1024)
 
 typedef struct iotxn_priv iotxn_priv_t;
 
+typedef struct iotxn_class {
+    mxr_mutex_t lock;
+    iotxn_priv_t* free;
+    uint32_t free_count;
+} iotxn_class_t;
+
+struct iotxn_pool {
+    iotxn_class_t buffers[IOTXN_BUFFER_CLASSES];
+    iotxn_class_t clones[IOTXN_CLONE_CLASSES];
+};
+
+// all zeroes is an empty pool
+static iotxn_pool_t default_pool;
+
 struct iotxn_priv {
+    // set when the memory is allocated and never modified afterwards
+    iotxn_pool_t* pool;
+    uint32_t size_class;     // in pool->buffers or pool->clones, or IOTXN_NO_CLASS
+    // total size and physical address of buffer containing this structure, minus the
+    // size of this structure
+    mx_size_t buffer_size;
+    mx_paddr_t buffer_phys;
+
+    // next on the class free list, while released
+    iotxn_priv_t* next_free;
+
+    // everything from here to the end of the extra data is zeroed each time
+    // the iotxn is handed out
+
     // data payload. either data buffer or vmo.
+    // for a vmo, data is NULL until mmap() maps it, and data_phys is 0 unless
+    // the pages are contiguous or physmap() has bounced the data
     mx_size_t data_size;
     void* data;
     mx_paddr_t data_phys;
     mx_size_t vmo_offset;
     mx_handle_t vmo;
 
+    // the physical pieces of the data, from physmap_sg()
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+    iotxn_sg_t sg_inline; // the single piece of a contiguous buffer
+
+    // vmo only, owned by this iotxn rather than shared with clones
+    void* bounce;      // temporary contiguous copy handed out by physmap()
+    uintptr_t mapped;  // mapping made by mmap()
+
     uint32_t flags;
 
+    // the device iotxn_queue() counts this iotxn against, until it completes
+    mx_device_t* queue_dev;
+    mx_time_t queue_time;
+
     // extra data, at the end of this ioxtn_t structure
     mx_size_t extra_size;
 
-    // total size and physical address of buffer containing this structure, minus the
-    // size of this structure
-    // this field is set on memory allocation and should never be modified afterwards
-    mx_size_t buffer_size;
-    mx_paddr_t buffer_phys;
-
-    // 64-bytes at this point on 64-bit systems
-
     iotxn_t txn; // must be at the end for extra data, only valid if not a clone
 };
 
 #define get_priv(iotxn) containerof(iotxn, iotxn_priv_t, txn)
 
-static list_node_t free_list = LIST_INITIAL_VALUE(free_list);
-static list_node_t clone_list = LIST_INITIAL_VALUE(clone_list); // free list for clones
+// Returns the smallest class of at least size bytes, or IOTXN_NO_CLASS.
+static uint32_t iotxn_size_class(size_t size, uint32_t min_shift, uint32_t classes) {
+    if (size <= (1u << min_shift)) return 0;
+    uint32_t shift = (sizeof(long) * 8) - __builtin_clzl(size - 1);
+    return shift - min_shift < classes ? shift - min_shift : IOTXN_NO_CLASS;
+}
+
+static iotxn_class_t* iotxn_get_class(iotxn_priv_t* priv) {
+    if (priv->size_class == IOTXN_NO_CLASS) return NULL;
+    return (priv->flags & IOTXN_FLAG_CLONE) ? &priv->pool->clones[priv->size_class]
+                                             : &priv->pool->buffers[priv->size_class];
+}
+
+static iotxn_priv_t* iotxn_class_pop(iotxn_class_t* class) {
+    mxr_mutex_lock(&class->lock);
+    iotxn_priv_t* priv = class->free;
+    if (priv) {
+        class->free = priv->next_free;
+        class->free_count--;
+    }
+    mxr_mutex_unlock(&class->lock);
+    return priv;
+}
+
+// Returns false if the class has enough cached already.
+static bool iotxn_class_push(iotxn_class_t* class, iotxn_priv_t* priv, size_t class_size) {
+    uint32_t max = MAX(2u, IOTXN_CLASS_CACHE_BYTES / class_size);
+    mxr_mutex_lock(&class->lock);
+    bool cached = class->free_count < max;
+    if (cached) {
+        priv->next_free = class->free;
+        class->free = priv;
+        class->free_count++;
+    }
+    mxr_mutex_unlock(&class->lock);
+    return cached;
+}
+
+static void iotxn_free_memory(iotxn_priv_t* priv) {
+    if (priv->flags & (IOTXN_FLAG_CLONE | IOTXN_FLAG_VMO)) {
+        free(priv);
+    } else {
+        mx_process_vm_unmap(0, (uintptr_t)priv, 0);
+    }
+}
+
+// Zeroes the part of priv that isn't kept across uses, and the extra data.
+static void iotxn_priv_reset(iotxn_priv_t* priv, size_t extra_size) {
+    size_t start = offsetof(iotxn_priv_t, data_size);
+    memset((void*)priv + start, 0, sizeof(iotxn_priv_t) - start + extra_size);
+}
 
 static void iotxn_complete(iotxn_t* txn, mx_status_t status, size_t actual) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (priv->bounce && status == NO_ERROR && txn->opcode != IOTXN_OP_WRITE) {
+        mx_vm_object_write(priv->vmo, priv->bounce, priv->vmo_offset, MIN(actual, priv->data_size));
+    }
+    // before the callback, which may release or requeue txn
+    mx_device_t* dev = priv->queue_dev;
+    if (dev) {
+        priv->queue_dev = NULL;
+        iostats_completed(&dev->iostats, txn->opcode, status, actual,
+                          mx_current_time() - priv->queue_time);
+    }
     txn->actual = actual;
     txn->status = status;
     if (txn->complete_cb) {
@@ -74,63 +191,114 @@ static void iotxn_complete(iotxn_t* txn, mx_status_t status, size_t actual) {
 static void iotxn_copyfrom(iotxn_t* txn, void* data, size_t length, size_t offset) {
     iotxn_priv_t* priv = get_priv(txn);
     size_t count = MIN(length, priv->data_size - offset);
+    if (!priv->data) {
+        mx_vm_object_read(priv->vmo, data, priv->vmo_offset + offset, count);
+        return;
+    }
     memcpy(data, priv->data + offset, count);
 }
 
 static void iotxn_copyto(iotxn_t* txn, const void* data, size_t length, size_t offset) {
     iotxn_priv_t* priv = get_priv(txn);
     size_t count = MIN(length, priv->data_size - offset);
+    if (!priv->data) {
+        mx_vm_object_write(priv->vmo, data, priv->vmo_offset + offset, count);
+        return;
+    }
     memcpy(priv->data + offset, data, count);
 }
 
-static void iotxn_physmap(iotxn_t* txn, mx_paddr_t* addr) {
+static mx_status_t iotxn_physmap(iotxn_t* txn, mx_paddr_t* addr) {
     iotxn_priv_t* priv = get_priv(txn);
+    if (!priv->data_phys && (priv->flags & IOTXN_FLAG_VMO)) {
+        // scattered pages, hand out a contiguous copy instead
+        void* bounce;
+        mx_paddr_t phys;
+        if (mx_alloc_device_memory(priv->data_size, &phys, &bounce) < 0) {
+            xprintf("iotxn: out of memory\n");
+            return ERR_NO_MEMORY;
+        }
+        iotxn_copyfrom(txn, bounce, priv->data_size, 0);
+        priv->bounce = bounce;
+        priv->data_phys = phys;
+    }
     *addr = priv->data_phys;
+    return NO_ERROR;
+}
+
+static void iotxn_physmap_sg(iotxn_t* txn, iotxn_sg_t** sg, uint32_t* sg_count) {
+    iotxn_priv_t* priv = get_priv(txn);
+    *sg = priv->sg;
+    *sg_count = priv->sg_count;
 }
 
 static void iotxn_mmap(iotxn_t* txn, void** data) {
     iotxn_priv_t* priv = get_priv(txn);
+    if (!priv->data && (priv->flags & IOTXN_FLAG_VMO)) {
+        uint64_t start = priv->vmo_offset & ~(PAGE_SIZE - 1);
+        uint64_t end = (priv->vmo_offset + priv->data_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uintptr_t mapping;
+        if (mx_process_vm_map(0, priv->vmo, start, end - start, &mapping,
+                              MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE) < 0) {
+            *data = NULL;
+            return;
+        }
+        priv->mapped = mapping;
+        priv->data = (void*)mapping + (priv->vmo_offset - start);
+    }
     *data = priv->data;
 }
 
+// sets up the physical description of a contiguous buffer
+static void iotxn_set_sg_inline(iotxn_priv_t* priv) {
+    priv->sg_inline.paddr = priv->data_phys;
+    priv->sg_inline.length = priv->data_size;
+    priv->sg = &priv->sg_inline;
+    priv->sg_count = 1;
+}
+
 static mx_status_t iotxn_clone(iotxn_t* txn, iotxn_t** out, size_t extra_size) {
     iotxn_priv_t* priv = get_priv(txn);
-    iotxn_t* clone = NULL;
+    iotxn_pool_t* pool = priv->pool;
+    size_t sz = sizeof(iotxn_priv_t) + extra_size;
+    uint32_t size_class = iotxn_size_class(sz, IOTXN_CLONE_MIN_SHIFT, IOTXN_CLONE_CLASSES);
     iotxn_priv_t* cpriv = NULL;
-    // look in clone list first for something that fits
-    bool found = false;
-    list_for_every_entry (&clone_list, clone, iotxn_t, node) {
-        cpriv = get_priv(clone);
-        if (cpriv->buffer_size >= extra_size) {
-            found = true;
-            break;
-        }
-    }
-    // found one that fits, skip allocation
-    if (found) {
-        list_delete(&clone->node);
-        if (cpriv->buffer_size) memset(cpriv + sizeof(iotxn_priv_t), 0, cpriv->buffer_size);
-        goto out;
+    if (size_class != IOTXN_NO_CLASS) {
+        cpriv = iotxn_class_pop(&pool->clones[size_class]);
+        sz = 1u << (IOTXN_CLONE_MIN_SHIFT + size_class);
     }
-    // didn't find one that fits, allocate a new one
-    size_t sz = sizeof(iotxn_priv_t) + extra_size;
-    cpriv = calloc(1, sz); // cloned iotxn's don't have to be in contiguous memory
     if (!cpriv) {
-        xprintf("iotxn: out of memory\n");
-        return ERR_NO_MEMORY;
+        // cloned iotxn's don't have to be in contiguous memory
+        cpriv = malloc(sz);
+        if (!cpriv) {
+            xprintf("iotxn: out of memory\n");
+            return ERR_NO_MEMORY;
+        }
+        cpriv->pool = pool;
+        cpriv->size_class = size_class;
+        cpriv->buffer_size = sz - sizeof(iotxn_priv_t);
+        cpriv->buffer_phys = 0;
     }
-    memset(cpriv, 0, sizeof(iotxn_priv_t));
+    iotxn_priv_reset(cpriv, extra_size);
 
-    // copy properties to the new iotxn
-    cpriv->buffer_size = extra_size;
-out:
-    cpriv->flags |= IOTXN_FLAG_CLONE;
+    cpriv->flags = IOTXN_FLAG_CLONE | (priv->flags & IOTXN_FLAG_VMO);
+    cpriv->extra_size = extra_size;
     // copy data payload metadata to the clone so the api can just work
     cpriv->data_size = priv->data_size;
-    cpriv->data = priv->data;
-    cpriv->data_phys = priv->data_phys;
     cpriv->vmo_offset = priv->vmo_offset;
     cpriv->vmo = priv->vmo;
+    if (priv->flags & IOTXN_FLAG_VMO) {
+        // the mapping and bounce buffer belong to the original, the clone
+        // makes its own if it needs them
+        cpriv->data = priv->mapped ? priv->data : NULL;
+        cpriv->data_phys = priv->bounce ? 0 : priv->data_phys;
+        cpriv->sg = priv->sg;
+        cpriv->sg_count = priv->sg_count;
+    } else {
+        cpriv->data = priv->data;
+        cpriv->data_phys = priv->data_phys;
+        iotxn_set_sg_inline(cpriv);
+    }
     memcpy(&cpriv->txn, txn, sizeof(iotxn_t));
     cpriv->txn.complete_cb = NULL; // clear the complete cb
     *out = &cpriv->txn;
@@ -140,10 +308,18 @@ out:
 static void iotxn_release(iotxn_t* txn) {
     xprintf("iotxn_release: txn=%p\n", txn);
     iotxn_priv_t* priv = get_priv(txn);
-    if (priv->flags & IOTXN_FLAG_CLONE) {
-        list_add_tail(&clone_list, &txn->node);
-    } else {
-        list_add_tail(&free_list, &txn->node);
+    if (priv->bounce) {
+        mx_process_vm_unmap(0, (uintptr_t)priv->bounce, 0);
+        priv->bounce = NULL;
+    }
+    if (priv->mapped) {
+        mx_process_vm_unmap(0, priv->mapped, 0);
+        priv->mapped = 0;
+    }
+    // iotxns over a vmo are sized for their page list and never pooled
+    iotxn_class_t* class = iotxn_get_class(priv);
+    if (!class || !iotxn_class_push(class, priv, sizeof(iotxn_priv_t) + priv->buffer_size)) {
+        iotxn_free_memory(priv);
     }
 }
 
@@ -152,54 +328,151 @@ static iotxn_ops_t ops = {
     .copyfrom = iotxn_copyfrom,
     .copyto = iotxn_copyto,
     .physmap = iotxn_physmap,
+    .physmap_sg = iotxn_physmap_sg,
     .mmap = iotxn_mmap,
     .clone = iotxn_clone,
     .release = iotxn_release,
 };
 
-mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size) {
-    xprintf("iotxn_alloc: flags=0x%x data_size=0x%zx extra_size=0x%zx\n", flags, data_size, extra_size);
-    iotxn_t* txn = NULL;
-    iotxn_priv_t* priv = NULL;
-    // look in free list first for something that fits
-    bool found = false;
-    list_for_every_entry (&free_list, txn, iotxn_t, node) {
-        priv = get_priv(txn);
-        if (priv->buffer_size >= data_size + extra_size) {
-            found = true;
-            break;
+mx_status_t iotxn_pool_create(iotxn_pool_t** out) {
+    iotxn_pool_t* pool = calloc(1, sizeof(iotxn_pool_t));
+    if (!pool) {
+        return ERR_NO_MEMORY;
+    }
+    *out = pool;
+    return NO_ERROR;
+}
+
+void iotxn_pool_destroy(iotxn_pool_t* pool) {
+    iotxn_priv_t* priv;
+    for (uint32_t i = 0; i < IOTXN_BUFFER_CLASSES; i++) {
+        while ((priv = iotxn_class_pop(&pool->buffers[i])) != NULL) {
+            iotxn_free_memory(priv);
         }
     }
-    // found one that fits, skip allocation
-    if (found) {
-        list_delete(&txn->node);
-        memset(&txn, 0, sizeof(iotxn_t) + priv->buffer_size);
-        goto out;
-    }
-    // didn't find one that fits, allocate a new one
-    size_t sz = sizeof(iotxn_priv_t) + data_size + extra_size;
-    mx_paddr_t phys;
-    mx_status_t status = mx_alloc_device_memory(sz, &phys, (void**)&priv);
-    if (status < 0) {
-        xprintf("iotxn: out of memory\n");
-        return status;
+    for (uint32_t i = 0; i < IOTXN_CLONE_CLASSES; i++) {
+        while ((priv = iotxn_class_pop(&pool->clones[i])) != NULL) {
+            iotxn_free_memory(priv);
+        }
     }
-    memset(priv, 0, sz);
+    free(pool);
+}
 
+mx_status_t iotxn_pool_alloc(iotxn_pool_t* pool, iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size) {
+    xprintf("iotxn_alloc: flags=0x%x data_size=0x%zx extra_size=0x%zx\n", flags, data_size, extra_size);
     // layout is iotxn_priv_t | extra_size | data
-    priv->buffer_size = data_size + extra_size;
-    priv->buffer_phys = phys;
-out:
+    size_t sz = sizeof(iotxn_priv_t) + extra_size + data_size;
+    uint32_t size_class = iotxn_size_class(sz, IOTXN_BUFFER_MIN_SHIFT, IOTXN_BUFFER_CLASSES);
+    iotxn_priv_t* priv = NULL;
+    if (size_class != IOTXN_NO_CLASS) {
+        priv = iotxn_class_pop(&pool->buffers[size_class]);
+        sz = 1u << (IOTXN_BUFFER_MIN_SHIFT + size_class);
+    }
+    if (!priv) {
+        mx_paddr_t phys;
+        mx_status_t status = mx_alloc_device_memory(sz, &phys, (void**)&priv);
+        if (status < 0) {
+            xprintf("iotxn: out of memory\n");
+            return status;
+        }
+        priv->pool = pool;
+        priv->size_class = size_class;
+        priv->buffer_size = sz - sizeof(iotxn_priv_t);
+        priv->buffer_phys = phys;
+    }
+    // the data is left as the last user had it
+    iotxn_priv_reset(priv, extra_size);
+
     priv->data_size = data_size;
     priv->extra_size = extra_size;
     priv->data = (void*)priv + sizeof(iotxn_priv_t) + extra_size;
     priv->data_phys = priv->buffer_phys + sizeof(iotxn_priv_t) + extra_size;
+    iotxn_set_sg_inline(priv);
+    priv->txn.ops = &ops;
+    *out = &priv->txn;
+    xprintf("iotxn_alloc: txn=%p buffer_size=0x%zx\n", &priv->txn, priv->buffer_size);
+    return NO_ERROR;
+}
+
+mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size) {
+    return iotxn_pool_alloc(&default_pool, out, flags, data_size, extra_size);
+}
+
+mx_status_t iotxn_alloc_vmo(iotxn_t** out, uint32_t flags, mx_handle_t vmo, uint64_t vmo_offset,
+                            size_t data_size, size_t extra_size) {
+    xprintf("iotxn_alloc_vmo: flags=0x%x vmo=%d vmo_offset=0x%" PRIx64 " data_size=0x%zx extra_size=0x%zx\n",
+            flags, vmo, vmo_offset, data_size, extra_size);
+    if (data_size == 0 || vmo_offset + data_size < vmo_offset) {
+        return ERR_INVALID_ARGS;
+    }
+    uint64_t start = vmo_offset & ~(PAGE_SIZE - 1);
+    uint64_t end = vmo_offset + data_size;
+    size_t page_count = ((end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1)) / PAGE_SIZE - start / PAGE_SIZE;
+
+    // layout is iotxn_priv_t | extra_size | sg list, which is never longer
+    // than one entry per page
+    size_t sg_offset = (extra_size + sizeof(iotxn_sg_t) - 1) & ~(sizeof(iotxn_sg_t) - 1);
+    iotxn_priv_t* priv = calloc(1, sizeof(iotxn_priv_t) + sg_offset + page_count * sizeof(iotxn_sg_t));
+    if (!priv) {
+        xprintf("iotxn: out of memory\n");
+        return ERR_NO_MEMORY;
+    }
+    iotxn_sg_t* sg = (void*)priv + sizeof(iotxn_priv_t) + sg_offset;
+    uint32_t sg_count = 0;
+
+    // merge physically contiguous pages into one piece as they're looked up
+    mx_paddr_t pages[IOTXN_LOOKUP_PAGES];
+    for (uint64_t o = start; o < end; o += IOTXN_LOOKUP_PAGES * PAGE_SIZE) {
+        uint64_t chunk_end = MIN(end, o + IOTXN_LOOKUP_PAGES * PAGE_SIZE);
+        mx_status_t status = mx_vm_object_lookup(vmo, o, chunk_end - o, pages, IOTXN_LOOKUP_PAGES);
+        if (status != NO_ERROR) {
+            free(priv);
+            return status;
+        }
+        for (uint64_t page = o; page < chunk_end; page += PAGE_SIZE) {
+            mx_paddr_t paddr = pages[(page - o) / PAGE_SIZE];
+            mx_size_t length = PAGE_SIZE;
+            if (page < vmo_offset) {
+                paddr += vmo_offset - page;
+                length -= vmo_offset - page;
+            }
+            if (page + PAGE_SIZE > end) {
+                length -= page + PAGE_SIZE - end;
+            }
+            if (sg_count && sg[sg_count - 1].paddr + sg[sg_count - 1].length == paddr) {
+                sg[sg_count - 1].length += length;
+            } else {
+                sg[sg_count].paddr = paddr;
+                sg[sg_count].length = length;
+                sg_count++;
+            }
+        }
+    }
+
+    priv->pool = &default_pool;
+    priv->size_class = IOTXN_NO_CLASS;
+    priv->flags = IOTXN_FLAG_VMO;
+    priv->vmo = vmo;
+    priv->vmo_offset = vmo_offset;
+    priv->data_size = data_size;
+    priv->extra_size = extra_size;
+    priv->data_phys = sg_count == 1 ? sg[0].paddr : 0;
+    priv->sg = sg;
+    priv->sg_count = sg_count;
     priv->txn.ops = &ops;
     *out = &priv->txn;
-    xprintf("iotxn_alloc: found=%d txn=%p buffer_size=0x%zx\n", found, &priv->txn, priv->buffer_size);
+    xprintf("iotxn_alloc_vmo: txn=%p sg_count=%u\n", &priv->txn, sg_count);
     return NO_ERROR;
 }
 
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
+    if (txn->ops == &ops) {
+        iotxn_priv_t* priv = get_priv(txn);
+        if (!priv->queue_dev) {
+            priv->queue_dev = dev;
+            priv->queue_time = mx_current_time();
+            iostats_queued(&dev->iostats);
+        }
+    }
     dev->ops->iotxn_queue(dev, txn);
 }
@@ -0,0 +1,121 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <ddk/ring-server.h>
+#include <magenta/syscalls.h>
+#include <runtime/thread.h>
+
+mx_status_t ring_server_init(ring_server_t* rs, size_t size, mx_handle_t* out) {
+    mx_status_t status;
+    mx_handle_t h[2] = { 0, 0 };
+    mx_handle_t vmo = 0;
+
+    rs->pipe = 0;
+    rs->mapping = NULL;
+    rs->mapping_size = size;
+    if ((rs->vmo = mx_vm_object_create(size)) < 0) {
+        status = rs->vmo;
+        goto fail;
+    }
+    uintptr_t mapping;
+    status = mx_process_vm_map(0, rs->vmo, 0, size, &mapping,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    if (status < 0) {
+        goto fail;
+    }
+    rs->mapping = (void*)mapping;
+
+    if ((status = mx_message_pipe_create(h, 0)) < 0) {
+        goto fail;
+    }
+    rs->pipe = h[0];
+
+    // hand the vmo to the client as the first message on the pipe
+    if ((vmo = mx_handle_duplicate(rs->vmo, MX_RIGHT_SAME_RIGHTS)) < 0) {
+        status = vmo;
+        goto fail;
+    }
+    if ((status = mx_message_write(h[1], NULL, 0, &vmo, 1, 0)) < 0) {
+        mx_handle_close(vmo);
+        goto fail;
+    }
+
+    *out = h[1];
+    return NO_ERROR;
+
+fail:
+    if (h[1] > 0) {
+        mx_handle_close(h[1]);
+    }
+    ring_server_release(rs);
+    return status;
+}
+
+static int ring_server_thread(void* arg) {
+    ring_server_t* rs = arg;
+    for (;;) {
+        mx_signals_state_t state;
+        mx_status_t status = mx_handle_wait_one(rs->pipe, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                                MX_TIME_INFINITE, &state);
+        if (status != NO_ERROR) break;
+
+        // any number of kicks mean the same thing
+        uint32_t kick;
+        uint32_t sz;
+        do {
+            sz = sizeof(kick);
+            status = mx_message_read(rs->pipe, &kick, &sz, NULL, NULL, 0);
+        } while (status == NO_ERROR);
+        if (status != ERR_BAD_STATE) break;
+
+        rs->ops->kick(rs->cookie);
+    }
+
+    rs->ops->close(rs->cookie);
+    return 0;
+}
+
+mx_status_t ring_server_start(ring_server_t* rs, const char* name,
+                              const ring_server_ops_t* ops, void* cookie) {
+    rs->ops = ops;
+    rs->cookie = cookie;
+
+    mxr_thread_t* thread;
+    mx_status_t status = mxr_thread_create(ring_server_thread, rs, name, &thread);
+    if (status < 0) {
+        return status;
+    }
+    mxr_thread_detach(thread);
+    return NO_ERROR;
+}
+
+void ring_server_notify(ring_server_t* rs) {
+    uint32_t msg = 0;
+    mx_message_write(rs->pipe, &msg, sizeof(msg), NULL, 0, 0);
+}
+
+void ring_server_release(ring_server_t* rs) {
+    if (rs->mapping) {
+        mx_process_vm_unmap(0, (uintptr_t)rs->mapping, 0);
+        rs->mapping = NULL;
+    }
+    if (rs->vmo > 0) {
+        mx_handle_close(rs->vmo);
+        rs->vmo = 0;
+    }
+    if (rs->pipe > 0) {
+        mx_handle_close(rs->pipe);
+        rs->pipe = 0;
+    }
+}
@@ -24,8 +24,11 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/common/hid.c \
     $(LOCAL_DIR)/common/usb.c \
     $(LOCAL_DIR)/protocol/input.c \
+    $(LOCAL_DIR)/block-queue.c \
     $(LOCAL_DIR)/io-alloc.c \
+    $(LOCAL_DIR)/iostats.c \
     $(LOCAL_DIR)/iotxn.c \
+    $(LOCAL_DIR)/ring-server.c \
     $(LOCAL_DIR)/hexdump.c \
 
 ifeq ($(ARCH),arm)
@@ -0,0 +1,109 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+// Layout of the kernel trace buffer returned by mx_ktrace_get_vmo().
+//
+// The first page holds an mx_ktrace_info_t. It is followed by one ring of
+// records_per_cpu records for each cpu; cpu n's ring starts at
+//     MX_KTRACE_RING_OFFSET + n * records_per_cpu * sizeof(mx_ktrace_record_t)
+//
+// cpu[n].head counts every record cpu n has ever written, so record i is
+// in slot i % records_per_cpu of its ring. The kernel keeps writing while
+// user mode reads, and the slot at head may be half written. To take a
+// consistent snapshot of a ring, read head, copy out the records from
+// max(head - records_per_cpu + 1, 0) up to head, then read head again and
+// throw away any records the kernel may have lapped in between.
+
+#define MX_KTRACE_VERSION       1
+#define MX_KTRACE_RING_OFFSET   4096
+
+// Groups of events, which are enabled and disabled together.
+#define MX_KTRACE_GRP_META      0x001
+#define MX_KTRACE_GRP_SCHED     0x002
+#define MX_KTRACE_GRP_IRQ       0x004
+#define MX_KTRACE_GRP_SYSCALL   0x008
+#define MX_KTRACE_GRP_PAGEFAULT 0x010
+#define MX_KTRACE_GRP_IPC       0x020
+#define MX_KTRACE_GRP_ALL       0x03f
+
+#define MX_KTRACE_TAG(grp, event)   (((uint32_t)(grp) << 16) | (uint32_t)(event))
+#define MX_KTRACE_GROUP(tag)        ((uint32_t)(tag) >> 16)
+#define MX_KTRACE_EVENT(tag)        ((uint32_t)(tag) & 0xffff)
+
+// Event tags, and what the a-d fields of their records hold. 64-bit
+// values are split across two fields, low half first.
+
+// a-d: the first 16 bytes of the name of thread tid, not terminated.
+#define MX_KTRACE_THREAD_NAME       MX_KTRACE_TAG(MX_KTRACE_GRP_META, 1)
+
+// tid switched to thread a. b: the state tid was left in, c: a's priority.
+#define MX_KTRACE_CONTEXT_SWITCH    MX_KTRACE_TAG(MX_KTRACE_GRP_SCHED, 1)
+
+// a: vector.
+#define MX_KTRACE_IRQ_ENTER         MX_KTRACE_TAG(MX_KTRACE_GRP_IRQ, 1)
+#define MX_KTRACE_IRQ_EXIT          MX_KTRACE_TAG(MX_KTRACE_GRP_IRQ, 2)
+
+// a: syscall number. On exit, b-c: the return value.
+#define MX_KTRACE_SYSCALL_ENTER     MX_KTRACE_TAG(MX_KTRACE_GRP_SYSCALL, 1)
+#define MX_KTRACE_SYSCALL_EXIT      MX_KTRACE_TAG(MX_KTRACE_GRP_SYSCALL, 2)
+
+// a-b: faulting address, c: VMM_PF_FLAG_* flags. On exit, d: status.
+#define MX_KTRACE_PAGE_FAULT_ENTER  MX_KTRACE_TAG(MX_KTRACE_GRP_PAGEFAULT, 1)
+#define MX_KTRACE_PAGE_FAULT_EXIT   MX_KTRACE_TAG(MX_KTRACE_GRP_PAGEFAULT, 2)
+
+// a: low 32 bits of the koid of the message pipe endpoint, b: bytes,
+// c: handles.
+#define MX_KTRACE_MSGPIPE_WRITE     MX_KTRACE_TAG(MX_KTRACE_GRP_IPC, 1)
+#define MX_KTRACE_MSGPIPE_READ      MX_KTRACE_TAG(MX_KTRACE_GRP_IPC, 2)
+
+typedef struct mx_ktrace_record {
+    uint32_t tag;
+    // Opaque id of the thread that was running, stable for its lifetime.
+    uint32_t tid;
+    // Cycle counter ticks; see ticks_to_ns_mult.
+    uint64_t ts;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+} mx_ktrace_record_t;
+
+typedef struct mx_ktrace_cpu {
+    uint64_t head;
+    uint64_t reserved[7];
+} mx_ktrace_cpu_t;
+
+typedef struct mx_ktrace_info {
+    uint32_t version;
+    uint32_t num_cpus;
+    // Groups currently being traced.
+    uint32_t grpmask;
+    uint32_t reserved0;
+    uint64_t records_per_cpu;
+    // Converts record timestamps to nanoseconds:
+    //     ns = (ts * ticks_to_ns_mult) >> 32
+    // or zero if the cycle counter doesn't run at a constant rate.
+    uint64_t ticks_to_ns_mult;
+    uint64_t reserved[4];
+    mx_ktrace_cpu_t cpu[];
+} mx_ktrace_info_t;
+
+// Actions for mx_ktrace_control().
+#define MX_KTRACE_ACTION_START  1 // options: groups to trace
+#define MX_KTRACE_ACTION_STOP   2
+#define MX_KTRACE_ACTION_REWIND 3 // only while stopped
@@ -0,0 +1,80 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+// Layout of the sample buffer returned by mx_profile_get_vmo().
+//
+// The first page holds an mx_profile_info_t. It is followed by one ring of
+// samples_per_cpu samples for each cpu; cpu n's ring starts at
+//     MX_PROFILE_RING_OFFSET + n * samples_per_cpu * sizeof(mx_profile_sample_t)
+//
+// cpu[n].head counts every sample cpu n has ever taken, so sample i is in
+// slot i % samples_per_cpu of its ring. As with the ktrace buffer, the
+// kernel keeps writing while user mode reads; read head before and after
+// copying samples out and throw away any the kernel may have lapped.
+
+#define MX_PROFILE_VERSION      1
+#define MX_PROFILE_RING_OFFSET  4096
+
+// Return addresses kept per sample, innermost first.
+#define MX_PROFILE_MAX_FRAMES   10
+
+// The cpu was running user code when the sample was taken.
+#define MX_PROFILE_SAMPLE_USER  0x1
+// The cpu was idle.
+#define MX_PROFILE_SAMPLE_IDLE  0x2
+
+typedef struct mx_profile_sample {
+    // Microseconds since boot.
+    uint64_t ts;
+    // Koids of the process and thread that were running, or zero for a
+    // kernel thread.
+    uint64_t pid;
+    uint64_t tid;
+    // Exactly one of these is set, depending on the mode the cpu was in.
+    uint64_t user_pc;
+    uint64_t kernel_pc;
+    uint32_t cpu;
+    uint16_t flags;
+    uint16_t num_frames;
+    // Return addresses found by following the frame pointer chain in the
+    // same mode as the pc.
+    uint64_t frames[MX_PROFILE_MAX_FRAMES];
+} mx_profile_sample_t;
+
+typedef struct mx_profile_cpu {
+    uint64_t head;
+    // Timer ticks that couldn't be turned into a sample.
+    uint64_t dropped;
+    uint64_t reserved[6];
+} mx_profile_cpu_t;
+
+typedef struct mx_profile_info {
+    uint32_t version;
+    uint32_t num_cpus;
+    // Samples per second on each cpu, or zero when stopped.
+    uint32_t rate;
+    uint32_t reserved0;
+    uint64_t samples_per_cpu;
+    uint64_t reserved[5];
+    mx_profile_cpu_t cpu[];
+} mx_profile_info_t;
+
+// Actions for mx_profile_control().
+#define MX_PROFILE_ACTION_START     1 // options: samples per second, 0 for the default
+#define MX_PROFILE_ACTION_STOP      2
+#define MX_PROFILE_ACTION_REWIND    3 // only while stopped
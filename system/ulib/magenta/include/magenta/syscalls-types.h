@@ -107,11 +107,25 @@ typedef enum {
     MX_EXCEPTION_STATUS_RESUME = 1
 } mx_exception_status_t;
 
+// Layout of the value of a priority inheritance futex, as used by
+// mx_futex_lock_pi() and mx_futex_unlock_pi(). Zero means unowned;
+// otherwise the low bits hold the owning thread's mx_futex_self_tid().
+#define MX_FUTEX_PI_TID_MASK      0x3fffffff
+// Set by userspace before blocking in mx_futex_lock_pi(), which forces the
+// owner's unlock into the kernel so ownership can be handed over.
+#define MX_FUTEX_PI_WAITERS       0x80000000
+// Set by the kernel when it hands over a futex whose owner exited without
+// releasing it. The kernel never clears it; the new owner does.
+#define MX_FUTEX_PI_OWNER_DIED    0x40000000
+
 // Valid topics for mx_handle_get_info.
 typedef enum {
     MX_INFO_HANDLE_VALID,
     MX_INFO_HANDLE_BASIC,
     MX_INFO_PROCESS,
+    MX_INFO_SYSCALL_STATS,
+    MX_INFO_HEAP_PROFILE,
+    MX_INFO_RUNTIME,
 } mx_handle_info_topic_t;
 
 typedef enum {
@@ -151,6 +165,40 @@ typedef struct mx_process_info {
     int return_code;
 } mx_process_info_t;
 
+// Number of buckets in mx_syscall_stats_t.latency. Bucket 0 counts calls
+// that took under 1us, bucket i those that took [2^(i-1), 2^i) us, and the
+// last bucket everything slower.
+#define MX_SYSCALL_LATENCY_BUCKETS 24
+
+// Returned for topic MX_INFO_SYSCALL_STATS, as an array with one entry for
+// each syscall that has been made since boot. The counts are system wide.
+typedef struct mx_syscall_stats {
+    uint32_t num;                 // syscall number
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t total_time;          // microseconds
+    uint64_t latency[MX_SYSCALL_LATENCY_BUCKETS];
+} mx_syscall_stats_t;
+
+// Returned for topic MX_INFO_HEAP_PROFILE, as an array with one entry for
+// each kernel call site seen by the sampling heap profiler. The counts are
+// estimates, scaled up by the sample rate; the array is empty while the
+// profiler is off. Only available with kernel.debug-syscalls.
+typedef struct mx_heap_profile_site {
+    uint64_t caller;              // kernel pc of the allocating call
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    uint64_t live;
+    uint64_t live_bytes;
+} mx_heap_profile_site_t;
+
+// Returned for topic MX_INFO_RUNTIME on a thread or process handle.
+typedef struct mx_runtime_info {
+    // Nanoseconds spent running on a cpu; for a process, summed over all
+    // of its threads, including those that have exited.
+    mx_time_t cpu_time;
+} mx_runtime_info_t;
+
 
 // Defines and structures related to mx_pci_*()
 // Info returned to dev manager for PCIe devices when probing.
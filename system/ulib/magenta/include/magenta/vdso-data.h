@@ -0,0 +1,35 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+// The kernel fills in this structure at the start of the vDSO's read-only
+// data page (between the DATA_START and DATA_END symbols of the image)
+// before the vDSO is mapped into any process.  It is private to the kernel
+// and the vDSO; nothing else should depend on its layout.
+//
+// A zero in any field means the value is not available in user mode and
+// the vDSO should make the real system call instead.
+struct mx_vdso_data {
+    // What mx_num_cpus() returns.
+    uint32_t num_cpus;
+    uint32_t reserved;
+
+    // Converts the user-readable cycle counter (the TSC on x86) into
+    // mx_current_time() nanoseconds:
+    //     ns = (ticks * ticks_to_ns_mult) >> 32
+    uint64_t ticks_to_ns_mult;
+};
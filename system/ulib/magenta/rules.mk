@@ -36,6 +36,9 @@ else ifeq ($(ARCH),x86)
     endif
 endif
 
+# User-mode implementations of some calls, see MAGENTA_VDSOCALL_DEF.
+MODULE_SRCS += $(LOCAL_DIR)/vdso.c
+
 MODULE_EXPORT := magenta
 MODULE_SO_NAME := magenta
 
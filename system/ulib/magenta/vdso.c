@@ -0,0 +1,58 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// User-mode implementations of the MAGENTA_VDSOCALL_DEF system calls.
+// Each one answers from the data page the kernel fills in, and falls back
+// to the real system call (_mx_syscall_*) when the kernel left that part of
+// the page zero.  When this code is linked statically rather than used as
+// the vDSO, the page is always zero and these are plain system calls.
+
+#include <magenta/syscalls.h>
+#include <magenta/vdso-data.h>
+
+#define HIDDEN __attribute__((visibility("hidden")))
+
+mx_time_t _mx_syscall_current_time(void) HIDDEN;
+unsigned int _mx_syscall_num_cpus(void) HIDDEN;
+
+// The page is defined in assembly so that the compiler can't see that it
+// is initially all zero and fold away the reads below.  The linker script
+// places the .rodso_data section in its own page of the read-only segment.
+__asm__(".pushsection .rodso_data,\"a\",%progbits\n"
+        ".p2align 12\n"
+        ".hidden vdso_data\n"
+        ".type vdso_data,%object\n"
+        "vdso_data:\n"
+        ".fill 4096,1,0\n"
+        ".size vdso_data, . - vdso_data\n"
+        ".popsection");
+extern const struct mx_vdso_data vdso_data HIDDEN;
+
+mx_time_t mx_current_time(void) {
+#if defined(__x86_64__)
+    uint64_t mult = vdso_data.ticks_to_ns_mult;
+    if (mult != 0) {
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        uint64_t ticks = ((uint64_t)hi << 32) | lo;
+        return (mx_time_t)(((unsigned __int128)ticks * mult) >> 32);
+    }
+#endif
+    return _mx_syscall_current_time();
+}
+
+unsigned int mx_num_cpus(void) {
+    unsigned int num_cpus = vdso_data.num_cpus;
+    return num_cpus != 0 ? num_cpus : _mx_syscall_num_cpus();
+}
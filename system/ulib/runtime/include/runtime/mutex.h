@@ -42,6 +42,10 @@ void mxr_mutex_lock(mxr_mutex_t* mutex);
 // Unlocks the lock.
 void mxr_mutex_unlock(mxr_mutex_t* mutex);
 
+// Returns the value that identifies the calling thread as the owner
+// of a locked mutex. This is the thread's mx_futex_self_tid().
+int mxr_mutex_owner_tid(void);
+
 #pragma GCC visibility pop
 
 __END_CDECLS
@@ -26,6 +26,7 @@ typedef uint32_t mxr_tls_t;
 #define MXR_TLS_SLOT_MAX ((mxr_tls_t)256)
 #define MXR_TLS_SLOT_SELF ((mxr_tls_t)0)
 #define MXR_TLS_SLOT_ERRNO ((mxr_tls_t)1)
+#define MXR_TLS_SLOT_FUTEX_TID ((mxr_tls_t)2)
 #define MXR_TLS_SLOT_INVALID ((mxr_tls_t)-1)
 
 #pragma GCC visibility push(hidden)
@@ -15,40 +15,61 @@
 #include <runtime/mutex.h>
 
 #include <magenta/syscalls.h>
+#include <runtime/tls.h>
 #include <system/atomic.h>
 
-// TODO(kulakowski) Reintroduce (correctly) optimization counting waiters.
-
-// These values have to be as such. UNLOCKED == 0 allows locks to be
-// statically allocated, and the ordering of the values is relied upon
-// in the atomic decrement in the unlock routine.
+// The futex holds the futex tid of the owning thread, or UNLOCKED.
+// Once another thread blocks on the mutex, MX_FUTEX_PI_WAITERS is set
+// as well, and unlocking goes through the kernel, which hands the
+// mutex to the highest priority waiter and boosts the owner to that
+// waiter's priority in the meantime.
 enum {
     UNLOCKED = 0,
-    LOCKED = 1,
 };
 
+int mxr_mutex_owner_tid(void) {
+    // Looked up from the kernel once per thread, then cached in TLS.
+    int tid = (int)(intptr_t)mxr_tls_get(MXR_TLS_SLOT_FUTEX_TID);
+    if (tid == 0) {
+        tid = mx_futex_self_tid();
+        mxr_tls_set(MXR_TLS_SLOT_FUTEX_TID, (void*)(intptr_t)tid);
+    }
+    return tid;
+}
+
 mx_status_t mxr_mutex_trylock(mxr_mutex_t* mutex) {
     int futex_value = UNLOCKED;
-    if (!atomic_cmpxchg(&mutex->futex, &futex_value, LOCKED))
+    if (!atomic_cmpxchg(&mutex->futex, &futex_value, mxr_mutex_owner_tid()))
         return ERR_BUSY;
     return NO_ERROR;
 }
 
 mx_status_t mxr_mutex_timedlock(mxr_mutex_t* mutex, mx_time_t timeout) {
+    int tid = mxr_mutex_owner_tid();
     for (;;) {
-        switch (atomic_swap(&mutex->futex, LOCKED)) {
-        case UNLOCKED:
+        int futex_value = UNLOCKED;
+        if (atomic_cmpxchg(&mutex->futex, &futex_value, tid))
             return NO_ERROR;
-        case LOCKED: {
-            mx_status_t status = mx_futex_wait(&mutex->futex, LOCKED, timeout);
-            if (status == ERR_BUSY) {
-                continue;
-            }
-            if (status != NO_ERROR) {
-                return status;
-            }
+
+        // Make sure the owner's unlock comes to the kernel before
+        // blocking. futex_value now holds the owner's tid.
+        int contended = futex_value | MX_FUTEX_PI_WAITERS;
+        if (futex_value != contended &&
+            !atomic_cmpxchg(&mutex->futex, &futex_value, contended))
             continue;
-        }
+
+        mx_status_t status = mx_futex_lock_pi(&mutex->futex, contended, timeout);
+        switch (status) {
+        case NO_ERROR:
+            // The kernel handed the mutex over to us. If the previous
+            // owner died holding it, the kernel says so; mxr mutexes have
+            // no notion of recovery, so just take it as is.
+            atomic_and(&mutex->futex, ~MX_FUTEX_PI_OWNER_DIED);
+            return NO_ERROR;
+        case ERR_BUSY:
+            continue;
+        default:
+            return status;
         }
     }
 }
@@ -60,8 +81,10 @@ void mxr_mutex_lock(mxr_mutex_t* mutex) {
 }
 
 void mxr_mutex_unlock(mxr_mutex_t* mutex) {
-    atomic_store(&mutex->futex, UNLOCKED);
-    mx_status_t status = mx_futex_wake(&mutex->futex, 0x7FFFFFFF);
+    int futex_value = mxr_mutex_owner_tid();
+    if (atomic_cmpxchg(&mutex->futex, &futex_value, UNLOCKED))
+        return;
+    mx_status_t status = mx_futex_unlock_pi(&mutex->futex);
     if (status != NO_ERROR)
         __builtin_trap();
 }
@@ -241,9 +241,11 @@ mx_handle_t mxr_thread_get_handle(mxr_thread_t* thread) {
 void __mxr_thread_main(void) {
     mxr_tls_t self_slot = mxr_tls_allocate();
     mxr_tls_t errno_slot = mxr_tls_allocate();
+    mxr_tls_t futex_tid_slot = mxr_tls_allocate();
 
     if (self_slot != MXR_TLS_SLOT_SELF ||
-        errno_slot != MXR_TLS_SLOT_ERRNO)
+        errno_slot != MXR_TLS_SLOT_ERRNO ||
+        futex_tid_slot != MXR_TLS_SLOT_FUTEX_TID)
         __builtin_trap();
 
     mxr_thread_t* thread = NULL;
@@ -432,6 +432,150 @@ static bool test_event_signalling() {
     END_TEST;
 }
 
+static bool test_futex_self_tid() {
+    BEGIN_TEST;
+    int tid = mx_futex_self_tid();
+    EXPECT_NEQ(tid, 0, "futex tid should be non-zero");
+    EXPECT_EQ(tid & ~MX_FUTEX_PI_TID_MASK, 0, "futex tid should fit in the tid mask");
+    EXPECT_EQ(mx_futex_self_tid(), tid, "futex tid should be stable");
+    END_TEST;
+}
+
+static bool test_futex_lock_pi_bad_args() {
+    BEGIN_TEST;
+    int self = mx_futex_self_tid();
+
+    int futex_value = self;
+    mx_status_t rc = mx_futex_lock_pi(&futex_value, futex_value, 0);
+    EXPECT_EQ(rc, ERR_INVALID_ARGS, "lock_pi without the waiters bit should fail");
+
+    futex_value = MX_FUTEX_PI_WAITERS;
+    rc = mx_futex_lock_pi(&futex_value, futex_value, 0);
+    EXPECT_EQ(rc, ERR_INVALID_ARGS, "lock_pi on an unowned futex should fail");
+
+    futex_value = self | MX_FUTEX_PI_WAITERS;
+    rc = mx_futex_lock_pi(&futex_value, futex_value + 1, 0);
+    EXPECT_EQ(rc, ERR_BUSY, "lock_pi should have returned busy");
+
+    rc = mx_futex_lock_pi(&futex_value, futex_value, 0);
+    EXPECT_EQ(rc, ERR_BAD_STATE, "lock_pi on our own futex should fail");
+
+    rc = mx_futex_lock_pi(nullptr, futex_value, 0);
+    EXPECT_EQ(rc, ERR_INVALID_ARGS, "lock_pi should check the address");
+
+    futex_value = 0;
+    rc = mx_futex_unlock_pi(&futex_value);
+    EXPECT_EQ(rc, ERR_BAD_STATE, "unlock_pi on an unowned futex should fail");
+    END_TEST;
+}
+
+static bool test_futex_lock_pi_timeout() {
+    BEGIN_TEST;
+    // Use a tid which is not ours; the kernel only needs it to be live
+    // for boosting, and a timeout of 0 returns before that matters.
+    int self = mx_futex_self_tid();
+    int futex_value = (self + 1) | MX_FUTEX_PI_WAITERS;
+    mx_status_t rc = mx_futex_lock_pi(&futex_value, futex_value, 0);
+    if (rc == NO_ERROR) {
+        EXPECT_EQ(futex_value, (int)(self | MX_FUTEX_PI_OWNER_DIED),
+                  "futex of a dead owner should be taken over");
+    } else {
+        EXPECT_EQ(rc, ERR_TIMED_OUT, "lock_pi should time out or see a dead owner");
+    }
+    END_TEST;
+}
+
+static int pi_exit_thread(void* arg) {
+    int* futex = reinterpret_cast<int*>(arg);
+    int expected = 0;
+    __atomic_compare_exchange_n(futex, &expected, mx_futex_self_tid(), false,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    // Give the main thread time to block before exiting with the lock held.
+    mx_nanosleep(100 * 1000 * 1000);
+    return 0;
+}
+
+static bool test_futex_lock_pi_owner_died() {
+    BEGIN_TEST;
+    int self = mx_futex_self_tid();
+    int futex_value = 0;
+
+    mxr_thread_t* handle;
+    ASSERT_EQ(mxr_thread_create(pi_exit_thread, &futex_value, "pi_exit", &handle), NO_ERROR,
+              "Error during thread creation");
+    int owner;
+    while ((owner = __atomic_load_n(&futex_value, __ATOMIC_SEQ_CST)) == 0)
+        mx_nanosleep(1000 * 1000);
+
+    // Block until the owner exits, which hands us the futex.
+    futex_value = owner | MX_FUTEX_PI_WAITERS;
+    mx_status_t rc = mx_futex_lock_pi(&futex_value, futex_value, MX_TIME_INFINITE);
+    mxr_thread_join(handle, NULL);
+    EXPECT_EQ(rc, NO_ERROR, "lock_pi should have succeeded");
+    EXPECT_EQ(futex_value, (int)(self | MX_FUTEX_PI_OWNER_DIED),
+              "futex should have been handed over with the owner died bit");
+
+    // Nobody was waiting when this owner exited; the next locker takes
+    // the futex over at once.
+    futex_value = owner | MX_FUTEX_PI_WAITERS;
+    rc = mx_futex_lock_pi(&futex_value, futex_value, MX_TIME_INFINITE);
+    EXPECT_EQ(rc, NO_ERROR, "lock_pi should have succeeded");
+    EXPECT_EQ(futex_value, (int)(self | MX_FUTEX_PI_OWNER_DIED),
+              "futex of an exited owner should be taken over");
+    END_TEST;
+}
+
+struct PiLockArgs {
+    int* futex;
+    int tid;
+    mx_status_t status;
+};
+
+static int pi_lock_thread(void* arg) {
+    PiLockArgs* args = reinterpret_cast<PiLockArgs*>(arg);
+    args->tid = mx_futex_self_tid();
+    int expected = 0;
+    while (!__atomic_compare_exchange_n(args->futex, &expected, args->tid, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        int waiting = expected | MX_FUTEX_PI_WAITERS;
+        if (expected == waiting ||
+            __atomic_compare_exchange_n(args->futex, &expected, waiting, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            args->status = mx_futex_lock_pi(args->futex, waiting, MX_TIME_INFINITE);
+            if (args->status != ERR_BUSY)
+                break;
+        }
+        expected = 0;
+    }
+    return 0;
+}
+
+static bool test_futex_lock_pi_handoff() {
+    BEGIN_TEST;
+    int self = mx_futex_self_tid();
+    int futex_value = self;
+
+    PiLockArgs args = {&futex_value, 0, ERR_INTERNAL};
+    mxr_thread_t* handle;
+    ASSERT_EQ(mxr_thread_create(pi_lock_thread, &args, "pi_lock", &handle), NO_ERROR,
+              "Error during thread creation");
+
+    // Wait for the thread to block on the futex.
+    while (__atomic_load_n(&futex_value, __ATOMIC_SEQ_CST) == self)
+        mx_nanosleep(1000 * 1000);
+    mx_nanosleep(100 * 1000 * 1000);
+
+    EXPECT_EQ(futex_value, (int)(self | MX_FUTEX_PI_WAITERS), "waiters bit should be set");
+    EXPECT_EQ(mx_futex_unlock_pi(&futex_value), NO_ERROR, "unlock_pi failed");
+    mxr_thread_join(handle, NULL);
+
+    EXPECT_EQ(args.status, NO_ERROR, "lock_pi should have succeeded");
+    EXPECT_EQ(futex_value, args.tid, "futex should have been handed to the waiter");
+    EXPECT_EQ(mx_futex_unlock_pi(&futex_value), ERR_BAD_STATE,
+              "unlock_pi by a non-owner should fail");
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(futex_tests)
 RUN_TEST(test_futex_wait_value_mismatch);
 RUN_TEST(test_futex_wait_timeout);
@@ -448,6 +592,11 @@ RUN_TEST(test_futex_requeue_same_addr);
 RUN_TEST(test_futex_requeue);
 RUN_TEST(test_futex_requeue_unqueued_on_timeout);
 RUN_TEST(test_event_signalling);
+RUN_TEST(test_futex_self_tid);
+RUN_TEST(test_futex_lock_pi_bad_args);
+RUN_TEST(test_futex_lock_pi_timeout);
+RUN_TEST(test_futex_lock_pi_handoff);
+RUN_TEST(test_futex_lock_pi_owner_died);
 END_TEST_CASE(futex_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -95,8 +95,142 @@ bool handle_rights_test(void) {
     END_TEST;
 }
 
+// Syscall numbers from syscalls.inc.
+#define SYSCALL_HANDLE_CLOSE 40
+#define MAX_SYSCALL_STATS 512
+
+bool syscall_stats_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t event = mx_event_create(0u);
+    mx_handle_t proc = mx_process_create("stats", 5u);
+    ASSERT_GT(proc, 0, "failed to create process");
+
+    mx_syscall_stats_t* stats = malloc(sizeof(*stats) * MAX_SYSCALL_STATS);
+    ASSERT_NEQ(stats, NULL, "out of memory");
+
+    CHECK(mx_handle_get_info(
+              event, MX_INFO_SYSCALL_STATS, stats, sizeof(*stats)),
+          ERR_WRONG_TYPE, "stats should need a process handle");
+    CHECK(mx_handle_get_info(
+              proc, MX_INFO_SYSCALL_STATS, stats, sizeof(*stats) - 1),
+          ERR_NOT_ENOUGH_BUFFER, "bad struct size validation");
+
+    // Make sure there is at least one call to look for.
+    EXPECT_EQ(mx_handle_close(event), NO_ERROR, "failed to close the handle");
+
+    mx_ssize_t size = mx_handle_get_info(
+        proc, MX_INFO_SYSCALL_STATS, stats, sizeof(*stats) * MAX_SYSCALL_STATS);
+    ASSERT_GT(size, 0, "failed to get syscall stats");
+    EXPECT_EQ((size_t)size % sizeof(*stats), 0u, "partial entry returned");
+
+    bool found = false;
+    for (size_t i = 0; i < (size_t)size / sizeof(*stats); i++) {
+        uint64_t total = 0;
+        for (int b = 0; b < MX_SYSCALL_LATENCY_BUCKETS; b++)
+            total += stats[i].latency[b];
+        EXPECT_GT(stats[i].count, 0ULL, "unused syscalls should be omitted");
+        EXPECT_EQ(stats[i].count, total, "histogram should add up to the count");
+        if (stats[i].num == SYSCALL_HANDLE_CLOSE)
+            found = true;
+    }
+    EXPECT_TRUE(found, "handle_close should have been counted");
+
+    free(stats);
+    mx_handle_close(proc);
+
+    END_TEST;
+}
+
+bool heap_profile_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t proc = mx_process_create("heapprof", 8u);
+    ASSERT_GT(proc, 0, "failed to create process");
+
+    mx_heap_profile_site_t sites[16];
+    if (mx_handle_get_info(proc, MX_INFO_HEAP_PROFILE, sites, sizeof(sites)) ==
+        ERR_ACCESS_DENIED) {
+        unittest_printf("heap profile disabled, boot with kernel.debug-syscalls\n");
+        mx_handle_close(proc);
+        END_TEST;
+    }
+
+    CHECK(mx_handle_get_info(
+              proc, MX_INFO_HEAP_PROFILE, sites, sizeof(sites[0]) - 1),
+          ERR_NOT_ENOUGH_BUFFER, "bad struct size validation");
+
+    // The profiler may well be off, in which case there are no sites.
+    mx_ssize_t size = mx_handle_get_info(proc, MX_INFO_HEAP_PROFILE, sites, sizeof(sites));
+    ASSERT_GE(size, 0, "failed to get heap profile");
+    EXPECT_LE((size_t)size, sizeof(sites), "overran the buffer");
+    EXPECT_EQ((size_t)size % sizeof(sites[0]), 0u, "partial entry returned");
+    for (size_t i = 0; i < (size_t)size / sizeof(sites[0]); i++) {
+        EXPECT_NEQ(sites[i].caller, 0ULL, "site without a caller");
+        EXPECT_LE(sites[i].live, sites[i].allocs, "more live than allocated");
+    }
+
+    mx_handle_close(proc);
+
+    END_TEST;
+}
+
+#define SPIN_NS 50000000ULL
+
+static int spin_thread(void* arg) {
+    mx_time_t end = mx_current_time() + SPIN_NS;
+    while (mx_current_time() < end)
+        ;
+    mx_thread_exit();
+    return 0;
+}
+
+bool runtime_test(void) {
+    BEGIN_TEST;
+
+    mx_runtime_info_t info;
+    mx_handle_t event = mx_event_create(0u);
+    CHECK(mx_handle_get_info(
+              event, MX_INFO_RUNTIME, &info, sizeof(info)),
+          ERR_WRONG_TYPE, "runtime should need a thread or process");
+    mx_handle_close(event);
+
+    // A process that hasn't started any threads hasn't run.
+    mx_handle_t proc = mx_process_create("runtime", 7u);
+    ASSERT_GT(proc, 0, "failed to create process");
+    CHECK(mx_handle_get_info(
+              proc, MX_INFO_RUNTIME, &info, sizeof(info) - 1),
+          ERR_NOT_ENOUGH_BUFFER, "bad struct size validation");
+    CHECK(mx_handle_get_info(
+              proc, MX_INFO_RUNTIME, &info, sizeof(info)),
+          sizeof(info), "failed to get process runtime");
+    EXPECT_EQ(info.cpu_time, 0ULL, "new process has run");
+    mx_handle_close(proc);
+
+    mx_time_t start = mx_current_time();
+    mx_handle_t thread = mx_thread_create(spin_thread, NULL, "spin", 5);
+    ASSERT_GT(thread, 0, "failed to create thread");
+    ASSERT_EQ(mx_handle_wait_one(thread, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL),
+              NO_ERROR, "failed to wait for thread");
+    mx_time_t elapsed = mx_current_time() - start;
+    CHECK(mx_handle_get_info(
+              thread, MX_INFO_RUNTIME, &info, sizeof(info)),
+          sizeof(info), "failed to get thread runtime");
+    // The thread may have been preempted, so it can have run for less than
+    // SPIN_NS, but never for longer than it existed. The clock has
+    // microsecond resolution, so allow for a tick.
+    EXPECT_GT(info.cpu_time, 0ULL, "spinning thread didn't run");
+    EXPECT_LE(info.cpu_time, elapsed + 1000, "thread ran longer than it existed");
+    mx_handle_close(thread);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(handle_info_tests)
 RUN_TEST(handle_info_test)
+RUN_TEST(syscall_stats_test)
+RUN_TEST(heap_profile_test)
+RUN_TEST(runtime_test)
 END_TEST_CASE(handle_info_tests)
 
 #ifndef BUILD_COMBINED_TESTS
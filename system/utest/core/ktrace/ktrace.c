@@ -0,0 +1,106 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <magenta/ktrace.h>
+#include <magenta/syscalls.h>
+#include <unittest/unittest.h>
+
+// The syscall whose entry we look for in the trace.
+#define TEST_SYSCALL_NUM 20000
+
+// ktrace is only available when the kernel is booted with
+// kernel.debug-syscalls; there is nothing to test without it.
+static bool ktrace_enabled(void) {
+    if (mx_ktrace_control(MX_KTRACE_ACTION_STOP, 0) == ERR_ACCESS_DENIED) {
+        unittest_printf("ktrace disabled, boot with kernel.debug-syscalls\n");
+        return false;
+    }
+    return true;
+}
+
+static bool syscall_trace_test(void) {
+    BEGIN_TEST;
+    if (!ktrace_enabled()) {
+        END_TEST;
+    }
+
+    ASSERT_EQ(mx_ktrace_control(MX_KTRACE_ACTION_START, MX_KTRACE_GRP_SYSCALL), NO_ERROR,
+              "start");
+    mx_syscall_test_0();
+    ASSERT_EQ(mx_ktrace_control(MX_KTRACE_ACTION_STOP, 0), NO_ERROR, "stop");
+
+    mx_handle_t vmo = mx_ktrace_get_vmo();
+    ASSERT_GT(vmo, 0, "get_vmo");
+    uint64_t size;
+    ASSERT_EQ(mx_vm_object_get_size(vmo, &size), NO_ERROR, "get_size");
+
+    // The buffer belongs to the kernel.
+    uintptr_t addr = 0;
+    EXPECT_EQ(mx_process_vm_map(0, vmo, 0, size, &addr,
+                                MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE),
+              ERR_ACCESS_DENIED, "mapped writable");
+
+    addr = 0;
+    ASSERT_EQ(mx_process_vm_map(0, vmo, 0, size, &addr, MX_VM_FLAG_PERM_READ), NO_ERROR,
+              "map");
+    EXPECT_EQ(mx_process_vm_protect(0, addr, 0, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE),
+              ERR_ACCESS_DENIED, "made writable");
+
+    const mx_ktrace_info_t* info = (const mx_ktrace_info_t*)addr;
+    EXPECT_EQ(info->version, (uint32_t)MX_KTRACE_VERSION, "version");
+    EXPECT_EQ(info->grpmask, 0u, "still tracing");
+    ASSERT_GT(info->records_per_cpu, 0u, "no records");
+
+    const mx_ktrace_record_t* rings =
+        (const mx_ktrace_record_t*)(addr + MX_KTRACE_RING_OFFSET);
+    bool found = false;
+    for (uint32_t cpu = 0; cpu < info->num_cpus && !found; cpu++) {
+        uint64_t head = info->cpu[cpu].head;
+        uint64_t count = head < info->records_per_cpu ? head : info->records_per_cpu;
+        const mx_ktrace_record_t* ring = rings + cpu * info->records_per_cpu;
+        for (uint64_t i = head - count; i < head; i++) {
+            const mx_ktrace_record_t* rec = &ring[i % info->records_per_cpu];
+            if (rec->tag == MX_KTRACE_SYSCALL_ENTER && rec->a == TEST_SYSCALL_NUM) {
+                found = true;
+                break;
+            }
+        }
+    }
+    EXPECT_TRUE(found, "syscall wasn't traced");
+
+    EXPECT_EQ(mx_process_vm_unmap(0, addr, 0), NO_ERROR, "unmap");
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "close");
+    END_TEST;
+}
+
+static bool bad_args_test(void) {
+    BEGIN_TEST;
+    if (!ktrace_enabled()) {
+        END_TEST;
+    }
+    EXPECT_EQ(mx_ktrace_control(MX_KTRACE_ACTION_START, 0), ERR_INVALID_ARGS, "no groups");
+    EXPECT_EQ(mx_ktrace_control(0, 0), ERR_INVALID_ARGS, "bad action");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(ktrace_tests)
+RUN_TEST(syscall_trace_test)
+RUN_TEST(bad_args_test)
+END_TEST_CASE(ktrace_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
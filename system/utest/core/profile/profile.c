@@ -0,0 +1,125 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <magenta/profile.h>
+#include <magenta/syscalls.h>
+#include <unittest/unittest.h>
+
+// Keeps the cpu busy in user mode for |ms| milliseconds.
+static void spin(uint64_t ms) {
+    mx_time_t end = mx_current_time() + ms * 1000000ULL;
+    while (mx_current_time() < end)
+        ;
+}
+
+// The profiler is only available when the kernel is booted with
+// kernel.debug-syscalls; there is nothing to test without it.
+static bool profile_enabled(void) {
+    if (mx_profile_control(MX_PROFILE_ACTION_STOP, 0) == ERR_ACCESS_DENIED) {
+        unittest_printf("profiler disabled, boot with kernel.debug-syscalls\n");
+        return false;
+    }
+    return true;
+}
+
+static bool per_cpu_ring_test(void) {
+    BEGIN_TEST;
+    if (!profile_enabled()) {
+        END_TEST;
+    }
+
+    ASSERT_EQ(mx_profile_control(MX_PROFILE_ACTION_REWIND, 0), NO_ERROR, "rewind");
+    mx_time_t start = mx_current_time();
+    ASSERT_EQ(mx_profile_control(MX_PROFILE_ACTION_START, 1000), NO_ERROR, "start");
+    EXPECT_EQ(mx_profile_control(MX_PROFILE_ACTION_REWIND, 0), ERR_BAD_STATE,
+              "rewound while sampling");
+    spin(200);
+    ASSERT_EQ(mx_profile_control(MX_PROFILE_ACTION_STOP, 0), NO_ERROR, "stop");
+    mx_time_t stop = mx_current_time();
+
+    mx_handle_t vmo = mx_profile_get_vmo();
+    ASSERT_GT(vmo, 0, "get_vmo");
+    uint64_t size;
+    ASSERT_EQ(mx_vm_object_get_size(vmo, &size), NO_ERROR, "get_size");
+    uintptr_t addr = 0;
+    ASSERT_EQ(mx_process_vm_map(0, vmo, 0, size, &addr, MX_VM_FLAG_PERM_READ), NO_ERROR,
+              "map");
+
+    const mx_profile_info_t* info = (const mx_profile_info_t*)addr;
+    EXPECT_EQ(info->rate, 0u, "still sampling");
+    ASSERT_GT(info->samples_per_cpu, 0u, "no samples");
+    ASSERT_GT(info->num_cpus, 0u, "no cpus");
+    ASSERT_LE(MX_PROFILE_RING_OFFSET + info->num_cpus * info->samples_per_cpu *
+                                           sizeof(mx_profile_sample_t),
+              size, "rings don't fit");
+
+    // Each ring only holds samples from its own cpu, in the order they
+    // were taken, and all from while the profiler was running. spin() ran
+    // in user mode for most of that time, so some samples caught it there.
+    const mx_profile_sample_t* rings =
+        (const mx_profile_sample_t*)(addr + MX_PROFILE_RING_OFFSET);
+    uint64_t sampled = 0, user = 0;
+    for (uint32_t cpu = 0; cpu < info->num_cpus; cpu++) {
+        uint64_t head = info->cpu[cpu].head;
+        uint64_t count = head < info->samples_per_cpu ? head : info->samples_per_cpu;
+        const mx_profile_sample_t* ring = rings + cpu * info->samples_per_cpu;
+        uint64_t last_ts = 0;
+        for (uint64_t i = head - count; i < head; i++) {
+            const mx_profile_sample_t* s = &ring[i % info->samples_per_cpu];
+            EXPECT_EQ(s->cpu, cpu, "sample in another cpu's ring");
+            EXPECT_GE(s->ts, last_ts, "samples out of order");
+            EXPECT_GE(s->ts, (uint64_t)start / 1000, "sample from before start");
+            EXPECT_LE(s->ts, (uint64_t)stop / 1000, "sample from after stop");
+            EXPECT_LE(s->num_frames, (uint16_t)MX_PROFILE_MAX_FRAMES, "too many frames");
+            if (s->flags & MX_PROFILE_SAMPLE_USER) {
+                EXPECT_TRUE(s->pid && s->tid && s->user_pc, "incomplete user sample");
+                EXPECT_EQ(s->kernel_pc, 0u, "user sample with a kernel pc");
+                user++;
+            } else {
+                EXPECT_EQ(s->user_pc, 0u, "kernel sample with a user pc");
+            }
+            last_ts = s->ts;
+        }
+        sampled += head;
+    }
+    EXPECT_GT(sampled, 0u, "no samples taken");
+    EXPECT_GT(user, 0u, "no user mode samples");
+
+    EXPECT_EQ(mx_process_vm_unmap(0, addr, 0), NO_ERROR, "unmap");
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "close");
+    EXPECT_EQ(mx_profile_control(MX_PROFILE_ACTION_REWIND, 0), NO_ERROR, "rewind");
+    END_TEST;
+}
+
+static bool bad_args_test(void) {
+    BEGIN_TEST;
+    if (!profile_enabled()) {
+        END_TEST;
+    }
+    EXPECT_EQ(mx_profile_control(MX_PROFILE_ACTION_START, 1000000), ERR_INVALID_ARGS,
+              "rate too high");
+    EXPECT_EQ(mx_profile_control(0, 0), ERR_INVALID_ARGS, "bad action");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(profile_tests)
+RUN_TEST(per_cpu_ring_test)
+RUN_TEST(bad_args_test)
+END_TEST_CASE(profile_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
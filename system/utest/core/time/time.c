@@ -0,0 +1,62 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <magenta/syscalls.h>
+#include <unittest/unittest.h>
+
+// mx_current_time() and mx_num_cpus() are usually answered by the vDSO
+// without entering the kernel, so check they still behave like the
+// system calls they stand in for.
+
+static bool current_time_monotonic_test(void) {
+    BEGIN_TEST;
+    mx_time_t last = mx_current_time();
+    for (int i = 0; i < 100000; ++i) {
+        mx_time_t now = mx_current_time();
+        ASSERT_GE(now, last, "time went backwards");
+        last = now;
+    }
+    END_TEST;
+}
+
+static bool current_time_advances_test(void) {
+    BEGIN_TEST;
+    const mx_time_t kSleep = 50 * 1000 * 1000;
+    mx_time_t before = mx_current_time();
+    ASSERT_EQ(mx_nanosleep(kSleep), NO_ERROR, "nanosleep failed");
+    mx_time_t elapsed = mx_current_time() - before;
+    EXPECT_GE(elapsed, kSleep, "time advanced less than we slept");
+    EXPECT_LT(elapsed, kSleep * 100, "time advanced far more than we slept");
+    END_TEST;
+}
+
+static bool num_cpus_test(void) {
+    BEGIN_TEST;
+    unsigned int num_cpus = mx_num_cpus();
+    EXPECT_GT(num_cpus, 0u, "no cpus");
+    EXPECT_EQ(mx_num_cpus(), num_cpus, "cpu count changed");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(time_tests)
+RUN_TEST(current_time_monotonic_test)
+RUN_TEST(current_time_advances_test)
+RUN_TEST(num_cpus_test)
+END_TEST_CASE(time_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -360,6 +360,11 @@ static mx_status_t usb_control(mx_device_t* device, uint8_t request_type, uint8_
     return dev->hci_protocol->control(dev->hcidev, dev->address, &dr, length, data);
 }
 
+static mx_status_t usb_reset_endpoint(mx_device_t* device, usb_endpoint_t* ep) {
+    usb_device_t* dev = get_usb_device(device);
+    return dev->hci_protocol->reset_endpoint(dev->hcidev, dev->address, ep);
+}
+
 static mx_status_t usb_get_config(mx_device_t* device, usb_device_config_t** config) {
     usb_device_t* dev = get_usb_device(device);
     *config = &dev->config;
@@ -385,6 +390,7 @@ usb_device_protocol_t _device_protocol = {
     .alloc_request = usb_alloc_request,
     .free_request = usb_free_request,
     .control = usb_control,
+    .reset_endpoint = usb_reset_endpoint,
     .get_config = usb_get_config,
     .queue_request = usb_queue_request,
     .get_speed = usb_get_speed,
@@ -18,20 +18,21 @@
  */
 
 static void* xhci_irq_thread(void* arg) {
-    usb_xhci_t* xhci = (usb_xhci_t*)arg;
-    printf("xhci_irq_thread start\n");
+    struct xhci_irq* irq = arg;
+    usb_xhci_t* xhci = irq->uxhci;
+    printf("xhci_irq_thread %u start\n", irq->intr);
 
     while (1) {
         mx_status_t wait_res;
 
-        wait_res = xhci->pci->pci_wait_interrupt(xhci->irq_handle);
+        wait_res = xhci->pci->pci_wait_interrupt(irq->handle);
         if (wait_res != NO_ERROR) {
             if (wait_res != ERR_CANCELLED)
                 printf("unexpected pci_wait_interrupt failure (%d)\n", wait_res);
             break;
         }
 
-        xhci_poll(&xhci->xhci);
+        xhci_poll(&xhci->xhci, irq->intr);
 
         // acknowledge everything
         uint32_t tmp = xhci->xhci.opreg->usbsts;
@@ -52,7 +53,7 @@ static void* xhci_irq_thread(void* arg) {
         if (xhci->legacy_irq_mode)
             xhci->xhci.hcrreg->intrrs[0].iman |= IMAN_IP;
     }
-    printf("xhci_irq_thread done\n");
+    printf("xhci_irq_thread %u done\n", irq->intr);
     return NULL;
 }
 
@@ -73,7 +74,6 @@ static mx_protocol_device_t xhci_device_proto = {
 };
 
 static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
-    mx_handle_t irq_handle = MX_HANDLE_INVALID;
     mx_handle_t mmio_handle = MX_HANDLE_INVALID;
     mx_handle_t cfg_handle = MX_HANDLE_INVALID;
     io_alloc_t* io_alloc = NULL;
@@ -139,8 +139,21 @@ static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
         goto error_return;
     }
 
-    // select our IRQ mode
-    status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, 1);
+    // select our IRQ mode, one MSI vector per interrupter if we can get them
+    const struct capreg* capreg = mmio;
+    uint32_t num_irqs = 1;
+    uint32_t max_irqs;
+    if (pci->query_irq_mode_caps(dev, MX_PCIE_IRQ_MODE_MSI, &max_irqs) == NO_ERROR) {
+        max_irqs = MIN(max_irqs, MIN(capreg->MaxIntrs, XHCI_MAX_INTERRUPTERS));
+        // MSI vectors come in powers of two
+        while (num_irqs * 2 <= max_irqs)
+            num_irqs *= 2;
+    }
+    status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, num_irqs);
+    if (status < 0 && num_irqs > 1) {
+        num_irqs = 1;
+        status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, num_irqs);
+    }
     if (status < 0) {
         mx_status_t status_legacy = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_LEGACY, 1);
 
@@ -155,17 +168,21 @@ static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
     }
 
     // register for interrupts
-    status = pci->map_interrupt(dev, 0);
-    if (status < 0) {
-        printf("usb_xhci_bind map_interrupt failed %d\n", status);
-        goto error_return;
+    for (uint32_t i = 0; i < num_irqs; i++) {
+        status = pci->map_interrupt(dev, i);
+        if (status < 0) {
+            printf("usb_xhci_bind map_interrupt %u failed %d\n", i, status);
+            goto error_return;
+        }
+        xhci->irqs[i].uxhci = xhci;
+        xhci->irqs[i].intr = i;
+        xhci->irqs[i].handle = status;
+        xhci->num_irqs = i + 1;
     }
-    irq_handle = status;
 
     xhci->io_alloc = io_alloc;
     xhci->mmio = mmio;
     xhci->mmio_len = mmio_len;
-    xhci->irq_handle = irq_handle;
     xhci->mmio_handle = mmio_handle;
     xhci->cfg_handle = cfg_handle;
     xhci->pci = pci;
@@ -183,17 +200,20 @@ static mx_status_t usb_xhci_bind(mx_driver_t* drv, mx_device_t* dev) {
 
     device_add(hcidev, dev);
 
-    pthread_create(&xhci->irq_thread, NULL, xhci_irq_thread, xhci);
+    for (uint32_t i = 0; i < xhci->xhci.num_interrupters; i++) {
+        pthread_create(&xhci->irqs[i].thread, NULL, xhci_irq_thread, &xhci->irqs[i]);
+    }
 
     return NO_ERROR;
 
 error_return:
-    if (xhci)
+    if (xhci) {
+        for (uint32_t i = 0; i < xhci->num_irqs; i++)
+            mx_handle_close(xhci->irqs[i].handle);
         free(xhci);
+    }
     if (io_alloc)
         io_alloc_free(io_alloc);
-    if (irq_handle != MX_HANDLE_INVALID)
-        mx_handle_close(irq_handle);
     if (mmio_handle != MX_HANDLE_INVALID)
         mx_handle_close(mmio_handle);
     if (cfg_handle != MX_HANDLE_INVALID)
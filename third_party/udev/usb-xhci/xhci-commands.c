@@ -96,11 +96,11 @@ int xhci_cmd_enable_slot(xhci_t* const xhci, int* const slot_id) {
     int cc = xhci_wait_for_command(xhci, cmd, 0);
     if (cc >= 0) {
         if (cc == CC_SUCCESS) {
-            *slot_id = TRB_GET(ID, xhci->er.cur);
+            *slot_id = TRB_GET(ID, xhci->er[0].cur);
             if (*slot_id > xhci->max_slots_en)
                 cc = CONTROLLER_ERROR;
         }
-        xhci_advance_event_ring(xhci);
+        xhci_advance_event_ring(xhci, &xhci->er[0]);
         //        xhci_handle_events_locked(xhci, NULL);
     }
     return cc;
@@ -48,13 +48,13 @@ xhci_event_ready(const event_ring_t* const er) {
     return (er->cur->control & TRB_CYCLE) == er->ccs;
 }
 
-void xhci_update_event_dq(xhci_t* const xhci) {
-    if (xhci->er.adv) {
-        xhci_spew("Updating dq ptr: @%p(0x%08" PRIx32 ") -> %p\n",
-                  xhci_phys_to_virt(xhci, xhci->hcrreg->intrrs[0].erdp_lo),
-                  xhci->hcrreg->intrrs[0].erdp_lo, xhci->er.cur);
+void xhci_update_event_dq(xhci_t* const xhci, event_ring_t* const er) {
+    if (er->adv) {
+        xhci_spew("Updating dq ptr %d: @%p(0x%08" PRIx32 ") -> %p\n", er->intr,
+                  xhci_phys_to_virt(xhci, xhci->hcrreg->intrrs[er->intr].erdp_lo),
+                  xhci->hcrreg->intrrs[er->intr].erdp_lo, er->cur);
 
-        uint64_t next_erdp = xhci_virt_to_phys(xhci, (mx_vaddr_t)xhci->er.cur);
+        uint64_t next_erdp = xhci_virt_to_phys(xhci, (mx_vaddr_t)er->cur);
         assert(!(next_erdp & ~ERDP_ADDR_MASK));
 
         // Clear the EHB (Event Handler Busy) bit by writing a 1 to it.
@@ -67,33 +67,37 @@ void xhci_update_event_dq(xhci_t* const xhci) {
         //
         // See section 5.5.2.3.3 of the XHCI spec, rev 1.1
         //
-        // next_erdp |= (xhci->er.cur_segment & ERDP_DESI_MASK);
+        // next_erdp |= (er->cur_segment & ERDP_DESI_MASK);
         
-        xhci->hcrreg->intrrs[0].erdp_lo = (uint32_t)(next_erdp & 0xFFFFFFFF);
-        xhci->hcrreg->intrrs[0].erdp_hi = (uint32_t)(next_erdp >> 32);
-        xhci->er.adv = 0;
+        xhci->hcrreg->intrrs[er->intr].erdp_lo = (uint32_t)(next_erdp & 0xFFFFFFFF);
+        xhci->hcrreg->intrrs[er->intr].erdp_hi = (uint32_t)(next_erdp >> 32);
+        er->adv = 0;
     }
 }
 
-void xhci_advance_event_ring(xhci_t* const xhci) {
-    xhci->er.cur++;
-    xhci->er.adv = 1;
-    if (xhci->er.cur == xhci->er.last) {
+void xhci_advance_event_ring(xhci_t* const xhci, event_ring_t* const er) {
+    er->cur++;
+    if (er->cur == er->last) {
         xhci_spew("Roll over in event ring\n");
-        xhci->er.cur = xhci->er.ring;
-        xhci->er.ccs ^= 1;
-        xhci_update_event_dq(xhci);
+        er->cur = er->ring;
+        er->ccs ^= 1;
     }
+    /* The ERDP is written once per batch of events by whoever drains the
+       ring, but not so rarely that the controller finds the ring full. */
+    if (++er->adv >= EVENT_RING_SIZE / 2)
+        xhci_update_event_dq(xhci, er);
 }
 
 // must hold mutex when calling this
 static void
-xhci_handle_transfer_event(xhci_t* const xhci) {
-    const trb_t* const ev = xhci->er.cur;
+xhci_handle_transfer_event(xhci_t* const xhci, event_ring_t* const er) {
+    const trb_t* const ev = er->cur;
     const int cc = TRB_GET(CC, ev);
     const int id = TRB_GET(ID, ev);
 
-    if (id && id <= xhci->max_slots_en) {
+    if (cc == CC_STOPPED || cc == CC_STOPPED_LENGTH_INVALID) {
+        /* Ignore 'Forced Stop Events', the TD they point at was cancelled */
+    } else if (id && id <= xhci->max_slots_en) {
         trb_t* driver_trb = (trb_t*)xhci_phys_to_virt(xhci, (mx_paddr_t)ev->ptr_low);
         usb_request_t* request;
         usb_request_t* temp;
@@ -107,12 +111,10 @@ xhci_handle_transfer_event(xhci_t* const xhci) {
                     request->transfer_length = 0;
                 }
                 list_delete(&request->node);
-                list_add_tail(&xhci->completed_reqs, &request->node);
+                list_add_tail(&er->completed_reqs, &request->node);
                 break;
             }
         }
-    } else if (cc == CC_STOPPED || cc == CC_STOPPED_LENGTH_INVALID) {
-        /* Ignore 'Forced Stop Events' */
     } else {
         xhci_debug(
             "Warning: "
@@ -124,13 +126,13 @@ xhci_handle_transfer_event(xhci_t* const xhci) {
             ev->ptr_high, ev->ptr_low,
             TRB_GET(EVTL, ev), cc);
     }
-    xhci_advance_event_ring(xhci);
+    xhci_advance_event_ring(xhci, er);
 }
 
 static void
-xhci_handle_command_completion_event(xhci_t* const xhci) {
+xhci_handle_command_completion_event(xhci_t* const xhci, event_ring_t* const er) {
 #ifdef XHCI_DEBUG
-    const trb_t* const ev = xhci->er.cur;
+    const trb_t* const ev = er->cur;
 #endif
 
     xhci_debug(
@@ -141,17 +143,17 @@ xhci_handle_command_completion_event(xhci_t* const xhci) {
         "    Cycle: %d\n",
         ev->ptr_high, ev->ptr_low,
         TRB_GET(CC, ev), TRB_GET(ID, ev), ev->control & TRB_CYCLE);
-    xhci_advance_event_ring(xhci);
+    xhci_advance_event_ring(xhci, er);
 }
 
 static void
-xhci_handle_host_controller_event(xhci_t* const xhci) {
-    const trb_t* const ev = xhci->er.cur;
+xhci_handle_host_controller_event(xhci_t* const xhci, event_ring_t* const er) {
+    const trb_t* const ev = er->cur;
 
     const int cc = TRB_GET(CC, ev);
     switch (cc) {
     case CC_EVENT_RING_FULL_ERROR:
-        xhci_debug("Event ring full! (@%p)\n", xhci->er.cur);
+        xhci_debug("Event ring %d full! (@%p)\n", er->intr, er->cur);
         /*
 		 * If we get here, we have processed the whole queue:
 		 * xHC pushes this event, when it sees the ring full,
@@ -159,12 +161,12 @@ xhci_handle_host_controller_event(xhci_t* const xhci) {
 		 * IMO it's save and necessary to update the dequeue
 		 * pointer here.
 		 */
-        xhci_advance_event_ring(xhci);
-        xhci_update_event_dq(xhci);
+        xhci_advance_event_ring(xhci, er);
+        xhci_update_event_dq(xhci, er);
         break;
     default:
         xhci_debug("Warning: Spurious host controller event: %d\n", cc);
-        xhci_advance_event_ring(xhci);
+        xhci_advance_event_ring(xhci, er);
         break;
     }
 }
@@ -177,41 +179,43 @@ xhci_handle_host_controller_event(xhci_t* const xhci) {
  *  must hold mutex when calling this
  */
 static void
-xhci_handle_event(xhci_t* const xhci) {
-    const trb_t* const ev = xhci->er.cur;
+xhci_handle_event(xhci_t* const xhci, event_ring_t* const er) {
+    const trb_t* const ev = er->cur;
 
     const int trb_type = TRB_GET(TT, ev);
     switch (trb_type) {
     /* Either pass along the event or advance event ring */
     case TRB_EV_TRANSFER:
-        xhci_handle_transfer_event(xhci);
+        xhci_handle_transfer_event(xhci, er);
         break;
     case TRB_EV_CMD_CMPL:
-        xhci_handle_command_completion_event(xhci);
+        xhci_handle_command_completion_event(xhci, er);
         break;
     case TRB_EV_PORTSC:
         xhci_debug("Port Status Change Event for %d: %d\n",
                    TRB_GET(PORT, ev), TRB_GET(CC, ev));
         /* We ignore the event as we look for the PORTSC
 		   registers instead, at a time when it suits _us_. */
-        xhci_advance_event_ring(xhci);
+        xhci_advance_event_ring(xhci, er);
         break;
     case TRB_EV_HOST:
-        xhci_handle_host_controller_event(xhci);
+        xhci_handle_host_controller_event(xhci, er);
         break;
     default:
         xhci_debug("Warning: Spurious event: %d, Completion Code: %d\n",
                    trb_type, TRB_GET(CC, ev));
-        xhci_advance_event_ring(xhci);
+        xhci_advance_event_ring(xhci, er);
         break;
     }
 }
 
 // must hold mutex when calling this
-void xhci_handle_events(xhci_t* const xhci) {
-    while (xhci_event_ready(&xhci->er))
-        xhci_handle_event(xhci);
-    xhci_update_event_dq(xhci);
+void xhci_handle_events(xhci_t* const xhci, event_ring_t* const er) {
+    /* drain everything the controller has posted, then acknowledge it all
+       with a single ERDP write */
+    while (xhci_event_ready(er))
+        xhci_handle_event(xhci, er);
+    xhci_update_event_dq(xhci, er);
 }
 
 static unsigned long
@@ -226,19 +230,22 @@ xhci_wait_for_event(const event_ring_t* const er,
 
 static unsigned long
 xhci_wait_for_event_type(xhci_t* const xhci,
+                         event_ring_t* const er,
                          uint32_t trb_type,
                          unsigned long* const timeout_ms) {
-    while (xhci_wait_for_event(&xhci->er, timeout_ms)) {
-        if (TRB_GET(TT, xhci->er.cur) == trb_type)
+    while (xhci_wait_for_event(er, timeout_ms)) {
+        if (TRB_GET(TT, er->cur) == trb_type)
             break;
 
-        xhci_handle_event(xhci);
+        xhci_handle_event(xhci, er);
     }
     return *timeout_ms;
 }
 
 /* returns cc of command in question (pointed to by `address`) */
 int xhci_wait_for_command_aborted(xhci_t* const xhci, const trb_t* const address) {
+    /* commands and control transfers complete on the primary interrupter */
+    event_ring_t* const er = &xhci->er[0];
     /*
 	 * Specification says that something might be seriously wrong, if
 	 * we don't get a response after 5s. Still, let the caller decide,
@@ -251,32 +258,32 @@ int xhci_wait_for_command_aborted(xhci_t* const xhci, const trb_t* const address
 	 * The first with CC == COMMAND_ABORTED should point to address,
 	 * the second with CC == COMMAND_RING_STOPPED should point to new dq.
 	 */
-    while (xhci_wait_for_event_type(xhci, TRB_EV_CMD_CMPL, &timeout_ms)) {
-        if ((xhci->er.cur->ptr_low == (uint32_t)xhci_virt_to_phys(xhci, (mx_vaddr_t)address)) &&
-            (xhci->er.cur->ptr_high == 0)) {
-            cc = (int)TRB_GET(CC, xhci->er.cur);
-            xhci_advance_event_ring(xhci);
+    while (xhci_wait_for_event_type(xhci, er, TRB_EV_CMD_CMPL, &timeout_ms)) {
+        if ((er->cur->ptr_low == (uint32_t)xhci_virt_to_phys(xhci, (mx_vaddr_t)address)) &&
+            (er->cur->ptr_high == 0)) {
+            cc = (int)TRB_GET(CC, er->cur);
+            xhci_advance_event_ring(xhci, er);
             break;
         }
 
-        xhci_handle_command_completion_event(xhci);
+        xhci_handle_command_completion_event(xhci, er);
     }
     if (!timeout_ms)
         xhci_debug("Warning: Timed out waiting for COMMAND_ABORTED.\n");
-    while (xhci_wait_for_event_type(xhci, TRB_EV_CMD_CMPL, &timeout_ms)) {
-        if (TRB_GET(CC, xhci->er.cur) == CC_COMMAND_RING_STOPPED) {
-            xhci->cr.cur = (trb_t*)xhci_phys_to_virt(xhci, xhci->er.cur->ptr_low);
-            xhci_advance_event_ring(xhci);
+    while (xhci_wait_for_event_type(xhci, er, TRB_EV_CMD_CMPL, &timeout_ms)) {
+        if (TRB_GET(CC, er->cur) == CC_COMMAND_RING_STOPPED) {
+            xhci->cr.cur = (trb_t*)xhci_phys_to_virt(xhci, er->cur->ptr_low);
+            xhci_advance_event_ring(xhci, er);
             break;
         }
 
-        xhci_handle_command_completion_event(xhci);
+        xhci_handle_command_completion_event(xhci, er);
     }
     if (!timeout_ms)
         xhci_debug(
             "Warning: Timed out "
             "waiting for COMMAND_RING_STOPPED.\n");
-    xhci_update_event_dq(xhci);
+    xhci_update_event_dq(xhci, er);
     return cc;
 }
 
@@ -287,6 +294,7 @@ int xhci_wait_for_command_aborted(xhci_t* const xhci, const trb_t* const address
 int xhci_wait_for_command_done(xhci_t* const xhci,
                                const trb_t* const address,
                                const int clear_event) {
+    event_ring_t* const er = &xhci->er[0];
     /*
 	 * The Address Device Command should take most time, as it has to
 	 * communicate with the USB device. Set address processing shouldn't
@@ -295,44 +303,45 @@ int xhci_wait_for_command_done(xhci_t* const xhci,
 	 */
     unsigned long timeout_ms = 100; /* 100ms */
     int cc = TIMEOUT;
-    while (xhci_wait_for_event_type(xhci, TRB_EV_CMD_CMPL, &timeout_ms)) {
-        if ((xhci->er.cur->ptr_low == xhci_virt_to_phys(xhci, (mx_vaddr_t)address)) &&
-            (xhci->er.cur->ptr_high == 0)) {
-            cc = TRB_GET(CC, xhci->er.cur);
+    while (xhci_wait_for_event_type(xhci, er, TRB_EV_CMD_CMPL, &timeout_ms)) {
+        if ((er->cur->ptr_low == xhci_virt_to_phys(xhci, (mx_vaddr_t)address)) &&
+            (er->cur->ptr_high == 0)) {
+            cc = TRB_GET(CC, er->cur);
             break;
         }
 
-        xhci_handle_command_completion_event(xhci);
+        xhci_handle_command_completion_event(xhci, er);
     }
     if (!timeout_ms) {
         xhci_debug("Warning: Timed out waiting for TRB_EV_CMD_CMPL.\n");
     } else if (clear_event) {
-        xhci_advance_event_ring(xhci);
+        xhci_advance_event_ring(xhci, er);
     }
-    xhci_update_event_dq(xhci);
+    xhci_update_event_dq(xhci, er);
     return cc;
 }
 
 /* returns amount of bytes transferred on success, negative CC on error */
 int xhci_wait_for_transfer(xhci_t* const xhci, uint32_t slot_id, uint32_t ep_id) {
+    event_ring_t* const er = &xhci->er[0];
     xhci_spew("Waiting for transfer on ID %d EP %d\n", slot_id, ep_id);
     /* 3s for all types of transfers */ /* TODO: test, wait longer? */
     unsigned long timeout_ms = 3 * 1000;
     int ret = TIMEOUT;
-    while (xhci_wait_for_event_type(xhci, TRB_EV_TRANSFER, &timeout_ms)) {
-        if (TRB_GET(ID, xhci->er.cur) == slot_id &&
-            TRB_GET(EP, xhci->er.cur) == ep_id) {
-            ret = -TRB_GET(CC, xhci->er.cur);
+    while (xhci_wait_for_event_type(xhci, er, TRB_EV_TRANSFER, &timeout_ms)) {
+        if (TRB_GET(ID, er->cur) == slot_id &&
+            TRB_GET(EP, er->cur) == ep_id) {
+            ret = -TRB_GET(CC, er->cur);
             if (ret == -CC_SUCCESS || ret == -CC_SHORT_PACKET)
-                ret = TRB_GET(EVTL, xhci->er.cur);
-            xhci_advance_event_ring(xhci);
+                ret = TRB_GET(EVTL, er->cur);
+            xhci_advance_event_ring(xhci, er);
             break;
         }
 
-        xhci_handle_transfer_event(xhci);
+        xhci_handle_transfer_event(xhci, er);
     }
     if (!timeout_ms)
         xhci_debug("Warning: Timed out waiting for TRB_EV_TRANSFER.\n");
-    xhci_update_event_dq(xhci);
+    xhci_update_event_dq(xhci, er);
     return ret;
 }
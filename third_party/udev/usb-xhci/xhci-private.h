@@ -118,6 +118,9 @@ enum { TRB_DIR_OUT = 0,
 #define TRB_TDS_FIELD status /* TDS - TD Size */
 #define TRB_TDS_START 17
 #define TRB_TDS_LEN 5
+#define TRB_INTR_FIELD status /* Interrupter Target */
+#define TRB_INTR_START 22
+#define TRB_INTR_LEN 10
 #define TRB_CC_FIELD status /* CC - Completion Code */
 #define TRB_CC_START 24
 #define TRB_CC_LEN 8
@@ -183,9 +186,18 @@ typedef struct {
     trb_t* cur;
     trb_t* last;
     uint8_t ccs;
-    uint8_t adv;
+    uint8_t adv;   /* events consumed since the last ERDP update */
+    uint8_t intr;  /* interrupter the ring belongs to */
+    list_node_t completed_reqs;
 } event_ring_t;
 
+/*
+ * Interrupter 0 takes command completion and port status events and
+ * control transfers. Bulk and interrupt transfers go to the others
+ * when the controller and PCI bus give us more than one vector.
+ */
+#define XHCI_MAX_INTERRUPTERS 4
+
 /* Never raise this above 256 to prevent transfer event length overflow! */
 #define TRANSFER_RING_SIZE 32
 typedef struct {
@@ -515,8 +527,9 @@ typedef struct xhci {
     uint64_t* sp_ptrs; /* pointers to scratchpad buffers */
 
     command_ring_t cr;
-    event_ring_t er;
-    volatile erst_entry_t* ev_ring_table;
+    event_ring_t er[XHCI_MAX_INTERRUPTERS];
+    volatile erst_entry_t* ev_ring_table[XHCI_MAX_INTERRUPTERS];
+    uint32_t num_interrupters;
 
     usbdev_t* roothub;
 
@@ -528,7 +541,15 @@ typedef struct xhci {
 
     usbdev_t* devices[128]; // dev 0 is root hub, 127 is last addressable
 
-    list_node_t completed_reqs;
+    /*
+     * While an interrupter thread runs completion callbacks, the
+     * doorbells for the transfers they queue are collected here
+     * (a bitmask of endpoint ids per slot) and rung once afterwards.
+     */
+    bool completing[XHCI_MAX_INTERRUPTERS];
+    pthread_t completing_thread[XHCI_MAX_INTERRUPTERS];
+    uint32_t* pending_doorbells;
+    bool doorbells_pending;
 
     mx_device_t* bus_device;
     usb_bus_protocol_t* bus_protocol;
@@ -547,10 +568,17 @@ typedef struct usb_xhci {
     bool legacy_irq_mode;
 
     pci_protocol_t* pci;
-    mx_handle_t irq_handle;
     mx_handle_t mmio_handle;
     mx_handle_t cfg_handle;
-    pthread_t irq_thread;
+
+    /* one interrupt, and thread, per interrupter */
+    struct xhci_irq {
+        struct usb_xhci* uxhci;
+        uint32_t intr;
+        mx_handle_t handle;
+        pthread_t thread;
+    } irqs[XHCI_MAX_INTERRUPTERS];
+    uint32_t num_irqs;
 } usb_xhci_t;
 
 mx_status_t xhci_startup(usb_xhci_t* uxhci);
@@ -568,11 +596,11 @@ int xhci_finish_device_config(mx_device_t* hcidev, int devaddr, usb_device_confi
 void xhci_destroy_dev(mx_device_t* hcidev, int slot_id);
 
 void xhci_reset_event_ring(event_ring_t*);
-void xhci_advance_event_ring(xhci_t*);
-void xhci_update_event_dq(xhci_t*);
+void xhci_advance_event_ring(xhci_t*, event_ring_t*);
+void xhci_update_event_dq(xhci_t*, event_ring_t*);
 
 // must hold mutex when calling this
-void xhci_handle_events(xhci_t* xhci);
+void xhci_handle_events(xhci_t* xhci, event_ring_t* er);
 
 int xhci_wait_for_command_aborted(xhci_t*, const trb_t*);
 int xhci_wait_for_command_done(xhci_t*, const trb_t*, int clear_event);
@@ -610,7 +638,7 @@ int xhci_get_descriptor(usbdev_t* dev, int rtype, int desc_type, int desc_idx,
 usb_hci_protocol_t _xhci_protocol;
 usb_hub_protocol_t xhci_rh_hub_protocol;
 
-void xhci_poll(xhci_t* xhci);
+void xhci_poll(xhci_t* xhci, uint32_t intr);
 
 #if ARCH_X86_32 || ARCH_X86_64
 #define wmb() __asm__ volatile("sfence")
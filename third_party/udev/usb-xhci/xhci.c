@@ -49,6 +49,7 @@ static void xhci_reinit(xhci_t* xhci);
 static int xhci_queue_request(mx_device_t* hcidev, int devaddr, usb_request_t* request);
 static int xhci_control(mx_device_t* hcidev, int devaddr, usb_setup_t* devreq,
                         int dalen, uint8_t* data);
+static int xhci_reset_ep(mx_device_t* hcidev, int devaddr, usb_endpoint_t* ep);
 
 /*
  * Some structures must not cross page boundaries. To get this,
@@ -161,30 +162,65 @@ usb_hci_protocol_t _xhci_protocol = {
     .free_request = xhci_free_request,
     .queue_request = xhci_queue_request,
     .control = xhci_control,
+    .reset_endpoint = xhci_reset_ep,
     .set_address = xhci_set_address,
     .finish_device_config = xhci_finish_device_config,
     .destroy_device = xhci_destroy_dev,
     .set_bus_device = xhci_set_bus_device,
 };
 
-void xhci_poll(xhci_t* xhci) {
+// must hold mutex when calling this
+static void xhci_ring_pending_doorbells(xhci_t* xhci) {
+    if (!xhci->doorbells_pending)
+        return;
+    for (int slot_id = 1; slot_id <= xhci->max_slots_en; slot_id++) {
+        uint32_t ep_ids = xhci->pending_doorbells[slot_id];
+        xhci->pending_doorbells[slot_id] = 0;
+        while (ep_ids) {
+            xhci->dbreg[slot_id] = __builtin_ctz(ep_ids);
+            ep_ids &= ep_ids - 1;
+        }
+    }
+    xhci->doorbells_pending = false;
+}
+
+// must hold mutex when calling this
+static void xhci_ring_doorbell(xhci_t* xhci, int slot_id, int ep_id) {
+    pthread_t self = pthread_self();
+    for (uint32_t i = 0; i < xhci->num_interrupters; i++) {
+        if (xhci->completing[i] && pthread_equal(xhci->completing_thread[i], self)) {
+            xhci->pending_doorbells[slot_id] |= 1u << ep_id;
+            xhci->doorbells_pending = true;
+            return;
+        }
+    }
+    xhci->dbreg[slot_id] = ep_id;
+}
+
+void xhci_poll(xhci_t* xhci, uint32_t intr) {
+    event_ring_t* er = &xhci->er[intr];
     list_node_t completed_reqs;
 
-    xhci_rh_check_status_changed(xhci);
+    if (intr == 0)
+        xhci_rh_check_status_changed(xhci);
 
     mxr_mutex_lock(&xhci->mutex);
-    xhci_handle_events(xhci);
-    // move contents of xhci->completed_reqs to a local list within the mutex
-    if (list_is_empty(&xhci->completed_reqs)) {
-        list_initialize(&completed_reqs);
-    } else {
-        xhci->completed_reqs.next->prev = &completed_reqs;
-        xhci->completed_reqs.prev->next = &completed_reqs;
-        completed_reqs.prev = xhci->completed_reqs.prev;
-        completed_reqs.next = xhci->completed_reqs.next;
-
-        list_initialize(&xhci->completed_reqs);
+    xhci_handle_events(xhci, er);
+    // move contents of er->completed_reqs to a local list within the mutex
+    if (list_is_empty(&er->completed_reqs)) {
+        mxr_mutex_unlock(&xhci->mutex);
+        return;
     }
+    er->completed_reqs.next->prev = &completed_reqs;
+    er->completed_reqs.prev->next = &completed_reqs;
+    completed_reqs.prev = er->completed_reqs.prev;
+    completed_reqs.next = er->completed_reqs.next;
+    list_initialize(&er->completed_reqs);
+
+    // Requests queued again from the callbacks below only get their
+    // doorbells rung once all of them have run.
+    xhci->completing_thread[intr] = pthread_self();
+    xhci->completing[intr] = true;
     mxr_mutex_unlock(&xhci->mutex);
 
     usb_request_t* request;
@@ -193,6 +229,11 @@ void xhci_poll(xhci_t* xhci) {
         list_delete(&request->node);
         request->complete_cb(request);
     }
+
+    mxr_mutex_lock(&xhci->mutex);
+    xhci->completing[intr] = false;
+    xhci_ring_pending_doorbells(xhci);
+    mxr_mutex_unlock(&xhci->mutex);
 }
 
 mx_status_t xhci_startup(usb_xhci_t* uxhci) {
@@ -210,15 +251,31 @@ mx_status_t xhci_startup(usb_xhci_t* uxhci) {
     usbdev_t* rhdev = init_device_entry(uxhci, 0);
     xhci->roothub = rhdev;
     xhci->cr.ring = xhci_align(xhci, 64, COMMAND_RING_SIZE * sizeof(trb_t));
-    xhci->er.ring = xhci_align(xhci, 64, EVENT_RING_SIZE * sizeof(trb_t));
-    xhci->ev_ring_table = xhci_align(xhci, 64, sizeof(erst_entry_t));
-    if (!xhci->roothub || !xhci->cr.ring ||
-        !xhci->er.ring || !xhci->ev_ring_table) {
+    if (!xhci->roothub || !xhci->cr.ring) {
         xhci_debug("Out of memory\n");
         goto _free_xhci;
     }
 
     xhci->capreg = uxhci->mmio;
+
+    /* an event ring for each interrupt we got */
+    xhci->num_interrupters = uxhci->num_irqs;
+    if (xhci->num_interrupters > xhci->capreg->MaxIntrs)
+        xhci->num_interrupters = xhci->capreg->MaxIntrs;
+    if (xhci->num_interrupters < 1)
+        xhci->num_interrupters = 1;
+    for (uint32_t i = 0; i < xhci->num_interrupters; i++) {
+        event_ring_t* er = &xhci->er[i];
+        er->ring = xhci_align(xhci, 64, EVENT_RING_SIZE * sizeof(trb_t));
+        xhci->ev_ring_table[i] = xhci_align(xhci, 64, sizeof(erst_entry_t));
+        if (!er->ring || !xhci->ev_ring_table[i]) {
+            xhci_debug("Out of memory\n");
+            goto _free_xhci;
+        }
+        er->intr = i;
+        list_initialize(&er->completed_reqs);
+    }
+
     xhci->opreg = ((void*)xhci->capreg) + xhci->capreg->caplength;
     xhci->hcrreg = ((void*)xhci->capreg) + xhci->capreg->rtsoff;
     xhci->dbreg = ((void*)xhci->capreg) + xhci->capreg->dboff;
@@ -248,7 +305,8 @@ mx_status_t xhci_startup(usb_xhci_t* uxhci) {
     xhci->max_slots_en = xhci->capreg->MaxSlots & CONFIG_LP_MASK_MaxSlotsEn;
     xhci->dcbaa = xhci_align(xhci, 64, (xhci->max_slots_en + 1) * sizeof(uint64_t));
     xhci->dev = malloc((xhci->max_slots_en + 1) * sizeof(*xhci->dev));
-    if (!xhci->dcbaa || !xhci->dev) {
+    xhci->pending_doorbells = calloc(xhci->max_slots_en + 1, sizeof(uint32_t));
+    if (!xhci->dcbaa || !xhci->dev || !xhci->pending_doorbells) {
         xhci_debug("Out of memory\n");
         goto _free_xhci;
     }
@@ -294,7 +352,6 @@ mx_status_t xhci_startup(usb_xhci_t* uxhci) {
     xhci_reinit(xhci);
 
     xhci_rh_init(uxhci);
-    list_initialize(&xhci->completed_reqs);
 
     return NO_ERROR;
 
@@ -308,11 +365,14 @@ _free_xhci_structs:
     free(xhci->sp_ptrs);
     free(xhci->dcbaa);
 _free_xhci:
-    xhci_free(xhci, (void*)xhci->ev_ring_table);
-    xhci_free(xhci, (void*)xhci->er.ring);
+    for (uint32_t i = 0; i < XHCI_MAX_INTERRUPTERS; i++) {
+        xhci_free(xhci, (void*)xhci->ev_ring_table[i]);
+        xhci_free(xhci, (void*)xhci->er[i].ring);
+    }
     xhci_free(xhci, (void*)xhci->cr.ring);
     free(xhci->roothub);
     free(xhci->dev);
+    free(xhci->pending_doorbells);
     /* _free_controller: */
     xhci_destroy_dev(&uxhci->hcidev, 0);
 
@@ -365,28 +425,33 @@ xhci_reinit(xhci_t* xhci) {
     /* Make sure interrupts are enabled */
     xhci->opreg->usbcmd |= USBCMD_INTE;
 
-    /* Initialize event ring */
-    xhci_reset_event_ring(&xhci->er);
-    xhci_debug("event ring @%p (%p)\n",
-               xhci->er.ring, (void*)xhci_virt_to_phys(xhci, (mx_vaddr_t)xhci->er.ring));
     xhci_debug("ERST Max: 0x%x ->  0x%x entries\n",
                xhci->capreg->ERST_Max, 1 << xhci->capreg->ERST_Max);
-    memset((void*)xhci->ev_ring_table, 0x00, sizeof(erst_entry_t));
-    xhci->ev_ring_table[0].seg_base_lo = xhci_virt_to_phys(xhci, (mx_vaddr_t)xhci->er.ring);
-    xhci->ev_ring_table[0].seg_base_hi = 0;
-    xhci->ev_ring_table[0].seg_size = EVENT_RING_SIZE;
-
-    /* pass event ring table to hardware */
-    wmb();
-    /* Initialize primary interrupter */
-    xhci->hcrreg->intrrs[0].erstsz = 1;
-    xhci_update_event_dq(xhci);
-    /* erstba has to be written at last */
-    xhci->hcrreg->intrrs[0].erstba_lo = xhci_virt_to_phys(xhci, (mx_vaddr_t)xhci->ev_ring_table);
-    xhci->hcrreg->intrrs[0].erstba_hi = 0;
-
-    /* enable interrupts */
-    xhci->hcrreg->intrrs[0].iman |= IMAN_IE;
+    for (uint32_t i = 0; i < xhci->num_interrupters; i++) {
+        event_ring_t* const er = &xhci->er[i];
+        volatile erst_entry_t* const erst = xhci->ev_ring_table[i];
+
+        /* Initialize event ring */
+        xhci_reset_event_ring(er);
+        xhci_debug("event ring %u @%p (%p)\n",
+                   i, er->ring, (void*)xhci_virt_to_phys(xhci, (mx_vaddr_t)er->ring));
+        memset((void*)erst, 0x00, sizeof(erst_entry_t));
+        erst->seg_base_lo = xhci_virt_to_phys(xhci, (mx_vaddr_t)er->ring);
+        erst->seg_base_hi = 0;
+        erst->seg_size = EVENT_RING_SIZE;
+
+        /* pass event ring table to hardware */
+        wmb();
+        /* Initialize interrupter */
+        xhci->hcrreg->intrrs[i].erstsz = 1;
+        xhci_update_event_dq(xhci, er);
+        /* erstba has to be written at last */
+        xhci->hcrreg->intrrs[i].erstba_lo = xhci_virt_to_phys(xhci, (mx_vaddr_t)erst);
+        xhci->hcrreg->intrrs[i].erstba_hi = 0;
+
+        /* enable interrupts */
+        xhci->hcrreg->intrrs[i].iman |= IMAN_IE;
+    }
 
     xhci_start(xhci);
 
@@ -457,8 +522,15 @@ xhci_stop(xhci_t* xhci) {
         xhci_debug("Controller didn't halt within 1s\n");
 }
 
+/*
+ * Resets a halted or stopped endpoint and moves its transfer ring back to
+ * the start. Requests still queued on it can't complete once their TDs are
+ * dropped from the ring, so they are moved to cancelled with status
+ * ERR_CANCELLED, for the caller to complete once the mutex is dropped.
+ */
 static int
-xhci_reset_endpoint(xhci_t* xhci, int slot_id, usb_endpoint_t* const ep) {
+xhci_reset_endpoint(xhci_t* xhci, int slot_id, usb_endpoint_t* const ep,
+                    list_node_t* const cancelled) {
     const int ep_id = ep ? xhci_ep_id(ep) : 1;
     epctx_t* const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
 
@@ -494,6 +566,17 @@ xhci_reset_endpoint(xhci_t* xhci, int slot_id, usb_endpoint_t* const ep) {
             return 1;
         }
         xhci_init_cycle_ring(xhci, tr, TRANSFER_RING_SIZE);
+
+        usb_request_t* request;
+        usb_request_t* temp;
+        list_for_every_entry_safe (&xhci->devices[slot_id]->req_queue, request, temp, usb_request_t, node) {
+            if (request->endpoint == ep) {
+                request->status = ERR_CANCELLED;
+                request->transfer_length = 0;
+                list_delete(&request->node);
+                list_add_tail(cancelled, &request->node);
+            }
+        }
     }
 
     xhci_debug("Finished resetting ID %d EP %d (ep state: %d)\n",
@@ -520,20 +603,36 @@ xhci_enqueue_trb(xhci_t* const xhci, transfer_ring_t* const tr) {
     }
 }
 
+/* Number of TRBs needed for the first length bytes of sg, none of which
+ * may cross a 64k boundary */
+static size_t
+xhci_td_trbs(const iotxn_sg_t* sg, const uint32_t sg_count, size_t length) {
+    size_t trbs = 0;
+    for (uint32_t i = 0; i < sg_count && length; ++i) {
+        const size_t piece = MIN(sg[i].length, length);
+        trbs += ((sg[i].paddr & 0xffff) + piece + 0xffff) >> 16;
+        length -= piece;
+    }
+    return trbs;
+}
+
 static trb_t*
 xhci_enqueue_td(xhci_t* const xhci, transfer_ring_t* const tr, const int ep, const size_t mps,
-                const int dalen, void* const data, const int dir) {
+                const int dalen, const iotxn_sg_t* const sg, const uint32_t sg_count, const int dir,
+                const uint32_t intr) {
     trb_t* trb = NULL;                         /* cur TRB */
-    uint8_t* cur_start = data;                 /* cur data pointer */
+    uint32_t piece = 0;                        /* cur physical piece */
+    mx_paddr_t cur_start = sg[0].paddr;        /* cur data address */
+    size_t piece_left = sg[0].length;          /* bytes left in cur piece */
     size_t length = dalen;                     /* remaining bytes */
     size_t packets = (length + mps - 1) / mps; /* remaining packets */
     size_t residue = 0;                        /* residue from last TRB */
     size_t trb_count = 0;                      /* TRBs added so far */
 
     while (length || !trb_count /* enqueue at least one */) {
-        const size_t cur_end = ((size_t)cur_start + 0x10000) & ~0xffff;
-        size_t cur_length = cur_end - (size_t)cur_start;
-        if (length < cur_length) {
+        const mx_paddr_t cur_end = (cur_start + 0x10000) & ~0xffff;
+        size_t cur_length = MIN(cur_end - cur_start, piece_left);
+        if (length <= cur_length) {
             cur_length = length;
             packets = 0;
             length = 0;
@@ -545,9 +644,11 @@ xhci_enqueue_td(xhci_t* const xhci, transfer_ring_t* const tr, const int ep, con
 
         trb = tr->cur;
         xhci_clear_trb(trb, tr->pcs);
-        trb->ptr_low = (uint32_t)xhci_virt_to_phys(xhci, (mx_vaddr_t)cur_start);
+        trb->ptr_low = (uint32_t)cur_start;
+        trb->ptr_high = (uint32_t)(cur_start >> 32);
         TRB_SET(TL, trb, cur_length);
         TRB_SET(TDS, trb, MIN(TRB_MAX_TD_SIZE, packets));
+        TRB_SET(INTR, trb, intr);
         TRB_SET(CH, trb, 1);
 
         if (length && 0 /* IS_ENABLED(CONFIG_LP_USB_XHCI_MTK_QUIRK) */) {
@@ -581,6 +682,11 @@ xhci_enqueue_td(xhci_t* const xhci, transfer_ring_t* const tr, const int ep, con
         xhci_enqueue_trb(xhci, tr);
 
         cur_start += cur_length;
+        piece_left -= cur_length;
+        if (!piece_left && ++piece < sg_count) {
+            cur_start = sg[piece].paddr;
+            piece_left = sg[piece].length;
+        }
         ++trb_count;
     }
 
@@ -588,6 +694,7 @@ xhci_enqueue_td(xhci_t* const xhci, transfer_ring_t* const tr, const int ep, con
     xhci_clear_trb(trb, tr->pcs);
     trb->ptr_low = (uint32_t)xhci_virt_to_phys(xhci, (mx_vaddr_t)trb); /* for easier debugging only */
     TRB_SET(TT, trb, TRB_EVENT_DATA);
+    TRB_SET(INTR, trb, intr);
     TRB_SET(IOC, trb, 1);
 
     xhci_enqueue_trb(xhci, tr);
@@ -627,7 +734,8 @@ xhci_control(mx_device_t* hcidev, int devaddr, usb_setup_t* const devreq,
     /* Reset endpoint if it's not running */
     const unsigned ep_state = EC_GET(STATE, epctx);
     if (ep_state > 1) {
-        if (xhci_reset_endpoint(xhci, devaddr, NULL)) {
+        list_node_t none = LIST_INITIAL_VALUE(none);
+        if (xhci_reset_endpoint(xhci, devaddr, NULL, &none)) {
             mxr_mutex_unlock(&xhci->mutex);
             return -1;
         }
@@ -651,7 +759,8 @@ xhci_control(mx_device_t* hcidev, int devaddr, usb_setup_t* const devreq,
     if (dalen) {
         const unsigned mps = EC_GET(MPS, epctx);
         const unsigned dt_dir = out ? TRB_DIR_OUT : TRB_DIR_IN;
-        xhci_enqueue_td(xhci, tr, 1, mps, dalen, data, dt_dir);
+        const iotxn_sg_t sg = { xhci_virt_to_phys(xhci, (mx_vaddr_t)data), dalen };
+        xhci_enqueue_td(xhci, tr, 1, mps, dalen, &sg, 1, dt_dir, 0);
     }
 
     /* Fill status TRB */
@@ -712,6 +821,21 @@ int xhci_get_descriptor(usbdev_t* dev, int rtype, int desc_type, int desc_idx,
     return xhci_control(&dev->hci->hcidev, dev->address, &dr, len, data);
 }
 
+/*
+ * Interrupt endpoints (HID devices, hubs) share an interrupter so their small
+ * completions don't wait behind bulk ones, and bulk endpoints are spread over
+ * the rest by slot. Everything shares interrupter 0 if that's all there is.
+ */
+static uint32_t
+xhci_ep_interrupter(xhci_t* const xhci, const int slot_id, const usb_endpoint_t* const ep) {
+    const uint32_t n = xhci->num_interrupters;
+    if (n <= 2)
+        return n - 1;
+    if (ep->type == USB_ENDPOINT_INTERRUPT)
+        return 1;
+    return 2 + slot_id % (n - 2);
+}
+
 static int
 xhci_queue_request(mx_device_t* hcidev, int slot_id, usb_request_t* request) {
     if (request->endpoint->type != USB_ENDPOINT_BULK && request->endpoint->type != USB_ENDPOINT_INTERRUPT) {
@@ -719,7 +843,6 @@ xhci_queue_request(mx_device_t* hcidev, int slot_id, usb_request_t* request) {
     }
 
     xhci_t* xhci = get_xhci(hcidev);
-    uint8_t* data = request->buffer;
     size_t size = request->transfer_length;
     usb_endpoint_t* ep = request->endpoint;
 
@@ -727,18 +850,33 @@ xhci_queue_request(mx_device_t* hcidev, int slot_id, usb_request_t* request) {
     epctx_t* const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
     transfer_ring_t* const tr = xhci->dev[slot_id].transfer_rings[ep_id];
 
-    const size_t off = (size_t)data & 0xffff;
-    if ((off + request->transfer_length) > ((TRANSFER_RING_SIZE - 2) << 16)) {
+    /* TRBs point straight at the request's physical pieces */
+    iotxn_sg_t buffer_sg = { xhci_virt_to_phys(xhci, (mx_vaddr_t)request->buffer), request->buffer_length };
+    const iotxn_sg_t* sg = &buffer_sg;
+    uint32_t sg_count = 1;
+    if (request->sg) {
+        sg = request->sg;
+        sg_count = request->sg_count;
+        size_t sg_length = 0;
+        for (uint32_t i = 0; i < sg_count; i++)
+            sg_length += sg[i].length;
+        if (!sg_count || sg_length < size)
+            return ERR_INVALID_ARGS;
+    }
+
+    if (xhci_td_trbs(sg, sg_count, size) > TRANSFER_RING_SIZE - 2) {
         xhci_debug("Unsupported transfer size\n");
         return ERR_TOO_BIG;
     }
 
     mxr_mutex_lock(&xhci->mutex);
 
-    /* Reset endpoint if it's not running */
+    /* Reset endpoint if it's not running. Anything it cancels completes
+       from the poll of the transfer queued below. */
+    const uint32_t intr = xhci_ep_interrupter(xhci, slot_id, ep);
     const unsigned ep_state = EC_GET(STATE, epctx);
     if (ep_state > 1) {
-        if (xhci_reset_endpoint(xhci, slot_id, ep)) {
+        if (xhci_reset_endpoint(xhci, slot_id, ep, &xhci->er[intr].completed_reqs)) {
             mxr_mutex_unlock(&xhci->mutex);
             return ERR_BAD_STATE;
         }
@@ -747,8 +885,8 @@ xhci_queue_request(mx_device_t* hcidev, int slot_id, usb_request_t* request) {
     /* Enqueue transfer and ring doorbell */
     const unsigned mps = EC_GET(MPS, epctx);
     const unsigned dir = (ep->direction == USB_ENDPOINT_OUT) ? TRB_DIR_OUT : TRB_DIR_IN;
-    request->driver_data = (void*)xhci_enqueue_td(xhci, tr, ep_id, mps, size, data, dir);
-    xhci->dbreg[slot_id] = ep_id;
+    request->driver_data = (void*)xhci_enqueue_td(xhci, tr, ep_id, mps, size, sg, sg_count, dir, intr);
+    xhci_ring_doorbell(xhci, slot_id, ep_id);
 
     list_add_tail(&xhci->devices[slot_id]->req_queue, &request->node);
 
@@ -756,6 +894,44 @@ xhci_queue_request(mx_device_t* hcidev, int slot_id, usb_request_t* request) {
     return NO_ERROR;
 }
 
+/*
+ * Stops a bulk or interrupt endpoint if it's running, resets it and
+ * completes the requests that were queued on it with ERR_CANCELLED. This
+ * only resets the host's side, clearing a stall on the device is up to
+ * the caller.
+ */
+static int
+xhci_reset_ep(mx_device_t* hcidev, int slot_id, usb_endpoint_t* ep) {
+    xhci_t* const xhci = get_xhci(hcidev);
+    if (slot_id <= 0 || slot_id > xhci->max_slots_en || !xhci->devices[slot_id])
+        return ERR_INVALID_ARGS;
+    if (ep->type != USB_ENDPOINT_BULK && ep->type != USB_ENDPOINT_INTERRUPT)
+        return ERR_NOT_SUPPORTED;
+
+    const int ep_id = xhci_ep_id(ep);
+    epctx_t* const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
+    list_node_t cancelled = LIST_INITIAL_VALUE(cancelled);
+    int ret = NO_ERROR;
+
+    mxr_mutex_lock(&xhci->mutex);
+    /* The transfer ring can only be moved while the endpoint is stopped */
+    if (EC_GET(STATE, epctx) == 1) {
+        const int cc = xhci_cmd_stop_endpoint(xhci, slot_id, ep_id);
+        if (cc != CC_SUCCESS) {
+            xhci_debug("Stop Endpoint Command failed: %d\n", cc);
+            ret = ERR_BAD_STATE;
+        }
+    }
+    if (ret == NO_ERROR && xhci_reset_endpoint(xhci, slot_id, ep, &cancelled))
+        ret = ERR_BAD_STATE;
+    mxr_mutex_unlock(&xhci->mutex);
+
+    usb_request_t* request;
+    while ((request = list_remove_head_type(&cancelled, usb_request_t, node)) != NULL)
+        request->complete_cb(request);
+    return ret;
+}
+
 static trb_t*
 xhci_next_trb(xhci_t* const xhci, trb_t* cur, int* const pcs) {
     ++cur;
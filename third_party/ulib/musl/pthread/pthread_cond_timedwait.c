@@ -50,10 +50,11 @@ static inline void unlock(volatile int* l) {
         __wake(l, 1);
 }
 
-static inline void unlock_requeue(volatile int* l, volatile int* r) {
+/* Mutexes are waited on with mx_futex_lock_pi, so the next waiter
+ * cannot be requeued onto the mutex futex; wake it to relock instead. */
+static inline void unlock_wake(volatile int* l) {
     a_store(l, 0);
-    mx_futex_requeue((void*)l, /* wake count */ 0, /* l futex value */ 0, (void*)r,
-                     /* requeue count */ 1);
+    __wake(l, 1);
 }
 
 enum {
@@ -142,15 +143,9 @@ relock:
     if (oldstate == WAITING)
         goto done;
 
-    if (!node.next)
-        a_inc(&m->_m_waiters);
-
-    /* Unlock the barrier that's holding back the next waiter, and
-     * either wake it or requeue it to the mutex. */
+    /* Unlock the barrier that's holding back the next waiter. */
     if (node.prev)
-        unlock_requeue(&node.prev->barrier, &m->_m_lock);
-    else
-        a_dec(&m->_m_waiters);
+        unlock_wake(&node.prev->barrier);
 
     /* Since a signal was consumed, cancellation is not permitted. */
     if (e == ECANCELED)
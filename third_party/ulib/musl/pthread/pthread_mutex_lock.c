@@ -3,7 +3,7 @@
 int __pthread_mutex_timedlock(pthread_mutex_t* restrict, const struct timespec* restrict);
 
 int __pthread_mutex_lock(pthread_mutex_t* m) {
-    if ((m->_m_type & 15) == PTHREAD_MUTEX_NORMAL && !a_cas(&m->_m_lock, 0, EBUSY))
+    if ((m->_m_type & 15) == PTHREAD_MUTEX_NORMAL && !a_cas(&m->_m_lock, 0, __thread_get_tid()))
         return 0;
 
     return __pthread_mutex_timedlock(m, 0);
@@ -1,7 +1,38 @@
 #include "pthread_impl.h"
 
+// The kernel has just handed us the mutex, with MX_FUTEX_PI_OWNER_DIED
+// set if the previous owner exited while holding it.
+static int handoff(pthread_mutex_t* m) {
+    int r = m->_m_lock;
+    if (r & MX_FUTEX_PI_OWNER_DIED) {
+        a_and(&m->_m_lock, ~MX_FUTEX_PI_OWNER_DIED);
+        m->_m_count = 0;
+        if (m->_m_type & 4) {
+            m->_m_type |= 8;
+            return EOWNERDEAD;
+        }
+        return 0;
+    }
+    // Released without pthread_mutex_consistent after EOWNERDEAD, while
+    // we were waiting for it.
+    if ((m->_m_type & 12) == 12) {
+        pthread_mutex_unlock(m);
+        return ENOTRECOVERABLE;
+    }
+    return 0;
+}
+
+// Relocking a normal mutex deadlocks rather than failing.
+static int deadlock(const struct timespec* restrict at) {
+    int dummy = 0;
+    while (__timedwait(&dummy, 0, CLOCK_REALTIME, at) != ETIMEDOUT)
+        ;
+    return ETIMEDOUT;
+}
+
 int __pthread_mutex_timedlock(pthread_mutex_t* restrict m, const struct timespec* restrict at) {
-    if ((m->_m_type & 15) == PTHREAD_MUTEX_NORMAL && !a_cas(&m->_m_lock, 0, EBUSY))
+    int tid = __thread_get_tid();
+    if ((m->_m_type & 15) == PTHREAD_MUTEX_NORMAL && !a_cas(&m->_m_lock, 0, tid))
         return 0;
 
     int r, t;
@@ -15,18 +46,25 @@ int __pthread_mutex_timedlock(pthread_mutex_t* restrict m, const struct timespec
         a_spin();
 
     while ((r = pthread_mutex_trylock(m)) == EBUSY) {
-        if (!(r = m->_m_lock) || ((r & 0x40000000) && (m->_m_type & 4)))
+        if (!(r = m->_m_lock) || ((r & MX_FUTEX_PI_OWNER_DIED) && (m->_m_type & 4)))
             continue;
         if ((m->_m_type & 3) == PTHREAD_MUTEX_ERRORCHECK &&
-            (r & 0x7fffffff) == __thread_get_tid())
+            (r & MX_FUTEX_PI_TID_MASK) == tid)
             return EDEADLK;
 
+        // Once the waiters bit is set the owner unlocks through the
+        // kernel, which hands the mutex straight to a waiter.
+        t = r | MX_FUTEX_PI_WAITERS;
+        if (r != t && a_cas(&m->_m_lock, r, t) != r)
+            continue;
         a_inc(&m->_m_waiters);
-        t = r | 0x80000000;
-        a_cas(&m->_m_lock, r, t);
-        r = __timedwait(&m->_m_lock, t, CLOCK_REALTIME, at);
+        r = __timedlock_pi(&m->_m_lock, t, CLOCK_REALTIME, at);
         a_dec(&m->_m_waiters);
-        if (r)
+        if (r == 0)
+            return handoff(m);
+        if (r == EDEADLK && (m->_m_type & 3) == PTHREAD_MUTEX_NORMAL)
+            return deadlock(at);
+        if (r != EAGAIN)
             break;
     }
     return r;
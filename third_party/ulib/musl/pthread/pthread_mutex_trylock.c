@@ -31,7 +31,7 @@ int __pthread_mutex_trylock_owner(pthread_mutex_t* m) {
 
 int __pthread_mutex_trylock(pthread_mutex_t* m) {
     if ((m->_m_type & 15) == PTHREAD_MUTEX_NORMAL)
-        return a_cas(&m->_m_lock, 0, EBUSY) & EBUSY;
+        return a_cas(&m->_m_lock, 0, __thread_get_tid()) ? EBUSY : 0;
     return __pthread_mutex_trylock_owner(m);
 }
 
@@ -1,21 +1,22 @@
 #include "pthread_impl.h"
 
-#include "futex_impl.h"
-
 int __pthread_mutex_unlock(pthread_mutex_t* m) {
-    int waiters = m->_m_waiters;
-    int cont;
     int type = m->_m_type & 15;
+    int tid = __thread_get_tid();
 
     if (type != PTHREAD_MUTEX_NORMAL) {
-        if ((m->_m_lock & 0x7fffffff) != __thread_get_tid())
+        if ((m->_m_lock & MX_FUTEX_PI_TID_MASK) != tid)
             return EPERM;
         if ((type & 3) == PTHREAD_MUTEX_RECURSIVE && m->_m_count)
             return m->_m_count--, 0;
     }
-    cont = a_swap(&m->_m_lock, (type & 8) ? 0x40000000 : 0);
-    if (waiters || cont < 0)
-        __wake(&m->_m_lock, 1);
+    // A robust mutex released without being made consistent is left
+    // permanently unrecoverable.
+    if (a_cas(&m->_m_lock, tid, (type & 8) ? MX_FUTEX_PI_OWNER_DIED : 0) == tid)
+        return 0;
+    // Someone is blocked in mx_futex_lock_pi.
+    if (mx_futex_unlock_pi((int*)&m->_m_lock) != NO_ERROR)
+        return EPERM;
     return 0;
 }
 
@@ -1,7 +1,16 @@
 #include "pthread_impl.h"
 
 int pthread_mutexattr_setprotocol(pthread_mutexattr_t* a, int protocol) {
-    if (protocol)
+    // All pthread_mutex_ts are built on priority inheriting futexes; the
+    // protocol is only recorded so that it can be read back.
+    switch (protocol) {
+    case PTHREAD_PRIO_NONE:
+        a->__attr &= ~16U;
+        return 0;
+    case PTHREAD_PRIO_INHERIT:
+        a->__attr |= 16;
+        return 0;
+    default:
         return ENOTSUP;
-    return 0;
+    }
 }
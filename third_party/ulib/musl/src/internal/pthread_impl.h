@@ -117,9 +117,9 @@ static inline struct pthread* __pthread_self(void) {
 }
 
 static inline pid_t __thread_get_tid(void) {
-    // TODO(kulakowski) Replace this with the current thread handle's
-    // ID when magenta exposes those.
-    return (pid_t)(intptr_t)mxr_tls_root_get();
+    // This is the tid the kernel expects to find in the futex of a
+    // priority inheriting mutex owned by this thread.
+    return mxr_mutex_owner_tid();
 }
 
 int __clone(int (*)(void*), void*, int, void*, ...);
@@ -135,6 +135,11 @@ void __vm_unlock(void);
 int __timedwait(volatile int*, int, clockid_t, const struct timespec*);
 int __timedwait_cp(volatile int*, int, clockid_t, const struct timespec*);
 
+// Blocks in mx_futex_lock_pi. Returns 0 once the lock has been handed
+// to the caller, EAGAIN if *addr no longer equals val, or ETIMEDOUT,
+// EINVAL or EDEADLK.
+int __timedlock_pi(volatile int*, int, clockid_t, const struct timespec*);
+
 void __acquire_ptc(void);
 void __release_ptc(void);
 void __inhibit_ptc(void);
@@ -10,9 +10,9 @@ int __clock_gettime(clockid_t, struct timespec*);
 
 #define NS_PER_S (1000000000ull)
 
-int __timedwait_cp(volatile int* addr, int val, clockid_t clk, const struct timespec* at) {
+static int __timespec_to_deadline(clockid_t clk, const struct timespec* at, mx_time_t* deadline) {
     struct timespec to;
-    mx_time_t deadline = MX_TIME_INFINITE;
+    *deadline = MX_TIME_INFINITE;
 
     if (at) {
         if (at->tv_nsec >= NS_PER_S)
@@ -26,9 +26,17 @@ int __timedwait_cp(volatile int* addr, int val, clockid_t clk, const struct time
         }
         if (to.tv_sec < 0)
             return ETIMEDOUT;
-        deadline = to.tv_sec * NS_PER_S;
-        deadline += to.tv_nsec;
+        *deadline = to.tv_sec * NS_PER_S;
+        *deadline += to.tv_nsec;
     }
+    return 0;
+}
+
+int __timedwait_cp(volatile int* addr, int val, clockid_t clk, const struct timespec* at) {
+    mx_time_t deadline;
+    int r = __timespec_to_deadline(clk, at, &deadline);
+    if (r)
+        return r;
 
     // mx_futex_wait will return ERR_BUSY if someone modifying *addr
     // races with this call. But this is indistinguishable from
@@ -46,6 +54,28 @@ int __timedwait_cp(volatile int* addr, int val, clockid_t clk, const struct time
     }
 }
 
+int __timedlock_pi(volatile int* addr, int val, clockid_t clk, const struct timespec* at) {
+    mx_time_t deadline;
+    int r = __timespec_to_deadline(clk, at, &deadline);
+    if (r)
+        return r;
+
+    switch (mx_futex_lock_pi((int*)addr, val, deadline)) {
+    case NO_ERROR:
+        return 0;
+    case ERR_BUSY:
+        return EAGAIN;
+    case ERR_TIMED_OUT:
+        return ETIMEDOUT;
+    case ERR_BAD_STATE:
+        // The owner is the caller.
+        return EDEADLK;
+    case ERR_INVALID_ARGS:
+    default:
+        __builtin_trap();
+    }
+}
+
 int __timedwait(volatile int* addr, int val, clockid_t clk, const struct timespec* at) {
     int cs, r;
     __pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cs);